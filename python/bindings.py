@@ -5,14 +5,8 @@ from ctypes.util import find_library
 libPath = find_library('obdii')
 obdii = CDLL(libPath)
 
-class OBDIISocket(Structure):
-    _fields_ = [
-            ('s', c_int),
-            ('shared', c_short),
-            ('ifindex', c_uint),
-            ('tid', c_uint32),
-            ('rid', c_uint32)
-    ]
+# OBDIITransport enum
+(OBDIITransportISOTP, OBDIITransportRaw, OBDIITransportUserISOTP) = (0, 1, 2)
 
 class OBDIICommand(Structure):
     pass
@@ -51,12 +45,22 @@ class OBDIIResponseValue(Union):
             ('oxygenSensorValues', OBDIIOxygenSensorValues)
     ]
 
+class timespec(Structure):
+    _fields_ = [
+            ('tv_sec', c_long),
+            ('tv_nsec', c_long)
+    ]
+
 class OBDIIResponse(Structure):
     _anonymous_ = [ 'value' ]
     _fields_ = [
             ('success', c_int),
+            ('negativeResponseCode', c_uint8),
             ('command', POINTER(OBDIICommand)),
-            ('value', OBDIIResponseValue)
+            ('value', OBDIIResponseValue),
+            ('timestamp', timespec),
+            ('requestTimestamp', timespec),
+            ('timedOut', c_int)
     ]
 
 # OBDIIResponseType enum
@@ -66,26 +70,47 @@ OBDIIResponseDecoder = CFUNCTYPE(None, POINTER(OBDIIResponse), POINTER(c_uint8),
 
 OBDIICommand._fields_ = [
         ('name', c_char_p),
-        ('payload', c_uint8 * 2),
+        ('payload', c_uint8 * 3),
         ('responseType', c_int),
         ('expectedResponseLength', c_short),
         ('responseDecoder', OBDIIResponseDecoder)
 ]
 
-class OBDIIMode1SupportedPIDs(Structure):
+class OBDIIPIDBitmap(Structure):
     _fields_ = [
-            ('_1_to_20', c_uint32),
-            ('_21_to_40', c_uint32),
-            ('_41_to_60', c_uint32),
-            ('_61_to_80', c_uint32)
+            ('words', c_uint64 * 4)
     ]
 
 class OBDIICommandSet(Structure):
     _fields_ = [
-            ('_mode1SupportedPIDs', OBDIIMode1SupportedPIDs),
-            ('_mode9SupportedPIDs', c_uint32),
-            ('numCommands', c_int),
-            ('commands', POINTER(POINTER(OBDIICommand)))
+            ('_mode1SupportedPIDs', OBDIIPIDBitmap),
+            ('_mode9SupportedPIDs', OBDIIPIDBitmap),
+            ('_supportsDTCs', c_int),
+            ('numCommands', c_int)
+    ]
+
+class OBDIISocket(Structure):
+    _fields_ = [
+            ('s', c_int),
+            ('shared', c_short),
+            ('ifindex', c_uint),
+            ('tid', c_uint32),
+            ('rid', c_uint32),
+            ('transport', c_short),
+            ('isotp', c_int),
+            ('stack', c_void_p),
+            ('session', c_void_p),
+            ('queue', c_void_p),
+            ('_refusals', c_uint8 * 513),
+            ('requestTimestamp', timespec),
+            ('timedOut', c_int)
+    ]
+
+class OBDIIDiscoveredECU(Structure):
+    _fields_ = [
+            ('tid', c_uint32),
+            ('rid', c_uint32),
+            ('commands', OBDIICommandSet)
     ]
 
 class OBDIICommandsT(Structure):
@@ -184,6 +209,10 @@ OBDIIDecodeResponseForCommand = obdii.OBDIIDecodeResponseForCommand
 OBDIIDecodeResponseForCommand.argtypes = [ POINTER(OBDIICommand), POINTER(c_uint8), c_int ]
 OBDIIDecodeResponseForCommand.restype = OBDIIResponse
 
+OBDIIResponseTimestamp = obdii.OBDIIResponseTimestamp
+OBDIIResponseTimestamp.restype = c_double
+OBDIIResponseTimestamp.argtypes = [ POINTER(OBDIIResponse) ]
+
 OBDIIResponseFree = obdii.OBDIIResponseFree
 OBDIIResponseFree.restype = None
 OBDIIResponseFree.argtypes = [ POINTER(OBDIIResponse) ]
@@ -191,6 +220,37 @@ OBDIIResponseFree.argtypes = [ POINTER(OBDIIResponse) ]
 OBDIICommandSetContainsCommand = obdii.OBDIICommandSetContainsCommand
 OBDIICommandSetContainsCommand.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommand) ]
 
+OBDIICommandSetContainsPID = obdii.OBDIICommandSetContainsPID
+OBDIICommandSetContainsPID.argtypes = [ POINTER(OBDIICommandSet), c_uint8, c_uint8 ]
+
+OBDIICommandSetAddCommand = obdii.OBDIICommandSetAddCommand
+OBDIICommandSetAddCommand.restype = None
+OBDIICommandSetAddCommand.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommand) ]
+
+OBDIICommandSetRemoveCommand = obdii.OBDIICommandSetRemoveCommand
+OBDIICommandSetRemoveCommand.restype = None
+OBDIICommandSetRemoveCommand.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommand) ]
+
+OBDIICommandSetUnion = obdii.OBDIICommandSetUnion
+OBDIICommandSetUnion.restype = None
+OBDIICommandSetUnion.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommandSet), POINTER(OBDIICommandSet) ]
+
+OBDIICommandSetIntersection = obdii.OBDIICommandSetIntersection
+OBDIICommandSetIntersection.restype = None
+OBDIICommandSetIntersection.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommandSet), POINTER(OBDIICommandSet) ]
+
+OBDIICommandSetDifference = obdii.OBDIICommandSetDifference
+OBDIICommandSetDifference.restype = None
+OBDIICommandSetDifference.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommandSet), POINTER(OBDIICommandSet) ]
+
+OBDIICommandSetNextCommand = obdii.OBDIICommandSetNextCommand
+OBDIICommandSetNextCommand.restype = POINTER(OBDIICommand)
+OBDIICommandSetNextCommand.argtypes = [ POINTER(OBDIICommandSet), POINTER(OBDIICommand) ]
+
+OBDIICommandSetCommandAtIndex = obdii.OBDIICommandSetCommandAtIndex
+OBDIICommandSetCommandAtIndex.restype = POINTER(OBDIICommand)
+OBDIICommandSetCommandAtIndex.argtypes = [ POINTER(OBDIICommandSet), c_int ]
+
 OBDIICommandSetFree = obdii.OBDIICommandSetFree
 OBDIICommandSetFree.restype = None
 OBDIICommandSetFree.argtypes = [ POINTER(OBDIICommandSet) ]
@@ -198,17 +258,97 @@ OBDIICommandSetFree.argtypes = [ POINTER(OBDIICommandSet) ]
 OBDIIOpenSocket = obdii.OBDIIOpenSocket
 OBDIIOpenSocket.argtypes = [ POINTER(OBDIISocket), c_char_p, c_uint32, c_uint32, c_int ]
 
+OBDIIOpenRawSocket = obdii.OBDIIOpenRawSocket
+OBDIIOpenRawSocket.argtypes = [ POINTER(OBDIISocket), c_char_p, c_uint32, c_uint32 ]
+
 OBDIICloseSocket = obdii.OBDIICloseSocket
 OBDIICloseSocket.argtypes = [ POINTER(OBDIISocket) ]
 
+OBDIIUnsupportedCode = obdii.OBDIIUnsupportedCode
+OBDIIUnsupportedCode.restype = c_uint8
+OBDIIUnsupportedCode.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand) ]
+
+OBDIIForgetUnsupported = obdii.OBDIIForgetUnsupported
+OBDIIForgetUnsupported.restype = None
+OBDIIForgetUnsupported.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand) ]
+
 OBDIIPerformQuery = obdii.OBDIIPerformQuery
 OBDIIPerformQuery.restype = OBDIIResponse
 OBDIIPerformQuery.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand) ]
 
+# OBDIIQueryStatus enum
+(OBDIIQueryStatusAnswered, OBDIIQueryStatusTimedOut, OBDIIQueryStatusCancelled, OBDIIQueryStatusError) = (0, 1, 2, 3)
+
+OBDIIPerformQueryWithDeadline = obdii.OBDIIPerformQueryWithDeadline
+OBDIIPerformQueryWithDeadline.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand), POINTER(timespec), c_int, POINTER(OBDIIResponse) ]
+
+# OBDIIQueryPriority enum
+(OBDIIQueryPriorityBulk, OBDIIQueryPriorityInteractive) = (0, 1)
+
+OBDIIPerformQueryWithPriority = obdii.OBDIIPerformQueryWithPriority
+OBDIIPerformQueryWithPriority.restype = OBDIIResponse
+OBDIIPerformQueryWithPriority.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand), c_int ]
+
+OBDIISendRequest = obdii.OBDIISendRequest
+OBDIISendRequest.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand) ]
+
+OBDIITryReceiveResponse = obdii.OBDIITryReceiveResponse
+OBDIITryReceiveResponse.argtypes = [ POINTER(OBDIISocket), POINTER(OBDIICommand), POINTER(OBDIIResponse) ]
+
+OBDIICancelRequest = obdii.OBDIICancelRequest
+OBDIICancelRequest.argtypes = [ POINTER(OBDIISocket) ]
+
 OBDIIGetSupportedCommands = obdii.OBDIIGetSupportedCommands
 OBDIIGetSupportedCommands.restype = OBDIICommandSet
 OBDIIGetSupportedCommands.argtypes = [ POINTER(OBDIISocket) ]
 
+OBDIIDiscoverSupportedCommands = obdii.OBDIIDiscoverSupportedCommands
+OBDIIDiscoverSupportedCommands.argtypes = [ c_char_p, c_int, POINTER(OBDIIDiscoveredECU) ]
+
+# Arrow C stream interface; the address of a stream can be passed to e.g. pyarrow.RecordBatchReader._import_from_c
+class ArrowArrayStream(Structure):
+    _fields_ = [
+            ('get_schema', c_void_p),
+            ('get_next', c_void_p),
+            ('get_last_error', c_void_p),
+            ('release', c_void_p),
+            ('private_data', c_void_p)
+    ]
+
+class OBDIIArrowBuilder(Structure):
+    _fields_ = [
+            ('command', POINTER(OBDIICommand)),
+            ('batchSize', c_int),
+            ('wallClockOffset', c_int64),
+            ('_length', c_int),
+            ('_nullCount', c_int),
+            ('_timestamps', c_void_p),
+            ('_values', c_void_p),
+            ('_validity', c_void_p),
+            ('_listOffsets', c_void_p),
+            ('_stringOffsets', c_void_p),
+            ('_stringData', c_void_p),
+            ('_numStrings', c_int),
+            ('_stringsCapacity', c_int),
+            ('_stringDataLength', c_int),
+            ('_stringDataCapacity', c_int),
+            ('_batches', c_void_p),
+            ('_numBatches', c_int),
+            ('_batchesCapacity', c_int)
+    ]
+
+OBDIIArrowBuilderInit = obdii.OBDIIArrowBuilderInit
+OBDIIArrowBuilderInit.argtypes = [ POINTER(OBDIIArrowBuilder), POINTER(OBDIICommand), c_int ]
+
+OBDIIArrowBuilderAppend = obdii.OBDIIArrowBuilderAppend
+OBDIIArrowBuilderAppend.argtypes = [ POINTER(OBDIIArrowBuilder), POINTER(OBDIIResponse), c_double ]
+
+OBDIIArrowBuilderExportStream = obdii.OBDIIArrowBuilderExportStream
+OBDIIArrowBuilderExportStream.argtypes = [ POINTER(OBDIIArrowBuilder), POINTER(ArrowArrayStream) ]
+
+OBDIIArrowBuilderFree = obdii.OBDIIArrowBuilderFree
+OBDIIArrowBuilderFree.argtypes = [ POINTER(OBDIIArrowBuilder) ]
+
 # constants from linux/can.h
 
 CAN_EFF_FLAG = 0x80000000
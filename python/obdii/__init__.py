@@ -0,0 +1,8 @@
+"""Native bindings to libobdii.
+
+`Socket` and `decode` come from the compiled `_obdii` extension (see `setup.py`). `obdii.aio` builds an asyncio client on
+top of the socket's nonblocking methods.
+"""
+from ._obdii import Socket, decode
+
+__all__ = [ 'Socket', 'decode' ]
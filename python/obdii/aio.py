@@ -0,0 +1,91 @@
+"""asyncio client for libobdii.
+
+Each `Client` registers its socket with the running event loop, so that awaiting a query costs no thread. A process can
+keep hundreds of queries in flight by using one client per ECU:
+
+    import asyncio
+    from obdii.aio import Client
+
+    async def main():
+        async with Client("can0", 0x7E0, 0x7E8) as engine, Client("can0", 0x7E1, 0x7E9) as transmission:
+            rpm, speed = await asyncio.gather(engine.query(0x0C), transmission.query((0x01, 0x0D)))
+
+Queries can be cancelled, e.g. by `asyncio.wait_for`: the client then cancels the request in flight, so that the socket
+is free for the next one. Code that drives `obdii.Socket.send_request` itself must do the same, calling `cancel_request`
+whenever it stops waiting for the response, or every later `send_request` fails with BlockingIOError.
+"""
+import asyncio
+from ._obdii import Socket
+
+# How long to wait before retrying when another process holds a shared socket
+_SHARED_SOCKET_RETRY_INTERVAL = 0.005
+
+class Client:
+    """An ECU, queried through a nonblocking `obdii.Socket`.
+
+    Commands are given as a mode 1 PID or a (mode, PID) tuple, as with `obdii.Socket`. Queries on the same client are
+    answered one at a time, in the order they were made.
+    """
+
+    def __init__(self, ifname, tx_id, rx_id, raw=False, shared=False, timeout=1.0):
+        self._socket = Socket(ifname, tx_id, rx_id, raw=raw, shared=shared)
+        self._timeout = timeout
+        self._lock = asyncio.Lock()
+
+    def fileno(self):
+        return self._socket.fileno()
+
+    def close(self):
+        self._socket.close()
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc_info):
+        self.close()
+
+    async def query(self, command, timeout=None):
+        """Query a command. Returns the decoded value, or None if the ECU did not answer in time or answered with a malformed response."""
+        loop = asyncio.get_running_loop()
+        timeout = self._timeout if timeout is None else timeout
+
+        async with self._lock:
+            deadline = loop.time() + timeout
+
+            while True:
+                try:
+                    self._socket.send_request(command)
+                    break
+                except BlockingIOError:
+                    if loop.time() >= deadline:
+                        return None
+                    await asyncio.sleep(_SHARED_SOCKET_RETRY_INTERVAL)
+
+            future = loop.create_future()
+            fd = self._socket.fileno()
+            loop.add_reader(fd, self._receive, future, command)
+
+            try:
+                return await asyncio.wait_for(future, max(deadline - loop.time(), 0))
+            except asyncio.TimeoutError:
+                return None
+            finally:
+                # Also when the query itself is cancelled; the socket stays taken until the response is received or
+                # the request is cancelled
+                loop.remove_reader(fd)
+                if not future.done() or future.cancelled():
+                    self._socket.cancel_request()
+
+    def _receive(self, future, command):
+        if future.done():
+            return
+
+        try:
+            value = self._socket.try_receive(command)
+        except BlockingIOError:
+            return
+        except OSError as error:
+            future.set_exception(error)
+            return
+
+        future.set_result(value)
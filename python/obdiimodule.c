@@ -0,0 +1,538 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include "OBDII.h"
+#include "OBDIICommunication.h"
+#include "OBDIIBatch.h"
+
+typedef struct {
+	PyObject_HEAD
+	OBDIISocket s;
+	int open;
+	// Set while a query runs without the GIL, so that other threads can't use the socket at the same time
+	int busy;
+} SocketObject;
+
+// Accepts a mode 1 PID (e.g. 0x0C) or a (mode, PID) tuple (e.g. (0x09, 0x02))
+static OBDIICommand *commandFromObject(PyObject *object)
+{
+	int mode = 0x01, pid;
+
+	if (PyTuple_Check(object)) {
+		if (!PyArg_ParseTuple(object, "ii", &mode, &pid)) {
+			return NULL;
+		}
+	} else {
+		pid = (int)PyLong_AsLong(object);
+		if (pid == -1 && PyErr_Occurred()) {
+			return NULL;
+		}
+	}
+
+	OBDIICommand *command = NULL;
+	if (mode >= 0 && mode <= 0xFF && pid >= 0 && pid <= 0xFF) {
+		command = OBDIICommandWithModeAndPID(mode, pid);
+	}
+
+	if (!command) {
+		PyErr_Format(PyExc_ValueError, "unknown command: mode %#04x, PID %#04x", mode, pid);
+	}
+
+	return command;
+}
+
+// Converts a successful response to the most natural Python value for its type
+static PyObject *valueFromResponse(OBDIIResponse *response)
+{
+	int i;
+
+	switch (response->command->responseType) {
+		case OBDIIResponseTypeNumeric:
+			return PyFloat_FromDouble(response->numericValue);
+		case OBDIIResponseTypeBitfield:
+			return PyLong_FromUnsignedLong(response->bitfieldValue);
+		case OBDIIResponseTypeString:
+			return PyUnicode_DecodeLatin1(response->stringValue, strlen(response->stringValue), "replace");
+		default:
+			break;
+	}
+
+	if (response->command == OBDIICommands.DTCs) {
+		PyObject *codes = PyList_New(response->DTCs.numTroubleCodes);
+		for (i = 0; codes && i < response->DTCs.numTroubleCodes; ++i) {
+			PyList_SET_ITEM(codes, i, PyUnicode_FromString(response->DTCs.troubleCodes[i]));
+		}
+		return codes;
+	}
+
+	if (OBDIIBatchSupportsCommand(response->command)) {
+		// Oxygen sensor commands
+		return Py_BuildValue("(dd)", response->oxygenSensorValues.voltage, response->oxygenSensorValues.shortTermFuelTrim);
+	}
+
+	Py_RETURN_NONE;
+}
+
+static int acquireSocket(SocketObject *self)
+{
+	if (!self->open) {
+		PyErr_SetString(PyExc_ValueError, "socket is closed");
+		return -1;
+	}
+
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "socket is in use by another thread");
+		return -1;
+	}
+
+	self->busy = 1;
+	return 0;
+}
+
+static double monotonicSeconds(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+static int Socket_init(SocketObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "ifname", "tx_id", "rx_id", "raw", "shared", NULL };
+	const char *ifname;
+	unsigned int tx, rx;
+	int raw = 0, shared = 0, retval;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sII|pp", keywords, &ifname, &tx, &rx, &raw, &shared)) {
+		return -1;
+	}
+
+	if (self->open) {
+		OBDIICloseSocket(&self->s);
+		self->open = 0;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	if (raw) {
+		retval = OBDIIOpenRawSocket(&self->s, ifname, tx, rx);
+	} else {
+		retval = OBDIIOpenSocket(&self->s, ifname, tx, rx, shared);
+	}
+	Py_END_ALLOW_THREADS
+
+	if (retval < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return -1;
+	}
+
+	self->open = 1;
+	return 0;
+}
+
+static void Socket_dealloc(SocketObject *self)
+{
+	if (self->open) {
+		OBDIICloseSocket(&self->s);
+	}
+
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Socket_close(SocketObject *self, PyObject *unused)
+{
+	if (self->busy) {
+		PyErr_SetString(PyExc_RuntimeError, "socket is in use by another thread");
+		return NULL;
+	}
+
+	if (self->open) {
+		self->open = 0;
+		if (OBDIICloseSocket(&self->s) < 0) {
+			return PyErr_SetFromErrno(PyExc_OSError);
+		}
+	}
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *Socket_fileno(SocketObject *self, PyObject *unused)
+{
+	if (!self->open) {
+		PyErr_SetString(PyExc_ValueError, "socket is closed");
+		return NULL;
+	}
+
+	return PyLong_FromLong(self->s.s);
+}
+
+static PyObject *Socket_enter(SocketObject *self, PyObject *unused)
+{
+	Py_INCREF(self);
+	return (PyObject *)self;
+}
+
+static PyObject *Socket_exit(SocketObject *self, PyObject *args)
+{
+	PyObject *result = Socket_close(self, NULL);
+	if (!result) {
+		return NULL;
+	}
+
+	Py_DECREF(result);
+	Py_RETURN_FALSE;
+}
+
+static PyObject *Socket_query(SocketObject *self, PyObject *arg)
+{
+	OBDIICommand *command = commandFromObject(arg);
+	if (!command || acquireSocket(self) < 0) {
+		return NULL;
+	}
+
+	OBDIIResponse response;
+
+	Py_BEGIN_ALLOW_THREADS
+	response = OBDIIPerformQuery(&self->s, command);
+	Py_END_ALLOW_THREADS
+
+	self->busy = 0;
+
+	PyObject *value;
+	if (response.success) {
+		value = valueFromResponse(&response);
+	} else {
+		value = Py_None;
+		Py_INCREF(value);
+	}
+
+	OBDIIResponseFree(&response);
+
+	return value;
+}
+
+static PyObject *Socket_send_request(SocketObject *self, PyObject *arg)
+{
+	OBDIICommand *command = commandFromObject(arg);
+	if (!command || acquireSocket(self) < 0) {
+		return NULL;
+	}
+
+	if (OBDIISendRequest(&self->s, command) < 0) {
+		self->busy = 0;
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+
+	// The socket stays busy until the response is received or the request is cancelled
+	Py_RETURN_NONE;
+}
+
+static PyObject *Socket_try_receive(SocketObject *self, PyObject *arg)
+{
+	OBDIICommand *command = commandFromObject(arg);
+	if (!command) {
+		return NULL;
+	}
+
+	if (!self->open) {
+		PyErr_SetString(PyExc_ValueError, "socket is closed");
+		return NULL;
+	}
+
+	OBDIIResponse response;
+	int retval = OBDIITryReceiveResponse(&self->s, command, &response);
+
+	if (retval == 0) {
+		PyErr_SetString(PyExc_BlockingIOError, "the response has not arrived yet");
+		return NULL;
+	}
+
+	self->busy = 0;
+
+	if (retval < 0) {
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+
+	PyObject *value;
+	if (response.success) {
+		value = valueFromResponse(&response);
+	} else {
+		value = Py_None;
+		Py_INCREF(value);
+	}
+
+	OBDIIResponseFree(&response);
+
+	return value;
+}
+
+static PyObject *Socket_cancel_request(SocketObject *self, PyObject *unused)
+{
+	if (self->open && OBDIICancelRequest(&self->s) < 0) {
+		self->busy = 0;
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+
+	self->busy = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject *Socket_poll(SocketObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "commands", "count", "interval", NULL };
+	PyObject *commandList;
+	Py_ssize_t count;
+	double interval = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "On|d", keywords, &commandList, &count, &interval)) {
+		return NULL;
+	}
+
+	if (count < 0 || interval < 0) {
+		PyErr_SetString(PyExc_ValueError, "count and interval must not be negative");
+		return NULL;
+	}
+
+	PyObject *sequence = PySequence_Fast(commandList, "commands must be a sequence");
+	if (!sequence) {
+		return NULL;
+	}
+
+	Py_ssize_t i, j, numCommands = PySequence_Fast_GET_SIZE(sequence);
+	OBDIICommand **commands = PyMem_New(OBDIICommand *, numCommands > 0 ? numCommands : 1);
+	if (!commands) {
+		Py_DECREF(sequence);
+		return PyErr_NoMemory();
+	}
+
+	for (j = 0; j < numCommands; ++j) {
+		commands[j] = commandFromObject(PySequence_Fast_GET_ITEM(sequence, j));
+		if (!commands[j]) {
+			break;
+		}
+
+		if (commands[j]->responseType != OBDIIResponseTypeNumeric) {
+			PyErr_Format(PyExc_ValueError, "%s does not have a numeric response", commands[j]->name);
+			commands[j] = NULL;
+			break;
+		}
+	}
+
+	Py_DECREF(sequence);
+
+	npy_intp valuesShape[2] = { count, numCommands };
+	npy_intp timestampsShape[1] = { count };
+	PyArrayObject *values = NULL, *timestamps = NULL;
+
+	if (j < numCommands
+		|| !(values = (PyArrayObject *)PyArray_SimpleNew(2, valuesShape, NPY_FLOAT32))
+		|| !(timestamps = (PyArrayObject *)PyArray_SimpleNew(1, timestampsShape, NPY_FLOAT64))
+		|| acquireSocket(self) < 0) {
+		goto error;
+	}
+
+	float *valuesData = PyArray_DATA(values);
+	double *timestampsData = PyArray_DATA(timestamps);
+	struct timespec deadline, now;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	for (i = 0; i < count; ++i) {
+		// The GIL is only taken back between rounds, to let signal handlers (e.g. KeyboardInterrupt) run
+		Py_BEGIN_ALLOW_THREADS
+		if (i > 0) {
+			long long nsec = deadline.tv_nsec + (long long)(interval * 1e9);
+			deadline.tv_sec += nsec / 1000000000;
+			deadline.tv_nsec = nsec % 1000000000;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timestampsData[i] = monotonicSeconds(&now);
+
+		for (j = 0; j < numCommands; ++j) {
+			OBDIIResponse response = OBDIIPerformQuery(&self->s, commands[j]);
+			valuesData[i * numCommands + j] = response.success ? response.numericValue : NAN;
+			OBDIIResponseFree(&response);
+		}
+		Py_END_ALLOW_THREADS
+
+		if (PyErr_CheckSignals() < 0) {
+			self->busy = 0;
+			goto error;
+		}
+	}
+
+	self->busy = 0;
+	PyMem_Free(commands);
+
+	return Py_BuildValue("(NN)", timestamps, values);
+
+error:
+	PyMem_Free(commands);
+	Py_XDECREF(values);
+	Py_XDECREF(timestamps);
+	return NULL;
+}
+
+static PyMethodDef Socket_methods[] = {
+	{ "query", (PyCFunction)Socket_query, METH_O,
+		"query(command)\n--\n\n"
+		"Query a single command. Returns the decoded value (float, int, str, list of DTCs, or (voltage, trim) tuple), or None on failure." },
+	{ "poll", (PyCFunction)(void (*)(void))Socket_poll, METH_VARARGS | METH_KEYWORDS,
+		"poll(commands, count, interval=0.0)\n--\n\n"
+		"Query a list of numeric commands `count` times, starting a round every `interval` seconds.\n\n"
+		"Returns (timestamps, values): a float64 array of CLOCK_MONOTONIC times, one per round, and a float32 array of shape\n"
+		"(count, len(commands)) holding NaN wherever a query failed. The GIL is released while querying." },
+	{ "send_request", (PyCFunction)Socket_send_request, METH_O,
+		"send_request(command)\n--\n\n"
+		"Send a command's request without waiting for the response (OBDIISendRequest). Raises BlockingIOError if another\n"
+		"process is using the same shared socket, or while an earlier request awaits its response: once the response is\n"
+		"received with try_receive, or the request is given up on with cancel_request, the socket is free again." },
+	{ "try_receive", (PyCFunction)Socket_try_receive, METH_O,
+		"try_receive(command)\n--\n\n"
+		"Receive the response to a request sent with send_request, without blocking (OBDIITryReceiveResponse). Returns the\n"
+		"decoded value like query, or raises BlockingIOError if the response has not arrived yet." },
+	{ "cancel_request", (PyCFunction)Socket_cancel_request, METH_NOARGS,
+		"cancel_request()\n--\n\nGive up on a request sent with send_request, e.g. after a timeout." },
+	{ "fileno", (PyCFunction)Socket_fileno, METH_NOARGS, "fileno()\n--\n\nThe underlying socket's file descriptor." },
+	{ "close", (PyCFunction)Socket_close, METH_NOARGS, "close()\n--\n\nClose the socket." },
+	{ "__enter__", (PyCFunction)Socket_enter, METH_NOARGS, NULL },
+	{ "__exit__", (PyCFunction)Socket_exit, METH_VARARGS, NULL },
+	{ NULL }
+};
+
+static PyTypeObject SocketType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "obdii.Socket",
+	.tp_doc = "Socket(ifname, tx_id, rx_id, raw=False, shared=False)\n--\n\n"
+		"A communications channel to an ECU, opened with OBDIIOpenSocket (or OBDIIOpenRawSocket if `raw` is true).\n"
+		"Commands are given as a mode 1 PID (e.g. 0x0C) or a (mode, PID) tuple (e.g. (0x09, 0x02)).",
+	.tp_basicsize = sizeof(SocketObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)Socket_init,
+	.tp_dealloc = (destructor)Socket_dealloc,
+	.tp_methods = Socket_methods
+};
+
+static PyObject *obdii_decode(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+	static char *keywords[] = { "command", "payloads", "stride", NULL };
+	PyObject *commandObject;
+	Py_buffer buffer;
+	int stride = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oy*|i", keywords, &commandObject, &buffer, &stride)) {
+		return NULL;
+	}
+
+	PyArrayObject *values = NULL;
+	OBDIICommand *command = commandFromObject(commandObject);
+	if (!command) {
+		goto exit;
+	}
+
+	if (!OBDIIBatchSupportsCommand(command)) {
+		PyErr_Format(PyExc_ValueError, "%s can't be batch decoded", command->name);
+		goto exit;
+	}
+
+	if (stride == 0) {
+		stride = command->expectedResponseLength;
+	}
+
+	if (stride < command->expectedResponseLength) {
+		PyErr_Format(PyExc_ValueError, "stride must be at least %d", command->expectedResponseLength);
+		goto exit;
+	}
+
+	// Oxygen sensor commands have a second value per payload
+	int isOxygenSensor = command->responseType != OBDIIResponseTypeNumeric;
+	npy_intp count = buffer.len / stride;
+	npy_intp shape[2] = { count, 2 };
+
+	if (count > INT_MAX) {
+		PyErr_SetString(PyExc_OverflowError, "too many payloads");
+		goto exit;
+	}
+
+	if (!(values = (PyArrayObject *)PyArray_SimpleNew(isOxygenSensor ? 2 : 1, shape, NPY_FLOAT32))) {
+		goto exit;
+	}
+
+	float *data = PyArray_DATA(values);
+	float *secondaryData = NULL;
+	float *primaryData = data;
+
+	if (isOxygenSensor) {
+		// Decode into two halves of a temporary buffer, then interleave into (count, 2) rows
+		primaryData = PyMem_New(float, 2 * (count > 0 ? count : 1));
+		if (!primaryData) {
+			Py_CLEAR(values);
+			PyErr_NoMemory();
+			goto exit;
+		}
+		secondaryData = primaryData + count;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	OBDIIDecodeBatch(command, buffer.buf, stride, (int)count, primaryData, secondaryData, NULL);
+	if (isOxygenSensor) {
+		npy_intp i;
+		for (i = 0; i < count; ++i) {
+			data[2 * i] = primaryData[i];
+			data[2 * i + 1] = secondaryData[i];
+		}
+	}
+	Py_END_ALLOW_THREADS
+
+	if (isOxygenSensor) {
+		PyMem_Free(primaryData);
+	}
+
+exit:
+	PyBuffer_Release(&buffer);
+	return (PyObject *)values;
+}
+
+static PyMethodDef obdiiMethods[] = {
+	{ "decode", (PyCFunction)(void (*)(void))obdii_decode, METH_VARARGS | METH_KEYWORDS,
+		"decode(command, payloads, stride=0)\n--\n\n"
+		"Decode a buffer of recorded response payloads to the same command with OBDIIDecodeBatch.\n\n"
+		"Payload i starts at byte i * stride (stride defaults to the command's response length). Returns a float32 array\n"
+		"of shape (n,), or (n, 2) for oxygen sensor commands, holding NaN for payloads that are not valid responses." },
+	{ NULL }
+};
+
+static struct PyModuleDef obdiiModule = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "obdii._obdii",
+	.m_doc = "Native bindings to libobdii, with bulk queries returning NumPy arrays.",
+	.m_size = -1,
+	.m_methods = obdiiMethods
+};
+
+PyMODINIT_FUNC PyInit__obdii(void)
+{
+	import_array();
+
+	if (PyType_Ready(&SocketType) < 0) {
+		return NULL;
+	}
+
+	PyObject *module = PyModule_Create(&obdiiModule);
+	if (!module) {
+		return NULL;
+	}
+
+	Py_INCREF(&SocketType);
+	if (PyModule_AddObject(module, "Socket", (PyObject *)&SocketType) < 0) {
+		Py_DECREF(&SocketType);
+		Py_DECREF(module);
+		return NULL;
+	}
+
+	return module;
+}
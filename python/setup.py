@@ -0,0 +1,27 @@
+# Builds the native `obdii` extension module against the shared library produced by `make shared`:
+#
+#     $ make shared
+#     $ cd python && python3 setup.py build_ext --inplace
+#
+import os
+import numpy
+from setuptools import setup, Extension
+
+root = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+
+obdii = Extension(
+    'obdii._obdii',
+    sources = [ 'obdiimodule.c' ],
+    include_dirs = [ os.path.join(root, 'src'), numpy.get_include() ],
+    library_dirs = [ os.path.join(root, 'build') ],
+    libraries = [ 'obdii' ]
+)
+
+setup(
+    name = 'obdii',
+    version = '1.0',
+    description = 'Native bindings to libobdii, with bulk queries returning NumPy arrays',
+    packages = [ 'obdii' ],
+    ext_modules = [ obdii ],
+    install_requires = [ 'numpy' ]
+)
@@ -1,39 +1,288 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include "OBDII.h"
 
+#define NUM_MODE1_COMMANDS (sizeof(OBDIIMode1Commands) / sizeof(OBDIIMode1Commands[0]))
+#define NUM_MODE9_COMMANDS (sizeof(OBDIIMode9Commands) / sizeof(OBDIIMode9Commands[0]))
+#define BITMAP_NUM_WORDS 4
+
+static inline int bitmapContains(const OBDIIPIDBitmap *bitmap, unsigned char pid)
+{
+	return (bitmap->words[pid >> 6] >> (pid & 63)) & 1;
+}
+
+// Keeps the PIDs below `numPIDs`, i.e. those that have a predefined command
+static inline void bitmapMaskBelow(OBDIIPIDBitmap *bitmap, unsigned int numPIDs)
+{
+	unsigned int i;
+	for (i = 0; i < BITMAP_NUM_WORDS; ++i) {
+		if (numPIDs <= i * 64) {
+			bitmap->words[i] = 0;
+		} else if (numPIDs < (i + 1) * 64) {
+			bitmap->words[i] &= (1ULL << (numPIDs - i * 64)) - 1;
+		}
+	}
+}
+
+static inline int bitmapCount(const OBDIIPIDBitmap *bitmap)
+{
+	return __builtin_popcountll(bitmap->words[0]) + __builtin_popcountll(bitmap->words[1]) + __builtin_popcountll(bitmap->words[2]) + __builtin_popcountll(bitmap->words[3]);
+}
+
+// Returns the first PID at or after `start` in the bitmap, or -1
+static int bitmapNext(const OBDIIPIDBitmap *bitmap, int start)
+{
+	int word = start >> 6;
+	if (word >= BITMAP_NUM_WORDS) {
+		return -1;
+	}
+
+	uint64_t bits = bitmap->words[word] & (~0ULL << (start & 63));
+
+	while (!bits) {
+		if (++word == BITMAP_NUM_WORDS) {
+			return -1;
+		}
+		bits = bitmap->words[word];
+	}
+
+	return word * 64 + __builtin_ctzll(bits);
+}
+
+// Returns the `index`th PID in the bitmap, or -1
+static int bitmapSelect(const OBDIIPIDBitmap *bitmap, int index)
+{
+	int word;
+	for (word = 0; word < BITMAP_NUM_WORDS; ++word) {
+		uint64_t bits = bitmap->words[word];
+		int count = __builtin_popcountll(bits);
+
+		if (index < count) {
+			while (index--) {
+				bits &= bits - 1; // Clear the lowest bit set
+			}
+			return word * 64 + __builtin_ctzll(bits);
+		}
+
+		index -= count;
+	}
+
+	return -1;
+}
+
+// The PIDs of a command set that have a predefined command
+static void knownPIDs(const OBDIICommandSet *commandSet, OBDIIPIDBitmap *mode1, OBDIIPIDBitmap *mode9)
+{
+	*mode1 = commandSet->_mode1SupportedPIDs;
+	*mode9 = commandSet->_mode9SupportedPIDs;
+	bitmapMaskBelow(mode1, NUM_MODE1_COMMANDS);
+	bitmapMaskBelow(mode9, NUM_MODE9_COMMANDS);
+}
+
+static void updateNumCommands(OBDIICommandSet *commandSet)
+{
+	OBDIIPIDBitmap mode1, mode9;
+	knownPIDs(commandSet, &mode1, &mode9);
+
+	commandSet->numCommands = bitmapCount(&mode1) + !!commandSet->_supportsDTCs + bitmapCount(&mode9);
+}
+
+int OBDIICommandSetContainsPID(OBDIICommandSet *commandSet, unsigned char mode, unsigned char pid)
+{
+	if (!commandSet) {
+		return 0;
+	}
+
+	switch (mode) {
+		case 0x01:
+			return bitmapContains(&commandSet->_mode1SupportedPIDs, pid);
+		case 0x03:
+			return !!commandSet->_supportsDTCs;
+		case 0x09:
+			return bitmapContains(&commandSet->_mode9SupportedPIDs, pid);
+	}
+
+	return 0;
+}
+
 int OBDIICommandSetContainsCommand(OBDIICommandSet *commandSet, OBDIICommand *command)
 {
-	if (!commandSet || !command) {
+	if (!command) {
 		return 0;
 	}
-	
-	unsigned char mode = OBDIICommandGetMode(command);
+
+	return OBDIICommandSetContainsPID(commandSet, OBDIICommandGetMode(command), OBDIICommandGetPID(command));
+}
+
+static void setPID(OBDIICommandSet *commandSet, OBDIICommand *command, int present)
+{
+	if (!commandSet || !command) {
+		return;
+	}
+
+	unsigned char pid = OBDIICommandGetPID(command);
+	OBDIIPIDBitmap *bitmap;
+
+	switch (OBDIICommandGetMode(command)) {
+		case 0x01:
+			bitmap = &commandSet->_mode1SupportedPIDs;
+			break;
+		case 0x03:
+			commandSet->_supportsDTCs = present;
+			updateNumCommands(commandSet);
+			return;
+		case 0x09:
+			bitmap = &commandSet->_mode9SupportedPIDs;
+			break;
+		default:
+			return;
+	}
+
+	if (present) {
+		bitmap->words[pid >> 6] |= 1ULL << (pid & 63);
+	} else {
+		bitmap->words[pid >> 6] &= ~(1ULL << (pid & 63));
+	}
+
+	updateNumCommands(commandSet);
+}
+
+void OBDIICommandSetAddCommand(OBDIICommandSet *commandSet, OBDIICommand *command)
+{
+	setPID(commandSet, command, 1);
+}
+
+void OBDIICommandSetRemoveCommand(OBDIICommandSet *commandSet, OBDIICommand *command)
+{
+	setPID(commandSet, command, 0);
+}
+
+void OBDIICommandSetAddSupportedPIDs(OBDIICommandSet *commandSet, unsigned char mode, unsigned char base, uint32_t bitfield)
+{
+	OBDIIPIDBitmap *bitmap;
+
 	if (mode == 0x01) {
-		unsigned char pid = OBDIICommandGetPID(command);
-
-		if (pid == 0x00) {
-		       return 1;
-		} else if (pid <= 0x20) {
-			return !!(commandSet->_mode1SupportedPIDs._1_to_20 & (1 << (0x20 - pid)));
-		} else if (pid <= 0x40) {
-			return !!(commandSet->_mode1SupportedPIDs._21_to_40 & (1 << (0x40 - pid)));
-		} else if (pid <= 0x60) {
-			return !!(commandSet->_mode1SupportedPIDs._41_to_60 & (1 << (0x60 - pid)));
-		} else {
-			return !!(commandSet->_mode1SupportedPIDs._61_to_80 & (1 << (0x80 - pid)));
-		}
+		bitmap = &commandSet->_mode1SupportedPIDs;
 	} else if (mode == 0x09) {
-		unsigned char pid = OBDIICommandGetPID(command);
+		bitmap = &commandSet->_mode9SupportedPIDs;
+	} else {
+		return;
+	}
+
+	while (bitfield) {
+		unsigned int pid = base + 32 - __builtin_ctz(bitfield);
 
-		if (pid == 0x00) {
-			return 1;
-		} else {
-			return !!(commandSet->_mode9SupportedPIDs & (1 << (0x20 - pid)));
+		if (pid <= 0xFF) {
+			bitmap->words[pid >> 6] |= 1ULL << (pid & 63);
 		}
+
+		bitfield &= bitfield - 1;
 	}
 
-	return 0;
+	updateNumCommands(commandSet);
+}
+
+void OBDIICommandSetUnion(OBDIICommandSet *result, const OBDIICommandSet *a, const OBDIICommandSet *b)
+{
+	int i;
+	for (i = 0; i < BITMAP_NUM_WORDS; ++i) {
+		result->_mode1SupportedPIDs.words[i] = a->_mode1SupportedPIDs.words[i] | b->_mode1SupportedPIDs.words[i];
+		result->_mode9SupportedPIDs.words[i] = a->_mode9SupportedPIDs.words[i] | b->_mode9SupportedPIDs.words[i];
+	}
+
+	result->_supportsDTCs = a->_supportsDTCs || b->_supportsDTCs;
+	updateNumCommands(result);
+}
+
+void OBDIICommandSetIntersection(OBDIICommandSet *result, const OBDIICommandSet *a, const OBDIICommandSet *b)
+{
+	int i;
+	for (i = 0; i < BITMAP_NUM_WORDS; ++i) {
+		result->_mode1SupportedPIDs.words[i] = a->_mode1SupportedPIDs.words[i] & b->_mode1SupportedPIDs.words[i];
+		result->_mode9SupportedPIDs.words[i] = a->_mode9SupportedPIDs.words[i] & b->_mode9SupportedPIDs.words[i];
+	}
+
+	result->_supportsDTCs = a->_supportsDTCs && b->_supportsDTCs;
+	updateNumCommands(result);
+}
+
+void OBDIICommandSetDifference(OBDIICommandSet *result, const OBDIICommandSet *a, const OBDIICommandSet *b)
+{
+	int i;
+	for (i = 0; i < BITMAP_NUM_WORDS; ++i) {
+		result->_mode1SupportedPIDs.words[i] = a->_mode1SupportedPIDs.words[i] & ~b->_mode1SupportedPIDs.words[i];
+		result->_mode9SupportedPIDs.words[i] = a->_mode9SupportedPIDs.words[i] & ~b->_mode9SupportedPIDs.words[i];
+	}
+
+	result->_supportsDTCs = a->_supportsDTCs && !b->_supportsDTCs;
+	updateNumCommands(result);
+}
+
+OBDIICommand *OBDIICommandSetNextCommand(const OBDIICommandSet *commandSet, OBDIICommand *previous)
+{
+	if (!commandSet) {
+		return NULL;
+	}
+
+	OBDIIPIDBitmap mode1, mode9;
+	knownPIDs(commandSet, &mode1, &mode9);
+
+	unsigned char mode = previous ? OBDIICommandGetMode(previous) : 0x01;
+	int pid = previous ? OBDIICommandGetPID(previous) + 1 : 0;
+
+	if (mode == 0x01) {
+		if ((pid = bitmapNext(&mode1, pid)) >= 0) {
+			return &OBDIIMode1Commands[pid];
+		}
+
+		if (commandSet->_supportsDTCs) {
+			return OBDIICommands.DTCs;
+		}
+	}
+
+	if (mode != 0x09) {
+		pid = 0;
+	}
+
+	if ((pid = bitmapNext(&mode9, pid)) >= 0) {
+		return &OBDIIMode9Commands[pid];
+	}
+
+	return NULL;
+}
+
+OBDIICommand *OBDIICommandSetCommandAtIndex(const OBDIICommandSet *commandSet, int index)
+{
+	if (!commandSet || index < 0) {
+		return NULL;
+	}
+
+	OBDIIPIDBitmap mode1, mode9;
+	knownPIDs(commandSet, &mode1, &mode9);
+
+	int numMode1Commands = bitmapCount(&mode1);
+	if (index < numMode1Commands) {
+		return &OBDIIMode1Commands[bitmapSelect(&mode1, index)];
+	}
+
+	index -= numMode1Commands;
+
+	if (commandSet->_supportsDTCs) {
+		if (index == 0) {
+			return OBDIICommands.DTCs;
+		}
+		index--;
+	}
+
+	int pid = bitmapSelect(&mode9, index);
+	return pid >= 0 ? &OBDIIMode9Commands[pid] : NULL;
+}
+
+void OBDIICommandSetFree(OBDIICommandSet *commandSet)
+{
+	// Sets are fixed-size bitmaps now; kept so existing callers still link
+	(void)commandSet;
 }
 
 int OBDIIResponseSuccessful(OBDIICommand *command, unsigned char *payload, int len)
@@ -54,13 +303,57 @@ int OBDIIResponseSuccessful(OBDIICommand *command, unsigned char *payload, int l
 	}
 
 	// PIDs should match
-	if (mode == 0x01 || mode == 0x09) {
-		if (len < 2 || payload[1] != command->payload[1]) {
-			return 0;
-		}
+	return OBDIIResponseEchoesPID(command, payload, len);
+}
+
+int OBDIIResponseEchoesPID(OBDIICommand *command, unsigned char *payload, int len)
+{
+	unsigned char mode = OBDIICommandGetMode(command);
+
+	if (mode != 0x01 && mode != 0x09 && mode != 0x21 && mode != OBDII_MODE_READ_DATA_BY_IDENTIFIER) {
+		return 1;
 	}
 
-	return 1;
+	int requestLength = OBDIICommandGetRequestLength(command);
+
+	return len >= requestLength && memcmp(&payload[1], &command->payload[1], requestLength - 1) == 0;
+}
+
+unsigned char OBDIINegativeResponseCode(OBDIICommand *command, unsigned char *payload, int len)
+{
+	if (!command || !payload || len < 3) {
+		return 0;
+	}
+
+	if (payload[0] != OBDII_NEGATIVE_RESPONSE || payload[1] != OBDIICommandGetMode(command)) {
+		return 0;
+	}
+
+	return payload[2];
+}
+
+const char *OBDIINegativeResponseCodeDescription(unsigned char code)
+{
+	switch (code) {
+		case OBDII_NRC_GENERAL_REJECT:
+			return "General reject";
+		case OBDII_NRC_SERVICE_NOT_SUPPORTED:
+			return "Service not supported";
+		case OBDII_NRC_SUBFUNCTION_NOT_SUPPORTED:
+			return "Sub-function not supported";
+		case OBDII_NRC_INCORRECT_MESSAGE_LENGTH:
+			return "Incorrect message length or invalid format";
+		case OBDII_NRC_BUSY_REPEAT_REQUEST:
+			return "Busy, repeat request";
+		case OBDII_NRC_CONDITIONS_NOT_CORRECT:
+			return "Conditions not correct";
+		case OBDII_NRC_REQUEST_OUT_OF_RANGE:
+			return "Request out of range";
+		case OBDII_NRC_RESPONSE_PENDING:
+			return "Response pending";
+	}
+
+	return "Unknown negative response code";
 }
 
 void OBDIIDecodeBitfield(OBDIIResponse *response, unsigned char *responsePayload, int len)
@@ -256,9 +549,40 @@ OBDIIResponse OBDIIDecodeResponseForCommand(OBDIICommand *command, unsigned char
 		command->responseDecoder(&response, payload, len);
 	}
 
+	response.negativeResponseCode = OBDIINegativeResponseCode(command, payload, len);
+
 	return response;
 }
 
+OBDIICommand *OBDIICommandWithModeAndPID(unsigned char mode, unsigned char pid)
+{
+	switch (mode) {
+		case 0x01:
+			if (pid < sizeof(OBDIIMode1Commands) / sizeof(OBDIIMode1Commands[0])) {
+				return &OBDIIMode1Commands[pid];
+			}
+			break;
+		case 0x03:
+			return OBDIICommands.DTCs;
+		case 0x09:
+			if (pid < sizeof(OBDIIMode9Commands) / sizeof(OBDIIMode9Commands[0])) {
+				return &OBDIIMode9Commands[pid];
+			}
+			break;
+	}
+
+	return NULL;
+}
+
+double OBDIIResponseTimestamp(const OBDIIResponse *response)
+{
+	if (!response->timestamp.tv_sec && !response->timestamp.tv_nsec) {
+		return response->requestTimestamp.tv_sec + response->requestTimestamp.tv_nsec / 1e9;
+	}
+
+	return response->timestamp.tv_sec + response->timestamp.tv_nsec / 1e9;
+}
+
 void OBDIIResponseFree(OBDIIResponse *response)
 {
 	if (!response) {
@@ -362,7 +686,7 @@ OBDIICommand OBDIIMode3Command = { "Get DTCs", { 0x03 }, OBDIIResponseTypeOther,
 
 OBDIICommand OBDIIMode9Commands[] = {
 	{ "Supported PIDs", { 0x09, 0x00 }, OBDIIResponseTypeBitfield, 6, &OBDIIDecodeBitfield },
-	{ "VIN message count", { 0x09, 0x01 }, OBDIIResponseTypeNumeric, 3, NULL },
+	{ "VIN message count", { 0x09, 0x01 }, OBDIIResponseTypeNumeric, 3, &OBDIIDecodeUInt8 },
 	{ "Get VIN", { 0x09, 0x02 }, OBDIIResponseTypeString, VARIABLE_RESPONSE_LENGTH, &OBDIIDecodeVIN }
 };
 
@@ -457,3 +781,107 @@ struct OBDIICommands OBDIICommands = {
 	&OBDIIMode9Commands[1],
 	&OBDIIMode9Commands[2]
 };
+
+// Field names of `struct OBDIICommands`, for looking up commands by name
+#define COMMAND_NAME(field) { #field, offsetof(struct OBDIICommands, field) }
+
+static const struct {
+	const char *name;
+	size_t offset;
+} commandNames[] = {
+	COMMAND_NAME(mode1SupportedPIDs_1_to_20),
+	COMMAND_NAME(monitorStatus),
+	COMMAND_NAME(freezeDTC),
+	COMMAND_NAME(fuelSystemStatus),
+	COMMAND_NAME(calculatedEngineLoad),
+	COMMAND_NAME(engineCoolantTemperature),
+	COMMAND_NAME(bank1ShortTermFuelTrim),
+	COMMAND_NAME(bank1LongTermFueldTrim),
+	COMMAND_NAME(bank2ShortTermFuelTrim),
+	COMMAND_NAME(bank2LongTermFuelTrim),
+	COMMAND_NAME(fuelPressure),
+	COMMAND_NAME(intakeManifoldAbsolutePressure),
+	COMMAND_NAME(engineRPMs),
+	COMMAND_NAME(vehicleSpeed),
+	COMMAND_NAME(timingAdvance),
+	COMMAND_NAME(intakeAirTemperature),
+	COMMAND_NAME(mafAirFlowRate),
+	COMMAND_NAME(throttlePosition),
+	COMMAND_NAME(commandedSecondaryAirStatus),
+	COMMAND_NAME(oxygenSensorsPresentIn2Banks),
+	COMMAND_NAME(oxygenSensor1_fuelTrim),
+	COMMAND_NAME(oxygenSensor2_fuelTrim),
+	COMMAND_NAME(oxygenSensor3_fuelTrim),
+	COMMAND_NAME(oxygenSensor4_fuelTrim),
+	COMMAND_NAME(oxygenSensor5_fuelTrim),
+	COMMAND_NAME(oxygenSensor6_fuelTrim),
+	COMMAND_NAME(oxygenSensor7_fuelTrim),
+	COMMAND_NAME(oxygenSensor8_fuelTrim),
+	COMMAND_NAME(conformingStandards),
+	COMMAND_NAME(oxygenSensorsPresentIn4Banks),
+	COMMAND_NAME(auxiliaryInputStatus),
+	COMMAND_NAME(runtimeSinceEngineStart),
+	COMMAND_NAME(mode1SupportedPIDs_21_to_40),
+	COMMAND_NAME(distanceTraveledWithMalfunctionIndicatorLampOn),
+	COMMAND_NAME(fuelRailPressure),
+	COMMAND_NAME(fuelRailGaugePressure),
+	COMMAND_NAME(oxygenSensor1_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor2_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor3_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor4_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor5_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor6_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor7_fuelAirRatioVoltage),
+	COMMAND_NAME(oxygenSensor8_fuelAirRatioVoltage),
+	COMMAND_NAME(commandedEGR),
+	COMMAND_NAME(egrError),
+	COMMAND_NAME(commandedEvaporativePurge),
+	COMMAND_NAME(fuelTankLevelInput),
+	COMMAND_NAME(warmUpsSinceCodesCleared),
+	COMMAND_NAME(distanceTraveledSinceCodesCleared),
+	COMMAND_NAME(evaporativeSystemVaporPressure),
+	COMMAND_NAME(absoluteBarometricPressure),
+	COMMAND_NAME(oxygenSensor1_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor2_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor3_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor4_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor5_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor6_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor7_fuelAirRatioCurrent),
+	COMMAND_NAME(oxygenSensor8_fuelAirRatioCurrent),
+	COMMAND_NAME(catalystTemperatureBank1Sensor1),
+	COMMAND_NAME(catalystTemperatureBank2Sensor1),
+	COMMAND_NAME(catalystTemperatureBank1Sensor2),
+	COMMAND_NAME(catalystTemperatureBank2Sensor2),
+	COMMAND_NAME(mode1SupportedPIDs_41_to_60),
+	COMMAND_NAME(currentDriveCycleMonitorStatus),
+	COMMAND_NAME(controlModuleVoltage),
+	COMMAND_NAME(absoluteLoadValue),
+	COMMAND_NAME(fuelAirCommandEquivalenceRatio),
+	COMMAND_NAME(relativeThrottlePosition),
+	COMMAND_NAME(ambientAirTemperature),
+	COMMAND_NAME(absoluteThrottlePositionB),
+	COMMAND_NAME(absoluteThrottlePositionC),
+	COMMAND_NAME(acceleratorPedalPositionD),
+	COMMAND_NAME(acceleratorPedalPositionE),
+	COMMAND_NAME(acceleratorPedalPositionF),
+	COMMAND_NAME(commandedThrottleActuator),
+	COMMAND_NAME(timeRunWithMalfunctionIndicatorLampOn),
+	COMMAND_NAME(timeSinceTroubleCodesCleared),
+	COMMAND_NAME(DTCs),
+	COMMAND_NAME(mode9SupportedPIDs),
+	COMMAND_NAME(vinMessageCount),
+	COMMAND_NAME(VIN),
+};
+
+OBDIICommand *OBDIICommandWithName(const char *name)
+{
+	size_t i;
+	for (i = 0; i < sizeof(commandNames) / sizeof(commandNames[0]); ++i) {
+		if (strcmp(commandNames[i].name, name) == 0) {
+			return *(OBDIICommand **)((char *)&OBDIICommands + commandNames[i].offset);
+		}
+	}
+
+	return NULL;
+}
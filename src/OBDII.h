@@ -1,11 +1,26 @@
 #ifndef __OBDII_H
 #define __OBDII_H
 #include <stdint.h>
+#include <time.h>
 
 #define OBDII_API_VERSION 1
 
 #define VARIABLE_RESPONSE_LENGTH 0
 
+/** Mode byte of a negative response, which is followed by the mode of the request and a negative response code */
+#define OBDII_NEGATIVE_RESPONSE 0x7F
+
+/** Negative response codes (NRC), as defined by ISO 14229-1 */
+#define OBDII_NRC_GENERAL_REJECT 0x10
+#define OBDII_NRC_SERVICE_NOT_SUPPORTED 0x11
+#define OBDII_NRC_SUBFUNCTION_NOT_SUPPORTED 0x12
+#define OBDII_NRC_INCORRECT_MESSAGE_LENGTH 0x13
+#define OBDII_NRC_BUSY_REPEAT_REQUEST 0x21
+#define OBDII_NRC_CONDITIONS_NOT_CORRECT 0x22
+#define OBDII_NRC_REQUEST_OUT_OF_RANGE 0x31
+/** Not a refusal: the ECU needs more time, and will send the actual response later */
+#define OBDII_NRC_RESPONSE_PENDING 0x78
+
 struct OBDIICommand; // Forward declaration
 
 /**
@@ -42,6 +57,8 @@ struct OBDIICommand; // Forward declaration
  */
 typedef struct OBDIIResponse {
 	int success;
+	/** If the ECU refused the request, the negative response code (NRC) it gave, e.g. `OBDII_NRC_REQUEST_OUT_OF_RANGE`; 0 otherwise */
+	unsigned char negativeResponseCode;
 	struct OBDIICommand *command;
 
 	union {
@@ -63,6 +80,17 @@ typedef struct OBDIIResponse {
 			};
 		} oxygenSensorValues;
 	};
+
+	/** When the response arrived (CLOCK_MONOTONIC). The kernel stamps it as it arrives wherever the socket allows, so
+	 * the time spent waiting to be read and decoded isn't included. Zero if nothing arrived. */
+	struct timespec timestamp;
+	/** When the request was sent (CLOCK_MONOTONIC), or for a refusal the socket repeated from memory when it was asked
+	 * for. Zero if the response didn't come from a query. */
+	struct timespec requestTimestamp;
+	/** 1 if the request went out and the ECU didn't answer in the time it is given (a second, or longer after a
+	 * "response pending" answer); 0 if it answered, or if the query gave up before that, e.g. because it couldn't be
+	 * sent, or the caller's deadline passed or it was cancelled first. */
+	int timedOut;
 } OBDIIResponse;
 
 typedef enum OBDIIResponseType {
@@ -93,8 +121,9 @@ typedef void (*OBDIIResponseDecoder)(OBDIIResponse *response, unsigned char *res
 typedef struct OBDIICommand {
 	/** A human-readable description of the command. */
 	char *name;
-	/** The raw request payload, which for all commands is simply a (mode, PID) tuple. */
-	unsigned char payload[2];
+	/** The raw request payload: a (mode, PID) tuple, or for mode 0x22 the mode followed by a 16-bit data identifier
+	 * (big-endian). See `OBDIICommandGetRequestLength`. */
+	unsigned char payload[3];
 	/** The type of data contained in the response for this command. */
 	OBDIIResponseType responseType;	
 	/** The expected length of a payload containing the raw response to this command. Equal to `VARIABLE_RESPONSE_LENGTH`
@@ -108,32 +137,51 @@ typedef struct OBDIICommand {
 #define OBDIICommandGetMode(command) (command)->payload[0]
 #define OBDIICommandGetPID(command) (command)->payload[1]
 
-/** Represents a dynamic collection of commands.
+/** Mode 0x22 (read data by identifier) takes a 16-bit data identifier instead of a PID */
+#define OBDII_MODE_READ_DATA_BY_IDENTIFIER 0x22
+
+/** Helper macro that returns the number of bytes of a command's request payload */
+#define OBDIICommandGetRequestLength(command) (OBDIICommandGetMode(command) == OBDII_MODE_READ_DATA_BY_IDENTIFIER ? 3 : 2)
+
+/** Functional (broadcast) request ID for 11-bit identifiers */
+#define OBDII_FUNCTIONAL_REQUEST_ID 0x7DF
+/** Physical request ID of the first ECU; ECU `n` listens on `OBDII_PHYSICAL_REQUEST_ID + n` */
+#define OBDII_PHYSICAL_REQUEST_ID 0x7E0
+/** Response ID of the first ECU; ECU `n` responds on `OBDII_RESPONSE_ID + n` */
+#define OBDII_RESPONSE_ID 0x7E8
+/** Number of ECUs addressable with 11-bit identifiers */
+#define OBDII_NUM_ECUS 8
+
+/** A set of PIDs within a mode: PID `pid` is present if bit `pid % 64` of `words[pid / 64]` is set. */
+typedef struct OBDIIPIDBitmap {
+	uint64_t words[4];
+} OBDIIPIDBitmap;
+
+/** Represents a collection of commands.
  *
  * The OBDII standard specifies a large number of diagnostic commands, but a particular vehicle will likely only support a subset.
  * The `OBDIIGetSupportedCommands` function can be used to query a vehicle for the set of commands it supports. For example,
  *
  *     OBDIICommandSet commands = OBDIIGetSupportedCommands(s);
- *     int i;
- *     for (i = 0; i < supportedCommands.numCommands; ++i) {
- *         OBDIICommand *command = supportedCommands.commands[i];
- *         printf("%i: mode %02x, PID %02x: %s\n", i, OBDIICommandGetMode(command), OBDIICommandGetPID(command), command->name);
+ *     OBDIICommand *command = NULL;
+ *     while ((command = OBDIICommandSetNextCommand(&commands, command))) {
+ *         printf("mode %02x, PID %02x: %s\n", OBDIICommandGetMode(command), OBDIICommandGetPID(command), command->name);
  *     }
- *     OBDIICommandSetFree(&commands);
+ *
+ * A command set is a fixed-size bitmap per mode, so it can be copied, compared and combined without allocating memory.
+ * The sets of several ECUs or vehicles can be combined with `OBDIICommandSetUnion`, `OBDIICommandSetIntersection` and
+ * `OBDIICommandSetDifference`. Mode 1 PIDs up to 0xFF are recorded, including those that have no predefined command;
+ * iteration and `numCommands` only cover the predefined commands.
+ *
+ * An empty set is obtained by zero-initializing the structure (`OBDIICommandSet commands = { 0 };`).
  */
 typedef struct OBDIICommandSet {
 	// Private
-	struct {
-		uint32_t _1_to_20;
-		uint32_t _21_to_40;
-		uint32_t _41_to_60;
-		uint32_t _61_to_80;
-	} _mode1SupportedPIDs;
+	OBDIIPIDBitmap _mode1SupportedPIDs;
+	OBDIIPIDBitmap _mode9SupportedPIDs;
+	int _supportsDTCs;
 
-	uint32_t _mode9SupportedPIDs;
-
-	int numCommands; /** The number of commands in this command set */
-	OBDIICommand **commands; /** The array of commands */
+	int numCommands; /** The number of predefined commands in this command set */
 } OBDIICommandSet;
 
 struct OBDIICommands {
@@ -246,6 +294,76 @@ extern OBDIICommand OBDIIMode9Commands[3];
  */
 OBDIIResponse OBDIIDecodeResponseForCommand(OBDIICommand *command, unsigned char *responsePayload, int len);
 
+/** Checks whether a raw response payload is a positive response to a given command.
+ *
+ * A positive response echoes the command's mode plus 0x40 and, for the modes that take one, its PID (see
+ * `OBDIIResponseEchoesPID`). For commands whose response
+ * length is known, the payload must also have exactly that length.
+ *
+ * \param command The command the response is expected to answer
+ * \param payload The raw response payload
+ * \param len The length of `payload`
+ *
+ * \returns 1 if the payload is a positive response to `command`, 0 otherwise
+ */
+int OBDIIResponseSuccessful(OBDIICommand *command, unsigned char *payload, int len);
+
+/** Checks whether a raw response payload echoes the PID of a command's request.
+ *
+ * Responses to modes 0x01, 0x09 and 0x21 repeat the PID after the mode byte, and responses to mode 0x22 its data
+ * identifier. Responses to other modes (e.g. mode 3) echo nothing, and always pass.
+ *
+ * \returns 1 if the PID matches or the mode echoes none, 0 otherwise
+ */
+int OBDIIResponseEchoesPID(OBDIICommand *command, unsigned char *payload, int len);
+
+/** Get the negative response code of a payload that refuses `command`.
+ *
+ * \param command The command the response is expected to answer
+ * \param payload The raw response payload
+ * \param len The length of `payload`
+ *
+ * \returns The negative response code, or 0 if the payload isn't a negative response to `command`
+ */
+unsigned char OBDIINegativeResponseCode(OBDIICommand *command, unsigned char *payload, int len);
+
+/** Describe a negative response code.
+ *
+ * \returns A static string, e.g. "Request out of range"
+ */
+const char *OBDIINegativeResponseCodeDescription(unsigned char code);
+
+/** Look up a predefined command by its mode and PID.
+ *
+ * \param mode The command's mode, e.g. 0x01
+ * \param pid The command's PID (ignored for mode 3)
+ *
+ * \returns The command, or NULL if no command with this mode and PID is defined
+ */
+OBDIICommand *OBDIICommandWithModeAndPID(unsigned char mode, unsigned char pid);
+
+/** Look up a predefined command by the name of its property on `OBDIICommands`.
+ *
+ *     // Same as OBDIICommands.vehicleSpeed
+ *     OBDIICommand *command = OBDIICommandWithName("vehicleSpeed");
+ *
+ * \param name The property name, e.g. "engineRPMs"
+ *
+ * \returns The command, or NULL if there is no command with this name
+ */
+OBDIICommand *OBDIICommandWithName(const char *name);
+
+/** The time a response arrived, in seconds.
+ *
+ * Pass this as the timestamp of a response to `OBDIIDerivedUpdate`, `OBDIIChangeFilterSubmit`,
+ * `OBDIIArrowBuilderAppend` or `OBDIIRecorderAppend`, so that samples of different commands line up by when they were
+ * actually received. Failed queries, to which nothing arrived, are stamped with when they were sent instead.
+ *
+ * \returns `response->timestamp`, or `response->requestTimestamp` if no response arrived, in seconds on the
+ *          CLOCK_MONOTONIC clock; 0 for responses that didn't come from a query
+ */
+double OBDIIResponseTimestamp(const OBDIIResponse *response);
+
 /** Free any resources allocated to this response object.
  * \param response A pointer to the response object whose resources should be freed.
  */
@@ -260,7 +378,69 @@ void OBDIIResponseFree(OBDIIResponse *response);
  */
 int OBDIICommandSetContainsCommand(OBDIICommandSet *commandSet, OBDIICommand *command);
 
+/** Checks if a PID is present within a command set, whether or not it has a predefined command.
+ *
+ * \param commandSet The collection of commands
+ * \param mode The mode (0x01, 0x03 or 0x09)
+ * \param pid The PID (ignored for mode 3)
+ *
+ * \returns 1 if the PID is present in the set, 0 otherwise
+ */
+int OBDIICommandSetContainsPID(OBDIICommandSet *commandSet, unsigned char mode, unsigned char pid);
+
+/** Add a command to a command set.
+ *
+ * \param commandSet The collection of commands
+ * \param command A command in mode 1, 3 or 9; commands in other modes are ignored
+ */
+void OBDIICommandSetAddCommand(OBDIICommandSet *commandSet, OBDIICommand *command);
+
+/** Remove a command from a command set.
+ *
+ * \param commandSet The collection of commands
+ * \param command The command to remove
+ */
+void OBDIICommandSetRemoveCommand(OBDIICommandSet *commandSet, OBDIICommand *command);
+
+/** Add the PIDs flagged in the response to a "supported PIDs" command (mode 1 or 9, PID 0x00, 0x20, ... 0xE0).
+ *
+ * \param commandSet The collection of commands
+ * \param mode The mode of the "supported PIDs" command
+ * \param base The PID of the "supported PIDs" command; the most significant bit of `bitfield` stands for PID `base + 1`
+ * \param bitfield The decoded response (`bitfieldValue`)
+ */
+void OBDIICommandSetAddSupportedPIDs(OBDIICommandSet *commandSet, unsigned char mode, unsigned char base, uint32_t bitfield);
+
+/** Compute the commands present in either `a` or `b`. `result` may point to `a` or `b`. */
+void OBDIICommandSetUnion(OBDIICommandSet *result, const OBDIICommandSet *a, const OBDIICommandSet *b);
+
+/** Compute the commands present in both `a` and `b`, e.g. the PIDs supported by every ECU of a fleet. `result` may point to `a` or `b`. */
+void OBDIICommandSetIntersection(OBDIICommandSet *result, const OBDIICommandSet *a, const OBDIICommandSet *b);
+
+/** Compute the commands present in `a` but not in `b`. `result` may point to `a` or `b`. */
+void OBDIICommandSetDifference(OBDIICommandSet *result, const OBDIICommandSet *a, const OBDIICommandSet *b);
+
+/** Iterate over the predefined commands in a command set, in mode then PID order.
+ *
+ * \param commandSet The collection of commands
+ * \param previous The command returned by the previous call, or NULL to get the first command
+ *
+ * \returns The next command in the set, or NULL if there are no more commands
+ */
+OBDIICommand *OBDIICommandSetNextCommand(const OBDIICommandSet *commandSet, OBDIICommand *previous);
+
+/** Get the predefined command at a given position in the iteration order of `OBDIICommandSetNextCommand`.
+ *
+ * \param commandSet The collection of commands
+ * \param index The position, between 0 and `numCommands - 1`
+ *
+ * \returns The command, or NULL if `index` is out of range
+ */
+OBDIICommand *OBDIICommandSetCommandAtIndex(const OBDIICommandSet *commandSet, int index);
+
 /** Free any resources allocated to this command set.
+ *
+ * Command sets no longer allocate memory, so this does nothing; it is kept for existing callers.
  *
  * \param commandSet A pointer to the command set whose resources should be freed.
  */
@@ -0,0 +1,527 @@
+#include "OBDIIArrow.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Owns the buffers and children of an exported array; the consumer may move children out and release them separately
+typedef struct {
+	const void *buffers[3];
+	struct ArrowArray *children[2];
+} ArrayPrivate;
+
+typedef struct {
+	struct ArrowSchema *children[2];
+} SchemaPrivate;
+
+typedef struct {
+	OBDIICommand *command;
+	struct ArrowArray *batches;
+	int numBatches;
+	int nextBatch;
+} StreamPrivate;
+
+static inline int isDTCCommand(OBDIICommand *command)
+{
+	return command == OBDIICommands.DTCs;
+}
+
+static inline int hasStrings(OBDIICommand *command)
+{
+	return command->responseType == OBDIIResponseTypeString || isDTCCommand(command);
+}
+
+// The Arrow format string of the command's value column
+static const char *valueFormat(OBDIICommand *command)
+{
+	if (isDTCCommand(command)) {
+		return "+l";
+	}
+
+	switch (command->responseType) {
+		case OBDIIResponseTypeNumeric:
+			return "f";
+		case OBDIIResponseTypeBitfield:
+			return "I";
+		case OBDIIResponseTypeString:
+			return "u";
+		default:
+			return NULL;
+	}
+}
+
+static void releaseArray(struct ArrowArray *array)
+{
+	ArrayPrivate *private = array->private_data;
+	int i;
+
+	for (i = 0; i < array->n_children; ++i) {
+		struct ArrowArray *child = array->children[i];
+		if (child) {
+			if (child->release) {
+				child->release(child);
+			}
+			free(child);
+		}
+	}
+
+	for (i = 0; i < array->n_buffers; ++i) {
+		free((void *)private->buffers[i]);
+	}
+
+	free(private);
+	array->release = NULL;
+}
+
+static int initArray(struct ArrowArray *array, int64_t length, int64_t nullCount, int numBuffers, int numChildren)
+{
+	ArrayPrivate *private = calloc(1, sizeof(*private));
+
+	memset(array, 0, sizeof(*array));
+	if (!private) {
+		return -1;
+	}
+
+	array->length = length;
+	array->null_count = nullCount;
+	array->n_buffers = numBuffers;
+	array->n_children = numChildren;
+	array->buffers = private->buffers;
+	array->children = numChildren > 0 ? private->children : NULL;
+	array->release = &releaseArray;
+	array->private_data = private;
+
+	return 0;
+}
+
+static struct ArrowArray *addChildArray(struct ArrowArray *parent, int index, int64_t length, int64_t nullCount, int numBuffers, int numChildren)
+{
+	struct ArrowArray *child = malloc(sizeof(*child));
+
+	if (!child) {
+		return NULL;
+	}
+
+	if (initArray(child, length, nullCount, numBuffers, numChildren) < 0) {
+		free(child);
+		return NULL;
+	}
+
+	parent->children[index] = child;
+	return child;
+}
+
+static void releaseSchema(struct ArrowSchema *schema)
+{
+	int i;
+
+	for (i = 0; i < schema->n_children; ++i) {
+		struct ArrowSchema *child = schema->children[i];
+		if (child) {
+			if (child->release) {
+				child->release(child);
+			}
+			free(child);
+		}
+	}
+
+	free(schema->private_data);
+	schema->release = NULL;
+}
+
+static int initSchema(struct ArrowSchema *schema, const char *format, const char *name, int64_t flags, int numChildren)
+{
+	SchemaPrivate *private = calloc(1, sizeof(*private));
+
+	memset(schema, 0, sizeof(*schema));
+	if (!private) {
+		return -1;
+	}
+
+	// The strings are literals or command names, which outlive the schema
+	schema->format = format;
+	schema->name = name;
+	schema->flags = flags;
+	schema->n_children = numChildren;
+	schema->children = numChildren > 0 ? private->children : NULL;
+	schema->release = &releaseSchema;
+	schema->private_data = private;
+
+	return 0;
+}
+
+static struct ArrowSchema *addChildSchema(struct ArrowSchema *parent, int index, const char *format, const char *name, int64_t flags, int numChildren)
+{
+	struct ArrowSchema *child = malloc(sizeof(*child));
+
+	if (!child) {
+		return NULL;
+	}
+
+	if (initSchema(child, format, name, flags, numChildren) < 0) {
+		free(child);
+		return NULL;
+	}
+
+	parent->children[index] = child;
+	return child;
+}
+
+static int exportCommandSchema(OBDIICommand *command, struct ArrowSchema *schema)
+{
+	int dtcs = isDTCCommand(command);
+
+	if (initSchema(schema, "+s", "", 0, 2) < 0) {
+		return -1;
+	}
+
+	struct ArrowSchema *value;
+	if (!addChildSchema(schema, 0, "tsn:UTC", "timestamp", 0, 0)
+			|| !(value = addChildSchema(schema, 1, valueFormat(command), command->name, ARROW_FLAG_NULLABLE, dtcs ? 1 : 0))
+			|| (dtcs && !addChildSchema(value, 0, "u", "item", 0, 0))) {
+		schema->release(schema);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Allocates the buffers of the next batch
+static int startBatch(OBDIIArrowBuilder *builder)
+{
+	int batchSize = builder->batchSize;
+
+	builder->_length = 0;
+	builder->_nullCount = 0;
+	builder->_timestamps = malloc(batchSize * sizeof(*builder->_timestamps));
+	builder->_validity = calloc((batchSize + 7) / 8, 1);
+
+	if (!builder->_timestamps || !builder->_validity) {
+		return -1;
+	}
+
+	if (!hasStrings(builder->command)) {
+		return (builder->_values = malloc(batchSize * sizeof(*builder->_values))) ? 0 : -1;
+	}
+
+	// Room for one short string per row, to begin with
+	builder->_numStrings = 0;
+	builder->_stringsCapacity = batchSize;
+	builder->_stringDataLength = 0;
+	builder->_stringDataCapacity = batchSize * 8;
+	builder->_stringOffsets = malloc((builder->_stringsCapacity + 1) * sizeof(*builder->_stringOffsets));
+	builder->_stringData = malloc(builder->_stringDataCapacity);
+
+	if (!builder->_stringOffsets || !builder->_stringData) {
+		return -1;
+	}
+	builder->_stringOffsets[0] = 0;
+
+	if (isDTCCommand(builder->command)) {
+		if (!(builder->_listOffsets = malloc((batchSize + 1) * sizeof(*builder->_listOffsets)))) {
+			return -1;
+		}
+		builder->_listOffsets[0] = 0;
+	}
+
+	return 0;
+}
+
+static void freeBatch(OBDIIArrowBuilder *builder)
+{
+	free(builder->_timestamps);
+	free(builder->_values);
+	free(builder->_validity);
+	free(builder->_listOffsets);
+	free(builder->_stringOffsets);
+	free(builder->_stringData);
+
+	builder->_timestamps = NULL;
+	builder->_values = NULL;
+	builder->_validity = NULL;
+	builder->_listOffsets = NULL;
+	builder->_stringOffsets = NULL;
+	builder->_stringData = NULL;
+	builder->_length = 0;
+}
+
+static int appendString(OBDIIArrowBuilder *builder, const char *string)
+{
+	int len = string ? strlen(string) : 0;
+
+	if (builder->_numStrings == builder->_stringsCapacity) {
+		int32_t *offsets = realloc(builder->_stringOffsets, (2 * builder->_stringsCapacity + 1) * sizeof(*offsets));
+		if (!offsets) {
+			return -1;
+		}
+		builder->_stringOffsets = offsets;
+		builder->_stringsCapacity *= 2;
+	}
+
+	if (builder->_stringDataLength + len > builder->_stringDataCapacity) {
+		int capacity = 2 * (builder->_stringDataLength + len);
+		char *data = realloc(builder->_stringData, capacity);
+		if (!data) {
+			return -1;
+		}
+		builder->_stringData = data;
+		builder->_stringDataCapacity = capacity;
+	}
+
+	if (len > 0) {
+		memcpy(&builder->_stringData[builder->_stringDataLength], string, len);
+		builder->_stringDataLength += len;
+	}
+	builder->_stringOffsets[++builder->_numStrings] = builder->_stringDataLength;
+
+	return 0;
+}
+
+// Hands the buffers of the batch being built over to an Arrow array, and queues it for export
+static int finishBatch(OBDIIArrowBuilder *builder)
+{
+	OBDIICommand *command = builder->command;
+	int dtcs = isDTCCommand(command);
+
+	if (builder->_numBatches == builder->_batchesCapacity) {
+		int capacity = builder->_batchesCapacity ? 2 * builder->_batchesCapacity : 8;
+		struct ArrowArray *batches = realloc(builder->_batches, capacity * sizeof(*batches));
+		if (!batches) {
+			return -1;
+		}
+		builder->_batches = batches;
+		builder->_batchesCapacity = capacity;
+	}
+
+	// Build the whole tree before giving it any buffer, so that the builder still owns them all if this fails
+	struct ArrowArray *batch = &builder->_batches[builder->_numBatches];
+	struct ArrowArray *timestamps, *values, *items = NULL;
+
+	if (initArray(batch, builder->_length, 0, 1, 2) < 0) {
+		return -1;
+	}
+
+	if (!(timestamps = addChildArray(batch, 0, builder->_length, 0, 2, 0))
+			|| !(values = addChildArray(batch, 1, builder->_length, builder->_nullCount, command->responseType == OBDIIResponseTypeString ? 3 : 2, dtcs ? 1 : 0))
+			|| (dtcs && !(items = addChildArray(values, 0, builder->_numStrings, 0, 3, 0)))) {
+		batch->release(batch);
+		return -1;
+	}
+
+	ArrayPrivate *private = timestamps->private_data;
+	private->buffers[1] = builder->_timestamps;
+
+	private = values->private_data;
+	if (builder->_nullCount > 0) {
+		private->buffers[0] = builder->_validity;
+	} else {
+		free(builder->_validity);
+	}
+
+	if (items) {
+		private->buffers[1] = builder->_listOffsets;
+		private = items->private_data;
+	}
+
+	if (hasStrings(command)) {
+		private->buffers[1] = builder->_stringOffsets;
+		private->buffers[2] = builder->_stringData;
+	} else {
+		private->buffers[1] = builder->_values;
+	}
+
+	builder->_timestamps = NULL;
+	builder->_values = NULL;
+	builder->_validity = NULL;
+	builder->_listOffsets = NULL;
+	builder->_stringOffsets = NULL;
+	builder->_stringData = NULL;
+	builder->_length = 0;
+	builder->_numBatches++;
+
+	return 0;
+}
+
+int OBDIIArrowBuilderInit(OBDIIArrowBuilder *builder, OBDIICommand *command, int batchSize)
+{
+	memset(builder, 0, sizeof(*builder));
+
+	if (!command || batchSize <= 0 || !valueFormat(command)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	builder->command = command;
+	builder->batchSize = batchSize;
+
+	// Responses are stamped on the monotonic clock, which consumers would take for the time since the epoch
+	struct timespec realtime, monotonic;
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	builder->wallClockOffset = (realtime.tv_sec - monotonic.tv_sec) * 1000000000LL + (realtime.tv_nsec - monotonic.tv_nsec);
+
+	return 0;
+}
+
+int OBDIIArrowBuilderAppend(OBDIIArrowBuilder *builder, const OBDIIResponse *response, double timestamp)
+{
+	if (!builder || !builder->command || !response) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// A full batch is only handed over once another row comes, so that a failure to do so loses nothing
+	if (builder->_length == builder->batchSize && finishBatch(builder) < 0) {
+		return -1;
+	}
+
+	if (!builder->_timestamps && startBatch(builder) < 0) {
+		freeBatch(builder);
+		return -1;
+	}
+
+	OBDIICommand *command = builder->command;
+	int row = builder->_length;
+	int valid = response->success && response->command == command;
+
+	if (command->responseType == OBDIIResponseTypeNumeric || command->responseType == OBDIIResponseTypeBitfield) {
+		// numericValue and bitfieldValue share their bytes
+		builder->_values[row] = 0;
+		if (valid) {
+			memcpy(&builder->_values[row], &response->bitfieldValue, sizeof(builder->_values[row]));
+		}
+	} else if (isDTCCommand(command)) {
+		int numStrings = builder->_numStrings, stringDataLength = builder->_stringDataLength;
+		int i;
+
+		for (i = 0; valid && i < response->DTCs.numTroubleCodes; ++i) {
+			if (appendString(builder, response->DTCs.troubleCodes[i]) < 0) {
+				// Drop the codes of this row that made it in
+				builder->_numStrings = numStrings;
+				builder->_stringDataLength = stringDataLength;
+				return -1;
+			}
+		}
+
+		builder->_listOffsets[row + 1] = builder->_numStrings;
+	} else if (appendString(builder, valid ? response->stringValue : NULL) < 0) {
+		return -1;
+	}
+
+	builder->_timestamps[row] = (int64_t)(timestamp * 1e9) + builder->wallClockOffset;
+	if (valid) {
+		builder->_validity[row / 8] |= 1 << (row % 8);
+	} else {
+		builder->_nullCount++;
+	}
+
+	builder->_length++;
+
+	return 0;
+}
+
+int OBDIIArrowBuilderExportSchema(OBDIIArrowBuilder *builder, struct ArrowSchema *schema)
+{
+	if (!builder || !builder->command || !schema) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return exportCommandSchema(builder->command, schema);
+}
+
+static int streamGetSchema(struct ArrowArrayStream *stream, struct ArrowSchema *out)
+{
+	StreamPrivate *private = stream->private_data;
+
+	return exportCommandSchema(private->command, out) < 0 ? ENOMEM : 0;
+}
+
+static int streamGetNext(struct ArrowArrayStream *stream, struct ArrowArray *out)
+{
+	StreamPrivate *private = stream->private_data;
+
+	if (private->nextBatch == private->numBatches) {
+		// The end of the stream
+		memset(out, 0, sizeof(*out));
+		return 0;
+	}
+
+	*out = private->batches[private->nextBatch++];
+	return 0;
+}
+
+static const char *streamGetLastError(struct ArrowArrayStream *stream)
+{
+	(void)stream;
+	return NULL;
+}
+
+static void releaseStream(struct ArrowArrayStream *stream)
+{
+	StreamPrivate *private = stream->private_data;
+
+	for (; private->nextBatch < private->numBatches; private->nextBatch++) {
+		private->batches[private->nextBatch].release(&private->batches[private->nextBatch]);
+	}
+
+	free(private->batches);
+	free(private);
+	stream->release = NULL;
+}
+
+int OBDIIArrowBuilderExportStream(OBDIIArrowBuilder *builder, struct ArrowArrayStream *stream)
+{
+	if (!builder || !builder->command || !stream) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (builder->_length > 0 && finishBatch(builder) < 0) {
+		return -1;
+	}
+
+	StreamPrivate *private = malloc(sizeof(*private));
+	if (!private) {
+		return -1;
+	}
+
+	private->command = builder->command;
+	private->batches = builder->_batches;
+	private->numBatches = builder->_numBatches;
+	private->nextBatch = 0;
+
+	stream->get_schema = &streamGetSchema;
+	stream->get_next = &streamGetNext;
+	stream->get_last_error = &streamGetLastError;
+	stream->release = &releaseStream;
+	stream->private_data = private;
+
+	// The stream owns the batches now
+	freeBatch(builder);
+	builder->_batches = NULL;
+	builder->_numBatches = 0;
+	builder->_batchesCapacity = 0;
+
+	return 0;
+}
+
+void OBDIIArrowBuilderFree(OBDIIArrowBuilder *builder)
+{
+	int i;
+
+	if (!builder) {
+		return;
+	}
+
+	freeBatch(builder);
+
+	for (i = 0; i < builder->_numBatches; ++i) {
+		builder->_batches[i].release(&builder->_batches[i]);
+	}
+
+	free(builder->_batches);
+	builder->_batches = NULL;
+	builder->_numBatches = 0;
+	builder->_batchesCapacity = 0;
+}
@@ -0,0 +1,154 @@
+#ifndef __OBDII_ARROW_H
+#define __OBDII_ARROW_H
+
+#include "OBDII.h"
+
+// The Arrow C data and stream interfaces, as specified by Apache Arrow (https://arrow.apache.org/docs/format/CDataInterface.html)
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	// Array type description
+	const char *format;
+	const char *name;
+	const char *metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema **children;
+	struct ArrowSchema *dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowSchema *);
+	// Opaque producer-specific data
+	void *private_data;
+};
+
+struct ArrowArray {
+	// Array data description
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void **buffers;
+	struct ArrowArray **children;
+	struct ArrowArray *dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowArray *);
+	// Opaque producer-specific data
+	void *private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+	// Callbacks providing stream functionality
+	int (*get_schema)(struct ArrowArrayStream *, struct ArrowSchema *out);
+	int (*get_next)(struct ArrowArrayStream *, struct ArrowArray *out);
+	const char *(*get_last_error)(struct ArrowArrayStream *);
+
+	// Release callback
+	void (*release)(struct ArrowArrayStream *);
+
+	// Opaque producer-specific data
+	void *private_data;
+};
+
+#endif /* ARROW_C_STREAM_INTERFACE */
+
+/** Accumulates the responses to one command in columnar buffers, for export as Arrow record batches.
+ *
+ * Each record batch has two columns: `timestamp` (a UTC timestamp in nanoseconds, Arrow format `tsn:UTC`), and a column named
+ * after the command that holds its values: a float32 for numeric commands, a uint32 for bitfield commands, a string for
+ * string commands, and a list of strings for `OBDIICommands.DTCs`. Unsuccessful responses are nulls.
+ *
+ * Exporting hands the buffers over to the consumer (e.g. pyarrow or Polars), which reads them in place and frees them
+ * through the release callbacks; the library itself doesn't depend on Arrow.
+ *
+ *     OBDIIArrowBuilder builder;
+ *     OBDIIArrowBuilderInit(&builder, OBDIICommands.engineRPMs, 4096);
+ *
+ *     OBDIIResponse response = OBDIIPerformQuery(&s, OBDIICommands.engineRPMs);
+ *     OBDIIArrowBuilderAppend(&builder, &response, OBDIIResponseTimestamp(&response));
+ *     OBDIIResponseFree(&response);
+ *
+ *     struct ArrowArrayStream stream;
+ *     OBDIIArrowBuilderExportStream(&builder, &stream);
+ *     // e.g. pyarrow.RecordBatchReader._import_from_c(address of stream)
+ */
+typedef struct OBDIIArrowBuilder {
+	OBDIICommand *command;
+	/** The number of rows per record batch */
+	int batchSize;
+	/** Nanoseconds added to the timestamps to turn them into wall-clock time: the offset of CLOCK_REALTIME from
+	 * CLOCK_MONOTONIC when the builder was initialized, so that NTP adjustments don't reorder rows. Set it to 0 to
+	 * append wall-clock timestamps. */
+	int64_t wallClockOffset;
+
+	// Private
+	int _length; // Rows in the batch being built
+	int _nullCount;
+	int64_t *_timestamps;
+	uint32_t *_values; // Numeric and bitfield commands
+	uint8_t *_validity;
+	int32_t *_listOffsets; // DTCs
+	int32_t *_stringOffsets; // String commands and DTCs
+	char *_stringData;
+	int _numStrings;
+	int _stringsCapacity;
+	int _stringDataLength;
+	int _stringDataCapacity;
+	struct ArrowArray *_batches; // Batches that are full
+	int _numBatches;
+	int _batchesCapacity;
+} OBDIIArrowBuilder;
+
+/** Initialize a builder.
+ *
+ * \param builder The builder struct that will be filled in by the call
+ * \param command The command whose responses the builder accumulates
+ * \param batchSize The number of rows per record batch
+ *
+ * \returns 0 on success, -1 on error (errno is set to EINVAL if the command's responses can't be exported, i.e. for the
+ *          oxygen sensor commands)
+ */
+int OBDIIArrowBuilderInit(OBDIIArrowBuilder *builder, OBDIICommand *command, int batchSize);
+
+/** Append a response as a row.
+ *
+ * \param builder The builder
+ * \param response A response to the builder's command; the row is null if the response is unsuccessful. The builder
+ *        copies what it needs, so the response can be freed right away.
+ * \param timestamp The time the response was received, in seconds on the CLOCK_MONOTONIC clock, e.g.
+ *        `OBDIIResponseTimestamp(response)`
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIArrowBuilderAppend(OBDIIArrowBuilder *builder, const OBDIIResponse *response, double timestamp);
+
+/** Get the schema of the builder's record batches.
+ *
+ * \returns 0 on success, -1 on error. The consumer must call the release callback of `schema`.
+ */
+int OBDIIArrowBuilderExportSchema(OBDIIArrowBuilder *builder, struct ArrowSchema *schema);
+
+/** Export every row appended so far as a stream of record batches, and empty the builder.
+ *
+ * The stream owns the batches, and stays valid after the builder is freed.
+ *
+ * \returns 0 on success, -1 on error. The consumer must call the release callback of `stream`.
+ */
+int OBDIIArrowBuilderExportStream(OBDIIArrowBuilder *builder, struct ArrowArrayStream *stream);
+
+/** Free the rows that haven't been exported. */
+void OBDIIArrowBuilderFree(OBDIIArrowBuilder *builder);
+
+#endif /* OBDIIArrow.h */
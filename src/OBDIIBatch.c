@@ -0,0 +1,398 @@
+#include "OBDIIBatch.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_KERNEL 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNEL 1
+#endif
+
+// A value computed as `scale * raw + bias`, where `raw` is a big-endian integer found in the response payload
+typedef struct {
+	unsigned char byteOffset; // Offset of the integer, after the mode and PID bytes
+	unsigned char numBytes; // 1 or 2
+	unsigned char isSigned;
+	float scale;
+	float bias;
+} LinearField;
+
+typedef struct {
+	unsigned char numFields; // 0 if the command can't be batch decoded
+	LinearField fields[2];
+} LinearKernel;
+
+#define U8(scale, bias) { 1, { { 0, 1, 0, (scale), (bias) } } }
+#define U16(scale, bias) { 1, { { 0, 2, 0, (scale), (bias) } } }
+#define S16(scale, bias) { 1, { { 0, 2, 1, (scale), (bias) } } }
+
+// Oxygen sensor commands: the first field maps to the voltage (or current), the second to the fuel trim (or equivalence ratio)
+#define OXYGEN_SENSOR_TRIM { 2, { { 0, 1, 0, 1.0f / 200.0f, 0.0f }, { 1, 1, 0, 100.0f / 128.0f, -100.0f } } }
+#define OXYGEN_SENSOR_VOLTAGE { 2, { { 2, 2, 0, 8.0f / 65536.0f, 0.0f }, { 0, 2, 0, 2.0f / 65536.0f, 0.0f } } }
+#define OXYGEN_SENSOR_CURRENT { 2, { { 2, 2, 0, 1.0f / 256.0f, -128.0f }, { 0, 2, 0, 2.0f / 65536.0f, 0.0f } } }
+
+#define PERCENTAGE U8(100.0f / 255.0f, 0.0f)
+#define TEMPERATURE U8(1.0f, -40.0f)
+#define FUEL_TRIM U8(100.0f / 128.0f, -100.0f)
+
+// Mirrors the decoders in OBDIIMode1Commands, indexed by PID
+static const LinearKernel mode1Kernels[] = {
+	[0x04] = PERCENTAGE,
+	[0x05] = TEMPERATURE,
+	[0x06] = FUEL_TRIM,
+	[0x07] = FUEL_TRIM,
+	[0x08] = FUEL_TRIM,
+	[0x09] = FUEL_TRIM,
+	[0x0A] = U8(3.0f, 0.0f),
+	[0x0B] = U8(1.0f, 0.0f),
+	[0x0C] = U16(0.25f, 0.0f),
+	[0x0D] = U8(1.0f, 0.0f),
+	[0x0E] = U8(0.5f, -64.0f),
+	[0x0F] = TEMPERATURE,
+	[0x10] = U16(0.01f, 0.0f),
+	[0x11] = PERCENTAGE,
+	[0x14] = OXYGEN_SENSOR_TRIM,
+	[0x15] = OXYGEN_SENSOR_TRIM,
+	[0x16] = OXYGEN_SENSOR_TRIM,
+	[0x17] = OXYGEN_SENSOR_TRIM,
+	[0x18] = OXYGEN_SENSOR_TRIM,
+	[0x19] = OXYGEN_SENSOR_TRIM,
+	[0x1A] = OXYGEN_SENSOR_TRIM,
+	[0x1B] = OXYGEN_SENSOR_TRIM,
+	[0x1F] = U16(1.0f, 0.0f),
+	[0x21] = U16(1.0f, 0.0f),
+	[0x22] = U16(0.079f, 0.0f),
+	[0x23] = U16(10.0f, 0.0f),
+	[0x24] = OXYGEN_SENSOR_VOLTAGE,
+	[0x25] = OXYGEN_SENSOR_VOLTAGE,
+	[0x26] = OXYGEN_SENSOR_VOLTAGE,
+	[0x27] = OXYGEN_SENSOR_VOLTAGE,
+	[0x28] = OXYGEN_SENSOR_VOLTAGE,
+	[0x29] = OXYGEN_SENSOR_VOLTAGE,
+	[0x2A] = OXYGEN_SENSOR_VOLTAGE,
+	[0x2B] = OXYGEN_SENSOR_VOLTAGE,
+	[0x2C] = PERCENTAGE,
+	[0x2D] = FUEL_TRIM,
+	[0x2E] = PERCENTAGE,
+	[0x2F] = PERCENTAGE,
+	[0x30] = U8(1.0f, 0.0f),
+	[0x31] = U16(1.0f, 0.0f),
+	[0x32] = S16(0.25f, 0.0f),
+	[0x33] = U8(1.0f, 0.0f),
+	[0x34] = OXYGEN_SENSOR_CURRENT,
+	[0x35] = OXYGEN_SENSOR_CURRENT,
+	[0x36] = OXYGEN_SENSOR_CURRENT,
+	[0x37] = OXYGEN_SENSOR_CURRENT,
+	[0x38] = OXYGEN_SENSOR_CURRENT,
+	[0x39] = OXYGEN_SENSOR_CURRENT,
+	[0x3A] = OXYGEN_SENSOR_CURRENT,
+	[0x3B] = OXYGEN_SENSOR_CURRENT,
+	[0x3C] = U16(0.1f, -40.0f),
+	[0x3D] = U16(0.1f, -40.0f),
+	[0x3E] = U16(0.1f, -40.0f),
+	[0x3F] = U16(0.1f, -40.0f),
+	[0x42] = U16(0.001f, 0.0f),
+	[0x43] = U16(100.0f / 255.0f, 0.0f),
+	[0x44] = U16(2.0f / 65536.0f, 0.0f),
+	[0x45] = PERCENTAGE,
+	[0x46] = TEMPERATURE,
+	[0x47] = PERCENTAGE,
+	[0x48] = PERCENTAGE,
+	[0x49] = PERCENTAGE,
+	[0x4A] = PERCENTAGE,
+	[0x4B] = PERCENTAGE,
+	[0x4C] = PERCENTAGE,
+	[0x4D] = U16(1.0f, 0.0f),
+	[0x4E] = U16(1.0f, 0.0f)
+};
+
+static const LinearKernel *kernelForCommand(OBDIICommand *command)
+{
+	if (!command || OBDIICommandGetMode(command) != 0x01) {
+		return NULL;
+	}
+
+	unsigned char pid = OBDIICommandGetPID(command);
+	if (pid >= sizeof(mode1Kernels) / sizeof(mode1Kernels[0]) || mode1Kernels[pid].numFields == 0) {
+		return NULL;
+	}
+
+	return &mode1Kernels[pid];
+}
+
+int OBDIIBatchSupportsCommand(OBDIICommand *command)
+{
+	return kernelForCommand(command) != NULL;
+}
+
+// The first two bytes of a valid payload, read as a little-endian integer
+static inline int32_t expectedHeader(OBDIICommand *command)
+{
+	return (OBDIICommandGetMode(command) + 0x40) | (OBDIICommandGetPID(command) << 8);
+}
+
+static inline int32_t extractRaw(const unsigned char *payload, const LinearField *field)
+{
+	const unsigned char *p = payload + 2 + field->byteOffset;
+
+	if (field->numBytes == 1) {
+		return p[0];
+	}
+
+	int32_t raw = p[0] << 8 | p[1];
+	return field->isSigned ? (int16_t)raw : raw;
+}
+
+static int decodeScalar(const LinearKernel *kernel, int32_t header, const unsigned char *payloads, int stride, int start, int count, float *values, float *secondaryValues, unsigned char *valid)
+{
+	int i, numValid = 0;
+
+	for (i = start; i < count; ++i) {
+		const unsigned char *payload = payloads + (size_t)i * stride;
+		int ok = (payload[0] | payload[1] << 8) == header;
+
+		values[i] = ok ? kernel->fields[0].scale * extractRaw(payload, &kernel->fields[0]) + kernel->fields[0].bias : NAN;
+
+		if (secondaryValues && kernel->numFields > 1) {
+			secondaryValues[i] = ok ? kernel->fields[1].scale * extractRaw(payload, &kernel->fields[1]) + kernel->fields[1].bias : NAN;
+		}
+
+		if (valid) {
+			valid[i] = ok;
+		}
+
+		numValid += ok;
+	}
+
+	return numValid;
+}
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+static inline __m256 fieldAVX2(const unsigned char *base, __m256i index, const LinearField *field)
+{
+	// Each lane reads 4 bytes starting at its integer, then keeps the bytes it needs
+	__m256i words = _mm256_i32gather_epi32((const int *)(base + 2 + field->byteOffset), index, 1);
+	__m256i lowByte = _mm256_set1_epi32(0xFF);
+	__m256i raw;
+
+	if (field->numBytes == 1) {
+		raw = _mm256_and_si256(words, lowByte);
+	} else {
+		raw = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(words, lowByte), 8), _mm256_and_si256(_mm256_srli_epi32(words, 8), lowByte));
+		if (field->isSigned) {
+			raw = _mm256_srai_epi32(_mm256_slli_epi32(raw, 16), 16);
+		}
+	}
+
+	return _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(raw), _mm256_set1_ps(field->scale)), _mm256_set1_ps(field->bias));
+}
+
+// Decodes the first `vectorCount` payloads (a multiple of 8) with AVX2 gathers
+__attribute__((target("avx2")))
+static int decodeAVX2(const LinearKernel *kernel, int32_t header, const unsigned char *payloads, int stride, int vectorCount, float *values, float *secondaryValues, unsigned char *valid)
+{
+	__m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	__m256i headerMask = _mm256_set1_epi32(0xFFFF);
+	__m256i headers = _mm256_set1_epi32(header);
+	__m256 nan = _mm256_set1_ps(NAN);
+	int i, j, numValid = 0;
+
+	for (i = 0; i < vectorCount; i += 8) {
+		const unsigned char *base = payloads + (size_t)i * stride;
+
+		__m256i words = _mm256_i32gather_epi32((const int *)base, index, 1);
+		__m256 ok = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(words, headerMask), headers));
+
+		_mm256_storeu_ps(&values[i], _mm256_blendv_ps(nan, fieldAVX2(base, index, &kernel->fields[0]), ok));
+
+		if (secondaryValues && kernel->numFields > 1) {
+			_mm256_storeu_ps(&secondaryValues[i], _mm256_blendv_ps(nan, fieldAVX2(base, index, &kernel->fields[1]), ok));
+		}
+
+		int mask = _mm256_movemask_ps(ok);
+		if (valid) {
+			for (j = 0; j < 8; ++j) {
+				valid[i + j] = (mask >> j) & 1;
+			}
+		}
+
+		numValid += __builtin_popcount(mask);
+	}
+
+	return numValid;
+}
+#endif
+
+#ifdef HAVE_SSE2_KERNEL
+static inline __m128 fieldSSE2(const int32_t raw[4], const LinearField *field)
+{
+	__m128 values = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)raw));
+	return _mm_add_ps(_mm_mul_ps(values, _mm_set1_ps(field->scale)), _mm_set1_ps(field->bias));
+}
+
+static inline __m128 selectSSE2(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Decodes the first `vectorCount` payloads (a multiple of 4); SSE2 has no gathers, so the integers are loaded one by one
+static int decodeSSE2(const LinearKernel *kernel, int32_t header, const unsigned char *payloads, int stride, int vectorCount, float *values, float *secondaryValues, unsigned char *valid)
+{
+	__m128 nan = _mm_set1_ps(NAN);
+	__m128i headers = _mm_set1_epi32(header);
+	int32_t loadedHeaders[4], raw[4], secondaryRaw[4];
+	int hasSecondary = secondaryValues && kernel->numFields > 1;
+	int i, j, numValid = 0;
+
+	for (i = 0; i < vectorCount; i += 4) {
+		for (j = 0; j < 4; ++j) {
+			const unsigned char *payload = payloads + (size_t)(i + j) * stride;
+			loadedHeaders[j] = payload[0] | payload[1] << 8;
+			raw[j] = extractRaw(payload, &kernel->fields[0]);
+			if (hasSecondary) {
+				secondaryRaw[j] = extractRaw(payload, &kernel->fields[1]);
+			}
+		}
+
+		__m128 ok = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)loadedHeaders), headers));
+
+		_mm_storeu_ps(&values[i], selectSSE2(ok, fieldSSE2(raw, &kernel->fields[0]), nan));
+
+		if (hasSecondary) {
+			_mm_storeu_ps(&secondaryValues[i], selectSSE2(ok, fieldSSE2(secondaryRaw, &kernel->fields[1]), nan));
+		}
+
+		int mask = _mm_movemask_ps(ok);
+		if (valid) {
+			for (j = 0; j < 4; ++j) {
+				valid[i + j] = (mask >> j) & 1;
+			}
+		}
+
+		numValid += __builtin_popcount(mask);
+	}
+
+	return numValid;
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static inline float32x4_t fieldNEON(const int32_t raw[4], const LinearField *field)
+{
+	float32x4_t values = vcvtq_f32_s32(vld1q_s32(raw));
+	return vaddq_f32(vmulq_n_f32(values, field->scale), vdupq_n_f32(field->bias));
+}
+
+// Decodes the first `vectorCount` payloads (a multiple of 4), loading the integers one by one
+static int decodeNEON(const LinearKernel *kernel, int32_t header, const unsigned char *payloads, int stride, int vectorCount, float *values, float *secondaryValues, unsigned char *valid)
+{
+	float32x4_t nan = vdupq_n_f32(NAN);
+	int32x4_t headers = vdupq_n_s32(header);
+	int32_t loadedHeaders[4], raw[4], secondaryRaw[4];
+	uint32_t mask[4];
+	int hasSecondary = secondaryValues && kernel->numFields > 1;
+	int i, j, numValid = 0;
+
+	for (i = 0; i < vectorCount; i += 4) {
+		for (j = 0; j < 4; ++j) {
+			const unsigned char *payload = payloads + (size_t)(i + j) * stride;
+			loadedHeaders[j] = payload[0] | payload[1] << 8;
+			raw[j] = extractRaw(payload, &kernel->fields[0]);
+			if (hasSecondary) {
+				secondaryRaw[j] = extractRaw(payload, &kernel->fields[1]);
+			}
+		}
+
+		uint32x4_t ok = vceqq_s32(vld1q_s32(loadedHeaders), headers);
+
+		vst1q_f32(&values[i], vbslq_f32(ok, fieldNEON(raw, &kernel->fields[0]), nan));
+
+		if (hasSecondary) {
+			vst1q_f32(&secondaryValues[i], vbslq_f32(ok, fieldNEON(secondaryRaw, &kernel->fields[1]), nan));
+		}
+
+		vst1q_u32(mask, ok);
+		for (j = 0; j < 4; ++j) {
+			if (valid) {
+				valid[i + j] = mask[j] != 0;
+			}
+			numValid += mask[j] != 0;
+		}
+	}
+
+	return numValid;
+}
+#endif
+
+static int validateArguments(const LinearKernel *kernel, OBDIICommand *command, const unsigned char *payloads, int stride, int count, float *values)
+{
+	if (!kernel || !payloads || !values || count < 0 || stride < command->expectedResponseLength) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int OBDIIDecodeBatchScalar(OBDIICommand *command, const unsigned char *payloads, int stride, int count, float *values, float *secondaryValues, unsigned char *valid)
+{
+	const LinearKernel *kernel = kernelForCommand(command);
+
+	if (validateArguments(kernel, command, payloads, stride, count, values) < 0) {
+		return -1;
+	}
+
+	return decodeScalar(kernel, expectedHeader(command), payloads, stride, 0, count, values, secondaryValues, valid);
+}
+
+int OBDIIDecodeBatch(OBDIICommand *command, const unsigned char *payloads, int stride, int count, float *values, float *secondaryValues, unsigned char *valid)
+{
+	const LinearKernel *kernel = kernelForCommand(command);
+
+	if (validateArguments(kernel, command, payloads, stride, count, values) < 0) {
+		return -1;
+	}
+
+	int32_t header = expectedHeader(command);
+	int numValid = 0, done = 0;
+
+#ifdef HAVE_AVX2_KERNEL
+	if (__builtin_cpu_supports("avx2")) {
+		// Gathers read 4 bytes from each integer, which may run past the end of the last payloads
+		int reach = 4, i;
+		for (i = 0; i < kernel->numFields; ++i) {
+			if (2 + kernel->fields[i].byteOffset + 4 > reach) {
+				reach = 2 + kernel->fields[i].byteOffset + 4;
+			}
+		}
+
+		int safeCount = count - (reach > stride ? (reach - stride + stride - 1) / stride : 0);
+		if (safeCount > 0) {
+			done = safeCount & ~7;
+			numValid += decodeAVX2(kernel, header, payloads, stride, done, values, secondaryValues, valid);
+		}
+	}
+#endif
+
+#if defined(HAVE_SSE2_KERNEL)
+	if (done == 0) {
+		done = count & ~3;
+		numValid += decodeSSE2(kernel, header, payloads, stride, done, values, secondaryValues, valid);
+	}
+#elif defined(HAVE_NEON_KERNEL)
+	done = count & ~3;
+	numValid += decodeNEON(kernel, header, payloads, stride, done, values, secondaryValues, valid);
+#endif
+
+	return numValid + decodeScalar(kernel, header, payloads, stride, done, count, values, secondaryValues, valid);
+}
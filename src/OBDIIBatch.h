@@ -0,0 +1,43 @@
+#ifndef __OBDII_BATCH_H
+#define __OBDII_BATCH_H
+
+#include "OBDII.h"
+
+/** Checks whether `OBDIIDecodeBatch` can decode responses to a command.
+ *
+ * Batch decoding covers every mode 1 command with a numeric response, as well as the oxygen sensor commands. The values
+ * of all of these commands are linear functions of one or two big-endian integers in the response payload.
+ *
+ * \returns 1 if the command can be batch decoded, 0 otherwise
+ */
+int OBDIIBatchSupportsCommand(OBDIICommand *command);
+
+/** Decode many raw response payloads to the same command into contiguous arrays.
+ *
+ * This is meant for offline processing of recorded responses. Rather than filling in one `OBDIIResponse` per payload,
+ * it evaluates a table of (byte offset, byte count, scale, offset) kernels with SIMD instructions where available
+ * (AVX2, SSE2 or NEON), using single-precision math. Results match `OBDIIDecodeResponseForCommand` to within float rounding.
+ *
+ * Payload `i` starts at `payloads + i * stride` and holds a complete response (e.g. `41 0C 1A F8`). A payload is valid if
+ * it starts with the command's mode + 0x40 and PID; the values of invalid payloads are set to NAN.
+ *
+ *     // 1000 recorded RPM responses, 4 bytes each
+ *     float rpms[1000];
+ *     OBDIIDecodeBatch(OBDIICommands.engineRPMs, recorded, 4, 1000, rpms, NULL, NULL);
+ *
+ * \param command The command the payloads respond to
+ * \param payloads The first payload
+ * \param stride The distance between consecutive payloads, in bytes. Must be at least `command->expectedResponseLength`.
+ * \param count The number of payloads
+ * \param values Filled in with `count` values: `numericValue` for numeric commands, or `oxygenSensorValues.voltage` (or `current`) for oxygen sensor commands
+ * \param secondaryValues For oxygen sensor commands, filled in with `count` values of `oxygenSensorValues.shortTermFuelTrim` (or `fuelAirEquivalenceRatio`). May be NULL.
+ * \param valid If not NULL, filled in with `count` flags, each 1 if the corresponding payload is valid and 0 otherwise
+ *
+ * \returns The number of valid payloads, or -1 if the command cannot be batch decoded or `stride` is too small
+ */
+int OBDIIDecodeBatch(OBDIICommand *command, const unsigned char *payloads, int stride, int count, float *values, float *secondaryValues, unsigned char *valid);
+
+/** Same as `OBDIIDecodeBatch`, but never uses SIMD instructions. Mainly useful to verify the vectorized kernels. */
+int OBDIIDecodeBatchScalar(OBDIICommand *command, const unsigned char *payloads, int stride, int count, float *values, float *secondaryValues, unsigned char *valid);
+
+#endif /* OBDIIBatch.h */
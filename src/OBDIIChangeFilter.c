@@ -0,0 +1,184 @@
+#include "OBDIIChangeFilter.h"
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static OBDIIChangeFilterEntry *entryForCommand(OBDIIChangeFilter *filter, OBDIICommand *command)
+{
+	int i;
+	for (i = 0; i < filter->_numEntries; ++i) {
+		if (filter->_entries[i].command == command) {
+			return &filter->_entries[i];
+		}
+	}
+
+	if (filter->_numEntries == OBDII_CHANGE_FILTER_MAX_COMMANDS) {
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	OBDIIChangeFilterEntry *entry = &filter->_entries[filter->_numEntries++];
+	memset(entry, 0, sizeof(*entry));
+	entry->command = command;
+	entry->rule = filter->defaultRule;
+
+	return entry;
+}
+
+// Whether a sample differs meaningfully from the last published one
+static int hasChanged(const OBDIIChangeFilterEntry *entry, const OBDIIChangeFilterSample *sample)
+{
+	const OBDIIChangeFilterRule *rule = &entry->rule;
+
+	if (!entry->published) {
+		return 1;
+	}
+
+	if (rule->maxSilence > 0 && sample->timestamp - entry->last.timestamp >= rule->maxSilence) {
+		return 1;
+	}
+
+	if (sample->command->responseType == OBDIIResponseTypeBitfield) {
+		return ((sample->bitfieldValue ^ entry->last.bitfieldValue) & rule->bitfieldMask) != 0;
+	}
+
+	double last = entry->last.numericValue;
+	double delta = fabs(sample->numericValue - last);
+	double threshold = rule->absoluteDeadband;
+
+	if (rule->relativeDeadband * fabs(last) > threshold) {
+		threshold = rule->relativeDeadband * fabs(last);
+	}
+
+	// A value that turns into or out of NAN is a change
+	return delta > threshold || (isnan(sample->numericValue) != isnan(last));
+}
+
+int OBDIIChangeFilterEntryUpdate(OBDIIChangeFilterEntry *entry, const OBDIIChangeFilterSample *sample)
+{
+	if (!hasChanged(entry, sample)) {
+		return 0;
+	}
+
+	entry->last = *sample;
+	entry->published = 1;
+
+	return 1;
+}
+
+void OBDIIChangeFilterInit(OBDIIChangeFilter *filter, const OBDIIChangeFilterRule *defaultRule)
+{
+	static const OBDIIChangeFilterRule defaultDefaultRule = OBDII_CHANGE_FILTER_DEFAULT_RULE;
+
+	memset(filter, 0, sizeof(*filter));
+	filter->defaultRule = defaultRule ? *defaultRule : defaultDefaultRule;
+	filter->eventfd = -1;
+}
+
+int OBDIIChangeFilterSetRule(OBDIIChangeFilter *filter, OBDIICommand *command, const OBDIIChangeFilterRule *rule)
+{
+	OBDIIChangeFilterEntry *entry = entryForCommand(filter, command);
+	if (!entry) {
+		return -1;
+	}
+
+	entry->rule = *rule;
+
+	return 0;
+}
+
+int OBDIIChangeFilterOpenEventFD(OBDIIChangeFilter *filter)
+{
+	if (filter->eventfd < 0) {
+		filter->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	}
+
+	return filter->eventfd;
+}
+
+int OBDIIChangeFilterSubmit(OBDIIChangeFilter *filter, const OBDIIResponse *response, double timestamp)
+{
+	OBDIICommand *command = response->command;
+
+	if (!response->success || !command || (command->responseType != OBDIIResponseTypeNumeric && command->responseType != OBDIIResponseTypeBitfield)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	OBDIIChangeFilterEntry *entry = entryForCommand(filter, command);
+	if (!entry) {
+		return -1;
+	}
+
+	OBDIIChangeFilterSample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.command = command;
+	sample.timestamp = timestamp;
+	if (command->responseType == OBDIIResponseTypeBitfield) {
+		sample.bitfieldValue = response->bitfieldValue;
+	} else {
+		sample.numericValue = response->numericValue;
+	}
+
+	filter->numSubmitted++;
+
+	if (!OBDIIChangeFilterEntryUpdate(entry, &sample)) {
+		return 0;
+	}
+
+	filter->numPublished++;
+
+	// Only the first value published since the consumer last took changes needs to wake it up
+	if (!entry->pending) {
+		entry->pending = 1;
+
+		if (filter->eventfd >= 0) {
+			eventfd_write(filter->eventfd, 1);
+		}
+	}
+
+	return 1;
+}
+
+int OBDIIChangeFilterTakeChanges(OBDIIChangeFilter *filter, OBDIIChangeFilterSample *samples, int maxSamples)
+{
+	int i, numSamples = 0, numLeft = 0;
+
+	if (filter->eventfd >= 0) {
+		eventfd_t count;
+		eventfd_read(filter->eventfd, &count);
+	}
+
+	for (i = 0; i < filter->_numEntries; ++i) {
+		OBDIIChangeFilterEntry *entry = &filter->_entries[i];
+
+		if (!entry->pending) {
+			continue;
+		}
+
+		if (numSamples == maxSamples) {
+			numLeft++;
+			continue;
+		}
+
+		samples[numSamples++] = entry->last;
+		entry->pending = 0;
+	}
+
+	// Keep the eventfd readable while values are left
+	if (numLeft > 0 && filter->eventfd >= 0) {
+		eventfd_write(filter->eventfd, 1);
+	}
+
+	return numSamples;
+}
+
+void OBDIIChangeFilterFree(OBDIIChangeFilter *filter)
+{
+	if (filter->eventfd >= 0) {
+		close(filter->eventfd);
+		filter->eventfd = -1;
+	}
+}
@@ -0,0 +1,144 @@
+#ifndef __OBDII_CHANGE_FILTER_H
+#define __OBDII_CHANGE_FILTER_H
+
+#include "OBDII.h"
+
+/** Maximum number of distinct commands a change filter tracks */
+#define OBDII_CHANGE_FILTER_MAX_COMMANDS 64
+
+/** When a new value of a command is worth publishing */
+typedef struct OBDIIChangeFilterRule {
+	/** Numeric values are published when they differ from the last published value by more than this */
+	double absoluteDeadband;
+	/** ...and by more than this fraction of the last published value, e.g. 0.01 for 1% */
+	double relativeDeadband;
+	/** A value is published anyway if nothing was published for this many seconds. 0 to disable. */
+	double maxSilence;
+	/** Bitfield values are published when any of these bits change */
+	uint32_t bitfieldMask;
+} OBDIIChangeFilterRule;
+
+/** The default rule: publish every change of a numeric value or of any bit, but never the same value twice */
+#define OBDII_CHANGE_FILTER_DEFAULT_RULE { 0, 0, 0, 0xFFFFFFFF }
+
+/** A published value */
+typedef struct OBDIIChangeFilterSample {
+	OBDIICommand *command;
+	/** `numericValue` of the response, for numeric commands */
+	float numericValue;
+	/** `bitfieldValue` of the response, for bitfield commands */
+	uint32_t bitfieldValue;
+	/** The time the response was received, in seconds */
+	double timestamp;
+} OBDIIChangeFilterSample;
+
+typedef struct OBDIIChangeFilterEntry {
+	OBDIICommand *command;
+	OBDIIChangeFilterRule rule;
+	/** 1 once a value was published */
+	int published;
+	/** 1 if the last published value was not yet taken with `OBDIIChangeFilterTakeChanges` */
+	int pending;
+	/** The last published value */
+	OBDIIChangeFilterSample last;
+} OBDIIChangeFilterEntry;
+
+/** Drops the responses whose values didn't change meaningfully since the last published value of the same command.
+ *
+ * Most commands (e.g. coolant temperature, fuel level or barometric pressure) barely change between two queries, so
+ * forwarding every response wastes IPC, storage and bandwidth. A filter compares each numeric response with the last
+ * published value of its command, against an absolute and a relative deadband, and each bitfield response against a
+ * mask of relevant bits (e.g. the MIL bit of `monitorStatus`). A maximum silence interval still publishes a value
+ * periodically, so that consumers can tell a steady value from a lost one.
+ *
+ * A filter can also wake a consumer through an eventfd, which becomes readable only when a value is published:
+ *
+ *     OBDIIChangeFilterRule rule = OBDII_CHANGE_FILTER_DEFAULT_RULE;
+ *     rule.maxSilence = 10;
+ *     OBDIIChangeFilter filter;
+ *     OBDIIChangeFilterInit(&filter, &rule);
+ *
+ *     OBDIIChangeFilterRule coolant = { 1, 0, 60, 0 };
+ *     OBDIIChangeFilterSetRule(&filter, OBDIICommands.engineCoolantTemperature, &coolant);
+ *
+ *     int efd = OBDIIChangeFilterOpenEventFD(&filter);
+ *
+ *     // Producer
+ *     OBDIIChangeFilterSubmit(&filter, &response, OBDIIResponseTimestamp(&response));
+ *
+ *     // Consumer, once `efd` is readable
+ *     OBDIIChangeFilterSample samples[16];
+ *     int n = OBDIIChangeFilterTakeChanges(&filter, samples, 16);
+ *
+ * A filter is not thread-safe: the producer and the consumer must be the same thread (e.g. an event loop), or serialize
+ * their calls.
+ */
+typedef struct OBDIIChangeFilter {
+	OBDIIChangeFilterRule defaultRule;
+	/** The eventfd signaled when a value is published, or -1 */
+	int eventfd;
+	/** The number of values submitted, and the number of those that were published */
+	unsigned long numSubmitted;
+	unsigned long numPublished;
+	OBDIIChangeFilterEntry _entries[OBDII_CHANGE_FILTER_MAX_COMMANDS];
+	int _numEntries;
+} OBDIIChangeFilter;
+
+/** Initialize a filter.
+ *
+ * \param filter The filter
+ * \param defaultRule The rule for commands without a rule of their own, or NULL for `OBDII_CHANGE_FILTER_DEFAULT_RULE`
+ */
+void OBDIIChangeFilterInit(OBDIIChangeFilter *filter, const OBDIIChangeFilterRule *defaultRule);
+
+/** Set the rule for a command.
+ *
+ * \returns 0 on success, or -1 with errno set to ENOSPC if the filter already tracks `OBDII_CHANGE_FILTER_MAX_COMMANDS` commands
+ */
+int OBDIIChangeFilterSetRule(OBDIIChangeFilter *filter, OBDIICommand *command, const OBDIIChangeFilterRule *rule);
+
+/** Create the filter's eventfd, if it doesn't exist yet.
+ *
+ * The eventfd is nonblocking. It becomes readable when a value is published, and is reset by `OBDIIChangeFilterTakeChanges`.
+ *
+ * \returns The eventfd, or -1 on error
+ */
+int OBDIIChangeFilterOpenEventFD(OBDIIChangeFilter *filter);
+
+/** Decide whether a response should be published.
+ *
+ * \param filter The filter
+ * \param response A successful response to a numeric or bitfield command
+ * \param timestamp The time the response was received, in seconds, e.g. `OBDIIResponseTimestamp(response)`
+ *
+ * \returns 1 if the value was published, 0 if it was dropped, or -1 with errno set to EINVAL if the response was
+ * unsuccessful or has neither a numeric nor a bitfield value, or to ENOSPC if the filter can't track another command
+ */
+int OBDIIChangeFilterSubmit(OBDIIChangeFilter *filter, const OBDIIResponse *response, double timestamp);
+
+/** Take the values published since the last call, at most one (the latest) per command.
+ *
+ * \param filter The filter
+ * \param samples Filled in with the published values
+ * \param maxSamples The capacity of `samples`; values that don't fit are kept for the next call
+ *
+ * \returns The number of values written to `samples`
+ */
+int OBDIIChangeFilterTakeChanges(OBDIIChangeFilter *filter, OBDIIChangeFilterSample *samples, int maxSamples);
+
+/** Apply a single rule to a sample, without a filter.
+ *
+ * This is for callers that keep the last published value per something other than the command, e.g. per ECU and
+ * command. Set `entry->rule` and zero the rest of the entry before the first call.
+ *
+ * \param entry The rule and the last published value
+ * \param sample A value of a numeric or bitfield command
+ *
+ * \returns 1 if the sample is published (and becomes the entry's last published value), 0 if it is dropped
+ */
+int OBDIIChangeFilterEntryUpdate(OBDIIChangeFilterEntry *entry, const OBDIIChangeFilterSample *sample);
+
+/** Close the filter's eventfd, if any. */
+void OBDIIChangeFilterFree(OBDIIChangeFilter *filter);
+
+#endif /* OBDIIChangeFilter.h */
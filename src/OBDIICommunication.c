@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // For ppoll
+
 #include "OBDIICommunication.h"
 #include "OBDIIDaemon.h"
 #include <stdlib.h>
@@ -10,12 +12,51 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
-#include <sys/file.h>
+#include <fcntl.h>
+#include <time.h>
+#include <linux/can/raw.h>
+#include <pthread.h>
 
 #define MAX_ISOTP_PAYLOAD 4095
 
-// Used for communicating with the daemon
+#define QUERY_TIMEOUT_MS 1000
+
+// How long to keep waiting each time the ECU answers "response pending" (P2* in ISO 14229), and at most in total
+#define RESPONSE_PENDING_TIMEOUT_MS 5000
+#define MAX_RESPONSE_PENDING_MS 30000
+
+// How long to wait for the daemon to answer a query, including the time it spends behind other queries
+#define REMOTE_QUERY_TIMEOUT_MS 5000
+
+// Used for opening and closing sockets through the daemon, by one thread at a time
 static int daemonSocket = -1;
+static pthread_mutex_t daemonLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Sockets that queries to the daemon wait for their answers on, one per query in progress, so that threads waiting
+// for the daemon don't wait for each other. Finished queries leave theirs here for reuse, guarded by daemonLock.
+#define MAX_IDLE_QUERY_SOCKETS 8
+static int idleQuerySockets[MAX_IDLE_QUERY_SOCKETS];
+static int numIdleQuerySockets = 0;
+
+// A query submitted to a socket's queue by one thread, and performed by whichever thread is combining
+typedef struct OBDIIQueuedQuery {
+	OBDIICommand *command;
+	OBDIIResponse response;
+	int done;
+	struct OBDIIQueuedQuery *next;
+} OBDIIQueuedQuery;
+
+struct OBDIISocketQueue {
+	pthread_mutex_t mutex;
+	pthread_cond_t done; // Signaled when the socket stops being busy
+	OBDIIQueuedQuery *head;
+	OBDIIQueuedQuery *tail;
+	// Set while a thread works through the queue, or while a request sent with OBDIISendRequest awaits its response
+	int busy;
+};
+
+static void freeQueue(OBDIISocket *socket);
+static int sendRequestOnAcquiredSocket(OBDIISocket *socket, OBDIICommand *command);
 
 static inline void pack(unsigned char **buffer, void *data, int len) {
 	if (!buffer) {
@@ -26,6 +67,13 @@ static inline void pack(unsigned char **buffer, void *data, int len) {
 	*buffer += len;
 }
 
+static void daemonAddress(struct sockaddr_un *daemonAddr)
+{
+	memset(daemonAddr, 0, sizeof(struct sockaddr_un));
+	daemonAddr->sun_family = AF_UNIX;
+	strncpy(daemonAddr->sun_path, OBDII_DAEMON_SOCKET_PATH, sizeof(daemonAddr->sun_path) - 1);
+}
+
 static int setupDaemonCommunication() {
 	if (daemonSocket != -1) {
 		return 0;
@@ -48,9 +96,7 @@ static int setupDaemonCommunication() {
 		goto err;
 	}
 
-	memset(&daemonAddr, 0, sizeof(struct sockaddr_un));
-	daemonAddr.sun_family = AF_UNIX;
-	strncpy(daemonAddr.sun_path, OBDII_DAEMON_SOCKET_PATH, sizeof(daemonAddr.sun_path) - 1);
+	daemonAddress(&daemonAddr);
 
 	// Even though this is a connection-less socket, by using connect we can use send and recv calls instead of sendto/recvfrom
 	if (connect(daemonSocket, (struct sockaddr *)&daemonAddr, sizeof(struct sockaddr_un)) < 0) {
@@ -64,6 +110,57 @@ err:
 	return -1;
 }
 
+// Returns a socket to send a query to the daemon on and wait for its answer, reusing an idle one if there is any
+static int takeQuerySocket(void)
+{
+	int s = -1;
+
+	pthread_mutex_lock(&daemonLock);
+	if (numIdleQuerySockets > 0) {
+		s = idleQuerySockets[--numIdleQuerySockets];
+	}
+	pthread_mutex_unlock(&daemonLock);
+
+	if (s >= 0) {
+		return s;
+	}
+
+	if ((s = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+
+	// Binding to nothing but the address family picks a unique abstract address, which leaves no file behind
+	struct sockaddr_un daemonAddr, selfAddr;
+	memset(&selfAddr, 0, sizeof(selfAddr));
+	selfAddr.sun_family = AF_UNIX;
+	daemonAddress(&daemonAddr);
+
+	if (bind(s, (struct sockaddr *)&selfAddr, sizeof(sa_family_t)) < 0 || connect(s, (struct sockaddr *)&daemonAddr, sizeof(daemonAddr)) < 0) {
+		int error = errno;
+		close(s);
+		errno = error;
+		return -1;
+	}
+
+	return s;
+}
+
+// Keeps the socket of a finished query for the next one. A query that gave up waiting closes its socket instead,
+// as the daemon may still answer it.
+static void returnQuerySocket(int s, int reusable)
+{
+	pthread_mutex_lock(&daemonLock);
+	if (reusable && numIdleQuerySockets < MAX_IDLE_QUERY_SOCKETS) {
+		idleQuerySockets[numIdleQuerySockets++] = s;
+		s = -1;
+	}
+	pthread_mutex_unlock(&daemonLock);
+
+	if (s >= 0) {
+		close(s);
+	}
+}
+
 int receiveFD(int s, int *fd)
 {
 	if (!s) {
@@ -89,7 +186,7 @@ int receiveFD(int s, int *fd)
 	return 0;
 }
 
-int requestRemoteSocket(OBDIISocket *obdiiSocket, int shouldOpen) {
+static int exchangeSocketRequest(OBDIISocket *obdiiSocket, int shouldOpen) {
 	if (setupDaemonCommunication() < 0) {
 		return -1;
 	}
@@ -133,34 +230,86 @@ int requestRemoteSocket(OBDIISocket *obdiiSocket, int shouldOpen) {
 	return 0;
 }
 
-int OBDIIOpenSocket(OBDIISocket *obdiiSocket, const char *ifname, canid_t tx_id, canid_t rx_id, int shared)
+int requestRemoteSocket(OBDIISocket *obdiiSocket, int shouldOpen) {
+	pthread_mutex_lock(&daemonLock);
+	int retval = exchangeSocketRequest(obdiiSocket, shouldOpen);
+	pthread_mutex_unlock(&daemonLock);
+
+	return retval;
+}
+
+static int openISOTPSocket(unsigned int ifindex, canid_t tx_id, canid_t rx_id)
 {
-	unsigned int ifindex = if_nametoindex(ifname);
+	int s;
+	struct sockaddr_can addr;
+	addr.can_addr.tp.tx_id = tx_id;
+	addr.can_addr.tp.rx_id = rx_id;
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+
+	if ((s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+		return -1;
+	}
 
-	if (ifindex == 0) {
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(s);
 		return -1;
 	}
 
+	OBDIIEnableReceiveTimestamps(s);
+
+	return s;
+}
+
+// Fills in the fields every kind of socket starts with, and creates its queue. The queue is created when the socket is
+// opened rather than on the first query, so that queries don't allocate, and freed only when it is closed.
+static int initSocket(OBDIISocket *obdiiSocket, unsigned int ifindex, canid_t tx_id, canid_t rx_id, OBDIITransport transport)
+{
 	obdiiSocket->ifindex = ifindex;
 	obdiiSocket->tid = tx_id;
 	obdiiSocket->rid = rx_id;
+	obdiiSocket->shared = 0;
+	obdiiSocket->transport = transport;
+	obdiiSocket->isotp = -1;
+	obdiiSocket->stack = NULL;
+	obdiiSocket->session = NULL;
+	memset(obdiiSocket->_refusals, 0, sizeof(obdiiSocket->_refusals));
+	memset(&obdiiSocket->requestTimestamp, 0, sizeof(obdiiSocket->requestTimestamp));
+
+	if (!(obdiiSocket->queue = (struct OBDIISocketQueue *)calloc(1, sizeof(struct OBDIISocketQueue)))) {
+		return -1;
+	}
+
+	pthread_mutex_init(&obdiiSocket->queue->mutex, NULL);
+	pthread_cond_init(&obdiiSocket->queue->done, NULL);
+
+	return 0;
+}
+
+int OBDIIOpenSocket(OBDIISocket *obdiiSocket, const char *ifname, canid_t tx_id, canid_t rx_id, int shared)
+{
+	unsigned int ifindex = if_nametoindex(ifname);
+
+	if (ifindex == 0) {
+		return -1;
+	}
+
+	if (initSocket(obdiiSocket, ifindex, tx_id, rx_id, OBDIITransportISOTP) < 0) {
+		return -1;
+	}
 	obdiiSocket->shared = shared;
 
 	if (shared) {
-		return requestRemoteSocket(obdiiSocket, 1);
-	} else {
-		struct sockaddr_can addr;
-		addr.can_addr.tp.tx_id = tx_id;
-		addr.can_addr.tp.rx_id = rx_id;
-		addr.can_family = AF_CAN;
-		addr.can_ifindex = ifindex;
-
-		if ((obdiiSocket->s = socket(PF_CAN, SOCK_DGRAM, CAN_ISOTP)) < 0) {
+		if (requestRemoteSocket(obdiiSocket, 1) < 0) {
+			freeQueue(obdiiSocket);
 			return -1;
 		}
 
-		if (bind(obdiiSocket->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-			close(obdiiSocket->s);
+		// The daemon opened the socket, so it doesn't have timestamps yet
+		OBDIIEnableReceiveTimestamps(obdiiSocket->s);
+	} else {
+		if ((obdiiSocket->s = openISOTPSocket(ifindex, tx_id, rx_id)) < 0) {
+			freeQueue(obdiiSocket);
 			return -1;
 		}
 
@@ -170,123 +319,197 @@ int OBDIIOpenSocket(OBDIISocket *obdiiSocket, const char *ifname, canid_t tx_id,
 	return 0;
 }
 
-int OBDIICloseSocket(OBDIISocket *s)
+int OBDIIOpenRawSocket(OBDIISocket *obdiiSocket, const char *ifname, canid_t tx_id, canid_t rx_id)
 {
-	if (!s) {
-		return 0;
+	unsigned int ifindex = if_nametoindex(ifname);
+
+	if (ifindex == 0) {
+		return -1;
 	}
 
-	if (s->shared) {
-		return requestRemoteSocket(s, 0);
+	if (initSocket(obdiiSocket, ifindex, tx_id, rx_id, OBDIITransportRaw) < 0) {
+		return -1;
+	}
+
+	if ((obdiiSocket->s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		freeQueue(obdiiSocket);
+		return -1;
+	}
+
+	// Only wake up for frames sent by the ECU
+	struct can_filter filter;
+	filter.can_id = rx_id;
+	if (rx_id & CAN_EFF_FLAG) {
+		filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK;
 	} else {
-		return close(s->s);
+		filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
 	}
-}
 
-// Counts # bits set in the argument
-// Code from Kernighan
-static inline unsigned int _BitsSet(unsigned int word)
-{
-	unsigned int c; // c accumulates the total bits set in v
-	for (c = 0; word; c++)
-	{
-	  word &= word - 1; // clear the least significant bit set
+	if (setsockopt(obdiiSocket->s, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) < 0) {
+		close(obdiiSocket->s);
+		freeQueue(obdiiSocket);
+		return -1;
+	}
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+
+	if (bind(obdiiSocket->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(obdiiSocket->s);
+		freeQueue(obdiiSocket);
+		return -1;
 	}
-	return c;
+
+	OBDIIEnableReceiveTimestamps(obdiiSocket->s);
+
+	return 0;
 }
 
-OBDIICommandSet OBDIIGetSupportedCommands(OBDIISocket *socket)
+int OBDIIOpenSocketOnStack(OBDIISocket *obdiiSocket, OBDIIISOTPStack *stack, canid_t tx_id, canid_t rx_id)
 {
-	OBDIICommandSet supportedCommands = { 0 };
-	unsigned int numCommands;
-
-	// Mode 1
-	OBDIIResponse response = OBDIIPerformQuery(socket, OBDIICommands.mode1SupportedPIDs_1_to_20);
+	if (!stack) {
+		errno = EINVAL;
+		return -1;
+	}
 
-	supportedCommands._mode1SupportedPIDs._1_to_20 = response.bitfieldValue;
+	if (initSocket(obdiiSocket, stack->ifindex, tx_id, rx_id, OBDIITransportUserISOTP) < 0) {
+		return -1;
+	}
 
-	// If PID 0x20 is supported, we can query the next set of PIDs
-	if (!(response.bitfieldValue & 0x01)) {
-		goto mode9;
+	if (!(obdiiSocket->session = OBDIIISOTPStackOpenSession(stack, tx_id, rx_id))) {
+		freeQueue(obdiiSocket);
+		return -1;
 	}
 
-	response = OBDIIPerformQuery(socket, OBDIICommands.mode1SupportedPIDs_21_to_40);
+	obdiiSocket->s = stack->s;
+	obdiiSocket->stack = stack;
 
-	supportedCommands._mode1SupportedPIDs._21_to_40 = response.bitfieldValue;
+	return 0;
+}
 
-	// If PID 0x40 is supported, we can query the next set of PIDs
-	if (!(response.bitfieldValue & 0x01)) {
-		goto mode9;
+int OBDIIOpenSocketOnDescriptor(OBDIISocket *obdiiSocket, int s, OBDIITransport transport, canid_t tx_id, canid_t rx_id)
+{
+	if (s < 0 || transport == OBDIITransportUserISOTP) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	response = OBDIIPerformQuery(socket, OBDIICommands.mode1SupportedPIDs_41_to_60);
+	if (initSocket(obdiiSocket, 0, tx_id, rx_id, transport) < 0) {
+		return -1;
+	}
 
-	// Mask out the rest of the PIDs, because they're not yet implemented
-	response.bitfieldValue &= 0xFFFC0000;
+	obdiiSocket->s = s;
 
-	supportedCommands._mode1SupportedPIDs._41_to_60 = response.bitfieldValue;
+	return 0;
+}
 
-	//// If PID 0x60 is supported, we can query the next set of commands
-	//if (!(response.bitfieldValue & 0x01)) {
-	//	goto mode9;
-	//}
+int OBDIICloseSocket(OBDIISocket *s)
+{
+	if (!s) {
+		return 0;
+	}
 
-	//response = OBDIIPerformQuery(socket, OBDIICommands.mode1SupportedPIDs_61_to_80);
+	freeQueue(s);
 
-	//supportedCommands._mode1SupportedPIDs._61_to_80 = response.bitfieldValue;
+	if (s->transport == OBDIITransportUserISOTP) {
+		// The stack's socket stays open for its other sessions
+		OBDIIISOTPStackCloseSession(s->stack, s->session);
+		s->session = NULL;
+		return 0;
+	}
 
-mode9:
-	// Mode 9
-	response = OBDIIPerformQuery(socket, OBDIICommands.mode9SupportedPIDs);
+	if (s->shared) {
+		return requestRemoteSocket(s, 0);
+	} else {
+		if (s->transport == OBDIITransportRaw && s->isotp >= 0) {
+			close(s->isotp);
+		}
 
-	// Mask out the PIDs that are not yet implemented
-	response.bitfieldValue &= 0xE0000000;
+		return close(s->s);
+	}
+}
 
-	supportedCommands._mode9SupportedPIDs = response.bitfieldValue;
+// Defined in OBDII.c
+void OBDIIDecodeBitfield(OBDIIResponse *response, unsigned char *responsePayload, int len);
 
-exit:
-	numCommands = _BitsSet(supportedCommands._mode1SupportedPIDs._1_to_20) + _BitsSet(supportedCommands._mode1SupportedPIDs._21_to_40) + _BitsSet(supportedCommands._mode1SupportedPIDs._41_to_60) + _BitsSet(supportedCommands._mode1SupportedPIDs._61_to_80) + _BitsSet(supportedCommands._mode9SupportedPIDs);
+// Supported PID ranges past the predefined commands, only queried to discover which PIDs a vehicle supports
+#define SUPPORTED_PIDS_COMMAND(name, pid) { name, { 0x01, pid }, OBDIIResponseTypeBitfield, 6, &OBDIIDecodeBitfield }
 
-	numCommands += 2; // mode 1, pid 0 and mode 9, pid 0
+static OBDIICommand extendedSupportedPIDsCommands[] = {
+	SUPPORTED_PIDS_COMMAND("Supported PIDs in the range 61 - 80", 0x60),
+	SUPPORTED_PIDS_COMMAND("Supported PIDs in the range 81 - A0", 0x80),
+	SUPPORTED_PIDS_COMMAND("Supported PIDs in the range A1 - C0", 0xA0),
+	SUPPORTED_PIDS_COMMAND("Supported PIDs in the range C1 - E0", 0xC0),
+	SUPPORTED_PIDS_COMMAND("Supported PIDs in the range E1 - FF", 0xE0)
+};
 
-	numCommands++; // mode 3
+// Queries the "supported PIDs" commands of a mode in turn, for as long as the last PID of each range says the next range is supported
+static void discoverSupportedPIDs(OBDIISocket *socket, OBDIICommandSet *commandSet, OBDIICommand **commands, int numCommands)
+{
+	int i;
+	for (i = 0; i < numCommands; ++i) {
+		OBDIICommand *command = commands[i];
+		OBDIIResponse response = OBDIIPerformQuery(socket, command);
+		if (!response.success) {
+			return;
+		}
 
-	OBDIICommand **commands = malloc(sizeof(OBDIICommand *) * numCommands);
-	if (commands != NULL) {
-		supportedCommands.commands = commands;
-		supportedCommands.numCommands = numCommands;
+		OBDIICommandSetAddSupportedPIDs(commandSet, OBDIICommandGetMode(command), OBDIICommandGetPID(command), response.bitfieldValue);
 
-		// Mode 1
-		unsigned int pid;
-		for (pid = 0; pid < sizeof(OBDIIMode1Commands) / sizeof(OBDIIMode1Commands[0]); ++pid) {
-			OBDIICommand *command = &OBDIIMode1Commands[pid];
-			if (OBDIICommandSetContainsCommand(&supportedCommands, command)) {
-				*commands = command;
-				++commands;
-			}
+		// If the last PID of this range is supported, we can query the next range
+		if (!(response.bitfieldValue & 0x01)) {
+			return;
 		}
+	}
+}
 
-		// Mode 3
-		*commands = OBDIICommands.DTCs;
-		++commands;
+OBDIICommandSet OBDIIGetSupportedCommands(OBDIISocket *socket)
+{
+	OBDIICommandSet supportedCommands = { 0 };
+	int i;
 
-		// Mode 9
-		for (pid = 0; pid < sizeof(OBDIIMode9Commands) / sizeof(OBDIIMode9Commands[0]); ++pid) {
-			OBDIICommand *command = &OBDIIMode9Commands[pid];
-			if (OBDIICommandSetContainsCommand(&supportedCommands, command)) {
-				*commands = command;
-				++commands;
-			}
-		}
+	// Mode 1
+	OBDIICommand *mode1Commands[8] = { OBDIICommands.mode1SupportedPIDs_1_to_20, OBDIICommands.mode1SupportedPIDs_21_to_40, OBDIICommands.mode1SupportedPIDs_41_to_60 };
+	for (i = 0; i < (int)(sizeof(extendedSupportedPIDsCommands) / sizeof(extendedSupportedPIDsCommands[0])); ++i) {
+		mode1Commands[3 + i] = &extendedSupportedPIDsCommands[i];
 	}
 
+	discoverSupportedPIDs(socket, &supportedCommands, mode1Commands, 8);
+
+	// Mode 9
+	OBDIICommand *mode9Commands[1] = { OBDIICommands.mode9SupportedPIDs };
+	discoverSupportedPIDs(socket, &supportedCommands, mode9Commands, 1);
+
+	// The commands used for discovery, and mode 3, are always included
+	OBDIICommandSetAddCommand(&supportedCommands, OBDIICommands.mode1SupportedPIDs_1_to_20);
+	OBDIICommandSetAddCommand(&supportedCommands, OBDIICommands.DTCs);
+	OBDIICommandSetAddCommand(&supportedCommands, OBDIICommands.mode9SupportedPIDs);
+
 	return supportedCommands;
 }
 
-void OBDIICommandSetFree(OBDIICommandSet *commandSet) {
-	if (commandSet && commandSet->commands) {
-		free(commandSet->commands);
+// Locks a shared socket for an exchange with the ECU, waiting for other processes if `wait` is set. The daemon hands
+// every process the same open file description, which flock would take for a single owner, so this takes a POSIX
+// record lock instead, which belongs to the process. The daemon takes it too before querying the same ECU.
+static int lockSharedSocket(int s, int wait)
+{
+	struct flock lock;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+
+	while (fcntl(s, wait ? F_SETLKW : F_SETLK, &lock) < 0) {
+		if (errno != EINTR) {
+			if (errno == EACCES) {
+				errno = EWOULDBLOCK;
+			}
+			return -1;
+		}
 	}
+
+	return 0;
 }
 
 static int inline LockIfNecessary(OBDIISocket *socket) {
@@ -296,7 +519,16 @@ static int inline LockIfNecessary(OBDIISocket *socket) {
 
 	if (socket->shared) {
 		// This socket is shared by multiple processes, so acquire a lock
-		return flock(socket->s, LOCK_EX);
+		return lockSharedSocket(socket->s, 1);
+	}
+
+	return 0;
+}
+
+// Fails with errno set to EWOULDBLOCK instead of waiting for another process
+static inline int TryLockIfNecessary(OBDIISocket *socket) {
+	if (socket->shared) {
+		return lockSharedSocket(socket->s, 0);
 	}
 
 	return 0;
@@ -308,55 +540,1294 @@ static int inline UnlockIfNecessary(OBDIISocket *socket) {
 	}
 
 	if (socket->shared) {
-		return flock(socket->s, LOCK_UN);
+		struct flock lock;
+		memset(&lock, 0, sizeof(lock));
+		lock.l_type = F_UNLCK;
+		lock.l_whence = SEEK_SET;
+
+		return fcntl(socket->s, F_SETLK, &lock);
 	}
 
 	return 0;
 }
 
-OBDIIResponse OBDIIPerformQuery(OBDIISocket *socket, OBDIICommand *command)
+// Takes the socket for a request sent without waiting for its response. Fails with errno set to EWOULDBLOCK instead of
+// waiting for another thread working through the socket's queue or awaiting a response, or for another process.
+static int tryAcquireSocket(OBDIISocket *socket)
 {
-	OBDIIResponse response = { 0 };
-	response.command = command;
+	struct OBDIISocketQueue *queue = socket->queue;
+	if (!queue) {
+		return TryLockIfNecessary(socket);
+	}
 
-	if (!socket) {
-		return response;
+	pthread_mutex_lock(&queue->mutex);
+	int busy = queue->busy;
+	queue->busy = 1;
+	pthread_mutex_unlock(&queue->mutex);
+
+	if (busy) {
+		errno = EWOULDBLOCK;
+		return -1;
 	}
 
-	LockIfNecessary(socket);
+	if (TryLockIfNecessary(socket) < 0) {
+		pthread_mutex_lock(&queue->mutex);
+		queue->busy = 0;
+		pthread_cond_broadcast(&queue->done);
+		pthread_mutex_unlock(&queue->mutex);
+		return -1;
+	}
 
-	// Send the command
-	int retval = write(socket->s, command->payload, sizeof(command->payload));
-	if (retval < 0 || retval != sizeof(command->payload)) {
-		UnlockIfNecessary(socket);
-		return response;
+	return 0;
+}
+
+// Ends the exchange started by tryAcquireSocket, handing the socket to the threads and processes waiting for it
+static int releaseSocket(OBDIISocket *socket)
+{
+	int retval = UnlockIfNecessary(socket);
+
+	struct OBDIISocketQueue *queue = socket->queue;
+	if (queue) {
+		pthread_mutex_lock(&queue->mutex);
+		queue->busy = 0;
+		pthread_cond_broadcast(&queue->done);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+
+	return retval;
+}
+
+// Fills in `deadline` with the monotonic time `ms` milliseconds from now
+static void deadlineAfter(int ms, struct timespec *deadline)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+
+	deadline->tv_sec += ms / 1000;
+	deadline->tv_nsec += (ms % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+// Fills in `timeout` with the time left until `deadline`, returning 0 if the deadline has already passed
+static int remainingTimeout(const struct timespec *deadline, struct timeval *timeout)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	long long remaining = (deadline->tv_sec - now.tv_sec) * 1000000LL + (deadline->tv_nsec - now.tv_nsec) / 1000;
+	if (remaining <= 0) {
+		return 0;
+	}
+
+	timeout->tv_sec = remaining / 1000000;
+	timeout->tv_usec = remaining % 1000000;
+
+	return 1;
+}
+
+// Checks whether a query sent at `requestTimestamp` has been waiting for at least as long as the ECU is given to
+// answer, so that giving up on it now means that the ECU didn't answer, rather than that the caller stopped waiting
+static int waitedOutQuery(const struct timespec *requestTimestamp)
+{
+	struct timespec deadline = *requestTimestamp;
+	deadline.tv_sec += QUERY_TIMEOUT_MS / 1000;
+	deadline.tv_nsec += (QUERY_TIMEOUT_MS % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
 	}
 
-	// Set a one second timeout
 	struct timeval timeout;
-	timeout.tv_sec = 1;
-	timeout.tv_usec = 0;
+	return !remainingTimeout(&deadline, &timeout);
+}
 
-	fd_set readFDs;
-	FD_ZERO(&readFDs);
-	FD_SET(socket->s, &readFDs);
+// Checks whether a response payload answers `command`, as opposed to an earlier query that timed out. A negative
+// response counts as an answer, unless it only says that the actual answer is still coming.
+static int responseMatchesCommand(OBDIICommand *command, unsigned char *payload, int len)
+{
+	unsigned char mode = OBDIICommandGetMode(command);
+	unsigned char negativeResponseCode = OBDIINegativeResponseCode(command, payload, len);
 
-	if (select(socket->s + 1, &readFDs, NULL, NULL, &timeout) <= 0) {
-	    // Either we timed out, or there was an error
-	    UnlockIfNecessary(socket);
-	    return response;
+	if (negativeResponseCode) {
+		return negativeResponseCode != OBDII_NRC_RESPONSE_PENDING;
 	}
 
-	// Receive the response
-	int responseLength = command->expectedResponseLength == VARIABLE_RESPONSE_LENGTH ? MAX_ISOTP_PAYLOAD : command->expectedResponseLength;
-	unsigned char responsePayload[responseLength];
-	retval = read(socket->s, responsePayload, responseLength);
+	if (len < 1 || payload[0] != mode + 0x40) {
+		return 0;
+	}
 
-	if (retval < 0 || (command->expectedResponseLength != VARIABLE_RESPONSE_LENGTH && retval != command->expectedResponseLength)) {
-		UnlockIfNecessary(socket);
-		return response;
+	return OBDIIResponseEchoesPID(command, payload, len);
+}
+
+static inline int isResponsePending(OBDIICommand *command, unsigned char *payload, int len)
+{
+	return OBDIINegativeResponseCode(command, payload, len) == OBDII_NRC_RESPONSE_PENDING;
+}
+
+// Gives the ECU more time after a "response pending" answer, but never past `limit`
+static void extendDeadline(struct timespec *deadline, const struct timespec *limit)
+{
+	deadlineAfter(RESPONSE_PENDING_TIMEOUT_MS, deadline);
+
+	if (deadline->tv_sec > limit->tv_sec || (deadline->tv_sec == limit->tv_sec && deadline->tv_nsec > limit->tv_nsec)) {
+		*deadline = *limit;
 	}
+}
 
-	UnlockIfNecessary(socket);
-	return OBDIIDecodeResponseForCommand(command, responsePayload, retval);
+// Whether a negative response code means the ECU will never answer the command, however often it is asked
+static inline int meansUnsupported(unsigned char negativeResponseCode)
+{
+	return negativeResponseCode == OBDII_NRC_SERVICE_NOT_SUPPORTED
+		|| negativeResponseCode == OBDII_NRC_SUBFUNCTION_NOT_SUPPORTED
+		|| negativeResponseCode == OBDII_NRC_REQUEST_OUT_OF_RANGE;
+}
+
+// Where a command's refusal is kept in the socket's `_refusals`, or -1 for commands whose refusals aren't remembered
+static inline int refusalSlot(OBDIICommand *command)
+{
+	switch (OBDIICommandGetMode(command)) {
+		case 0x01:
+			return OBDIICommandGetPID(command);
+		case 0x09:
+			return 256 + OBDIICommandGetPID(command);
+		case 0x03:
+			return 512;
+	}
+
+	return -1;
+}
+
+// The refusals are shared by the threads using the socket, so they are guarded by the queue's mutex
+static void setRefusal(OBDIISocket *socket, OBDIICommand *command, unsigned char negativeResponseCode)
+{
+	int slot = refusalSlot(command);
+	if (slot < 0) {
+		return;
+	}
+
+	if (socket->queue) {
+		pthread_mutex_lock(&socket->queue->mutex);
+	}
+
+	socket->_refusals[slot] = negativeResponseCode;
+
+	if (socket->queue) {
+		pthread_mutex_unlock(&socket->queue->mutex);
+	}
+}
+
+unsigned char OBDIIUnsupportedCode(OBDIISocket *socket, OBDIICommand *command)
+{
+	int slot;
+	if (!socket || !command || (slot = refusalSlot(command)) < 0) {
+		return 0;
+	}
+
+	if (socket->queue) {
+		pthread_mutex_lock(&socket->queue->mutex);
+	}
+
+	unsigned char negativeResponseCode = socket->_refusals[slot];
+
+	if (socket->queue) {
+		pthread_mutex_unlock(&socket->queue->mutex);
+	}
+
+	return negativeResponseCode;
+}
+
+void OBDIIForgetUnsupported(OBDIISocket *socket, OBDIICommand *command)
+{
+	if (socket && command) {
+		setRefusal(socket, command, 0);
+	}
+}
+
+// Keeps the code the ECU gave, to answer later queries with; a command can be refused for another reason if asked again
+static void rememberIfUnsupported(OBDIISocket *socket, OBDIIResponse *response)
+{
+	if (meansUnsupported(response->negativeResponseCode)) {
+		setRefusal(socket, response->command, response->negativeResponseCode);
+	}
+}
+
+// Fills in the response to a command the ECU already refused as unsupported, instead of asking it again
+static int knownUnsupported(OBDIISocket *socket, OBDIICommand *command, OBDIIResponse *response)
+{
+	unsigned char negativeResponseCode = OBDIIUnsupportedCode(socket, command);
+	if (!negativeResponseCode) {
+		return 0;
+	}
+
+	// Nothing goes out, so the time it was asked for stands in for when the request was sent
+	memset(response, 0, sizeof(*response));
+	response->command = command;
+	response->negativeResponseCode = negativeResponseCode;
+	clock_gettime(CLOCK_MONOTONIC, &response->requestTimestamp);
+
+	return 1;
+}
+
+// Whether both the request and the response for a command fit in a single CAN frame
+static inline int fitsInSingleFrame(OBDIICommand *command)
+{
+	return command->expectedResponseLength != VARIABLE_RESPONSE_LENGTH && command->expectedResponseLength <= OBDII_ISOTP_SINGLE_FRAME_MAX_PAYLOAD;
+}
+
+typedef enum {
+	RawQueryDone,
+	RawQueryNeedsISOTP
+} RawQueryResult;
+
+typedef enum {
+	RawFrameIgnored,
+	RawFrameDecoded,
+	RawFrameSegmented,
+	RawFramePending
+} RawFrameResult;
+
+// Sends a command's request over a raw socket as a single frame: the PCI byte holds the payload length, and the unused bytes are padded
+static int sendSingleFrameRequest(OBDIISocket *socket, OBDIICommand *command)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	memset(frame.data, OBDII_ISOTP_DEFAULT_PADDING, sizeof(frame.data));
+	frame.can_id = socket->tid;
+	frame.can_dlc = CAN_MAX_DLEN;
+	frame.data[0] = OBDII_ISOTP_PCI_SINGLE_FRAME | OBDIICommandGetRequestLength(command);
+	memcpy(&frame.data[1], command->payload, OBDIICommandGetRequestLength(command));
+
+	return write(socket->s, &frame, sizeof(frame)) == sizeof(frame) ? 0 : -1;
+}
+
+// Interprets a frame received on a raw socket while waiting for the response to `command`
+static RawFrameResult handleRawFrame(OBDIICommand *command, struct can_frame *frame, OBDIIResponse *response)
+{
+	if (frame->can_dlc < 2) {
+		return RawFrameIgnored;
+	}
+
+	unsigned char pci = frame->data[0] & OBDII_ISOTP_PCI_TYPE_MASK;
+
+	if (pci == OBDII_ISOTP_PCI_FIRST_FRAME) {
+		// The ECU is answering with a segmented response, which needs flow control from an ISO-TP socket
+		if (frame->can_dlc >= 3 && responseMatchesCommand(command, &frame->data[2], frame->can_dlc - 2)) {
+			return RawFrameSegmented;
+		}
+
+		return RawFrameIgnored;
+	}
+
+	int len = frame->data[0] & 0x0F;
+	if (pci != OBDII_ISOTP_PCI_SINGLE_FRAME || len == 0 || len > frame->can_dlc - 1) {
+		return RawFrameIgnored;
+	}
+
+	if (isResponsePending(command, &frame->data[1], len)) {
+		return RawFramePending;
+	}
+
+	// Skip over late responses to queries that have already timed out
+	if (!responseMatchesCommand(command, &frame->data[1], len)) {
+		return RawFrameIgnored;
+	}
+
+	*response = OBDIIDecodeResponseForCommand(command, &frame->data[1], len);
+	return RawFrameDecoded;
+}
+
+static RawQueryResult performRawQuery(OBDIISocket *socket, OBDIICommand *command, OBDIIResponse *response)
+{
+	if (sendSingleFrameRequest(socket, command) < 0) {
+		return RawQueryDone;
+	}
+
+	struct timespec deadline, limit;
+	deadlineAfter(QUERY_TIMEOUT_MS, &deadline);
+	deadlineAfter(MAX_RESPONSE_PENDING_MS, &limit);
+
+	while (1) {
+		struct timeval timeout;
+		if (!remainingTimeout(&deadline, &timeout)) {
+			response->timedOut = 1;
+			return RawQueryDone;
+		}
+
+		fd_set readFDs;
+		FD_ZERO(&readFDs);
+		FD_SET(socket->s, &readFDs);
+
+		int ready = select(socket->s + 1, &readFDs, NULL, NULL, &timeout);
+		if (ready <= 0) {
+			// Either we timed out, or there was an error
+			response->timedOut = ready == 0;
+			return RawQueryDone;
+		}
+
+		struct can_frame frame;
+		struct timespec timestamp;
+		if (OBDIIReceiveTimestamped(socket->s, &frame, sizeof(frame), 0, &timestamp) != sizeof(frame)) {
+			return RawQueryDone;
+		}
+
+		switch (handleRawFrame(command, &frame, response)) {
+			case RawFrameDecoded:
+				response->timestamp = timestamp;
+				return RawQueryDone;
+			case RawFrameSegmented:
+				return RawQueryNeedsISOTP;
+			case RawFramePending:
+				extendDeadline(&deadline, &limit);
+				break;
+			case RawFrameIgnored:
+				break;
+		}
+	}
+}
+
+static OBDIIResponse performUserISOTPQuery(OBDIISocket *socket, OBDIICommand *command)
+{
+	OBDIIResponse response = { 0 };
+	response.command = command;
+
+	if (OBDIIISOTPSend(socket->stack, socket->session, command->payload, OBDIICommandGetRequestLength(command)) < 0) {
+		return response;
+	}
+
+	struct timespec deadline, limit;
+	deadlineAfter(QUERY_TIMEOUT_MS, &deadline);
+	deadlineAfter(MAX_RESPONSE_PENDING_MS, &limit);
+
+	while (1) {
+		struct timeval timeout;
+		if (!remainingTimeout(&deadline, &timeout)) {
+			response.timedOut = 1;
+			return response;
+		}
+
+		unsigned char *payload;
+		int len = OBDIIISOTPReceive(socket->stack, socket->session, &payload, timeout.tv_sec * 1000 + timeout.tv_usec / 1000 + 1);
+		if (len <= 0) {
+			response.timedOut = len == 0;
+			return response;
+		}
+
+		// Decode straight out of the stack's buffer, then hand the buffer back
+		if (responseMatchesCommand(command, payload, len)) {
+			response = OBDIIDecodeResponseForCommand(command, payload, len);
+			response.timestamp = socket->session->lastFrameTime;
+			OBDIIISOTPSessionRelease(socket->session);
+			return response;
+		}
+
+		if (isResponsePending(command, payload, len)) {
+			extendDeadline(&deadline, &limit);
+		}
+
+		// Either that, or a late response to a query that has already timed out
+		OBDIIISOTPSessionRelease(socket->session);
+	}
+}
+
+// Returns the ISO-TP socket for `socket`, opening one on first use if it uses the raw transport
+static int ISOTPSocketForQuery(OBDIISocket *socket)
+{
+	if (socket->transport != OBDIITransportRaw) {
+		return socket->s;
+	}
+
+	// Both the queue's thread and OBDIIPerformQueryWithDeadline may get here first
+	if (socket->queue) {
+		pthread_mutex_lock(&socket->queue->mutex);
+	}
+
+	if (socket->isotp < 0) {
+		socket->isotp = openISOTPSocket(socket->ifindex, socket->tid, socket->rid);
+	}
+
+	int s = socket->isotp;
+
+	if (socket->queue) {
+		pthread_mutex_unlock(&socket->queue->mutex);
+	}
+
+	return s;
+}
+
+static OBDIIResponse exchangeQuery(OBDIISocket *socket, OBDIICommand *command)
+{
+	OBDIIResponse response = { 0 };
+	response.command = command;
+
+	if (socket->transport == OBDIITransportUserISOTP) {
+		return performUserISOTPQuery(socket, command);
+	}
+
+	if (socket->transport == OBDIITransportRaw && fitsInSingleFrame(command)) {
+		if (performRawQuery(socket, command, &response) == RawQueryDone) {
+			return response;
+		}
+	}
+
+	int s = ISOTPSocketForQuery(socket);
+	if (s < 0) {
+		return response;
+	}
+
+	// Send the command
+	int retval = write(s, command->payload, OBDIICommandGetRequestLength(command));
+	if (retval < 0 || retval != OBDIICommandGetRequestLength(command)) {
+		return response;
+	}
+
+	struct timespec deadline, limit;
+	deadlineAfter(QUERY_TIMEOUT_MS, &deadline);
+	deadlineAfter(MAX_RESPONSE_PENDING_MS, &limit);
+
+	while (1) {
+		struct timeval timeout;
+		if (!remainingTimeout(&deadline, &timeout)) {
+			response.timedOut = 1;
+			return response;
+		}
+
+		fd_set readFDs;
+		FD_ZERO(&readFDs);
+		FD_SET(s, &readFDs);
+
+		int ready = select(s + 1, &readFDs, NULL, NULL, &timeout);
+		if (ready <= 0) {
+			// Either we timed out, or there was an error
+			response.timedOut = ready == 0;
+			return response;
+		}
+
+		// Receive the response
+		unsigned char responsePayload[MAX_ISOTP_PAYLOAD];
+		struct timespec timestamp;
+		retval = OBDIIReceiveTimestamped(s, responsePayload, sizeof(responsePayload), 0, &timestamp);
+		if (retval < 0) {
+			return response;
+		}
+
+		if (isResponsePending(command, responsePayload, retval)) {
+			extendDeadline(&deadline, &limit);
+			continue;
+		}
+
+		// A response of the wrong length is still the answer to this request, but not a successful one
+		if (responseMatchesCommand(command, responsePayload, retval)) {
+			response = OBDIIDecodeResponseForCommand(command, responsePayload, retval);
+			response.timestamp = timestamp;
+			return response;
+		}
+	}
+}
+
+// Performs a query for the thread working through the socket's queue
+static OBDIIResponse performQuery(OBDIISocket *socket, OBDIICommand *command)
+{
+	OBDIIResponse response;
+
+	if (knownUnsupported(socket, command, &response)) {
+		return response;
+	}
+
+	struct timespec requestTimestamp;
+	clock_gettime(CLOCK_MONOTONIC, &requestTimestamp);
+
+	LockIfNecessary(socket);
+	response = exchangeQuery(socket, command);
+	UnlockIfNecessary(socket);
+
+	response.requestTimestamp = requestTimestamp;
+	rememberIfUnsupported(socket, &response);
+
+	return response;
+}
+
+static void freeQueue(OBDIISocket *socket)
+{
+	if (socket->queue) {
+		pthread_mutex_destroy(&socket->queue->mutex);
+		pthread_cond_destroy(&socket->queue->done);
+		free(socket->queue);
+		socket->queue = NULL;
+	}
+}
+
+OBDIIResponse OBDIIPerformQuery(OBDIISocket *socket, OBDIICommand *command)
+{
+	OBDIIResponse response = { 0 };
+	response.command = command;
+
+	if (!socket) {
+		return response;
+	}
+
+	// Sockets that weren't opened by the library have no queue, and no other threads to wait for
+	struct OBDIISocketQueue *queue = socket->queue;
+	if (!queue) {
+		return performQuery(socket, command);
+	}
+
+	OBDIIQueuedQuery query;
+	memset(&query, 0, sizeof(query));
+	query.command = command;
+
+	pthread_mutex_lock(&queue->mutex);
+
+	if (queue->tail) {
+		queue->tail->next = &query;
+	} else {
+		queue->head = &query;
+	}
+	queue->tail = &query;
+
+	// Flat combining: the first thread to find the socket idle performs every query queued so far, back to back,
+	// while the threads that submitted them wait for their responses
+	while (!query.done) {
+		if (queue->busy) {
+			pthread_cond_wait(&queue->done, &queue->mutex);
+			continue;
+		}
+
+		OBDIIQueuedQuery *batch = queue->head;
+		queue->head = queue->tail = NULL;
+		queue->busy = 1;
+		pthread_mutex_unlock(&queue->mutex);
+
+		OBDIIQueuedQuery *queued;
+		for (queued = batch; queued != NULL; queued = queued->next) {
+			queued->response = performQuery(socket, queued->command);
+		}
+
+		pthread_mutex_lock(&queue->mutex);
+		for (queued = batch; queued != NULL; queued = queued->next) {
+			queued->done = 1;
+		}
+
+		// Hand over to a thread whose query was queued in the meantime
+		queue->busy = 0;
+		pthread_cond_broadcast(&queue->done);
+	}
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	return query.response;
+}
+
+// The daemon only knows the built-in commands, which it looks up by mode and PID
+static int daemonKnowsCommand(OBDIICommand *command)
+{
+	return command == OBDIICommandWithModeAndPID(OBDIICommandGetMode(command), OBDIICommandGetPID(command));
+}
+
+// Sends a query to the daemon on `s` and waits for its answer, returning 0 once the daemon has answered, even if the
+// ECU didn't, and -1 if it gave up waiting
+static int exchangeRemoteQuery(int s, OBDIISocket *socket, OBDIICommand *command, OBDIIQueryPriority priority, OBDIIResponse *response)
+{
+	// The daemon queues the query with the others for the same ECU
+	uint16_t apiVersion = OBDII_API_VERSION;
+	uint16_t requestType = OBDIIDaemonRequestQuery;
+	unsigned char priorityClass = priority;
+
+	unsigned char request[OBDII_DAEMON_REQUEST_HEADER_SIZE + OBDII_DAEMON_QUERY_PARAMS_SIZE];
+	unsigned char *p = request;
+
+	pack(&p, &apiVersion, sizeof(apiVersion));
+	pack(&p, &requestType, sizeof(requestType));
+	pack(&p, &socket->ifindex, sizeof(socket->ifindex));
+	pack(&p, &socket->tid, sizeof(socket->tid));
+	pack(&p, &socket->rid, sizeof(socket->rid));
+	pack(&p, &command->payload[0], 1);
+	pack(&p, &command->payload[1], 1);
+	pack(&p, &priorityClass, sizeof(priorityClass));
+
+	if (send(s, request, sizeof(request), 0) != sizeof(request)) {
+		return -1;
+	}
+
+	struct timespec deadline, limit;
+	deadlineAfter(REMOTE_QUERY_TIMEOUT_MS, &deadline);
+	deadlineAfter(REMOTE_QUERY_TIMEOUT_MS + MAX_RESPONSE_PENDING_MS, &limit);
+
+	while (1) {
+		struct timeval timeout;
+		if (!remainingTimeout(&deadline, &timeout)) {
+			return -1;
+		}
+
+		fd_set readFDs;
+		FD_ZERO(&readFDs);
+		FD_SET(s, &readFDs);
+
+		if (select(s + 1, &readFDs, NULL, NULL, &timeout) <= 0) {
+			return -1;
+		}
+
+		// The daemon's socket has no receive timestamps, so this is when the daemon's answer was read
+		unsigned char result[OBDII_DAEMON_QUERY_RESULT_MAX_SIZE];
+		struct timespec timestamp;
+		ssize_t len = OBDIIReceiveTimestamped(s, result, sizeof(result), 0, &timestamp);
+		if (len < 0) {
+			return -1;
+		}
+
+		// Skip over anything that isn't the answer to this query
+		uint16_t responseCode = 0;
+		if (len >= 4) {
+			memcpy(&responseCode, result, sizeof(responseCode));
+		}
+
+		if ((responseCode != OBDIIDaemonResponseCodeQueryResult && responseCode != OBDIIDaemonResponseCodeQueryTimeout)
+			|| result[2] != command->payload[0] || result[3] != command->payload[1]) {
+			continue;
+		}
+
+		if (responseCode == OBDIIDaemonResponseCodeQueryTimeout) {
+			response->timedOut = 1;
+			return 0;
+		}
+
+		unsigned char *payload = &result[4];
+		int payloadLength = len - 4;
+
+		// The daemon passes "response pending" answers on, so that we keep waiting for the actual response
+		if (isResponsePending(command, payload, payloadLength)) {
+			extendDeadline(&deadline, &limit);
+			continue;
+		}
+
+		// No payload means that the daemon couldn't send the query
+		if (responseMatchesCommand(command, payload, payloadLength)) {
+			*response = OBDIIDecodeResponseForCommand(command, payload, payloadLength);
+			response->timestamp = timestamp;
+		}
+
+		return 0;
+	}
+}
+
+// Performs a query through the daemon. Each query waits on a socket of its own, so concurrent queries from other
+// threads go to the daemon, and are arbitrated by it, without waiting for this one.
+static OBDIIResponse performRemoteQuery(OBDIISocket *socket, OBDIICommand *command, OBDIIQueryPriority priority)
+{
+	OBDIIResponse response = { 0 };
+	response.command = command;
+
+	if (!command) {
+		return response;
+	}
+
+	if (!daemonKnowsCommand(command)) {
+		errno = EINVAL;
+		return response;
+	}
+
+	int s = takeQuerySocket();
+	if (s < 0) {
+		return response;
+	}
+
+	int answered = exchangeRemoteQuery(s, socket, command, priority, &response) == 0;
+	returnQuerySocket(s, answered);
+
+	return response;
+}
+
+OBDIIResponse OBDIIPerformQueryWithPriority(OBDIISocket *socket, OBDIICommand *command, OBDIIQueryPriority priority)
+{
+	if (!socket || !socket->shared) {
+		return OBDIIPerformQuery(socket, command);
+	}
+
+	OBDIIResponse response;
+	if (knownUnsupported(socket, command, &response)) {
+		return response;
+	}
+
+	struct timespec requestTimestamp;
+	clock_gettime(CLOCK_MONOTONIC, &requestTimestamp);
+
+	response = performRemoteQuery(socket, command, priority);
+
+	response.requestTimestamp = requestTimestamp;
+	rememberIfUnsupported(socket, &response);
+
+	return response;
+}
+
+// Discards whatever is waiting on the socket, e.g. late responses to queries that timed out
+static void drainSocket(int s)
+{
+	unsigned char buffer[MAX_ISOTP_PAYLOAD];
+	while (recv(s, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0);
+}
+
+int OBDIISendRequest(OBDIISocket *socket, OBDIICommand *command)
+{
+	if (!socket || !command) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (socket->transport == OBDIITransportRaw && !fitsInSingleFrame(command)) {
+		// Segmented responses need the blocking ISO-TP fallback of OBDIIPerformQuery
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	// Don't wait for another thread or process that is querying through the same socket
+	if (tryAcquireSocket(socket) < 0) {
+		return -1;
+	}
+
+	return sendRequestOnAcquiredSocket(socket, command);
+}
+
+// Sends a request once the socket is taken, handing it back if the request couldn't be sent
+static int sendRequestOnAcquiredSocket(OBDIISocket *socket, OBDIICommand *command)
+{
+	int retval;
+	if (socket->transport == OBDIITransportUserISOTP) {
+		clock_gettime(CLOCK_MONOTONIC, &socket->requestTimestamp);
+		retval = OBDIIISOTPSend(socket->stack, socket->session, command->payload, OBDIICommandGetRequestLength(command));
+	} else {
+		drainSocket(socket->s);
+		clock_gettime(CLOCK_MONOTONIC, &socket->requestTimestamp);
+
+		if (socket->transport == OBDIITransportRaw) {
+			retval = sendSingleFrameRequest(socket, command);
+		} else {
+			retval = write(socket->s, command->payload, OBDIICommandGetRequestLength(command)) == OBDIICommandGetRequestLength(command) ? 0 : -1;
+		}
+	}
+
+	if (retval < 0) {
+		releaseSocket(socket);
+	}
+
+	return retval;
+}
+
+// Reads the kernel ISO-TP socket `s` until the response to `command` turns up
+static int receiveISOTPResponse(int s, OBDIICommand *command, OBDIIResponse *response, unsigned char *payload, int payloadSize)
+{
+	struct timespec timestamp;
+
+	while (1) {
+		ssize_t len = OBDIIReceiveTimestamped(s, payload, payloadSize, MSG_DONTWAIT, &timestamp);
+
+		if (len < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+
+		// Keep waiting past "response pending" answers
+		if (!responseMatchesCommand(command, payload, len)) {
+			continue;
+		}
+
+		*response = OBDIIDecodeResponseForCommand(command, payload, len);
+		response->timestamp = timestamp;
+
+		return 1;
+	}
+}
+
+static int tryReceiveISOTPResponse(OBDIISocket *socket, OBDIICommand *command, OBDIIResponse *response)
+{
+	unsigned char payload[MAX_ISOTP_PAYLOAD];
+
+	return receiveISOTPResponse(socket->s, command, response, payload, sizeof(payload));
+}
+
+static int tryReceiveRawResponse(OBDIISocket *socket, OBDIICommand *command, OBDIIResponse *response)
+{
+	struct can_frame frame;
+	struct timespec timestamp;
+
+	while (1) {
+		ssize_t len = OBDIIReceiveTimestamped(socket->s, &frame, sizeof(frame), MSG_DONTWAIT, &timestamp);
+
+		if (len < 0) {
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+
+		if (len != sizeof(frame)) {
+			continue;
+		}
+
+		switch (handleRawFrame(command, &frame, response)) {
+			case RawFrameDecoded:
+				response->timestamp = timestamp;
+				return 1;
+			case RawFrameSegmented:
+				errno = EMSGSIZE;
+				return -1;
+			case RawFramePending:
+			case RawFrameIgnored:
+				break;
+		}
+	}
+}
+
+static int tryReceiveUserISOTPResponse(OBDIISocket *socket, OBDIICommand *command, OBDIIResponse *response)
+{
+	OBDIIISOTPSession *session = socket->session;
+
+	while (1) {
+		if (session->state != OBDIIISOTPSessionComplete) {
+			if (OBDIIISOTPStackProcessPendingFrames(socket->stack) < 0) {
+				return -1;
+			}
+
+			if (session->state != OBDIIISOTPSessionComplete) {
+				return 0;
+			}
+		}
+
+		int matches = responseMatchesCommand(command, session->message, session->messageLength);
+		if (matches) {
+			*response = OBDIIDecodeResponseForCommand(command, session->message, session->messageLength);
+			response->timestamp = session->lastFrameTime;
+		}
+
+		OBDIIISOTPSessionRelease(session);
+
+		if (matches) {
+			return 1;
+		}
+	}
+}
+
+int OBDIITryReceiveResponse(OBDIISocket *socket, OBDIICommand *command, OBDIIResponse *response)
+{
+	if (!socket || !command || !response) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(response, 0, sizeof(*response));
+	response->command = command;
+
+	int retval;
+	switch (socket->transport) {
+		case OBDIITransportUserISOTP:
+			retval = tryReceiveUserISOTPResponse(socket, command, response);
+			break;
+		case OBDIITransportRaw:
+			retval = tryReceiveRawResponse(socket, command, response);
+			break;
+		default:
+			retval = tryReceiveISOTPResponse(socket, command, response);
+			break;
+	}
+
+	// The exchange is over, so other threads and processes may use the socket again
+	if (retval != 0) {
+		releaseSocket(socket);
+	}
+
+	if (retval == 1) {
+		response->requestTimestamp = socket->requestTimestamp;
+		rememberIfUnsupported(socket, response);
+	}
+
+	return retval;
+}
+
+int OBDIICancelRequest(OBDIISocket *socket)
+{
+	if (!socket) {
+		return 0;
+	}
+
+	if (socket->transport == OBDIITransportUserISOTP) {
+		OBDIIISOTPSessionRelease(socket->session);
+	}
+
+	return releaseSocket(socket);
+}
+
+// How long to wait before trying again to lock a shared socket that another process is querying through. The wait
+// doubles with each failed attempt, up to the maximum, so that a long exchange isn't polled for every millisecond.
+#define LOCK_RETRY_INTERVAL_NS 1000000
+#define MAX_LOCK_RETRY_INTERVAL_NS 50000000
+
+// Waits until `fd` is readable (or `maxWaitNs` passed, if not 0), unless the deadline passes or the query is cancelled first
+static OBDIIQueryStatus waitForQuery(int fd, int cancelFD, const struct timespec *deadline, long maxWaitNs)
+{
+	while (1) {
+		struct timeval remaining;
+		if (!remainingTimeout(deadline, &remaining)) {
+			return OBDIIQueryStatusTimedOut;
+		}
+
+		struct timespec timeout;
+		timeout.tv_sec = remaining.tv_sec;
+		timeout.tv_nsec = remaining.tv_usec * 1000;
+		if (maxWaitNs > 0 && (timeout.tv_sec > 0 || timeout.tv_nsec > maxWaitNs)) {
+			timeout.tv_sec = 0;
+			timeout.tv_nsec = maxWaitNs;
+		}
+
+		// ppoll ignores negative file descriptors
+		struct pollfd fds[2];
+		fds[0].fd = fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = cancelFD;
+		fds[1].events = POLLIN;
+
+		int retval = ppoll(fds, 2, &timeout, NULL);
+		if (retval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return OBDIIQueryStatusError;
+		}
+
+		if (retval > 0 && fds[1].revents) {
+			return OBDIIQueryStatusCancelled;
+		}
+
+		if ((retval > 0 && fds[0].revents) || maxWaitNs > 0) {
+			return OBDIIQueryStatusAnswered;
+		}
+	}
+}
+
+// Takes the socket like OBDIISendRequest. Neither the queue nor the lock can time out, so this retries until the
+// deadline instead of blocking.
+static OBDIIQueryStatus acquireSocketBefore(OBDIISocket *socket, const struct timespec *deadline, int cancelFD)
+{
+	OBDIIQueryStatus status;
+	long retryInterval = LOCK_RETRY_INTERVAL_NS;
+
+	while (tryAcquireSocket(socket) < 0) {
+		if (errno != EWOULDBLOCK && errno != EAGAIN) {
+			return OBDIIQueryStatusError;
+		}
+
+		if ((status = waitForQuery(-1, cancelFD, deadline, retryInterval)) != OBDIIQueryStatusAnswered) {
+			return status;
+		}
+
+		retryInterval = 2 * retryInterval < MAX_LOCK_RETRY_INTERVAL_NS ? 2 * retryInterval : MAX_LOCK_RETRY_INTERVAL_NS;
+	}
+
+	return OBDIIQueryStatusAnswered;
+}
+
+static OBDIIQueryStatus performQueryWithDeadline(OBDIISocket *socket, OBDIICommand *command, const struct timespec *deadline, int cancelFD, OBDIIResponse *response)
+{
+	OBDIIQueryStatus status;
+
+	// Left to the ISO-TP fallback of OBDIIPerformQueryWithDeadline, as in OBDIISendRequest
+	if (socket->transport == OBDIITransportRaw && !fitsInSingleFrame(command)) {
+		errno = EMSGSIZE;
+		return OBDIIQueryStatusError;
+	}
+
+	if ((status = acquireSocketBefore(socket, deadline, cancelFD)) != OBDIIQueryStatusAnswered) {
+		return status;
+	}
+
+	if (sendRequestOnAcquiredSocket(socket, command) < 0) {
+		return OBDIIQueryStatusError;
+	}
+
+	int fd = socket->transport == OBDIITransportUserISOTP ? socket->stack->s : socket->s;
+
+	while (1) {
+		if ((status = waitForQuery(fd, cancelFD, deadline, 0)) != OBDIIQueryStatusAnswered) {
+			response->requestTimestamp = socket->requestTimestamp;
+			response->timedOut = status != OBDIIQueryStatusError && waitedOutQuery(&socket->requestTimestamp);
+			OBDIICancelRequest(socket);
+			return status;
+		}
+
+		// Releases the lock once the response is in
+		int retval = OBDIITryReceiveResponse(socket, command, response);
+		if (retval != 0) {
+			return retval == 1 ? OBDIIQueryStatusAnswered : OBDIIQueryStatusError;
+		}
+	}
+}
+
+// Performs a query of a raw socket through its ISO-TP socket, holding the raw socket for the whole exchange
+static OBDIIQueryStatus performISOTPQueryWithDeadline(OBDIISocket *socket, OBDIICommand *command, const struct timespec *deadline, int cancelFD, OBDIIResponse *response)
+{
+	int s = ISOTPSocketForQuery(socket);
+	if (s < 0) {
+		return OBDIIQueryStatusError;
+	}
+
+	OBDIIQueryStatus status;
+	if ((status = acquireSocketBefore(socket, deadline, cancelFD)) != OBDIIQueryStatusAnswered) {
+		return status;
+	}
+
+	drainSocket(s);
+	clock_gettime(CLOCK_MONOTONIC, &socket->requestTimestamp);
+
+	if (write(s, command->payload, OBDIICommandGetRequestLength(command)) != OBDIICommandGetRequestLength(command)) {
+		releaseSocket(socket);
+		return OBDIIQueryStatusError;
+	}
+
+	unsigned char payload[MAX_ISOTP_PAYLOAD];
+	int retval = 0;
+
+	while (retval == 0) {
+		if ((status = waitForQuery(s, cancelFD, deadline, 0)) != OBDIIQueryStatusAnswered) {
+			response->requestTimestamp = socket->requestTimestamp;
+			response->timedOut = status != OBDIIQueryStatusError && waitedOutQuery(&socket->requestTimestamp);
+			releaseSocket(socket);
+			return status;
+		}
+
+		retval = receiveISOTPResponse(s, command, response, payload, sizeof(payload));
+	}
+
+	releaseSocket(socket);
+
+	if (retval < 0) {
+		return OBDIIQueryStatusError;
+	}
+
+	response->requestTimestamp = socket->requestTimestamp;
+	rememberIfUnsupported(socket, response);
+
+	return OBDIIQueryStatusAnswered;
+}
+
+OBDIIQueryStatus OBDIIPerformQueryWithDeadline(OBDIISocket *socket, OBDIICommand *command, const struct timespec *deadline, int cancelFD, OBDIIResponse *response)
+{
+	if (!response) {
+		errno = EINVAL;
+		return OBDIIQueryStatusError;
+	}
+
+	memset(response, 0, sizeof(*response));
+	response->command = command;
+
+	if (!socket || !command || !deadline) {
+		errno = EINVAL;
+		return OBDIIQueryStatusError;
+	}
+
+	if (knownUnsupported(socket, command, response)) {
+		return OBDIIQueryStatusAnswered;
+	}
+
+	OBDIIQueryStatus status = performQueryWithDeadline(socket, command, deadline, cancelFD, response);
+
+	// Segmented responses on a raw socket need flow control from its ISO-TP socket
+	if (status == OBDIIQueryStatusError && errno == EMSGSIZE && socket->transport == OBDIITransportRaw) {
+		memset(response, 0, sizeof(*response));
+		response->command = command;
+		status = performISOTPQueryWithDeadline(socket, command, deadline, cancelFD, response);
+	}
+
+	return status;
+}
+
+typedef enum {
+	CycleQueryQueued,
+	CycleQueryInFlight,
+	CycleQueryDone
+} CycleQueryState;
+
+void OBDIICycleInit(OBDIICycle *cycle)
+{
+	memset(cycle, 0, sizeof(*cycle));
+}
+
+int OBDIICycleAdd(OBDIICycle *cycle, OBDIISocket *socket, OBDIICommand *command)
+{
+	if (!cycle || !socket || !command) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cycle->numQueries == OBDII_CYCLE_MAX_QUERIES) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	cycle->sockets[cycle->numQueries] = socket;
+	cycle->commands[cycle->numQueries] = command;
+	cycle->responses[cycle->numQueries].command = command;
+
+	return cycle->numQueries++;
+}
+
+void OBDIICycleFree(OBDIICycle *cycle)
+{
+	int i;
+	for (i = 0; i < cycle->numQueries; ++i) {
+		OBDIIResponseFree(&cycle->responses[i]);
+		memset(&cycle->responses[i], 0, sizeof(cycle->responses[i]));
+		cycle->responses[i].command = cycle->commands[i];
+	}
+}
+
+// Sends a query of a cycle, without draining the socket first
+static int sendCycleRequest(OBDIISocket *socket, OBDIICommand *command)
+{
+	if (socket->transport == OBDIITransportUserISOTP) {
+		return OBDIISendRequest(socket, command);
+	}
+
+	if (socket->transport == OBDIITransportRaw && !fitsInSingleFrame(command)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	// Skip the query rather than wait for another thread or process that is querying through the same socket
+	if (tryAcquireSocket(socket) < 0) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &socket->requestTimestamp);
+
+	int retval;
+	if (socket->transport == OBDIITransportRaw) {
+		retval = sendSingleFrameRequest(socket, command);
+	} else {
+		retval = write(socket->s, command->payload, OBDIICommandGetRequestLength(command)) == OBDIICommandGetRequestLength(command) ? 0 : -1;
+	}
+
+	if (retval < 0) {
+		releaseSocket(socket);
+	}
+
+	return retval;
+}
+
+// Reads the response to a query in flight, returning 1 once the query is over
+static int receiveCycleResponse(OBDIICycle *cycle, int i)
+{
+	OBDIISocket *socket = cycle->sockets[i];
+	int retval;
+
+	switch (socket->transport) {
+		case OBDIITransportUserISOTP:
+			retval = OBDIITryReceiveResponse(socket, cycle->commands[i], &cycle->responses[i]);
+			break;
+		case OBDIITransportRaw:
+			retval = tryReceiveRawResponse(socket, cycle->commands[i], &cycle->responses[i]);
+			if (retval != 0) {
+				releaseSocket(socket);
+			}
+			break;
+		default:
+			retval = receiveISOTPResponse(socket->s, cycle->commands[i], &cycle->responses[i], cycle->_buffer, sizeof(cycle->_buffer));
+			if (retval != 0) {
+				releaseSocket(socket);
+			}
+			break;
+	}
+
+	if (retval == 1) {
+		cycle->responses[i].requestTimestamp = socket->requestTimestamp;
+		rememberIfUnsupported(socket, &cycle->responses[i]);
+	}
+
+	return retval != 0;
+}
+
+// Sends the first queued query of every socket that has no query in flight
+static void sendCycleRequests(OBDIICycle *cycle)
+{
+	int i, j;
+
+	for (i = 0; i < cycle->numQueries; ++i) {
+		if (cycle->_state[i] != CycleQueryQueued) {
+			continue;
+		}
+
+		int busy = 0;
+		for (j = 0; j < i && !busy; ++j) {
+			busy = cycle->sockets[j] == cycle->sockets[i] && cycle->_state[j] != CycleQueryDone;
+		}
+
+		if (!busy && knownUnsupported(cycle->sockets[i], cycle->commands[i], &cycle->responses[i])) {
+			cycle->_state[i] = CycleQueryDone;
+		} else if (!busy) {
+			cycle->_state[i] = sendCycleRequest(cycle->sockets[i], cycle->commands[i]) < 0 ? CycleQueryDone : CycleQueryInFlight;
+		}
+	}
+}
+
+int OBDIICyclePerform(OBDIICycle *cycle, int timeoutMs)
+{
+	int i, numSuccessful = 0, retval = 0;
+
+	if (!cycle) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	OBDIICycleFree(cycle);
+	memset(cycle->_state, CycleQueryQueued, sizeof(cycle->_state));
+
+	struct timespec deadline;
+	deadlineAfter(timeoutMs, &deadline);
+
+	sendCycleRequests(cycle);
+
+	while (1) {
+		int numInFlight = 0;
+		for (i = 0; i < cycle->numQueries; ++i) {
+			// ppoll ignores negative file descriptors
+			cycle->_fds[i].fd = cycle->_state[i] == CycleQueryInFlight ? cycle->sockets[i]->s : -1;
+			cycle->_fds[i].events = POLLIN;
+			cycle->_fds[i].revents = 0;
+			numInFlight += cycle->_state[i] == CycleQueryInFlight;
+		}
+
+		struct timeval remaining;
+		if (numInFlight == 0 || !remainingTimeout(&deadline, &remaining)) {
+			break;
+		}
+
+		struct timespec timeout;
+		timeout.tv_sec = remaining.tv_sec;
+		timeout.tv_nsec = remaining.tv_usec * 1000;
+
+		int numReady = ppoll(cycle->_fds, cycle->numQueries, &timeout, NULL);
+		if (numReady < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			retval = -1;
+			break;
+		}
+
+		for (i = 0; i < cycle->numQueries; ++i) {
+			if (cycle->_fds[i].revents && receiveCycleResponse(cycle, i)) {
+				cycle->_state[i] = CycleQueryDone;
+			}
+		}
+
+		// The next queries of the sockets that answered
+		sendCycleRequests(cycle);
+	}
+
+	// Give up on the queries that didn't get an answer in time. Only those sent long enough ago are ECU timeouts: a short
+	// cycle may just not have waited for the others.
+	for (i = 0; i < cycle->numQueries; ++i) {
+		if (cycle->_state[i] == CycleQueryInFlight) {
+			cycle->responses[i].requestTimestamp = cycle->sockets[i]->requestTimestamp;
+			cycle->responses[i].timedOut = retval == 0 && waitedOutQuery(&cycle->sockets[i]->requestTimestamp);
+			OBDIICancelRequest(cycle->sockets[i]);
+		}
+		numSuccessful += cycle->responses[i].success;
+	}
+
+	return retval < 0 ? -1 : numSuccessful;
 }
@@ -2,7 +2,23 @@
 #define __OBDII_COMMUNICATION_H
 
 #include "OBDII.h"
+#include "OBDIIISOTP.h"
 #include <linux/can.h>
+#include <poll.h>
+#include <time.h>
+
+/** The transport used by an `OBDIISocket` to exchange payloads with an ECU */
+typedef enum OBDIITransport {
+	/** The kernel ISO-TP module (CAN_ISOTP) segments and reassembles every payload */
+	OBDIITransportISOTP,
+	/** Single-frame exchanges go over a CAN_RAW socket, with the ISO-TP header built in user space */
+	OBDIITransportRaw,
+	/** Every exchange goes through a session of a user-space `OBDIIISOTPStack` */
+	OBDIITransportUserISOTP
+} OBDIITransport;
+
+/** Number of commands whose refusals a socket remembers: the PIDs of modes 1 and 9, and reading DTCs */
+#define OBDII_NUM_REFUSABLE_COMMANDS (256 + 256 + 1)
 
 /** Opaque structure representing an OBDII socket */
 typedef struct {
@@ -11,6 +27,13 @@ typedef struct {
 	unsigned int ifindex;
 	canid_t tid;
 	canid_t rid;
+	short transport;
+	int isotp; // Kernel ISO-TP socket used by OBDIITransportRaw for multi-frame responses, or -1 if not yet opened
+	OBDIIISOTPStack *stack; // Used by OBDIITransportUserISOTP
+	OBDIIISOTPSession *session;
+	struct OBDIISocketQueue *queue; // Queries of the threads sharing the socket, from opening the socket until it is closed
+	unsigned char _refusals[OBDII_NUM_REFUSABLE_COMMANDS]; // The code each command was refused with as unsupported, or 0
+	struct timespec requestTimestamp; // When the request awaiting `OBDIITryReceiveResponse` was sent
 } OBDIISocket;
 
 /** Open a communication channel to a particular ECU.
@@ -39,6 +62,87 @@ typedef struct {
  */
 int OBDIIOpenSocket(OBDIISocket *s, const char *ifname, canid_t tx_id, canid_t rx_id, int shared);
 
+/** Open a communication channel to a particular ECU using a raw CAN socket.
+ *
+ * Almost every request and mode 1 response fits in a single CAN frame, so the returned socket sends and receives
+ * those directly over CAN_RAW, building the ISO-TP header byte itself. A kernel filter restricts the socket to frames
+ * carrying `rx_id`. This does not require the ISO-TP kernel module, and it avoids the module's overhead on every query.
+ *
+ * Commands whose responses span several frames (`OBDIICommands.DTCs`, `OBDIICommands.VIN`, or any response that
+ * unexpectedly arrives as an ISO-TP first frame) fall back to a kernel ISO-TP socket, which is opened on first use.
+ * On kernels without the module, those queries fail while single-frame queries keep working.
+ *
+ *     OBDIISocket s;
+ *     if (OBDIIOpenRawSocket(&s, "can0", 0x7E0, 0x7E8) < 0) {
+ *         printf("Error opening socket: %s\n", strerror(errno));
+ *     }
+ *
+ * \param s The `OBDIISocket` struct that will be filled in by the call
+ * \param ifname The name of the CAN interface that the socket will be bound to
+ * \param tx_id The ID used to address frames to the ECU
+ * \param rx_id The ID the ECU will use for response frames
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIOpenRawSocket(OBDIISocket *s, const char *ifname, canid_t tx_id, canid_t rx_id);
+
+/** Open a communication channel to a particular ECU through a user-space ISO-TP stack.
+ *
+ * The socket gets its own session on `stack`, whose single CAN_RAW socket can serve every ECU on the interface. Segmented
+ * responses are reassembled in the stack's pooled buffers and decoded in place, and flow control follows the stack's
+ * BS/STmin options. Closing the socket closes the session, but not the stack. The stack isn't thread-safe, so neither
+ * are sockets sharing it: query them from one thread, or guard the stack with a lock of your own.
+ *
+ *     OBDIIISOTPStack stack;
+ *     OBDIISocket engine, transmission;
+ *     OBDIIISOTPStackOpen(&stack, "can0", NULL);
+ *     OBDIIOpenSocketOnStack(&engine, &stack, 0x7E0, 0x7E8);
+ *     OBDIIOpenSocketOnStack(&transmission, &stack, 0x7E1, 0x7E9);
+ *
+ * \param s The `OBDIISocket` struct that will be filled in by the call
+ * \param stack An open user-space ISO-TP stack, which must outlive the socket
+ * \param tx_id The ID used to address frames to the ECU
+ * \param rx_id The ID the ECU will use for response frames
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIOpenSocketOnStack(OBDIISocket *s, OBDIIISOTPStack *stack, canid_t tx_id, canid_t rx_id);
+
+/** Use a socket opened by the caller, such as a CAN socket with options of its own, or one end of a socket pair that
+ * stands in for the vehicle in tests.
+ *
+ * `s` must be a kernel ISO-TP socket for `OBDIITransportISOTP`, or a CAN_RAW socket that only receives the ECU's frames
+ * for `OBDIITransportRaw`. The socket takes ownership of `s`, which `OBDIICloseSocket` closes.
+ *
+ * \param s The `OBDIISocket` struct that will be filled in by the call
+ * \param fd The open socket
+ * \param transport How to talk to the ECU over `fd`; `OBDIITransportUserISOTP` needs `OBDIIOpenSocketOnStack`
+ * \param tx_id The ID used to address frames to the ECU
+ * \param rx_id The ID the ECU will use for response frames
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIOpenSocketOnDescriptor(OBDIISocket *s, int fd, OBDIITransport transport, canid_t tx_id, canid_t rx_id);
+
+/** The code the ECU refused a command with as unsupported, if it did.
+ *
+ * Refusals of the PIDs of modes 1 and 9, and of reading DTCs, are remembered, each in a slot of its own.
+ *
+ * \param s The socket used to communicate with the vehicle
+ * \param command The command
+ *
+ * \returns `OBDII_NRC_SERVICE_NOT_SUPPORTED`, `OBDII_NRC_SUBFUNCTION_NOT_SUPPORTED` or `OBDII_NRC_REQUEST_OUT_OF_RANGE`,
+ * or 0 if the ECU hasn't refused the command as unsupported
+ */
+unsigned char OBDIIUnsupportedCode(OBDIISocket *s, OBDIICommand *command);
+
+/** Forget that the ECU refused a command as unsupported, so that the next query for it goes to the ECU again.
+ *
+ * \param s The socket used to communicate with the vehicle
+ * \param command The command
+ */
+void OBDIIForgetUnsupported(OBDIISocket *s, OBDIICommand *command);
+
 /** Close an open socket created with `OBDIIOpenSocket`
  *
  * \param s The socket structure filled in by a call to `OBDIIOpenSocket`
@@ -60,6 +164,16 @@ int OBDIICloseSocket(OBDIISocket *s);
  *     }
  *     OBDIIResponseFree(&response);
  *
+ * If the ECU refuses the request, `negativeResponseCode` holds the reason it gave. An ECU that needs more time answers
+ * with `OBDII_NRC_RESPONSE_PENDING` first; each such answer extends the wait by five seconds, up to thirty seconds in
+ * total. Commands refused as unsupported (`OBDII_NRC_SERVICE_NOT_SUPPORTED`, `OBDII_NRC_SUBFUNCTION_NOT_SUPPORTED` or
+ * `OBDII_NRC_REQUEST_OUT_OF_RANGE`) are remembered by the socket (see `OBDIIUnsupportedCode`), and later queries for
+ * them fail right away with the code the ECU gave instead of going to the ECU. Such answers have no `timestamp`. Call
+ * `OBDIIForgetUnsupported` to ask again.
+ *
+ * On a shared socket, the query goes to the ECU directly, under the socket's lock, and isn't arbitrated by the daemon;
+ * use `OBDIIPerformQueryWithPriority` for that.
+ *
  * \param s The socket used to communicate with the vehicle
  * \param command The command to query the vehicle for
  *
@@ -67,6 +181,192 @@ int OBDIICloseSocket(OBDIISocket *s);
  */
 OBDIIResponse OBDIIPerformQuery(OBDIISocket *s, OBDIICommand *command);
 
+/** How a query with a deadline ended */
+typedef enum OBDIIQueryStatus {
+	/** The ECU answered; the response's `success` property is 0 if the answer was malformed */
+	OBDIIQueryStatusAnswered,
+	/** The deadline passed first */
+	OBDIIQueryStatusTimedOut,
+	/** The cancellation file descriptor became readable first */
+	OBDIIQueryStatusCancelled,
+	/** The request couldn't be sent or the response couldn't be received; errno is set */
+	OBDIIQueryStatusError
+} OBDIIQueryStatus;
+
+/** Query the car for a particular command, giving up at a deadline or when cancelled.
+ *
+ * The deadline is absolute, so one deadline can bound a whole sequence of queries. The query is cancelled as soon as
+ * `cancelFD` becomes readable, e.g. an eventfd that a control loop signals when it moves on. The file descriptor isn't
+ * read, so it keeps cancelling later queries until the caller resets it.
+ *
+ * On a shared socket, the lock is only waited for until the deadline or cancellation, and is always released before
+ * returning.
+ *
+ *     struct timespec deadline;
+ *     clock_gettime(CLOCK_MONOTONIC, &deadline);
+ *     deadline.tv_nsec += 50000000; // 50 ms for both queries
+ *     if (deadline.tv_nsec >= 1000000000) {
+ *         deadline.tv_sec++;
+ *         deadline.tv_nsec -= 1000000000;
+ *     }
+ *
+ *     OBDIIResponse rpms, speed;
+ *     if (OBDIIPerformQueryWithDeadline(&s, OBDIICommands.engineRPMs, &deadline, cancelFD, &rpms) == OBDIIQueryStatusAnswered
+ *             && OBDIIPerformQueryWithDeadline(&s, OBDIICommands.vehicleSpeed, &deadline, cancelFD, &speed) == OBDIIQueryStatusAnswered) {
+ *         ...
+ *     }
+ *
+ * \param s The socket used to communicate with the vehicle
+ * \param command The command to query the vehicle for
+ * \param deadline When to give up, on the CLOCK_MONOTONIC clock
+ * \param cancelFD A file descriptor that cancels the query when it becomes readable, or -1
+ * \param response Filled in with the decoded response. Its `success` property is 0 unless the status is `OBDIIQueryStatusAnswered`.
+ *
+ * \returns How the query ended
+ */
+OBDIIQueryStatus OBDIIPerformQueryWithDeadline(OBDIISocket *s, OBDIICommand *command, const struct timespec *deadline, int cancelFD, OBDIIResponse *response);
+
+/** How urgently a query on a shared socket should be answered */
+typedef enum OBDIIQueryPriority {
+	/** Background polling, e.g. loggers and dashboards */
+	OBDIIQueryPriorityBulk,
+	/** Queries a person is waiting for, e.g. reading DTCs or the VIN from a technician tool */
+	OBDIIQueryPriorityInteractive
+} OBDIIQueryPriority;
+
+/** Query the car for a particular command, ahead of lower priority queries of other processes.
+ *
+ * On a shared socket, the query is performed by the daemon, which sends one query at a time to each ECU. Interactive
+ * queries wait for at most the query already in flight, and for the interactive queries ahead of them. To keep bulk
+ * queries from starving, one bulk query goes through after every few interactive queries while bulk queries wait.
+ * Scheduled polling for subscriptions (see `OBDIISubscription.h`) counts as bulk.
+ *
+ * Arbitration is opt-in: the other ways of querying a shared socket (`OBDIIPerformQuery`, `OBDIISendRequest`,
+ * `OBDIIPerformQueryWithDeadline` and cycles) go to the ECU directly, under the socket's lock, which the daemon waits
+ * for but doesn't arbitrate. They therefore also work with daemons that predate query arbitration.
+ *
+ *     OBDIIResponse response = OBDIIPerformQueryWithPriority(&s, OBDIICommands.DTCs, OBDIIQueryPriorityInteractive);
+ *
+ * \param s The socket used to communicate with the vehicle. If it isn't shared, this is the same as `OBDIIPerformQuery`.
+ * \param command The command to query the vehicle for
+ * \param priority The priority class of the query
+ *
+ * \returns An `OBDIIResponse` object containing the decoded diagnostic data
+ */
+OBDIIResponse OBDIIPerformQueryWithPriority(OBDIISocket *s, OBDIICommand *command, OBDIIQueryPriority priority);
+
+/** Send a command's request without waiting for the response.
+ *
+ * Together with `OBDIITryReceiveResponse`, this lets an event loop drive many queries at once: send the request, wait
+ * for `s->s` to become readable (e.g. with poll or epoll), then try to receive the response. Only one request may be
+ * outstanding on a socket at a time. Sockets using the raw transport can only send commands whose responses fit
+ * in a single frame.
+ *
+ *     OBDIISendRequest(&s, OBDIICommands.engineRPMs);
+ *     // ... once s.s is readable:
+ *     OBDIIResponse response;
+ *     if (OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response) == 1) {
+ *         // Use the response
+ *         OBDIIResponseFree(&response);
+ *     }
+ *
+ * \param s The socket used to communicate with the vehicle
+ * \param command The command to query the vehicle for
+ *
+ * \returns 0 on success, -1 on error. If another thread is using the socket (through any of these functions or
+ *          `OBDIIPerformQuery`), or another process the same shared socket, fails with errno set to EWOULDBLOCK.
+ */
+int OBDIISendRequest(OBDIISocket *s, OBDIICommand *command);
+
+/** Receive and decode the response to a request sent with `OBDIISendRequest`, without blocking.
+ *
+ * Frames that don't answer `command` (e.g. late responses to a query that timed out) are discarded.
+ *
+ * \param s The socket the request was sent on
+ * \param command The command that was sent
+ * \param response Filled in with the decoded response when the function returns 1. Its `success` property is 0 if the ECU answered with a malformed response.
+ *
+ * \returns 1 if the response was received, 0 if it has not arrived yet, -1 on error
+ */
+int OBDIITryReceiveResponse(OBDIISocket *s, OBDIICommand *command, OBDIIResponse *response);
+
+/** Give up on a request sent with `OBDIISendRequest`, e.g. after a timeout. This hands the socket back to other threads,
+ * and releases the lock held on a shared socket.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIICancelRequest(OBDIISocket *s);
+
+/** Maximum number of queries in a cycle */
+#define OBDII_CYCLE_MAX_QUERIES 32
+
+/** Longest response payload a cycle can receive */
+#define OBDII_CYCLE_MAX_PAYLOAD 4095
+
+/** One round of queries to several ECUs, e.g. each period of a polling loop.
+ *
+ * Querying N ECUs one after the other with `OBDIIPerformQuery` makes 3N system calls (write, select, read) and keeps
+ * only one ECU busy at a time. A cycle sends every request first, then waits for all of the sockets with a single
+ * `ppoll`, and reads each socket as soon as it is readable. The responses go to a vector that is reused from one
+ * cycle to the next, and payloads are received into a buffer inside the cycle rather than on the stack.
+ *
+ * Unlike `OBDIISendRequest`, a cycle doesn't drain the sockets before sending: late responses to earlier queries are
+ * skipped when they are read instead.
+ *
+ *     OBDIICycle cycle;
+ *     OBDIICycleInit(&cycle);
+ *     OBDIICycleAdd(&cycle, &engine, OBDIICommands.engineRPMs);
+ *     OBDIICycleAdd(&cycle, &engine, OBDIICommands.engineCoolantTemperature);
+ *     OBDIICycleAdd(&cycle, &transmission, OBDIICommands.vehicleSpeed);
+ *
+ *     while (running) {
+ *         OBDIICyclePerform(&cycle, 100);
+ *         if (cycle.responses[0].success) {
+ *             printf("%.0f rpm\n", cycle.responses[0].numericValue);
+ *         }
+ *     }
+ *
+ *     OBDIICycleFree(&cycle);
+ *
+ * Only one query per socket should be in flight at a time, so queries on the same socket are sent one after the other
+ * within the cycle (the first in the order they were added, and each next one once the previous one is answered).
+ * Queries on a socket that another thread or process is using are skipped, like those that can't be sent.
+ */
+typedef struct OBDIICycle {
+	int numQueries;
+	OBDIISocket *sockets[OBDII_CYCLE_MAX_QUERIES];
+	OBDIICommand *commands[OBDII_CYCLE_MAX_QUERIES];
+	/** The response to each query of the last `OBDIICyclePerform`, in the order the queries were added */
+	OBDIIResponse responses[OBDII_CYCLE_MAX_QUERIES];
+	unsigned char _state[OBDII_CYCLE_MAX_QUERIES];
+	struct pollfd _fds[OBDII_CYCLE_MAX_QUERIES];
+	unsigned char _buffer[OBDII_CYCLE_MAX_PAYLOAD];
+} OBDIICycle;
+
+/** Initialize an empty cycle. */
+void OBDIICycleInit(OBDIICycle *cycle);
+
+/** Add a query to a cycle.
+ *
+ * \returns The index of the query's response in `cycle->responses`, or -1 with errno set to EINVAL if an argument is NULL,
+ * or to ENOSPC if the cycle already has `OBDII_CYCLE_MAX_QUERIES` queries
+ */
+int OBDIICycleAdd(OBDIICycle *cycle, OBDIISocket *s, OBDIICommand *command);
+
+/** Perform every query of a cycle.
+ *
+ * The responses of the previous cycle are freed first.
+ *
+ * \param cycle The cycle
+ * \param timeoutMs How long to wait for all of the responses, in milliseconds
+ *
+ * \returns The number of successful responses, or -1 on error
+ */
+int OBDIICyclePerform(OBDIICycle *cycle, int timeoutMs);
+
+/** Free the responses of the last `OBDIICyclePerform`. */
+void OBDIICycleFree(OBDIICycle *cycle);
+
 /** Queries the car for the commands it supports.
  *
  *     OBDIICommandSet commands = OBDIIGetSupportedCommands(&s);
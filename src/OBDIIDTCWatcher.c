@@ -0,0 +1,137 @@
+#include "OBDIIDTCWatcher.h"
+#include <string.h>
+#include <errno.h>
+
+#define MIL_BIT 0x80000000U
+#define NUM_CONFIRMED_SHIFT 24
+#define NUM_CONFIRMED_MASK 0x7F
+
+static int containsCode(char (*codes)[6], int numCodes, const char *code)
+{
+	int i;
+	for (i = 0; i < numCodes; ++i) {
+		if (strcmp(codes[i], code) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void OBDIIDTCWatcherInit(OBDIIDTCWatcher *watcher)
+{
+	memset(watcher, 0, sizeof(*watcher));
+}
+
+int OBDIIDTCWatcherSubmitStatus(OBDIIDTCWatcher *watcher, const OBDIIResponse *response)
+{
+	if (!response->success || response->command != OBDIICommands.monitorStatus) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int milOn = (response->bitfieldValue & MIL_BIT) != 0;
+	int numConfirmed = (response->bitfieldValue >> NUM_CONFIRMED_SHIFT) & NUM_CONFIRMED_MASK;
+
+	watcher->numStatusQueries++;
+
+	if (!watcher->_hasStatus || milOn != watcher->milOn || numConfirmed != watcher->numConfirmed) {
+		watcher->_needsFetch = 1;
+	}
+
+	if (watcher->maxAge > 0 && OBDIIResponseTimestamp(response) - watcher->_fetchedAt >= watcher->maxAge) {
+		watcher->_needsFetch = 1;
+	}
+
+	watcher->milOn = milOn;
+	watcher->numConfirmed = numConfirmed;
+	watcher->_hasStatus = 1;
+
+	return watcher->_needsFetch;
+}
+
+int OBDIIDTCWatcherSubmitDTCs(OBDIIDTCWatcher *watcher, const OBDIIResponse *response)
+{
+	if (response->command != OBDIICommands.DTCs) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	watcher->numDTCQueries++;
+
+	// The codes are fetched again after the next status
+	if (!response->success) {
+		watcher->_needsFetch = 1;
+		errno = EINVAL;
+		return -1;
+	}
+
+	char codes[OBDII_DTC_WATCHER_MAX_CODES][6];
+	int i, numCodes = 0;
+
+	for (i = 0; i < response->DTCs.numTroubleCodes && numCodes < OBDII_DTC_WATCHER_MAX_CODES; ++i) {
+		const char *code = response->DTCs.troubleCodes[i];
+
+		// Some ECUs pad the list with P0000, and some report a code twice
+		if (strcmp(code, "P0000") == 0 || containsCode(codes, numCodes, code)) {
+			continue;
+		}
+
+		memcpy(codes[numCodes++], code, sizeof(codes[0]));
+	}
+
+	char added[OBDII_DTC_WATCHER_MAX_CODES][6], cleared[OBDII_DTC_WATCHER_MAX_CODES][6];
+	int numAdded = 0, numCleared = 0;
+
+	for (i = 0; i < numCodes; ++i) {
+		if (!containsCode(watcher->troubleCodes, watcher->numTroubleCodes, codes[i])) {
+			memcpy(added[numAdded++], codes[i], sizeof(codes[0]));
+		}
+	}
+
+	for (i = 0; i < watcher->numTroubleCodes; ++i) {
+		if (!containsCode(codes, numCodes, watcher->troubleCodes[i])) {
+			memcpy(cleared[numCleared++], watcher->troubleCodes[i], sizeof(codes[0]));
+		}
+	}
+
+	watcher->_needsFetch = 0;
+	watcher->_fetchedAt = OBDIIResponseTimestamp(response);
+
+	if (numAdded == 0 && numCleared == 0) {
+		return 0;
+	}
+
+	memcpy(watcher->added, added, numAdded * sizeof(added[0]));
+	watcher->numAdded = numAdded;
+	memcpy(watcher->cleared, cleared, numCleared * sizeof(cleared[0]));
+	watcher->numCleared = numCleared;
+	memcpy(watcher->troubleCodes, codes, numCodes * sizeof(codes[0]));
+	watcher->numTroubleCodes = numCodes;
+
+	return 1;
+}
+
+int OBDIIDTCWatcherPoll(OBDIIDTCWatcher *watcher, OBDIISocket *s)
+{
+	OBDIIResponse response = OBDIIPerformQuery(s, OBDIICommands.monitorStatus);
+	int needsFetch = OBDIIDTCWatcherSubmitStatus(watcher, &response);
+	OBDIIResponseFree(&response);
+
+	if (needsFetch <= 0) {
+		if (needsFetch < 0) {
+			errno = EIO;
+		}
+		return needsFetch;
+	}
+
+	response = OBDIIPerformQuery(s, OBDIICommands.DTCs);
+	int changed = OBDIIDTCWatcherSubmitDTCs(watcher, &response);
+	OBDIIResponseFree(&response);
+
+	if (changed < 0) {
+		errno = EIO;
+	}
+
+	return changed;
+}
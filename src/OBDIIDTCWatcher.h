@@ -0,0 +1,104 @@
+#ifndef __OBDII_DTC_WATCHER_H
+#define __OBDII_DTC_WATCHER_H
+
+#include "OBDII.h"
+#include "OBDIICommunication.h"
+
+/** Maximum number of trouble codes a watcher tracks; further codes reported by the ECU are ignored */
+#define OBDII_DTC_WATCHER_MAX_CODES 64
+
+/** Tracks the trouble codes of an ECU, fetching them only when its monitor status says they changed.
+ *
+ * Querying `OBDIICommands.DTCs` is expensive: the response usually spans several frames and is decoded into a freshly
+ * allocated list, which nearly always holds the same codes as the last time. The `monitorStatus` PID (01 01) fits in a
+ * single frame and carries the state of the malfunction indicator lamp (MIL) and the number of confirmed codes, so a
+ * watcher polls it instead, and only fetches the list of codes when the MIL or the count changes. It then compares the
+ * list with the previous one and reports the codes that were added and cleared:
+ *
+ *     OBDIIDTCWatcher watcher;
+ *     OBDIIDTCWatcherInit(&watcher);
+ *     watcher.maxAge = 600;
+ *
+ *     // Every 100 ms or so
+ *     if (OBDIIDTCWatcherPoll(&watcher, &s) > 0) {
+ *         for (i = 0; i < watcher.numAdded; ++i) {
+ *             printf("+ %s\n", watcher.added[i]);
+ *         }
+ *         for (i = 0; i < watcher.numCleared; ++i) {
+ *             printf("- %s\n", watcher.cleared[i]);
+ *         }
+ *     }
+ *
+ * Callers that send their own queries (e.g. from an event loop, with `OBDIISendRequest`) submit the responses instead:
+ * `OBDIIDTCWatcherSubmitStatus` tells whether the codes need fetching, and `OBDIIDTCWatcherSubmitDTCs` compares them.
+ *
+ * A code can be cleared and another one set between two polls without changing the count; set `maxAge` to also fetch
+ * the codes periodically. The first status always leads to a fetch, whose codes are all reported as added.
+ */
+typedef struct OBDIIDTCWatcher {
+	/** The codes are fetched anyway if they are older than this many seconds. 0 to disable. */
+	double maxAge;
+
+	/** Whether the MIL was on, and the number of confirmed codes, in the last status */
+	int milOn;
+	int numConfirmed;
+
+	/** The codes in the last fetched list */
+	char troubleCodes[OBDII_DTC_WATCHER_MAX_CODES][6];
+	int numTroubleCodes;
+
+	/** The codes added and cleared by the last fetch that changed the list */
+	char added[OBDII_DTC_WATCHER_MAX_CODES][6];
+	int numAdded;
+	char cleared[OBDII_DTC_WATCHER_MAX_CODES][6];
+	int numCleared;
+
+	/** The number of statuses and lists submitted */
+	unsigned long numStatusQueries;
+	unsigned long numDTCQueries;
+
+	/** 1 once a status was submitted */
+	int _hasStatus;
+	/** 1 while the codes need fetching */
+	int _needsFetch;
+	/** The time the codes were last fetched, in seconds */
+	double _fetchedAt;
+} OBDIIDTCWatcher;
+
+/** Initialize a watcher. */
+void OBDIIDTCWatcherInit(OBDIIDTCWatcher *watcher);
+
+/** Submit a response to `OBDIICommands.monitorStatus`.
+ *
+ * \param watcher The watcher
+ * \param response A successful response to `OBDIICommands.monitorStatus`
+ *
+ * \returns 1 if the codes need fetching (the MIL or the number of codes changed, the codes were never fetched or are
+ * older than `maxAge`, or the last fetch failed), 0 if not, or -1 with errno set to EINVAL if the response was
+ * unsuccessful or not to `OBDIICommands.monitorStatus`
+ */
+int OBDIIDTCWatcherSubmitStatus(OBDIIDTCWatcher *watcher, const OBDIIResponse *response);
+
+/** Submit a response to `OBDIICommands.DTCs`, and compare its codes with the previous ones.
+ *
+ * `added` and `cleared` are only updated if the codes changed. An unsuccessful response leaves the codes as they were,
+ * and the next status asks for another fetch.
+ *
+ * \param watcher The watcher
+ * \param response A response to `OBDIICommands.DTCs`
+ *
+ * \returns 1 if codes were added or cleared, 0 if the codes didn't change, or -1 with errno set to EINVAL if the
+ * response was unsuccessful or not to `OBDIICommands.DTCs`
+ */
+int OBDIIDTCWatcherSubmitDTCs(OBDIIDTCWatcher *watcher, const OBDIIResponse *response);
+
+/** Query the monitor status of an ECU, and its codes if they need fetching.
+ *
+ * \param watcher The watcher
+ * \param s The socket of the ECU
+ *
+ * \returns 1 if codes were added or cleared, 0 if not, or -1 with errno set to EIO if a query failed
+ */
+int OBDIIDTCWatcherPoll(OBDIIDTCWatcher *watcher, OBDIISocket *s);
+
+#endif /* OBDIIDTCWatcher.h */
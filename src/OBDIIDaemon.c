@@ -9,9 +9,42 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <poll.h>
+#include <math.h>
+#include <fcntl.h>
 
 #include "OBDIIDaemon.h"
 #include "OBDIICommunication.h"
+#include "OBDIIPollSchedule.h"
+#include "OBDIIChangeFilter.h"
+
+// How long an ECU has to answer a scheduled query, in seconds
+#define POLL_QUERY_TIMEOUT 0.2
+
+// How long an ECU has to answer a query of a client, in seconds
+#define CLIENT_QUERY_TIMEOUT 1.0
+
+// How much longer an ECU has each time it answers "response pending", and at most in total, in seconds
+#define RESPONSE_PENDING_TIMEOUT 5.0
+#define MAX_RESPONSE_PENDING 30.0
+
+// How often samples that couldn't be delivered are retried, in seconds
+#define DELIVERY_RETRY_INTERVAL 0.02
+
+// Queries of clients waiting for the same ECU; more are turned down
+#define MAX_PENDING_QUERIES 64
+
+// How long to wait before trying again to lock a shared socket that a client is querying through, in seconds. The wait
+// doubles with each failed attempt, up to the maximum, so that a client holding the lock for long isn't polled for it.
+#define LOCK_RETRY_INTERVAL 0.001
+#define MAX_LOCK_RETRY_INTERVAL 0.05
+
+// Interactive queries sent in a row while bulk queries wait
+#define MAX_INTERACTIVE_STREAK 4
+
+#define MAX_ISOTP_PAYLOAD 4095
+
+#define MAX_SUBSCRIPTIONS_PER_SUBSCRIBER 64
 
 static FILE *LogFile = NULL;
 static const char *LogPath = "/var/log/obdiid/obdiid.log";
@@ -140,6 +173,637 @@ void closeSocketConnection(OBDIISocketConnection *conn)
 	}
 }
 
+static double monotonicTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// A query a client asked the daemon to perform
+typedef struct OBDIIPendingQuery {
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	OBDIICommand *command;
+	double sentAt;
+
+	struct OBDIIPendingQuery *next;
+} OBDIIPendingQuery;
+
+typedef struct OBDIIQueryQueue {
+	OBDIIPendingQuery *head;
+	OBDIIPendingQuery *tail;
+} OBDIIQueryQueue;
+
+// An ECU queried on behalf of subscribers and clients, one query at a time. Scheduled queries go through a raw CAN
+// socket of its own, and the queries of clients through the shared ISO-TP socket, which is the only ISO-TP socket bound
+// to the ECU's IDs, so that a single one sends flow control for segmented responses. Both take the shared socket's lock.
+typedef struct OBDIIPollTarget {
+	unsigned int ifindex;
+	canid_t tid;
+	canid_t rid;
+	OBDIISocket socket;
+	OBDIIPollSchedule schedule; // Each command at the highest rate any subscriber asked for
+	OBDIIQueryQueue queries[2]; // Indexed by OBDIIQueryPriority
+	int numQueries;
+	int interactiveStreak;
+
+	OBDIICommand *inFlight;
+	OBDIIPendingQuery *inFlightQuery; // The client the query in flight is for, or NULL for a scheduled query
+	double deadline;
+	OBDIISocketConnection *locked; // The shared socket to the ECU, locked while a query is in flight, or NULL
+	double lockRetryAt; // When to try again to lock the shared socket, after finding a client holding it
+	double lockRetryInterval; // How long the last wait for the lock was, 0 if the last attempt got it
+
+	struct OBDIIPollTarget *prev;
+	struct OBDIIPollTarget *next;
+} OBDIIPollTarget;
+
+static OBDIIPollTarget *pollTargets = NULL;
+
+typedef struct OBDIISubscription {
+	OBDIIPollTarget *target;
+	OBDIICommand *command;
+	double interval;
+	double nextDue;
+	OBDIIChangeFilterEntry filter;
+} OBDIISubscription;
+
+typedef struct OBDIIQueuedSample {
+	OBDIICommand *command;
+	canid_t rid;
+	uint32_t dropped;
+	uint64_t timestamp;
+	uint32_t value;
+} OBDIIQueuedSample;
+
+typedef struct OBDIISubscriberConnection {
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	OBDIISubscription subscriptions[MAX_SUBSCRIPTIONS_PER_SUBSCRIBER];
+	int numSubscriptions;
+
+	// Ring buffer of samples waiting to be delivered; the oldest are dropped when it is full
+	OBDIIQueuedSample *queue;
+	int queueLength;
+	int queueHead;
+	int queueCount;
+
+	struct OBDIISubscriberConnection *prev;
+	struct OBDIISubscriberConnection *next;
+} OBDIISubscriberConnection;
+
+static OBDIISubscriberConnection *subscribers = NULL;
+
+OBDIIPollTarget *pollTargetMatchingParams(unsigned int ifindex, canid_t tid, canid_t rid)
+{
+	OBDIIPollTarget *found;
+	for (found = pollTargets; found != NULL; found = found->next) {
+		if (found->tid == tid && found->rid == rid && found->ifindex == ifindex) {
+			break;
+		}
+	}
+
+	return found;
+}
+
+OBDIIPollTarget *openPollTarget(unsigned int ifindex, canid_t tid, canid_t rid)
+{
+	char ifname[IF_NAMESIZE];
+
+	if (!if_indextoname(ifindex, ifname)) {
+		return NULL;
+	}
+
+	OBDIIPollTarget *target = (OBDIIPollTarget *)calloc(1, sizeof(OBDIIPollTarget));
+	if (!target) {
+		return NULL;
+	}
+
+	Log("Opening raw socket for queries: (%i, %x, %x)", ifindex, tid, rid);
+
+	if (OBDIIOpenRawSocket(&target->socket, ifname, tid, rid) < 0) {
+		free(target);
+		return NULL;
+	}
+
+	target->ifindex = ifindex;
+	target->tid = tid;
+	target->rid = rid;
+	OBDIIPollScheduleInit(&target->schedule);
+
+	target->next = pollTargets;
+	if (pollTargets) {
+		pollTargets->prev = target;
+	}
+	pollTargets = target;
+
+	return target;
+}
+
+static int setConnectionLock(OBDIISocketConnection *conn, short type)
+{
+	struct flock lock;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+
+	return fcntl(conn->s, F_SETLK, &lock);
+}
+
+// Takes the lock that clients hold on the shared socket to the target's ECU while they exchange with it directly (see
+// `lockSharedSocket` in OBDIICommunication.c), so that the daemon's queries don't land in the middle of their exchanges.
+// Returns -1 if a client holds it.
+static int lockSharedSocket(OBDIIPollTarget *target, double now)
+{
+	OBDIISocketConnection *conn = socketConnectionMatchingParams(target->ifindex, target->tid, target->rid);
+	if (!conn) {
+		return 0;
+	}
+
+	if (now < target->lockRetryAt) {
+		return -1;
+	}
+
+	if (setConnectionLock(conn, F_WRLCK) < 0) {
+		target->lockRetryInterval = target->lockRetryInterval > 0
+			? fmin(2 * target->lockRetryInterval, MAX_LOCK_RETRY_INTERVAL)
+			: LOCK_RETRY_INTERVAL;
+		target->lockRetryAt = now + target->lockRetryInterval;
+		return -1;
+	}
+	target->lockRetryInterval = 0;
+
+	// Kept open until the lock is released, even if every client closes it in the meantime
+	conn->refcount++;
+	target->locked = conn;
+
+	return 0;
+}
+
+// Releases the shared socket once the daemon's query is over. The shared socket also receives the ECU's responses to
+// the daemon's queries, which are discarded first so that a client doesn't take them for the answer to its own.
+static void unlockSharedSocket(OBDIIPollTarget *target)
+{
+	OBDIISocketConnection *conn = target->locked;
+	if (!conn) {
+		return;
+	}
+
+	unsigned char buffer[MAX_ISOTP_PAYLOAD];
+	while (recv(conn->s, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0);
+
+	setConnectionLock(conn, F_UNLCK);
+
+	target->locked = NULL;
+	closeSocketConnection(conn);
+}
+
+void closePollTarget(OBDIIPollTarget *target)
+{
+	Log("Closing raw socket for queries: (%i, %x, %x)", target->ifindex, target->tid, target->rid);
+
+	if (target->inFlight) {
+		OBDIICancelRequest(&target->socket);
+	}
+	unlockSharedSocket(target);
+	OBDIICloseSocket(&target->socket);
+
+	if (target->prev) {
+		target->prev->next = target->next;
+	} else {
+		pollTargets = target->next;
+	}
+
+	if (target->next) {
+		target->next->prev = target->prev;
+	}
+
+	free(target);
+}
+
+// Closes a target once nobody subscribes to it and no query of a client is left
+void closePollTargetIfIdle(OBDIIPollTarget *target)
+{
+	if (target->schedule.numEntries == 0 && target->numQueries == 0 && !target->inFlight) {
+		closePollTarget(target);
+	}
+}
+
+// Polls a command of a target at the highest rate any subscriber asked for
+void updateSchedule(OBDIIPollTarget *target, OBDIICommand *command)
+{
+	double interval = 0;
+	OBDIISubscriberConnection *subscriber;
+	int i;
+
+	for (subscriber = subscribers; subscriber != NULL; subscriber = subscriber->next) {
+		for (i = 0; i < subscriber->numSubscriptions; ++i) {
+			OBDIISubscription *subscription = &subscriber->subscriptions[i];
+
+			if (subscription->target == target && subscription->command == command && (interval == 0 || subscription->interval < interval)) {
+				interval = subscription->interval;
+			}
+		}
+	}
+
+	OBDIIPollScheduleSetInterval(&target->schedule, command, interval);
+	closePollTargetIfIdle(target);
+}
+
+OBDIISubscriberConnection *subscriberMatchingAddress(struct sockaddr_un *caddr, socklen_t caddrlen)
+{
+	OBDIISubscriberConnection *found;
+	for (found = subscribers; found != NULL; found = found->next) {
+		if (found->addrlen == caddrlen && memcmp(&found->addr, caddr, caddrlen) == 0) {
+			break;
+		}
+	}
+
+	return found;
+}
+
+OBDIISubscriberConnection *openSubscriber(struct sockaddr_un *caddr, socklen_t caddrlen, int queueLength)
+{
+	OBDIISubscriberConnection *subscriber = (OBDIISubscriberConnection *)calloc(1, sizeof(OBDIISubscriberConnection));
+	if (!subscriber) {
+		return NULL;
+	}
+
+	subscriber->queue = (OBDIIQueuedSample *)malloc(queueLength * sizeof(OBDIIQueuedSample));
+	if (!subscriber->queue) {
+		free(subscriber);
+		return NULL;
+	}
+
+	memcpy(&subscriber->addr, caddr, caddrlen);
+	subscriber->addrlen = caddrlen;
+	subscriber->queueLength = queueLength;
+
+	subscriber->next = subscribers;
+	if (subscribers) {
+		subscribers->prev = subscriber;
+	}
+	subscribers = subscriber;
+
+	return subscriber;
+}
+
+void removeSubscription(OBDIISubscriberConnection *subscriber, int index)
+{
+	OBDIIPollTarget *target = subscriber->subscriptions[index].target;
+	OBDIICommand *command = subscriber->subscriptions[index].command;
+
+	subscriber->subscriptions[index] = subscriber->subscriptions[--subscriber->numSubscriptions];
+	updateSchedule(target, command);
+}
+
+void closeSubscriber(OBDIISubscriberConnection *subscriber)
+{
+	Log("Removing subscriber %s", subscriber->addr.sun_path);
+
+	while (subscriber->numSubscriptions > 0) {
+		removeSubscription(subscriber, subscriber->numSubscriptions - 1);
+	}
+
+	if (subscriber->prev) {
+		subscriber->prev->next = subscriber->next;
+	} else {
+		subscribers = subscriber->next;
+	}
+
+	if (subscriber->next) {
+		subscriber->next->prev = subscriber->prev;
+	}
+
+	free(subscriber->queue);
+	free(subscriber);
+}
+
+// Appends a sample to a subscriber's queue, dropping the oldest sample if the queue is full
+void enqueueSample(OBDIISubscriberConnection *subscriber, OBDIIQueuedSample *sample)
+{
+	if (subscriber->queueCount == subscriber->queueLength) {
+		uint32_t dropped = subscriber->queue[subscriber->queueHead].dropped + 1;
+
+		subscriber->queueHead = (subscriber->queueHead + 1) % subscriber->queueLength;
+		subscriber->queueCount--;
+
+		// The next sample to be delivered reports the drop
+		if (subscriber->queueCount > 0) {
+			subscriber->queue[subscriber->queueHead].dropped += dropped;
+		} else {
+			sample->dropped += dropped;
+		}
+	}
+
+	subscriber->queue[(subscriber->queueHead + subscriber->queueCount) % subscriber->queueLength] = *sample;
+	subscriber->queueCount++;
+}
+
+// Sends a subscriber's queued samples until its socket buffer is full, returning -1 if the subscriber has gone away
+int deliverSamples(int s, OBDIISubscriberConnection *subscriber)
+{
+	while (subscriber->queueCount > 0) {
+		OBDIIQueuedSample *sample = &subscriber->queue[subscriber->queueHead];
+		unsigned char message[OBDII_DAEMON_SAMPLE_SIZE];
+		unsigned char *p = message;
+		uint16_t code = OBDIIDaemonResponseCodeSample;
+
+		memcpy(p, &code, sizeof(code)); p += sizeof(code);
+		*p++ = OBDIICommandGetMode(sample->command);
+		*p++ = OBDIICommandGetPID(sample->command);
+		memcpy(p, &sample->rid, sizeof(sample->rid)); p += sizeof(sample->rid);
+		memcpy(p, &sample->dropped, sizeof(sample->dropped)); p += sizeof(sample->dropped);
+		memcpy(p, &sample->timestamp, sizeof(sample->timestamp)); p += sizeof(sample->timestamp);
+		memcpy(p, &sample->value, sizeof(sample->value));
+
+		if (sendto(s, message, sizeof(message), MSG_DONTWAIT, (struct sockaddr *)&subscriber->addr, subscriber->addrlen) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+				return 0;
+			}
+
+			if (errno == ECONNREFUSED || errno == ENOENT) {
+				return -1;
+			}
+
+			Log("Error sending sample to subscriber %s: %s", subscriber->addr.sun_path, strerror(errno));
+		}
+
+		subscriber->queueHead = (subscriber->queueHead + 1) % subscriber->queueLength;
+		subscriber->queueCount--;
+	}
+
+	return 0;
+}
+
+// Hands a response to every subscriber of the command whose own rate calls for a sample, and whose filter lets it through
+void fanOut(OBDIIPollTarget *target, OBDIIResponse *response, double now)
+{
+	// Stamped as the response arrived, rather than when the loop got around to it
+	struct timespec timestamp = response->timestamp;
+
+	OBDIIChangeFilterSample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.command = response->command;
+	sample.timestamp = now;
+	if (response->command->responseType == OBDIIResponseTypeBitfield) {
+		sample.bitfieldValue = response->bitfieldValue;
+	} else {
+		sample.numericValue = response->numericValue;
+	}
+
+	// Samples arrive about one polling interval apart, give or take the latency of each query
+	double tolerance = OBDIIPollScheduleGetInterval(&target->schedule, response->command) / 2;
+
+	OBDIISubscriberConnection *subscriber;
+	int i;
+
+	for (subscriber = subscribers; subscriber != NULL; subscriber = subscriber->next) {
+		for (i = 0; i < subscriber->numSubscriptions; ++i) {
+			OBDIISubscription *subscription = &subscriber->subscriptions[i];
+
+			if (subscription->target != target || subscription->command != response->command || now + tolerance < subscription->nextDue) {
+				continue;
+			}
+
+			subscription->nextDue += subscription->interval;
+			if (subscription->nextDue <= now) {
+				subscription->nextDue = now + subscription->interval;
+			}
+
+			if (!OBDIIChangeFilterEntryUpdate(&subscription->filter, &sample)) {
+				continue;
+			}
+
+			OBDIIQueuedSample queued;
+			queued.command = response->command;
+			queued.rid = target->rid;
+			queued.dropped = 0;
+			queued.timestamp = timestamp.tv_sec * 1000000000ULL + timestamp.tv_nsec;
+			if (response->command->responseType == OBDIIResponseTypeBitfield) {
+				queued.value = response->bitfieldValue;
+			} else {
+				memcpy(&queued.value, &response->numericValue, sizeof(queued.value));
+			}
+
+			enqueueSample(subscriber, &queued);
+		}
+	}
+}
+
+// Answers a client's query with a response code, followed by the query's mode and PID and by `payload`
+static void sendQueryAnswer(int s, OBDIIPendingQuery *query, uint16_t code, unsigned char *payload, int len)
+{
+	unsigned char message[OBDII_DAEMON_QUERY_RESULT_MAX_SIZE];
+
+	memcpy(message, &code, sizeof(code));
+	message[2] = query->command->payload[0];
+	message[3] = query->command->payload[1];
+	if (len > 0) {
+		memcpy(&message[4], payload, len);
+	}
+
+	if (sendto(s, message, 4 + len, MSG_DONTWAIT, (struct sockaddr *)&query->addr, query->addrlen) < 0) {
+		Log("Error sending query result to %s: %s", query->addr.sun_path, strerror(errno));
+	}
+}
+
+// Answers a client's query with the ECU's response payload, or with no payload if the query failed
+void sendQueryResult(int s, OBDIIPendingQuery *query, unsigned char *payload, int len)
+{
+	sendQueryAnswer(s, query, OBDIIDaemonResponseCodeQueryResult, payload, len);
+}
+
+// Whether a payload is the ECU's response to `command`, as opposed to a late response to an earlier query. Negative
+// responses count, including "response pending", which the client needs to know to keep waiting.
+static int payloadAnswersCommand(OBDIICommand *command, unsigned char *payload, ssize_t len)
+{
+	unsigned char mode = OBDIICommandGetMode(command);
+
+	if (OBDIINegativeResponseCode(command, payload, len)) {
+		return 1;
+	}
+
+	if (len < 1 || payload[0] != mode + 0x40) {
+		return 0;
+	}
+
+	return OBDIIResponseEchoesPID(command, payload, len);
+}
+
+void enqueueQuery(OBDIIPollTarget *target, OBDIIPendingQuery *query, OBDIIQueryPriority priority)
+{
+	OBDIIQueryQueue *queue = &target->queries[priority];
+
+	query->next = NULL;
+	if (queue->tail) {
+		queue->tail->next = query;
+	} else {
+		queue->head = query;
+	}
+	queue->tail = query;
+	target->numQueries++;
+}
+
+OBDIIPendingQuery *dequeueQuery(OBDIIPollTarget *target, OBDIIQueryPriority priority)
+{
+	OBDIIQueryQueue *queue = &target->queries[priority];
+	OBDIIPendingQuery *query = queue->head;
+
+	if (query) {
+		queue->head = query->next;
+		if (!queue->head) {
+			queue->tail = NULL;
+		}
+		target->numQueries--;
+	}
+
+	return query;
+}
+
+// Sends a client's query through the shared ISO-TP socket, which also reassembles multi-frame responses. The socket
+// is opened if no client has it open, and locked in any case.
+static int sendClientQuery(OBDIIPollTarget *target, OBDIIPendingQuery *query)
+{
+	if (!target->locked) {
+		if (!(target->locked = openSocketConnection(target->ifindex, target->tid, target->rid))) {
+			return -1;
+		}
+
+		// Nobody else holds the socket yet, but a client may open it while the query is in flight
+		setConnectionLock(target->locked, F_WRLCK);
+	}
+
+	// Discard late responses to queries that timed out
+	unsigned char buffer[MAX_ISOTP_PAYLOAD];
+	while (recv(target->locked->s, buffer, sizeof(buffer), MSG_DONTWAIT) >= 0);
+
+	return write(target->locked->s, query->command->payload, OBDIICommandGetRequestLength(query->command)) == OBDIICommandGetRequestLength(query->command) ? 0 : -1;
+}
+
+// Picks the next query for a target: interactive queries first, except that one bulk query goes through after
+// MAX_INTERACTIVE_STREAK interactive ones while bulk queries wait. Scheduled queries are bulk.
+void sendNextQuery(int s, OBDIIPollTarget *target, double now)
+{
+	OBDIICommand *scheduled = OBDIIPollScheduleNextDue(&target->schedule, now, NULL);
+	int bulkWaiting = target->queries[OBDIIQueryPriorityBulk].head || scheduled;
+	int interactive = target->queries[OBDIIQueryPriorityInteractive].head && (!bulkWaiting || target->interactiveStreak < MAX_INTERACTIVE_STREAK);
+	OBDIIQueryPriority priority = interactive ? OBDIIQueryPriorityInteractive : OBDIIQueryPriorityBulk;
+	int queryWaiting = target->queries[priority].head != NULL;
+
+	// The ECU already refused the command as unsupported
+	if (!queryWaiting && scheduled && OBDIIUnsupportedCode(&target->socket, scheduled)) {
+		OBDIIPollScheduleMarkPolled(&target->schedule, scheduled, now);
+		return;
+	}
+
+	if ((!queryWaiting && !scheduled) || lockSharedSocket(target, now) < 0) {
+		return;
+	}
+
+	OBDIIPendingQuery *query = dequeueQuery(target, priority);
+	target->interactiveStreak = interactive ? target->interactiveStreak + 1 : 0;
+
+	if (query) {
+		if (sendClientQuery(target, query) < 0) {
+			Log("Error sending query to (%i, %x, %x): %s", target->ifindex, target->tid, target->rid, strerror(errno));
+			sendQueryResult(s, query, NULL, 0);
+			free(query);
+			unlockSharedSocket(target);
+		} else {
+			target->inFlight = query->command;
+			target->inFlightQuery = query;
+			target->deadline = now + CLIENT_QUERY_TIMEOUT;
+			query->sentAt = now;
+		}
+		return;
+	}
+
+	OBDIIPollScheduleMarkPolled(&target->schedule, scheduled, now);
+
+	if (OBDIISendRequest(&target->socket, scheduled) < 0) {
+		Log("Error sending scheduled query to (%i, %x, %x): %s", target->ifindex, target->tid, target->rid, strerror(errno));
+		unlockSharedSocket(target);
+	} else {
+		target->inFlight = scheduled;
+		target->deadline = now + POLL_QUERY_TIMEOUT;
+	}
+}
+
+// Handles the response to a client's query in flight, returning 1 once the query is over
+static int receiveClientQueryResult(int s, OBDIIPollTarget *target, double now)
+{
+	OBDIIPendingQuery *query = target->inFlightQuery;
+	unsigned char payload[MAX_ISOTP_PAYLOAD];
+	ssize_t len;
+
+	while ((len = recv(target->locked->s, payload, sizeof(payload), MSG_DONTWAIT)) >= 0) {
+		if (!payloadAnswersCommand(query->command, payload, len)) {
+			continue;
+		}
+
+		sendQueryResult(s, query, payload, len);
+
+		if (OBDIINegativeResponseCode(query->command, payload, len) != OBDII_NRC_RESPONSE_PENDING) {
+			return 1;
+		}
+
+		target->deadline = now + RESPONSE_PENDING_TIMEOUT;
+		if (target->deadline > query->sentAt + MAX_RESPONSE_PENDING) {
+			target->deadline = query->sentAt + MAX_RESPONSE_PENDING;
+		}
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		sendQueryResult(s, query, NULL, 0);
+		return 1;
+	}
+
+	// Tell the client apart from the queries that failed, since a timeout says something about the ECU
+	if (now >= target->deadline) {
+		sendQueryAnswer(s, query, OBDIIDaemonResponseCodeQueryTimeout, NULL, 0);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Handles the response to a target's outstanding query, and sends the next query
+void serviceTarget(int s, OBDIIPollTarget *target, double now)
+{
+	if (target->inFlightQuery) {
+		if (receiveClientQueryResult(s, target, now)) {
+			free(target->inFlightQuery);
+			target->inFlightQuery = NULL;
+			target->inFlight = NULL;
+			unlockSharedSocket(target);
+		}
+	} else if (target->inFlight) {
+		OBDIIResponse response;
+		int retval = OBDIITryReceiveResponse(&target->socket, target->inFlight, &response);
+
+		if (retval == 1) {
+			if (response.success) {
+				fanOut(target, &response, now);
+			}
+			OBDIIResponseFree(&response);
+			target->inFlight = NULL;
+			unlockSharedSocket(target);
+		} else if (retval < 0 || now >= target->deadline) {
+			OBDIICancelRequest(&target->socket);
+			target->inFlight = NULL;
+			unlockSharedSocket(target);
+		}
+	}
+
+	if (!target->inFlight) {
+		sendNextQuery(s, target, now);
+		closePollTargetIfIdle(target);
+	}
+}
+
 static void dump(char *dest, char *src, unsigned int len)
 {
 	unsigned int i;
@@ -224,6 +888,195 @@ void handleSocketRequest(int s, struct sockaddr_un *caddr, socklen_t caddrlen, u
 	}
 }
 
+static float asfloat(unsigned char *buf)
+{
+	uint32_t bits = asuint32(buf);
+	float value;
+
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+int subscriptionIndex(OBDIISubscriberConnection *subscriber, OBDIIPollTarget *target, OBDIICommand *command)
+{
+	int i;
+	for (i = 0; i < subscriber->numSubscriptions; ++i) {
+		if (subscriber->subscriptions[i].target == target && subscriber->subscriptions[i].command == command) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void handleSubscribeRequest(int s, struct sockaddr_un *caddr, socklen_t caddrlen, unsigned char *request, ssize_t requestLen)
+{
+	if (requestLen < OBDII_DAEMON_SUBSCRIBE_PARAMS_SIZE) {
+		Log("handleSubscribeRequest: Request payload insufficient size");
+		return;
+	}
+
+	unsigned int ifindex = asuint32(request);
+	canid_t tid = asuint32(&request[4]);
+	canid_t rid = asuint32(&request[8]);
+	OBDIICommand *command = OBDIICommandWithModeAndPID(request[12], request[13]);
+	uint32_t intervalMicroseconds = asuint32(&request[14]);
+	int queueLength = request[18] | (request[19] << 8);
+
+	OBDIIChangeFilterRule rule;
+	rule.absoluteDeadband = asfloat(&request[20]);
+	rule.relativeDeadband = asfloat(&request[24]);
+	rule.maxSilence = asuint32(&request[28]) / 1000.0;
+	rule.bitfieldMask = asuint32(&request[32]);
+
+	Log("Received request to subscribe to %02x %02x of (%i, %x, %x) every %u us", request[12], request[13], ifindex, tid, rid, intervalMicroseconds);
+
+	// Only single frame responses can be queried over a raw socket
+	if (!command || intervalMicroseconds == 0 || command->expectedResponseLength > 7
+			|| (command->responseType != OBDIIResponseTypeNumeric && command->responseType != OBDIIResponseTypeBitfield)) {
+		sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeInvalidSubscription);
+		return;
+	}
+
+	if (queueLength == 0) {
+		queueLength = OBDII_DAEMON_DEFAULT_QUEUE_LENGTH;
+	} else if (queueLength > OBDII_DAEMON_MAX_QUEUE_LENGTH) {
+		queueLength = OBDII_DAEMON_MAX_QUEUE_LENGTH;
+	}
+
+	OBDIISubscriberConnection *subscriber = subscriberMatchingAddress(caddr, caddrlen);
+	if (!subscriber && !(subscriber = openSubscriber(caddr, caddrlen, queueLength))) {
+		sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeInvalidSubscription);
+		return;
+	}
+
+	OBDIIPollTarget *target = pollTargetMatchingParams(ifindex, tid, rid);
+	if (!target && !(target = openPollTarget(ifindex, tid, rid))) {
+		Log("Error opening raw socket (%i, %x, %x): %s", ifindex, tid, rid, strerror(errno));
+		sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeOpenSocketError);
+		if (subscriber->numSubscriptions == 0) {
+			closeSubscriber(subscriber);
+		}
+		return;
+	}
+
+	int index = subscriptionIndex(subscriber, target, command);
+	if (index < 0) {
+		if (subscriber->numSubscriptions == MAX_SUBSCRIPTIONS_PER_SUBSCRIBER) {
+			sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeInvalidSubscription);
+			closePollTargetIfIdle(target);
+			return;
+		}
+		index = subscriber->numSubscriptions++;
+	}
+
+	OBDIISubscription *subscription = &subscriber->subscriptions[index];
+	memset(subscription, 0, sizeof(*subscription));
+	subscription->target = target;
+	subscription->command = command;
+	subscription->interval = intervalMicroseconds / 1e6;
+	subscription->filter.command = command;
+	subscription->filter.rule = rule;
+
+	if (OBDIIPollScheduleGetInterval(&target->schedule, command) == 0 && target->schedule.numEntries == OBDII_POLL_SCHEDULE_MAX_ENTRIES) {
+		subscriber->subscriptions[index] = subscriber->subscriptions[--subscriber->numSubscriptions];
+		sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeInvalidSubscription);
+		if (subscriber->numSubscriptions == 0) {
+			closeSubscriber(subscriber);
+		}
+		closePollTargetIfIdle(target);
+		return;
+	}
+
+	updateSchedule(target, command);
+	sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeSuccess);
+}
+
+void handleUnsubscribeRequest(int s, struct sockaddr_un *caddr, socklen_t caddrlen, unsigned char *request, ssize_t requestLen)
+{
+	if (requestLen < OBDII_DAEMON_UNSUBSCRIBE_PARAMS_SIZE) {
+		Log("handleUnsubscribeRequest: Request payload insufficient size");
+		return;
+	}
+
+	unsigned int ifindex = asuint32(request);
+	canid_t tid = asuint32(&request[4]);
+	canid_t rid = asuint32(&request[8]);
+	OBDIICommand *command = OBDIICommandWithModeAndPID(request[12], request[13]);
+
+	Log("Received request to unsubscribe from %02x %02x of (%i, %x, %x)", request[12], request[13], ifindex, tid, rid);
+
+	OBDIISubscriberConnection *subscriber = subscriberMatchingAddress(caddr, caddrlen);
+	OBDIIPollTarget *target = pollTargetMatchingParams(ifindex, tid, rid);
+	int index = subscriber && target ? subscriptionIndex(subscriber, target, command) : -1;
+
+	if (index < 0) {
+		sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeInvalidSubscription);
+		return;
+	}
+
+	removeSubscription(subscriber, index);
+	sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeSuccess);
+}
+
+void handleUnsubscribeAllRequest(int s, struct sockaddr_un *caddr, socklen_t caddrlen)
+{
+	OBDIISubscriberConnection *subscriber = subscriberMatchingAddress(caddr, caddrlen);
+
+	if (subscriber) {
+		closeSubscriber(subscriber);
+	}
+
+	sendResponseCode(s, caddr, caddrlen, OBDIIDaemonResponseCodeSuccess);
+}
+
+void handleQueryRequest(int s, struct sockaddr_un *caddr, socklen_t caddrlen, unsigned char *request, ssize_t requestLen)
+{
+	if (requestLen < OBDII_DAEMON_QUERY_PARAMS_SIZE) {
+		Log("handleQueryRequest: Request payload insufficient size");
+		return;
+	}
+
+	unsigned int ifindex = asuint32(request);
+	canid_t tid = asuint32(&request[4]);
+	canid_t rid = asuint32(&request[8]);
+	OBDIICommand *command = OBDIICommandWithModeAndPID(request[12], request[13]);
+	unsigned char priority = request[14];
+
+	OBDIIPendingQuery *query = (OBDIIPendingQuery *)calloc(1, sizeof(OBDIIPendingQuery));
+	if (!query) {
+		return;
+	}
+
+	memcpy(&query->addr, caddr, caddrlen);
+	query->addrlen = caddrlen;
+	query->command = command;
+
+	if (!command || priority > OBDIIQueryPriorityInteractive) {
+		Log("Received invalid query %02x %02x with priority %i", request[12], request[13], priority);
+
+		// Still answer with the command the client asked for
+		OBDIICommand unknown;
+		memset(&unknown, 0, sizeof(unknown));
+		unknown.payload[0] = request[12];
+		unknown.payload[1] = request[13];
+		query->command = &unknown;
+
+		sendQueryResult(s, query, NULL, 0);
+		free(query);
+		return;
+	}
+
+	OBDIIPollTarget *target = pollTargetMatchingParams(ifindex, tid, rid);
+	if ((!target && !(target = openPollTarget(ifindex, tid, rid))) || target->numQueries == MAX_PENDING_QUERIES) {
+		sendQueryResult(s, query, NULL, 0);
+		free(query);
+		return;
+	}
+
+	enqueueQuery(target, query, priority);
+}
+
 // Request dispatcher
 static void handleMessage(int s, struct sockaddr_un *caddr, socklen_t caddrlen, unsigned char *request, ssize_t requestLen)
 {
@@ -246,6 +1099,18 @@ static void handleMessage(int s, struct sockaddr_un *caddr, socklen_t caddrlen,
 			case OBDIIDaemonRequestCloseSocket:
 				handleSocketRequest(s, caddr, caddrlen, payload, payloadLen, 0);
 				break;
+			case OBDIIDaemonRequestSubscribe:
+				handleSubscribeRequest(s, caddr, caddrlen, payload, payloadLen);
+				break;
+			case OBDIIDaemonRequestUnsubscribe:
+				handleUnsubscribeRequest(s, caddr, caddrlen, payload, payloadLen);
+				break;
+			case OBDIIDaemonRequestUnsubscribeAll:
+				handleUnsubscribeAllRequest(s, caddr, caddrlen);
+				break;
+			case OBDIIDaemonRequestQuery:
+				handleQueryRequest(s, caddr, caddrlen, payload, payloadLen);
+				break;
 			default:
 				Log("Received request with unsupported request type: %i", requestType);
 				break;
@@ -292,20 +1157,89 @@ int main(int argc, char *argv[])
 	}
 
 	while (1) {
-		caddrlen = sizeof(struct sockaddr_un);
-		
-		if ((requestLen = recvfrom(s, request, sizeof(request), 0, (struct sockaddr *)&caddr, &caddrlen)) < 0) {
-			Log("Error reading request: %s", strerror(errno));
+		double now = monotonicTime();
+		double wakeup = INFINITY;
+		int numTargets = 0;
+		OBDIIPollTarget *target, *nextTarget;
+		OBDIISubscriberConnection *subscriber, *nextSubscriber;
+
+		for (target = pollTargets; target != NULL; target = target->next) {
+			numTargets++;
+		}
+
+		struct pollfd fds[numTargets + 1];
+		int numFDs = 1;
+
+		fds[0].fd = s;
+		fds[0].events = POLLIN;
+
+		// Wake up for the responses to queries, their timeouts, and the next query due
+		for (target = pollTargets; target != NULL; target = target->next) {
+			if (target->inFlight) {
+				fds[numFDs].fd = target->inFlightQuery ? target->locked->s : target->socket.s;
+				fds[numFDs].events = POLLIN;
+				numFDs++;
+				wakeup = fmin(wakeup, target->deadline);
+			} else {
+				// Not before trying the lock of the shared socket again, if a client held it
+				double ready = fmax(now, target->lockRetryAt);
+				double nextDue;
+				OBDIIPollScheduleNextDue(&target->schedule, now, &nextDue);
+				if (target->numQueries > 0) {
+					wakeup = fmin(wakeup, ready);
+				} else if (nextDue >= 0) {
+					wakeup = fmin(wakeup, fmax(nextDue, ready));
+				}
+			}
+		}
+
+		for (subscriber = subscribers; subscriber != NULL; subscriber = subscriber->next) {
+			if (subscriber->queueCount > 0) {
+				wakeup = fmin(wakeup, now + DELIVERY_RETRY_INTERVAL);
+			}
+		}
+
+		int timeout = isinf(wakeup) ? -1 : wakeup <= now ? 0 : (int)ceil((wakeup - now) * 1000);
+
+		if (poll(fds, numFDs, timeout) < 0 && errno != EINTR) {
+			Log("Error polling sockets: %s", strerror(errno));
 			exit(EXIT_FAILURE);
 		}
 
-		char formatted[requestLen * 2 + 1];
-		formatted[requestLen * 2]= '\0';
-		dump(formatted, request, requestLen);
+		if (fds[0].revents & POLLIN) {
+			caddrlen = sizeof(struct sockaddr_un);
 
-		Log("Received raw request: %s", formatted);
+			while ((requestLen = recvfrom(s, request, sizeof(request), MSG_DONTWAIT, (struct sockaddr *)&caddr, &caddrlen)) >= 0) {
+				char formatted[requestLen * 2 + 1];
+				formatted[requestLen * 2]= '\0';
+				dump(formatted, request, requestLen);
 
-		handleMessage(s, &caddr, caddrlen, request, requestLen);
+				Log("Received raw request: %s", formatted);
+
+				handleMessage(s, &caddr, caddrlen, request, requestLen);
+				caddrlen = sizeof(struct sockaddr_un);
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				Log("Error reading request: %s", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		now = monotonicTime();
+		for (target = pollTargets; target != NULL; target = nextTarget) {
+			nextTarget = target->next;
+			serviceTarget(s, target, now);
+		}
+
+		// Subscribers that went away without unsubscribing are dropped
+		for (subscriber = subscribers; subscriber != NULL; subscriber = nextSubscriber) {
+			nextSubscriber = subscriber->next;
+
+			if (deliverSamples(s, subscriber) < 0) {
+				closeSubscriber(subscriber);
+			}
+		}
 	}
 
 	return 0;
@@ -3,20 +3,47 @@
 
 typedef enum {
 	OBDIIDaemonRequestOpenSocket,
-	OBDIIDaemonRequestCloseSocket
+	OBDIIDaemonRequestCloseSocket,
+	OBDIIDaemonRequestSubscribe,
+	OBDIIDaemonRequestUnsubscribe,
+	OBDIIDaemonRequestUnsubscribeAll,
+	OBDIIDaemonRequestQuery
 } OBDIIDaemonRequestType;
 
 typedef enum {
 	OBDIIDaemonResponseCodeSuccess,
 	OBDIIDaemonResponseCodeNoSuchSocket,
-	OBDIIDaemonResponseCodeOpenSocketError
+	OBDIIDaemonResponseCodeOpenSocketError,
+	OBDIIDaemonResponseCodeInvalidSubscription,
+	/** Not a response to a request: a sample pushed to a subscriber */
+	OBDIIDaemonResponseCodeSample,
+	/** The answer to a query request, followed by the command's mode and PID and the ECU's response payload, if any */
+	OBDIIDaemonResponseCodeQueryResult,
+	/** The answer to a query request the ECU didn't answer in time, followed by the command's mode and PID */
+	OBDIIDaemonResponseCodeQueryTimeout
 } OBDIIDaemonResponseCode;
-	
+
 
 #define OBDII_DAEMON_REQUEST_MAX_SIZE 100
 #define OBDII_DAEMON_RESPONSE_MAX_SIZE 100
 #define OBDII_DAEMON_REQUEST_HEADER_SIZE 4
 
+/** Size of the parameters of a subscribe request */
+#define OBDII_DAEMON_SUBSCRIBE_PARAMS_SIZE 36
+/** Size of the parameters of an unsubscribe request */
+#define OBDII_DAEMON_UNSUBSCRIBE_PARAMS_SIZE 14
+/** Size of the parameters of a query request */
+#define OBDII_DAEMON_QUERY_PARAMS_SIZE 15
+/** Size of the answer to a query request, with the longest response payload ISO-TP can carry */
+#define OBDII_DAEMON_QUERY_RESULT_MAX_SIZE (4 + 4095)
+/** Size of a sample message */
+#define OBDII_DAEMON_SAMPLE_SIZE 24
+
+/** Queue length of a subscriber that doesn't ask for one */
+#define OBDII_DAEMON_DEFAULT_QUEUE_LENGTH 64
+/** Longest queue a subscriber can ask for */
+#define OBDII_DAEMON_MAX_QUEUE_LENGTH 4096
+
 #define OBDII_DAEMON_SOCKET_PATH "/tmp/obdiid.sock"
 
 #endif /* OBDIIDaemon.h */
@@ -0,0 +1,194 @@
+#include "OBDIIDefinitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// The data bytes of a response are the variables A, B, C...
+static int resolveDataByte(const char *name, int length, void *context)
+{
+	int dataLength = *(int *)context;
+
+	if (length != 1 || name[0] < 'A' || name[0] >= 'A' + dataLength) {
+		return -1;
+	}
+
+	return name[0] - 'A';
+}
+
+// Evaluates the formula of the definition that `response->command` is the first member of
+static void decodeDefinition(OBDIIResponse *response, unsigned char *responsePayload, int len)
+{
+	const OBDIIDefinition *definition = (const OBDIIDefinition *)response->command;
+	int header = OBDIICommandGetRequestLength(response->command);
+	double bytes[OBDII_DEFINITIONS_MAX_DATA_BYTES];
+	int i;
+
+	for (i = 0; i < len - header && i < OBDII_DEFINITIONS_MAX_DATA_BYTES; ++i) {
+		bytes[i] = responsePayload[header + i];
+	}
+
+	response->numericValue = OBDIIExpressionEvaluate(&definition->_expression, bytes);
+}
+
+void OBDIIDefinitionsInit(OBDIIDefinitions *definitions)
+{
+	definitions->numDefinitions = 0;
+}
+
+OBDIICommand *OBDIIDefinitionsAdd(OBDIIDefinitions *definitions, const char *name, unsigned char mode, unsigned int pid, int dataLength, const char *formula)
+{
+	unsigned int maxPID = mode == OBDII_MODE_READ_DATA_BY_IDENTIFIER ? 0xFFFF : 0xFF;
+
+	if (mode == 0 || mode >= 0x40 || pid > maxPID || dataLength <= 0 || dataLength > OBDII_DEFINITIONS_MAX_DATA_BYTES) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (strlen(name) >= OBDII_DEFINITIONS_MAX_NAME_LENGTH) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	if (OBDIIDefinitionsCommandWithName(definitions, name)) {
+		errno = EEXIST;
+		return NULL;
+	}
+
+	if (definitions->numDefinitions == OBDII_DEFINITIONS_MAX_COMMANDS) {
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	OBDIIDefinition *definition = &definitions->definitions[definitions->numDefinitions];
+
+	if (OBDIIExpressionCompile(&definition->_expression, formula, &resolveDataByte, &dataLength, NULL) < 0) {
+		return NULL;
+	}
+
+	strcpy(definition->name, name);
+
+	OBDIICommand *command = &definition->command;
+	memset(command, 0, sizeof(*command));
+	command->name = definition->name;
+	command->payload[0] = mode;
+	if (mode == OBDII_MODE_READ_DATA_BY_IDENTIFIER) {
+		command->payload[1] = pid >> 8;
+		command->payload[2] = pid & 0xFF;
+	} else {
+		command->payload[1] = pid;
+	}
+	command->responseType = OBDIIResponseTypeNumeric;
+	command->expectedResponseLength = OBDIICommandGetRequestLength(command) + dataLength;
+	command->responseDecoder = &decodeDefinition;
+
+	definitions->numDefinitions++;
+
+	return command;
+}
+
+// Parses a line of a definition file into a definition, modifying `line`. Returns 0 for blank lines and comments.
+static int parseLine(OBDIIDefinitions *definitions, char *line)
+{
+	char *name, *modeString, *pidString, *lengthString, *formula, *end, *savePtr;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	if (!(name = strtok_r(line, " \t", &savePtr)) || name[0] == '#') {
+		return 0;
+	}
+
+	if (!(modeString = strtok_r(NULL, " \t", &savePtr)) || !(pidString = strtok_r(NULL, " \t", &savePtr))
+			|| !(lengthString = strtok_r(NULL, " \t", &savePtr)) || !(formula = strtok_r(NULL, "", &savePtr))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	unsigned long mode = strtoul(modeString, &end, 16);
+	if (*end != '\0' || mode > 0xFF) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	unsigned long pid = strtoul(pidString, &end, 16);
+	if (*end != '\0' || pid > 0xFFFF) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	long dataLength = strtol(lengthString, &end, 10);
+	if (*end != '\0' || dataLength > OBDII_DEFINITIONS_MAX_DATA_BYTES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return OBDIIDefinitionsAdd(definitions, name, mode, pid, dataLength, formula) ? 1 : -1;
+}
+
+int OBDIIDefinitionsLoad(OBDIIDefinitions *definitions, const char *path, int *errorLine)
+{
+	FILE *file = fopen(path, "r");
+	char line[512];
+	int lineNumber = 0, numDefined = 0;
+
+	if (errorLine) {
+		*errorLine = 0;
+	}
+
+	if (!file) {
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		lineNumber++;
+
+		int result = parseLine(definitions, line);
+		if (result < 0) {
+			if (errorLine) {
+				*errorLine = lineNumber;
+			}
+
+			int error = errno;
+			fclose(file);
+			errno = error;
+			return -1;
+		}
+
+		numDefined += result;
+	}
+
+	fclose(file);
+
+	return numDefined;
+}
+
+OBDIICommand *OBDIIDefinitionsCommandWithName(const OBDIIDefinitions *definitions, const char *name)
+{
+	int i;
+	for (i = 0; i < definitions->numDefinitions; ++i) {
+		if (strcmp(definitions->definitions[i].name, name) == 0) {
+			return (OBDIICommand *)&definitions->definitions[i].command;
+		}
+	}
+
+	return NULL;
+}
+
+OBDIICommand *OBDIIDefinitionsCommandWithModeAndPID(const OBDIIDefinitions *definitions, unsigned char mode, unsigned int pid)
+{
+	int i;
+	for (i = 0; i < definitions->numDefinitions; ++i) {
+		const OBDIICommand *command = &definitions->definitions[i].command;
+		unsigned int commandPID = OBDIICommandGetPID(command);
+
+		if (mode == OBDII_MODE_READ_DATA_BY_IDENTIFIER) {
+			commandPID = commandPID << 8 | command->payload[2];
+		}
+
+		if (OBDIICommandGetMode(command) == mode && commandPID == pid) {
+			return (OBDIICommand *)command;
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,103 @@
+#ifndef __OBDII_DEFINITIONS_H
+#define __OBDII_DEFINITIONS_H
+
+#include "OBDII.h"
+#include "OBDIIExpression.h"
+
+/** Maximum number of commands in a set of definitions */
+#define OBDII_DEFINITIONS_MAX_COMMANDS 128
+
+/** Maximum length of the name of a defined command, including the terminating NUL */
+#define OBDII_DEFINITIONS_MAX_NAME_LENGTH 48
+
+/** Maximum number of data bytes in the response to a defined command, which formulas refer to as A to Z */
+#define OBDII_DEFINITIONS_MAX_DATA_BYTES 26
+
+/** A command defined at runtime, e.g. a manufacturer-specific data identifier */
+typedef struct OBDIIDefinition {
+	/** The command, to pass to `OBDIIPerformQuery` and the other functions that take one. Its decoder evaluates the
+	 * formula into the response's `numericValue`. Must stay the first member. */
+	OBDIICommand command;
+	char name[OBDII_DEFINITIONS_MAX_NAME_LENGTH];
+	OBDIIExpression _expression;
+} OBDIIDefinition;
+
+/** Commands defined at runtime, from a definition file, instead of being compiled in like `OBDIICommands`.
+ *
+ * Each definition gives a name, a mode, a PID (or, for mode 0x22, a 16-bit data identifier), the number of data bytes
+ * in the response, and a formula over those bytes. The data bytes follow the echoed mode and PID, and formulas refer to
+ * them as `A`, `B`, `C`... in the usual OBD-II notation; the bitwise operators extract bits and multi-byte values. A
+ * definition file has one definition per line, with the formula last:
+ *
+ *     # name mode PID length formula
+ *     hybridBatteryCharge 22 5b3d 1 A * 100 / 255
+ *     transmissionTemperature 22 1e1c 2 (A * 256 + B) / 16 - 40
+ *     brakeSwitch 22 2b0a 1 (A >> 3) & 1
+ *     steeringAngle 22 3201 2 (((A << 8 | B) ^ 0x8000) - 0x8000) / 10
+ *
+ * The mode and the PID are in hex; blank lines and lines starting with `#` are ignored. Formulas are compiled once,
+ * when they are loaded, so decoding a response is a single pass over the formula's instructions without any parsing:
+ *
+ *     static OBDIIDefinitions definitions;
+ *     OBDIIDefinitionsInit(&definitions);
+ *     if (OBDIIDefinitionsLoad(&definitions, "hybrid.def", &line) < 0) {
+ *         fprintf(stderr, "hybrid.def:%d: %s\n", line, strerror(errno));
+ *     }
+ *
+ *     OBDIICommand *charge = OBDIIDefinitionsCommandWithName(&definitions, "hybridBatteryCharge");
+ *     OBDIIResponse response = OBDIIPerformQuery(&s, charge);
+ *
+ * Defined commands are numeric, and work with every transport and query function except
+ * `OBDIIPerformQueryWithPriority` on a shared socket, which fails because the daemon only knows the built-in commands.
+ * Commands point into the definitions, which must therefore outlive them and must not be moved.
+ * A set of definitions is large; declare it static or allocate it.
+ */
+typedef struct OBDIIDefinitions {
+	OBDIIDefinition definitions[OBDII_DEFINITIONS_MAX_COMMANDS];
+	int numDefinitions;
+} OBDIIDefinitions;
+
+/** Initialize an empty set of definitions. */
+void OBDIIDefinitionsInit(OBDIIDefinitions *definitions);
+
+/** Define a command.
+ *
+ * \param definitions The definitions
+ * \param name The name of the command, which is also its description
+ * \param mode The mode, between 0x01 and 0x3F
+ * \param pid The PID, or for mode 0x22 the data identifier
+ * \param dataLength The number of data bytes in the response, between 1 and `OBDII_DEFINITIONS_MAX_DATA_BYTES`
+ * \param formula The formula over the data bytes `A`, `B`, `C`...
+ *
+ * \returns The command, or NULL with errno set to EINVAL (invalid mode, PID or length, or syntax error), ENOENT (a
+ * formula refers to a byte past `dataLength`), EEXIST (a command with the same name exists), ENAMETOOLONG or ENOSPC
+ */
+OBDIICommand *OBDIIDefinitionsAdd(OBDIIDefinitions *definitions, const char *name, unsigned char mode, unsigned int pid, int dataLength, const char *formula);
+
+/** Load the definitions in a file.
+ *
+ * Loading stops at the first invalid definition; the definitions before it are kept.
+ *
+ * \param definitions The definitions
+ * \param path The path of the definition file
+ * \param errorLine If not NULL and loading fails, set to the line number of the invalid definition, or 0 if the file
+ * couldn't be read
+ *
+ * \returns The number of commands defined, or -1 with errno set as by `OBDIIDefinitionsAdd` (EINVAL for a malformed
+ * line), or by `fopen`
+ */
+int OBDIIDefinitionsLoad(OBDIIDefinitions *definitions, const char *path, int *errorLine);
+
+/** Look up a defined command by name.
+ *
+ * \returns The command, or NULL if there is none with that name
+ */
+OBDIICommand *OBDIIDefinitionsCommandWithName(const OBDIIDefinitions *definitions, const char *name);
+
+/** Look up a defined command by mode and PID (or data identifier).
+ *
+ * \returns The first command defined with that mode and PID, or NULL if there is none
+ */
+OBDIICommand *OBDIIDefinitionsCommandWithModeAndPID(const OBDIIDefinitions *definitions, unsigned char mode, unsigned int pid);
+
+#endif /* OBDIIDefinitions.h */
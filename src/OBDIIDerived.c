@@ -0,0 +1,222 @@
+#include "OBDIIDerived.h"
+#include <string.h>
+#include <errno.h>
+
+// Recomputes a channel from the latest values of its inputs
+static int updateChannel(OBDIIDerivedEngine *engine, OBDIIDerivedChannel *channel)
+{
+	uint32_t variables = channel->_expression.variables;
+	double newest = 0, oldest = 0;
+	int i, haveCommands = 0;
+
+	for (i = 0; i < engine->numInputs; ++i) {
+		OBDIIDerivedInput *input = &engine->inputs[i];
+
+		if (!(variables & ((uint32_t)1 << i))) {
+			continue;
+		}
+
+		if (!input->valid) {
+			channel->valid = 0;
+			return 0;
+		}
+
+		if (input->command) {
+			if (!haveCommands || input->timestamp > newest) {
+				newest = input->timestamp;
+			}
+			if (!haveCommands || input->timestamp < oldest) {
+				oldest = input->timestamp;
+			}
+			haveCommands = 1;
+		}
+	}
+
+	if (engine->maxSkew > 0 && newest - oldest > engine->maxSkew) {
+		channel->valid = 0;
+		return 0;
+	}
+
+	channel->value = OBDIIExpressionEvaluate(&channel->_expression, engine->_values);
+	channel->timestamp = newest;
+	channel->valid = 1;
+
+	return 1;
+}
+
+static int updateChannelsUsingInput(OBDIIDerivedEngine *engine, int input)
+{
+	int i, numUpdated = 0;
+
+	for (i = 0; i < engine->numChannels; ++i) {
+		if (engine->channels[i]._expression.variables & ((uint32_t)1 << input)) {
+			numUpdated += updateChannel(engine, &engine->channels[i]);
+		}
+	}
+
+	return numUpdated;
+}
+
+// Resolves a formula's variable to a constant or a command, adding the command as an input the first time it appears
+static int resolveInput(const char *name, int length, void *context)
+{
+	OBDIIDerivedEngine *engine = context;
+	char nameString[64];
+	int i;
+
+	if (length >= (int)sizeof(nameString)) {
+		return -1;
+	}
+
+	memcpy(nameString, name, length);
+	nameString[length] = '\0';
+
+	for (i = 0; i < engine->numInputs; ++i) {
+		if (!engine->inputs[i].command && strcmp(engine->inputs[i].name, nameString) == 0) {
+			return i;
+		}
+	}
+
+	OBDIICommand *command = OBDIICommandWithName(nameString);
+	if (!command || (command->responseType != OBDIIResponseTypeNumeric && command->responseType != OBDIIResponseTypeBitfield)) {
+		return -1;
+	}
+
+	for (i = 0; i < engine->numInputs; ++i) {
+		if (engine->inputs[i].command == command) {
+			return i;
+		}
+	}
+
+	if (engine->numInputs == OBDII_DERIVED_MAX_INPUTS) {
+		return -1;
+	}
+
+	OBDIIDerivedInput *input = &engine->inputs[engine->numInputs];
+	memset(input, 0, sizeof(*input));
+	input->command = command;
+
+	return engine->numInputs++;
+}
+
+void OBDIIDerivedEngineInit(OBDIIDerivedEngine *engine, double maxSkew)
+{
+	memset(engine, 0, sizeof(*engine));
+	engine->maxSkew = maxSkew;
+}
+
+int OBDIIDerivedSetConstant(OBDIIDerivedEngine *engine, const char *name, double value)
+{
+	int i;
+
+	for (i = 0; i < engine->numInputs; ++i) {
+		if (!engine->inputs[i].command && strcmp(engine->inputs[i].name, name) == 0) {
+			engine->_values[i] = value;
+			updateChannelsUsingInput(engine, i);
+			return 0;
+		}
+	}
+
+	if (strlen(name) >= OBDII_DERIVED_MAX_NAME_LENGTH) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (engine->numInputs == OBDII_DERIVED_MAX_INPUTS) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	OBDIIDerivedInput *input = &engine->inputs[engine->numInputs];
+	memset(input, 0, sizeof(*input));
+	strcpy(input->name, name);
+	input->valid = 1;
+	engine->_values[engine->numInputs++] = value;
+
+	return 0;
+}
+
+int OBDIIDerivedAddChannel(OBDIIDerivedEngine *engine, const char *name, const char *formula)
+{
+	if (strlen(name) >= OBDII_DERIVED_MAX_NAME_LENGTH) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (engine->numChannels == OBDII_DERIVED_MAX_CHANNELS) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	OBDIIDerivedChannel *channel = &engine->channels[engine->numChannels];
+	memset(channel, 0, sizeof(*channel));
+	strcpy(channel->name, name);
+
+	// Don't keep the inputs of a formula that fails to compile
+	int numInputs = engine->numInputs;
+	if (OBDIIExpressionCompile(&channel->_expression, formula, &resolveInput, engine, NULL) < 0) {
+		engine->numInputs = numInputs;
+		return -1;
+	}
+
+	updateChannel(engine, channel);
+
+	return engine->numChannels++;
+}
+
+OBDIICommandSet OBDIIDerivedGetCommands(const OBDIIDerivedEngine *engine)
+{
+	OBDIICommandSet commandSet;
+	memset(&commandSet, 0, sizeof(commandSet));
+
+	int i;
+	for (i = 0; i < engine->numInputs; ++i) {
+		if (engine->inputs[i].command) {
+			OBDIICommandSetAddCommand(&commandSet, engine->inputs[i].command);
+		}
+	}
+
+	return commandSet;
+}
+
+int OBDIIDerivedUpdate(OBDIIDerivedEngine *engine, const OBDIIResponse *response, double timestamp)
+{
+	int i;
+
+	if (!response->success) {
+		return 0;
+	}
+
+	for (i = 0; i < engine->numInputs; ++i) {
+		OBDIIDerivedInput *input = &engine->inputs[i];
+
+		if (input->command && input->command == response->command) {
+			engine->_values[i] = input->command->responseType == OBDIIResponseTypeBitfield ? response->bitfieldValue : response->numericValue;
+			input->timestamp = timestamp;
+			input->valid = 1;
+
+			return updateChannelsUsingInput(engine, i);
+		}
+	}
+
+	return 0;
+}
+
+int OBDIIDerivedPoll(OBDIIDerivedEngine *engine, OBDIISocket *s)
+{
+	int i, numUpdated = 0;
+
+	for (i = 0; i < engine->numInputs; ++i) {
+		if (!engine->inputs[i].command) {
+			continue;
+		}
+
+		OBDIIResponse response = OBDIIPerformQuery(s, engine->inputs[i].command);
+
+		// Stamped with when the response arrived, so that a slow query doesn't make its value look fresher
+		numUpdated += OBDIIDerivedUpdate(engine, &response, OBDIIResponseTimestamp(&response));
+		OBDIIResponseFree(&response);
+	}
+
+	return numUpdated;
+}
@@ -0,0 +1,128 @@
+#ifndef __OBDII_DERIVED_H
+#define __OBDII_DERIVED_H
+
+#include "OBDII.h"
+#include "OBDIICommunication.h"
+#include "OBDIIExpression.h"
+
+/** Maximum number of derived channels in an engine */
+#define OBDII_DERIVED_MAX_CHANNELS 16
+
+/** Maximum number of inputs (commands and constants) in an engine */
+#define OBDII_DERIVED_MAX_INPUTS OBDII_EXPRESSION_MAX_VARIABLES
+
+/** Maximum length of the name of a channel or constant, including the terminating NUL */
+#define OBDII_DERIVED_MAX_NAME_LENGTH 32
+
+/** Fuel rate of a gasoline engine in L/h, from the air flow at a stoichiometric air-fuel ratio of 14.7 and a fuel density of 737 g/L */
+#define OBDII_DERIVED_FUEL_RATE "mafAirFlowRate * 3600 / (14.7 * 737)"
+
+/** Instantaneous fuel economy of a gasoline engine in km/L */
+#define OBDII_DERIVED_FUEL_ECONOMY "vehicleSpeed / (" OBDII_DERIVED_FUEL_RATE ")"
+
+/** Estimated engine power in kW, taking the calculated load as a fraction of the peak torque. Needs a `peakTorque` constant, in N·m. */
+#define OBDII_DERIVED_ENGINE_POWER "calculatedEngineLoad / 100 * peakTorque * engineRPMs * 2 * 3.14159265 / 60000"
+
+/** A base value that derived channels are computed from: the latest response to a command, or a constant */
+typedef struct OBDIIDerivedInput {
+	/** The command, or NULL for a constant */
+	OBDIICommand *command;
+	/** The name of a constant */
+	char name[OBDII_DERIVED_MAX_NAME_LENGTH];
+	/** 1 once a value is known */
+	int valid;
+	/** The time of the latest response, in seconds */
+	double timestamp;
+} OBDIIDerivedInput;
+
+/** A metric computed from one or more inputs */
+typedef struct OBDIIDerivedChannel {
+	char name[OBDII_DERIVED_MAX_NAME_LENGTH];
+	/** 1 if `value` was computed from the latest responses to all of the channel's commands */
+	int valid;
+	/** The latest value */
+	double value;
+	/** The time of the freshest response `value` was computed from, in seconds */
+	double timestamp;
+	OBDIIExpression _expression;
+} OBDIIDerivedChannel;
+
+/** Computes derived channels, declared as formulas over the values of commands, as responses arrive.
+ *
+ * Every command that some formula refers to is an input of the engine, however many channels refer to it, so it only
+ * has to be queried once per cycle. Each response updates only the channels that depend on it, using the latest
+ * responses to the channel's other commands; a channel is time-stamped with its freshest input.
+ *
+ *     OBDIIDerivedEngine engine;
+ *     OBDIIDerivedEngineInit(&engine, 1.0);
+ *     int economy = OBDIIDerivedAddChannel(&engine, "economy", OBDII_DERIVED_FUEL_ECONOMY);
+ *
+ *     while (1) {
+ *         OBDIIDerivedPoll(&engine, &s);
+ *         if (engine.channels[economy].valid) {
+ *             printf("%.1f km/L\n", engine.channels[economy].value);
+ *         }
+ *     }
+ *
+ * Formulas use the syntax of `OBDIIExpression`, and refer to commands by their name on `OBDIICommands` (e.g.
+ * `vehicleSpeed`) and to constants by the name given to `OBDIIDerivedSetConstant`. The value of a command is the
+ * response's `numericValue`, or its `bitfieldValue` for bitfield commands.
+ */
+typedef struct OBDIIDerivedEngine {
+	OBDIIDerivedInput inputs[OBDII_DERIVED_MAX_INPUTS];
+	int numInputs;
+	OBDIIDerivedChannel channels[OBDII_DERIVED_MAX_CHANNELS];
+	int numChannels;
+	/** A channel is only valid while all of its inputs were received within this many seconds of each other. 0 to disable. */
+	double maxSkew;
+	double _values[OBDII_DERIVED_MAX_INPUTS];
+} OBDIIDerivedEngine;
+
+/** Initialize an engine with no channels.
+ *
+ * \param engine The engine
+ * \param maxSkew The initial value of `maxSkew`, in seconds
+ */
+void OBDIIDerivedEngineInit(OBDIIDerivedEngine *engine, double maxSkew);
+
+/** Define or change a constant that formulas can refer to, e.g. a vehicle parameter.
+ *
+ * Constants must be defined before the channels that refer to them. Changing a constant recomputes the channels that
+ * refer to it.
+ *
+ * \returns 0 on success, or -1 with errno set to ENAMETOOLONG or ENOSPC
+ */
+int OBDIIDerivedSetConstant(OBDIIDerivedEngine *engine, const char *name, double value);
+
+/** Add a derived channel.
+ *
+ * \param engine The engine
+ * \param name The name of the channel
+ * \param formula The formula, e.g. `OBDII_DERIVED_FUEL_RATE`
+ *
+ * \returns The index of the channel in `channels`, or -1 with errno set to EINVAL (syntax error), ENOENT (unknown
+ * command or constant, a command whose response isn't numeric or a bitfield, or more than `OBDII_DERIVED_MAX_INPUTS`
+ * inputs), ENAMETOOLONG or ENOSPC
+ */
+int OBDIIDerivedAddChannel(OBDIIDerivedEngine *engine, const char *name, const char *formula);
+
+/** Get the commands that must be queried to compute every channel, each exactly once. */
+OBDIICommandSet OBDIIDerivedGetCommands(const OBDIIDerivedEngine *engine);
+
+/** Feed a response into the engine, and update the channels that depend on it.
+ *
+ * \param engine The engine
+ * \param response A response to any command; unsuccessful responses and responses to other commands are ignored
+ * \param timestamp The time the response was received, in seconds, e.g. `OBDIIResponseTimestamp(response)`
+ *
+ * \returns The number of channels that were updated and are valid
+ */
+int OBDIIDerivedUpdate(OBDIIDerivedEngine *engine, const OBDIIResponse *response, double timestamp);
+
+/** Query each of the engine's commands once, feeding the responses into the engine as they arrive.
+ *
+ * \returns The number of channels that were updated and are valid
+ */
+int OBDIIDerivedPoll(OBDIIDerivedEngine *engine, OBDIISocket *s);
+
+#endif /* OBDIIDerived.h */
@@ -0,0 +1,220 @@
+#include "OBDIIDiscovery.h"
+#include "OBDIIISOTP.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+// PID of the last "supported PIDs" range in mode 1
+#define LAST_SUPPORTED_PIDS_RANGE 0xE0
+
+// The chain of probes sent to a single ECU
+typedef struct {
+	int answered;
+	int waiting; // Whether a probe is outstanding
+	unsigned char mode; // Mode and PID of the outstanding (or last) probe
+	unsigned char pid;
+	long long deadline;
+	OBDIICommandSet commands;
+} Probe;
+
+static long long monotonicMilliseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static int sendRequest(int s, canid_t id, unsigned char mode, unsigned char pid)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	memset(frame.data, OBDII_ISOTP_DEFAULT_PADDING, sizeof(frame.data));
+	frame.can_id = id;
+	frame.can_dlc = CAN_MAX_DLEN;
+	frame.data[0] = OBDII_ISOTP_PCI_SINGLE_FRAME | 2;
+	frame.data[1] = mode;
+	frame.data[2] = pid;
+
+	return write(s, &frame, sizeof(frame)) == sizeof(frame) ? 0 : -1;
+}
+
+// Moves an ECU's chain past its outstanding probe: on to the next mode 1 range if `continueMode1`, then to mode 9, then done
+static void sendNextProbe(int s, int ecu, Probe *probe, int continueMode1, long long now, int probeTimeoutMs)
+{
+	if (probe->mode == 0x01 && continueMode1 && probe->pid < LAST_SUPPORTED_PIDS_RANGE) {
+		probe->pid += 0x20;
+	} else if (probe->mode == 0x01) {
+		probe->mode = 0x09;
+		probe->pid = 0x00;
+	} else {
+		probe->waiting = 0;
+		return;
+	}
+
+	// A probe that could not be sent simply times out
+	sendRequest(s, OBDII_PHYSICAL_REQUEST_ID + ecu, probe->mode, probe->pid);
+	probe->waiting = 1;
+	probe->deadline = now + probeTimeoutMs;
+}
+
+static void handleResponse(int s, Probe *probes, const struct can_frame *frame, long long now, int probeTimeoutMs)
+{
+	canid_t id = frame->can_id;
+
+	if ((id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)) || id < OBDII_RESPONSE_ID || id >= OBDII_RESPONSE_ID + OBDII_NUM_ECUS) {
+		return;
+	}
+
+	// Responses to "supported PIDs" requests always fit in a single frame
+	int len = frame->data[0] & 0x0F;
+	if (frame->can_dlc < 3 || (frame->data[0] & OBDII_ISOTP_PCI_TYPE_MASK) != OBDII_ISOTP_PCI_SINGLE_FRAME || len < 2 || len > frame->can_dlc - 1) {
+		return;
+	}
+
+	int ecu = id - OBDII_RESPONSE_ID;
+	Probe *probe = &probes[ecu];
+	const unsigned char *payload = &frame->data[1];
+
+	if (payload[0] == 0x7F) {
+		// Negative response: the ECU doesn't support this range
+		if (probe->waiting && payload[1] == probe->mode) {
+			sendNextProbe(s, ecu, probe, 0, now, probeTimeoutMs);
+		}
+		return;
+	}
+
+	if (len < 6) {
+		return;
+	}
+
+	if (!probe->answered) {
+		// The broadcast request starts the ECU's chain
+		if (payload[0] != 0x41 || payload[1] != 0x00) {
+			return;
+		}
+
+		probe->answered = 1;
+		probe->mode = 0x01;
+		probe->pid = 0x00;
+	} else if (!probe->waiting || payload[0] != probe->mode + 0x40 || payload[1] != probe->pid) {
+		// A late or duplicate response
+		return;
+	}
+
+	uint32_t bitfield = (uint32_t)payload[2] << 24 | payload[3] << 16 | payload[4] << 8 | payload[5];
+	OBDIICommandSetAddSupportedPIDs(&probe->commands, probe->mode, probe->pid, bitfield);
+
+	// The last PID of each range flags whether the next range is supported
+	sendNextProbe(s, ecu, probe, bitfield & 0x01, now, probeTimeoutMs);
+}
+
+int OBDIIDiscoverSupportedCommandsOnSocket(int s, int probeTimeoutMs, OBDIIDiscoveredECU *ecus)
+{
+	Probe probes[OBDII_NUM_ECUS];
+	memset(probes, 0, sizeof(probes));
+
+	if (sendRequest(s, OBDII_FUNCTIONAL_REQUEST_ID, 0x01, 0x00) < 0) {
+		return -1;
+	}
+
+	// ECUs may answer the broadcast request until this deadline; each one that does is probed as soon as it answers
+	long long broadcastDeadline = monotonicMilliseconds() + probeTimeoutMs;
+	int i;
+
+	while (1) {
+		long long now = monotonicMilliseconds();
+		long long nextDeadline = now < broadcastDeadline ? broadcastDeadline : -1;
+
+		for (i = 0; i < OBDII_NUM_ECUS; ++i) {
+			Probe *probe = &probes[i];
+
+			if (probe->waiting && probe->deadline <= now) {
+				sendNextProbe(s, i, probe, 0, now, probeTimeoutMs);
+			}
+
+			if (probe->waiting && (nextDeadline < 0 || probe->deadline < nextDeadline)) {
+				nextDeadline = probe->deadline;
+			}
+		}
+
+		if (nextDeadline < 0) {
+			break;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = s;
+		pfd.events = POLLIN;
+
+		int retval = poll(&pfd, 1, (int)(nextDeadline - now));
+		if (retval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		struct can_frame frame;
+		while (retval > 0 && recv(s, &frame, sizeof(frame), MSG_DONTWAIT) == sizeof(frame)) {
+			handleResponse(s, probes, &frame, monotonicMilliseconds(), probeTimeoutMs);
+		}
+	}
+
+	int numECUs = 0;
+	for (i = 0; i < OBDII_NUM_ECUS; ++i) {
+		if (!probes[i].answered) {
+			continue;
+		}
+
+		// Same as OBDIIGetSupportedCommands: the commands used for discovery, and mode 3, are always included
+		OBDIICommandSetAddCommand(&probes[i].commands, OBDIICommands.mode1SupportedPIDs_1_to_20);
+		OBDIICommandSetAddCommand(&probes[i].commands, OBDIICommands.DTCs);
+		OBDIICommandSetAddCommand(&probes[i].commands, OBDIICommands.mode9SupportedPIDs);
+
+		ecus[numECUs].tid = OBDII_PHYSICAL_REQUEST_ID + i;
+		ecus[numECUs].rid = OBDII_RESPONSE_ID + i;
+		ecus[numECUs].commands = probes[i].commands;
+		numECUs++;
+	}
+
+	return numECUs;
+}
+
+int OBDIIDiscoverSupportedCommands(const char *ifname, int probeTimeoutMs, OBDIIDiscoveredECU *ecus)
+{
+	unsigned int ifindex = if_nametoindex(ifname);
+
+	if (ifindex == 0) {
+		return -1;
+	}
+
+	int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		return -1;
+	}
+
+	// Only the responses on 0x7E8-0x7EF
+	struct can_filter filter;
+	filter.can_id = OBDII_RESPONSE_ID;
+	filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | (CAN_SFF_MASK & ~(OBDII_NUM_ECUS - 1));
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+
+	if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) < 0 || bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(s);
+		return -1;
+	}
+
+	int numECUs = OBDIIDiscoverSupportedCommandsOnSocket(s, probeTimeoutMs, ecus);
+	close(s);
+
+	return numECUs;
+}
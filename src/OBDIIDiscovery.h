@@ -0,0 +1,48 @@
+#ifndef __OBDII_DISCOVERY_H
+#define __OBDII_DISCOVERY_H
+
+#include "OBDII.h"
+#include <linux/can.h>
+
+/** Default time an ECU is given to answer each discovery probe, in milliseconds */
+#define OBDII_DISCOVERY_DEFAULT_PROBE_TIMEOUT_MS 100
+
+/** The commands supported by an ECU that answered discovery */
+typedef struct OBDIIDiscoveredECU {
+	/** The ID used to address frames to the ECU, e.g. 0x7E0 */
+	canid_t tid;
+	/** The ID the ECU responds with, e.g. 0x7E8 */
+	canid_t rid;
+	/** The commands the ECU supports, as returned by `OBDIIGetSupportedCommands` */
+	OBDIICommandSet commands;
+} OBDIIDiscoveredECU;
+
+/** Discover the commands supported by every ECU on an interface at once.
+ *
+ * Calling `OBDIIGetSupportedCommands` for each of the 8 ECU addresses runs up to 9 queries per ECU one after the
+ * other, each waiting up to a second, so absent ECUs make a full scan take tens of seconds. Instead, this function
+ * broadcasts a single "supported PIDs" request on 0x7DF over a CAN_RAW socket, and every ECU that answers starts its own
+ * chain of physically addressed probes right away. The chains of all ECUs run in parallel, and each probe is given
+ * `probeTimeoutMs` to be answered, so the scan takes about as long as the slowest ECU's chain of round trips.
+ *
+ *     OBDIIDiscoveredECU ecus[OBDII_NUM_ECUS];
+ *     int i, numECUs = OBDIIDiscoverSupportedCommands("can0", OBDII_DISCOVERY_DEFAULT_PROBE_TIMEOUT_MS, ecus);
+ *     for (i = 0; i < numECUs; ++i) {
+ *         printf("%03x: %d commands\n", ecus[i].tid, ecus[i].commands.numCommands);
+ *     }
+ *
+ * \param ifname The name of the CAN interface
+ * \param probeTimeoutMs How long to wait for each response, in milliseconds
+ * \param ecus Filled in with one entry per ECU that answered, in address order. Must have room for `OBDII_NUM_ECUS` entries.
+ *
+ * \returns The number of ECUs that answered, or -1 on error
+ */
+int OBDIIDiscoverSupportedCommands(const char *ifname, int probeTimeoutMs, OBDIIDiscoveredECU *ecus);
+
+/** Same as `OBDIIDiscoverSupportedCommands`, on a CAN_RAW socket that is already bound to an interface.
+ *
+ * The socket must receive the responses on 0x7E8-0x7EF; frames with other IDs are ignored.
+ */
+int OBDIIDiscoverSupportedCommandsOnSocket(int s, int probeTimeoutMs, OBDIIDiscoveredECU *ecus);
+
+#endif /* OBDIIDiscovery.h */
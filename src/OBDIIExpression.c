@@ -0,0 +1,417 @@
+#include "OBDIIExpression.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+// Deepest recursion of the parser, which grows with nested parentheses and unary operators
+#define MAX_NESTING 256
+
+enum {
+	OpConstant,
+	OpVariable,
+	OpAdd,
+	OpSubtract,
+	OpMultiply,
+	OpDivide,
+	OpModulo,
+	OpAnd,
+	OpOr,
+	OpXor,
+	OpShiftLeft,
+	OpShiftRight,
+	OpMin,
+	OpMax,
+	OpNegate,
+	OpNot,
+	OpAbs
+};
+
+// Binary operators by precedence level, lowest first
+static const struct {
+	const char *token;
+	unsigned char opcode;
+	int level;
+} binaryOperators[] = {
+	{ "|", OpOr, 0 },
+	{ "^", OpXor, 1 },
+	{ "&", OpAnd, 2 },
+	{ "<<", OpShiftLeft, 3 },
+	{ ">>", OpShiftRight, 3 },
+	{ "+", OpAdd, 4 },
+	{ "-", OpSubtract, 4 },
+	{ "*", OpMultiply, 5 },
+	{ "/", OpDivide, 5 },
+	{ "%", OpModulo, 5 }
+};
+
+#define NUM_LEVELS 6
+
+static const struct {
+	const char *name;
+	unsigned char opcode;
+	int arity;
+} functions[] = {
+	{ "min", OpMin, 2 },
+	{ "max", OpMax, 2 },
+	{ "abs", OpAbs, 1 }
+};
+
+typedef struct {
+	const char *source;
+	const char *p;
+	OBDIIExpression *expression;
+	OBDIIExpressionResolver resolve;
+	void *context;
+	int depth; // Of the evaluation stack after the instructions emitted so far
+	int nesting;
+	int error;
+	int errorPosition;
+} Parser;
+
+// Bitwise operators work on integers; values that don't fit in one yield NAN
+static inline int toInteger(double x, int64_t *result)
+{
+	if (!(x > -9.2e18 && x < 9.2e18)) {
+		return 0;
+	}
+
+	*result = (int64_t)x;
+	return 1;
+}
+
+static inline double apply(unsigned char opcode, double a, double b)
+{
+	int64_t i, j;
+
+	switch (opcode) {
+		case OpAdd:
+			return a + b;
+		case OpSubtract:
+			return a - b;
+		case OpMultiply:
+			return a * b;
+		case OpDivide:
+			return a / b;
+		case OpModulo:
+			return fmod(a, b);
+		case OpMin:
+			return a < b ? a : b;
+		case OpMax:
+			return a > b ? a : b;
+		case OpNegate:
+			return -a;
+		case OpAbs:
+			return fabs(a);
+	}
+
+	if (!toInteger(a, &i) || (opcode != OpNot && !toInteger(b, &j))) {
+		return NAN;
+	}
+
+	switch (opcode) {
+		case OpAnd:
+			return (double)(i & j);
+		case OpOr:
+			return (double)(i | j);
+		case OpXor:
+			return (double)(i ^ j);
+		case OpShiftLeft:
+			return j < 0 || j > 63 ? NAN : (double)(int64_t)((uint64_t)i << j);
+		case OpShiftRight:
+			return j < 0 || j > 63 ? NAN : (double)(i >> j);
+		case OpNot:
+			return (double)~i;
+	}
+
+	return NAN;
+}
+
+static int fail(Parser *parser, int error)
+{
+	if (!parser->error) {
+		parser->error = error;
+		parser->errorPosition = (int)(parser->p - parser->source);
+	}
+
+	return -1;
+}
+
+static void skipSpaces(Parser *parser)
+{
+	while (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r') {
+		parser->p++;
+	}
+}
+
+static int emit(Parser *parser, unsigned char opcode, double constant, int variable)
+{
+	OBDIIExpression *expression = parser->expression;
+
+	if (expression->_length == OBDII_EXPRESSION_MAX_INSTRUCTIONS || parser->depth == OBDII_EXPRESSION_MAX_STACK) {
+		return fail(parser, EINVAL);
+	}
+
+	OBDIIExpressionInstruction *instruction = &expression->_code[expression->_length++];
+	instruction->opcode = opcode;
+	if (opcode == OpVariable) {
+		instruction->variable = variable;
+	} else {
+		instruction->constant = constant;
+	}
+	parser->depth++;
+
+	return 0;
+}
+
+// Emits an operator, or folds it into a constant if all of its operands are constants
+static int emitOperator(Parser *parser, unsigned char opcode, int arity)
+{
+	OBDIIExpression *expression = parser->expression;
+	OBDIIExpressionInstruction *operands = &expression->_code[expression->_length - arity];
+
+	if (operands[0].opcode == OpConstant && operands[arity - 1].opcode == OpConstant) {
+		double value = apply(opcode, operands[0].constant, operands[arity - 1].constant);
+		expression->_length -= arity;
+		parser->depth -= arity;
+		return emit(parser, OpConstant, value, 0);
+	}
+
+	if (expression->_length == OBDII_EXPRESSION_MAX_INSTRUCTIONS) {
+		return fail(parser, EINVAL);
+	}
+
+	expression->_code[expression->_length++].opcode = opcode;
+	parser->depth -= arity - 1;
+
+	return 0;
+}
+
+static int parseBinary(Parser *parser, int level);
+
+static int parseFunction(Parser *parser, const char *name, int length)
+{
+	size_t i;
+	for (i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i) {
+		if (strlen(functions[i].name) == (size_t)length && strncmp(functions[i].name, name, length) == 0) {
+			break;
+		}
+	}
+
+	if (i == sizeof(functions) / sizeof(functions[0])) {
+		parser->p = name;
+		return fail(parser, ENOENT);
+	}
+
+	int argument;
+	for (argument = 0; argument < functions[i].arity; ++argument) {
+		parser->p++; // The opening parenthesis or the comma before the argument
+
+		if (parseBinary(parser, 0) < 0) {
+			return -1;
+		}
+
+		skipSpaces(parser);
+		if (*parser->p != (argument == functions[i].arity - 1 ? ')' : ',')) {
+			return fail(parser, EINVAL);
+		}
+	}
+	parser->p++;
+
+	return emitOperator(parser, functions[i].opcode, functions[i].arity);
+}
+
+static int parsePrimary(Parser *parser)
+{
+	skipSpaces(parser);
+	const char *start = parser->p;
+
+	if ((*start >= '0' && *start <= '9') || *start == '.') {
+		char *end;
+		double value = strtod(start, &end);
+		if (end == start) {
+			return fail(parser, EINVAL);
+		}
+
+		if (emit(parser, OpConstant, value, 0) < 0) {
+			return -1;
+		}
+
+		parser->p = end;
+		return 0;
+	}
+
+	if ((*start >= 'a' && *start <= 'z') || (*start >= 'A' && *start <= 'Z') || *start == '_') {
+		const char *end = start;
+		while ((*end >= 'a' && *end <= 'z') || (*end >= 'A' && *end <= 'Z') || (*end >= '0' && *end <= '9') || *end == '_') {
+			end++;
+		}
+
+		parser->p = end;
+		skipSpaces(parser);
+		if (*parser->p == '(') {
+			return parseFunction(parser, start, (int)(end - start));
+		}
+
+		const char *next = parser->p;
+		parser->p = start;
+
+		int variable = parser->resolve ? parser->resolve(start, (int)(end - start), parser->context) : -1;
+		if (variable < 0 || variable >= OBDII_EXPRESSION_MAX_VARIABLES) {
+			return fail(parser, ENOENT);
+		}
+
+		if (emit(parser, OpVariable, 0, variable) < 0) {
+			return -1;
+		}
+
+		parser->expression->variables |= (uint32_t)1 << variable;
+		parser->p = next;
+		return 0;
+	}
+
+	if (*start == '(') {
+		parser->p++;
+		if (parseBinary(parser, 0) < 0) {
+			return -1;
+		}
+
+		skipSpaces(parser);
+		if (*parser->p != ')') {
+			return fail(parser, EINVAL);
+		}
+
+		parser->p++;
+		return 0;
+	}
+
+	return fail(parser, EINVAL);
+}
+
+static int parseUnary(Parser *parser)
+{
+	skipSpaces(parser);
+	char c = *parser->p;
+
+	if (c != '-' && c != '~' && c != '+') {
+		return parsePrimary(parser);
+	}
+
+	if (++parser->nesting > MAX_NESTING) {
+		return fail(parser, EINVAL);
+	}
+
+	parser->p++;
+	if (parseUnary(parser) < 0) {
+		return -1;
+	}
+	parser->nesting--;
+
+	return c == '+' ? 0 : emitOperator(parser, c == '-' ? OpNegate : OpNot, 1);
+}
+
+static int parseBinary(Parser *parser, int level)
+{
+	if (level == NUM_LEVELS) {
+		return parseUnary(parser);
+	}
+
+	if (++parser->nesting > MAX_NESTING) {
+		return fail(parser, EINVAL);
+	}
+
+	if (parseBinary(parser, level + 1) < 0) {
+		return -1;
+	}
+
+	while (1) {
+		skipSpaces(parser);
+
+		size_t i;
+		for (i = 0; i < sizeof(binaryOperators) / sizeof(binaryOperators[0]); ++i) {
+			size_t length = strlen(binaryOperators[i].token);
+			if (binaryOperators[i].level == level && strncmp(parser->p, binaryOperators[i].token, length) == 0) {
+				break;
+			}
+		}
+
+		if (i == sizeof(binaryOperators) / sizeof(binaryOperators[0])) {
+			break;
+		}
+
+		parser->p += strlen(binaryOperators[i].token);
+		if (parseBinary(parser, level + 1) < 0 || emitOperator(parser, binaryOperators[i].opcode, 2) < 0) {
+			return -1;
+		}
+	}
+
+	parser->nesting--;
+
+	return 0;
+}
+
+int OBDIIExpressionCompile(OBDIIExpression *expression, const char *source, OBDIIExpressionResolver resolve, void *context, int *errorPosition)
+{
+	Parser parser;
+	memset(&parser, 0, sizeof(parser));
+	parser.source = source;
+	parser.p = source;
+	parser.expression = expression;
+	parser.resolve = resolve;
+	parser.context = context;
+
+	expression->_length = 0;
+	expression->variables = 0;
+
+	if (parseBinary(&parser, 0) == 0) {
+		skipSpaces(&parser);
+		if (*parser.p != '\0') {
+			fail(&parser, EINVAL);
+		}
+	}
+
+	if (parser.error) {
+		expression->_length = 0;
+		expression->variables = 0;
+
+		if (errorPosition) {
+			*errorPosition = parser.errorPosition;
+		}
+
+		errno = parser.error;
+		return -1;
+	}
+
+	return 0;
+}
+
+double OBDIIExpressionEvaluate(const OBDIIExpression *expression, const double *variables)
+{
+	double stack[OBDII_EXPRESSION_MAX_STACK];
+	int top = -1;
+	int i;
+
+	for (i = 0; i < expression->_length; ++i) {
+		const OBDIIExpressionInstruction *instruction = &expression->_code[i];
+
+		switch (instruction->opcode) {
+			case OpConstant:
+				stack[++top] = instruction->constant;
+				break;
+			case OpVariable:
+				stack[++top] = variables[instruction->variable];
+				break;
+			case OpNegate:
+			case OpNot:
+			case OpAbs:
+				stack[top] = apply(instruction->opcode, stack[top], 0);
+				break;
+			default:
+				top--;
+				stack[top] = apply(instruction->opcode, stack[top], stack[top + 1]);
+				break;
+		}
+	}
+
+	return top == 0 ? stack[0] : NAN;
+}
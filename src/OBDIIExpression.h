@@ -0,0 +1,74 @@
+#ifndef __OBDII_EXPRESSION_H
+#define __OBDII_EXPRESSION_H
+
+#include <stdint.h>
+
+/** Maximum number of instructions in a compiled expression */
+#define OBDII_EXPRESSION_MAX_INSTRUCTIONS 64
+
+/** Maximum depth of the evaluation stack, i.e. of nested subexpressions */
+#define OBDII_EXPRESSION_MAX_STACK 16
+
+/** Maximum number of distinct variables an expression can refer to */
+#define OBDII_EXPRESSION_MAX_VARIABLES 32
+
+typedef struct OBDIIExpressionInstruction {
+	unsigned char opcode;
+	union {
+		double constant;
+		int variable;
+	};
+} OBDIIExpressionInstruction;
+
+/** A formula compiled to a fixed-size stack program.
+ *
+ * Formulas are written in infix notation with C operator precedence, over numbers (`737`, `0.5`, `0x1F`) and named
+ * variables:
+ *
+ * - arithmetic: `+`, `-`, `*`, `/`, `%`, unary `-`
+ * - bitwise, on the operands truncated to integers: `&`, `|`, `^`, `<<`, `>>`, unary `~`
+ * - functions: `min(a, b)`, `max(a, b)`, `abs(a)`
+ * - parentheses
+ *
+ * Compiling resolves each variable name to an index once, and folds constant subexpressions, so that evaluating is a
+ * single pass over a flat array of instructions without any allocation or string handling.
+ */
+typedef struct OBDIIExpression {
+	OBDIIExpressionInstruction _code[OBDII_EXPRESSION_MAX_INSTRUCTIONS];
+	int _length;
+	/** Bit `i` is set if the expression refers to variable `i` */
+	uint32_t variables;
+} OBDIIExpression;
+
+/** Type for a function that maps a variable name to its index.
+ *
+ * \param name The variable name; not NUL-terminated
+ * \param length The length of `name`
+ * \param context The context passed to `OBDIIExpressionCompile`
+ *
+ * \returns The index of the variable, between 0 and `OBDII_EXPRESSION_MAX_VARIABLES - 1`, or -1 if there is no such variable
+ */
+typedef int (*OBDIIExpressionResolver)(const char *name, int length, void *context);
+
+/** Compile a formula.
+ *
+ * \param expression The expression to fill in
+ * \param source The formula, e.g. "vehicleSpeed / (mafAirFlowRate * 3600 / (14.7 * 737))"
+ * \param resolve Maps the variable names in `source` to indices. May be NULL if `source` has no variables.
+ * \param context Passed to `resolve`
+ * \param errorPosition If not NULL and compiling fails, set to the offset in `source` where the error was detected
+ *
+ * \returns 0 on success, or -1 with errno set to EINVAL (syntax error, or formula too long or too deeply nested) or ENOENT (unknown variable)
+ */
+int OBDIIExpressionCompile(OBDIIExpression *expression, const char *source, OBDIIExpressionResolver resolve, void *context, int *errorPosition);
+
+/** Evaluate a compiled expression.
+ *
+ * \param expression The compiled expression
+ * \param variables The values of the variables, indexed as returned by the resolver
+ *
+ * \returns The value of the expression. Division by zero follows IEEE 754 rules (infinity or NAN).
+ */
+double OBDIIExpressionEvaluate(const OBDIIExpression *expression, const double *variables);
+
+#endif /* OBDIIExpression.h */
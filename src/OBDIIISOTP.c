@@ -0,0 +1,538 @@
+#include "OBDIIISOTP.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+#define DEFAULT_NUM_BUFFERS 4
+#define DEFAULT_CONSECUTIVE_FRAME_TIMEOUT_MS 1000
+
+const OBDIIISOTPOptions OBDIIISOTPDefaultOptions = { 0, 0, OBDII_ISOTP_DEFAULT_PADDING, DEFAULT_NUM_BUFFERS, DEFAULT_CONSECUTIVE_FRAME_TIMEOUT_MS };
+
+int OBDIIISOTPBufferPoolInit(OBDIIISOTPBufferPool *pool, int numBuffers)
+{
+	if (!pool || numBuffers <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pool->_storage = malloc(numBuffers * sizeof(OBDIIISOTPBuffer));
+	pool->_free = NULL;
+
+	if (!pool->_storage) {
+		return -1;
+	}
+
+	int i;
+	for (i = numBuffers - 1; i >= 0; --i) {
+		pool->_storage[i].next = pool->_free;
+		pool->_free = &pool->_storage[i];
+	}
+
+	return 0;
+}
+
+void OBDIIISOTPBufferPoolDestroy(OBDIIISOTPBufferPool *pool)
+{
+	if (pool && pool->_storage) {
+		free(pool->_storage);
+		pool->_storage = NULL;
+		pool->_free = NULL;
+	}
+}
+
+static inline OBDIIISOTPBuffer *acquireBuffer(OBDIIISOTPBufferPool *pool)
+{
+	OBDIIISOTPBuffer *buffer = pool->_free;
+	if (buffer) {
+		pool->_free = buffer->next;
+	}
+
+	return buffer;
+}
+
+static inline void releaseBuffer(OBDIIISOTPBufferPool *pool, OBDIIISOTPBuffer *buffer)
+{
+	buffer->next = pool->_free;
+	pool->_free = buffer;
+}
+
+void OBDIIISOTPSessionInit(OBDIIISOTPSession *session, OBDIIISOTPBufferPool *pool, canid_t tx_id, canid_t rx_id, unsigned char blockSize)
+{
+	memset(session, 0, sizeof(*session));
+	session->tid = tx_id;
+	session->rid = rx_id;
+	session->state = OBDIIISOTPSessionIdle;
+	session->_blockSize = blockSize;
+	session->_pool = pool;
+}
+
+void OBDIIISOTPSessionRelease(OBDIIISOTPSession *session)
+{
+	if (!session) {
+		return;
+	}
+
+	if (session->_buffer) {
+		releaseBuffer(session->_pool, session->_buffer);
+		session->_buffer = NULL;
+	}
+
+	session->message = NULL;
+	session->messageLength = 0;
+	session->state = OBDIIISOTPSessionIdle;
+}
+
+OBDIIISOTPFrameResult OBDIIISOTPSessionHandleFrame(OBDIIISOTPSession *session, const struct can_frame *frame, const struct timespec *timestamp)
+{
+	if (!session || !frame || frame->can_dlc < 1 || frame->can_dlc > CAN_MAX_DLEN) {
+		return OBDIIISOTPFrameIgnored;
+	}
+
+	int len;
+	const unsigned char *data = frame->data;
+
+	switch (data[0] & OBDII_ISOTP_PCI_TYPE_MASK) {
+		case OBDII_ISOTP_PCI_SINGLE_FRAME:
+			len = data[0] & 0x0F;
+			if (len == 0 || len > frame->can_dlc - 1) {
+				return OBDIIISOTPFrameIgnored;
+			}
+
+			// A new message supersedes whatever the session was holding
+			OBDIIISOTPSessionRelease(session);
+
+			memcpy(session->_singleFrame, &data[1], len);
+			session->message = session->_singleFrame;
+			session->messageLength = len;
+			session->state = OBDIIISOTPSessionComplete;
+			session->firstFrameTime = *timestamp;
+			session->lastFrameTime = *timestamp;
+			session->numFrames = 1;
+			session->numFlowControlFrames = 0;
+
+			return OBDIIISOTPFrameComplete;
+
+		case OBDII_ISOTP_PCI_FIRST_FRAME:
+			len = (data[0] & 0x0F) << 8 | data[1];
+
+			// First frames always fill the whole frame, and announce more than a single frame can hold
+			if (frame->can_dlc != CAN_MAX_DLEN || len <= OBDII_ISOTP_SINGLE_FRAME_MAX_PAYLOAD) {
+				return OBDIIISOTPFrameIgnored;
+			}
+
+			OBDIIISOTPSessionRelease(session);
+
+			if (!(session->_buffer = acquireBuffer(session->_pool))) {
+				return OBDIIISOTPFrameOverflow;
+			}
+
+			session->message = session->_buffer->data;
+			session->messageLength = len;
+			session->_received = CAN_MAX_DLEN - 2;
+			memcpy(session->message, &data[2], session->_received);
+
+			session->state = OBDIIISOTPSessionReceiving;
+			session->_nextSequenceNumber = 1;
+			session->_blockFramesLeft = session->_blockSize;
+			session->firstFrameTime = *timestamp;
+			session->lastFrameTime = *timestamp;
+			session->numFrames = 1;
+			session->numFlowControlFrames = 1;
+
+			return OBDIIISOTPFrameNeedsFlowControl;
+
+		case OBDII_ISOTP_PCI_CONSECUTIVE_FRAME:
+			if (session->state != OBDIIISOTPSessionReceiving) {
+				return OBDIIISOTPFrameIgnored;
+			}
+
+			len = session->messageLength - session->_received;
+			if (len > CAN_MAX_DLEN - 1) {
+				len = CAN_MAX_DLEN - 1;
+			}
+
+			// A lost or truncated frame makes the rest of the message meaningless
+			if ((data[0] & 0x0F) != session->_nextSequenceNumber || frame->can_dlc - 1 < len) {
+				OBDIIISOTPSessionRelease(session);
+				return OBDIIISOTPFrameIgnored;
+			}
+
+			memcpy(session->message + session->_received, &data[1], len);
+			session->_received += len;
+			session->_nextSequenceNumber = (session->_nextSequenceNumber + 1) & 0x0F;
+			session->lastFrameTime = *timestamp;
+			session->numFrames++;
+
+			if (session->_received == session->messageLength) {
+				session->state = OBDIIISOTPSessionComplete;
+				return OBDIIISOTPFrameComplete;
+			}
+
+			if (session->_blockSize && --session->_blockFramesLeft == 0) {
+				session->_blockFramesLeft = session->_blockSize;
+				session->numFlowControlFrames++;
+				return OBDIIISOTPFrameNeedsFlowControl;
+			}
+
+			return OBDIIISOTPFrameConsumed;
+
+		default:
+			// Flow control frames only matter to a sender of segmented messages
+			return OBDIIISOTPFrameIgnored;
+	}
+}
+
+void OBDIIISOTPBuildFlowControlFrame(struct can_frame *frame, canid_t tx_id, unsigned char flowStatus, unsigned char blockSize, unsigned char separationTime, unsigned char padding)
+{
+	memset(frame, 0, sizeof(*frame));
+	memset(frame->data, padding, sizeof(frame->data));
+	frame->can_id = tx_id;
+	frame->can_dlc = CAN_MAX_DLEN;
+	frame->data[0] = OBDII_ISOTP_PCI_FLOW_CONTROL | flowStatus;
+	frame->data[1] = blockSize;
+	frame->data[2] = separationTime;
+}
+
+static inline long long monotonicMilliseconds(const struct timespec *t)
+{
+	return t->tv_sec * 1000LL + t->tv_nsec / 1000000;
+}
+
+// Points the kernel filter of the stack's socket at the receive IDs of its open sessions
+static int updateFilters(OBDIIISOTPStack *stack)
+{
+	struct can_filter filters[OBDII_ISOTP_MAX_SESSIONS];
+	int i, numFilters = 0;
+
+	for (i = 0; i < OBDII_ISOTP_MAX_SESSIONS; ++i) {
+		OBDIIISOTPSession *session = &stack->_sessions[i];
+		if (!session->_inUse) {
+			continue;
+		}
+
+		filters[numFilters].can_id = session->rid;
+		if (session->rid & CAN_EFF_FLAG) {
+			filters[numFilters].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK;
+		} else {
+			filters[numFilters].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+		}
+		numFilters++;
+	}
+
+	return setsockopt(stack->s, SOL_CAN_RAW, CAN_RAW_FILTER, filters, numFilters * sizeof(struct can_filter));
+}
+
+int OBDIIISOTPStackOpen(OBDIIISOTPStack *stack, const char *ifname, const OBDIIISOTPOptions *options)
+{
+	memset(stack, 0, sizeof(*stack));
+	stack->s = -1;
+	stack->options = options ? *options : OBDIIISOTPDefaultOptions;
+
+	if (stack->options.numBuffers <= 0) {
+		stack->options.numBuffers = DEFAULT_NUM_BUFFERS;
+	}
+
+	if (stack->options.consecutiveFrameTimeout <= 0) {
+		stack->options.consecutiveFrameTimeout = DEFAULT_CONSECUTIVE_FRAME_TIMEOUT_MS;
+	}
+
+	if ((stack->ifindex = if_nametoindex(ifname)) == 0) {
+		return -1;
+	}
+
+	if (OBDIIISOTPBufferPoolInit(&stack->_pool, stack->options.numBuffers) < 0) {
+		return -1;
+	}
+
+	if ((stack->s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		goto err;
+	}
+
+	OBDIIEnableReceiveTimestamps(stack->s);
+
+	// No sessions yet, so don't receive anything
+	if (updateFilters(stack) < 0) {
+		goto err;
+	}
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = stack->ifindex;
+
+	if (bind(stack->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		goto err;
+	}
+
+	return 0;
+
+err:
+	if (stack->s >= 0) {
+		close(stack->s);
+		stack->s = -1;
+	}
+	OBDIIISOTPBufferPoolDestroy(&stack->_pool);
+	return -1;
+}
+
+int OBDIIISOTPStackClose(OBDIIISOTPStack *stack)
+{
+	if (!stack) {
+		return 0;
+	}
+
+	int i;
+	for (i = 0; i < OBDII_ISOTP_MAX_SESSIONS; ++i) {
+		OBDIIISOTPSessionRelease(&stack->_sessions[i]);
+		stack->_sessions[i]._inUse = 0;
+	}
+
+	OBDIIISOTPBufferPoolDestroy(&stack->_pool);
+
+	return close(stack->s);
+}
+
+OBDIIISOTPSession *OBDIIISOTPStackOpenSession(OBDIIISOTPStack *stack, canid_t tx_id, canid_t rx_id)
+{
+	OBDIIISOTPSession *available = NULL;
+	int i;
+
+	for (i = 0; i < OBDII_ISOTP_MAX_SESSIONS; ++i) {
+		OBDIIISOTPSession *session = &stack->_sessions[i];
+		if (session->_inUse && session->rid == rx_id) {
+			// Frames can only be dispatched to one session per receive ID
+			errno = EADDRINUSE;
+			return NULL;
+		} else if (!session->_inUse && !available) {
+			available = session;
+		}
+	}
+
+	if (!available) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	OBDIIISOTPSessionInit(available, &stack->_pool, tx_id, rx_id, stack->options.blockSize);
+	available->_inUse = 1;
+
+	if (updateFilters(stack) < 0) {
+		available->_inUse = 0;
+		return NULL;
+	}
+
+	return available;
+}
+
+void OBDIIISOTPStackCloseSession(OBDIIISOTPStack *stack, OBDIIISOTPSession *session)
+{
+	if (!stack || !session) {
+		return;
+	}
+
+	OBDIIISOTPSessionRelease(session);
+	session->_inUse = 0;
+	updateFilters(stack);
+}
+
+int OBDIIISOTPSend(OBDIIISOTPStack *stack, OBDIIISOTPSession *session, const unsigned char *payload, int len)
+{
+	if (len <= 0 || len > OBDII_ISOTP_SINGLE_FRAME_MAX_PAYLOAD) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	// Anything the session holds now answers an earlier request
+	OBDIIISOTPSessionRelease(session);
+
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	memset(frame.data, stack->options.padding, sizeof(frame.data));
+	frame.can_id = session->tid;
+	frame.can_dlc = CAN_MAX_DLEN;
+	frame.data[0] = OBDII_ISOTP_PCI_SINGLE_FRAME | len;
+	memcpy(&frame.data[1], payload, len);
+
+	if (write(stack->s, &frame, sizeof(frame)) != sizeof(frame)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static OBDIIISOTPSession *sessionForFrame(OBDIIISOTPStack *stack, const struct can_frame *frame)
+{
+	int i;
+	for (i = 0; i < OBDII_ISOTP_MAX_SESSIONS; ++i) {
+		OBDIIISOTPSession *session = &stack->_sessions[i];
+		if (session->_inUse && session->rid == frame->can_id) {
+			return session;
+		}
+	}
+
+	return NULL;
+}
+
+static void dispatchFrame(OBDIIISOTPStack *stack, const struct can_frame *frame, const struct timespec *timestamp)
+{
+	OBDIIISOTPSession *session = sessionForFrame(stack, frame);
+	if (!session) {
+		return;
+	}
+
+	struct can_frame flowControl;
+
+	switch (OBDIIISOTPSessionHandleFrame(session, frame, timestamp)) {
+		case OBDIIISOTPFrameNeedsFlowControl:
+			OBDIIISOTPBuildFlowControlFrame(&flowControl, session->tid, OBDII_ISOTP_FLOW_STATUS_CONTINUE, stack->options.blockSize, stack->options.separationTime, stack->options.padding);
+			if (write(stack->s, &flowControl, sizeof(flowControl)) != sizeof(flowControl)) {
+				OBDIIISOTPSessionRelease(session);
+			}
+			break;
+		case OBDIIISOTPFrameOverflow:
+			OBDIIISOTPBuildFlowControlFrame(&flowControl, session->tid, OBDII_ISOTP_FLOW_STATUS_OVERFLOW, 0, 0, stack->options.padding);
+			write(stack->s, &flowControl, sizeof(flowControl));
+			break;
+		default:
+			break;
+	}
+}
+
+// Abandons segmented messages whose sender has gone quiet
+static void expireStalledSessions(OBDIIISOTPStack *stack, const struct timespec *now)
+{
+	int i;
+	for (i = 0; i < OBDII_ISOTP_MAX_SESSIONS; ++i) {
+		OBDIIISOTPSession *session = &stack->_sessions[i];
+		if (session->_inUse && session->state == OBDIIISOTPSessionReceiving &&
+		    monotonicMilliseconds(now) - monotonicMilliseconds(&session->lastFrameTime) > stack->options.consecutiveFrameTimeout) {
+			OBDIIISOTPSessionRelease(session);
+		}
+	}
+}
+
+int OBDIIISOTPStackProcessPendingFrames(OBDIIISOTPStack *stack)
+{
+	int numFrames = 0;
+	struct can_frame frame;
+	struct timespec now;
+
+	while (1) {
+		ssize_t retval = OBDIIReceiveTimestamped(stack->s, &frame, sizeof(frame), MSG_DONTWAIT, &now);
+
+		if (retval < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
+
+		if (retval != sizeof(frame)) {
+			continue;
+		}
+
+		dispatchFrame(stack, &frame, &now);
+		numFrames++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	expireStalledSessions(stack, &now);
+
+	return numFrames;
+}
+
+int OBDIIISOTPReceive(OBDIIISOTPStack *stack, OBDIIISOTPSession *session, unsigned char **payload, int timeoutMs)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long deadline = monotonicMilliseconds(&now) + timeoutMs;
+
+	while (session->state != OBDIIISOTPSessionComplete) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long remaining = deadline - monotonicMilliseconds(&now);
+		if (remaining <= 0) {
+			return 0;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = stack->s;
+		pfd.events = POLLIN;
+
+		int retval = poll(&pfd, 1, (int)remaining);
+		if (retval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		if (retval > 0 && OBDIIISOTPStackProcessPendingFrames(stack) < 0) {
+			return -1;
+		}
+	}
+
+	*payload = session->message;
+	return session->messageLength;
+}
+
+int OBDIIEnableReceiveTimestamps(int s)
+{
+	int enable = 1;
+	return setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+}
+
+ssize_t OBDIIReceiveTimestamped(int s, void *buffer, size_t size, int flags, struct timespec *timestamp)
+{
+	union {
+		char buffer[CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
+
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+
+	ssize_t len = recvmsg(s, &msg, flags);
+	if (len < 0) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, timestamp);
+
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS) {
+			continue;
+		}
+
+		// The kernel stamps with CLOCK_REALTIME: carry over how long ago that was to the monotonic clock
+		struct timespec kernel, now;
+		memcpy(&kernel, CMSG_DATA(cmsg), sizeof(kernel));
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		long long age = (now.tv_sec - kernel.tv_sec) * 1000000000LL + (now.tv_nsec - kernel.tv_nsec);
+		if (age < 0) {
+			// The wall clock was stepped back in the meantime
+			break;
+		}
+
+		long long stamp = timestamp->tv_sec * 1000000000LL + timestamp->tv_nsec - age;
+		timestamp->tv_sec = stamp / 1000000000LL;
+		timestamp->tv_nsec = stamp % 1000000000LL;
+		break;
+	}
+
+	return len;
+}
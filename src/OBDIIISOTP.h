@@ -0,0 +1,255 @@
+#ifndef __OBDII_ISOTP_H
+#define __OBDII_ISOTP_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <linux/can.h>
+
+/** Largest payload that can be carried by an ISO-TP message with a 12-bit length */
+#define OBDII_ISOTP_MAX_PAYLOAD 4095
+
+/** Maximum number of sessions (ECUs) that can share a single `OBDIIISOTPStack` */
+#define OBDII_ISOTP_MAX_SESSIONS 16
+
+/** Largest payload that fits in a single frame, after the PCI byte */
+#define OBDII_ISOTP_SINGLE_FRAME_MAX_PAYLOAD (CAN_MAX_DLEN - 1)
+
+// ISO-TP protocol control information, carried in the high nibble of a frame's first byte
+#define OBDII_ISOTP_PCI_TYPE_MASK 0xF0
+#define OBDII_ISOTP_PCI_SINGLE_FRAME 0x00
+#define OBDII_ISOTP_PCI_FIRST_FRAME 0x10
+#define OBDII_ISOTP_PCI_CONSECUTIVE_FRAME 0x20
+#define OBDII_ISOTP_PCI_FLOW_CONTROL 0x30
+
+// Flow status values sent in the low nibble of a flow control frame
+#define OBDII_ISOTP_FLOW_STATUS_CONTINUE 0x00
+#define OBDII_ISOTP_FLOW_STATUS_WAIT 0x01
+#define OBDII_ISOTP_FLOW_STATUS_OVERFLOW 0x02
+
+/** Value used to pad unused bytes of a frame, as many ECUs ignore frames shorter than 8 bytes */
+#define OBDII_ISOTP_DEFAULT_PADDING 0x55
+
+/** A buffer large enough to hold any ISO-TP message. Messages are reassembled in place in these buffers. */
+typedef struct OBDIIISOTPBuffer {
+	unsigned char data[OBDII_ISOTP_MAX_PAYLOAD];
+	struct OBDIIISOTPBuffer *next; // Private
+} OBDIIISOTPBuffer;
+
+/** A fixed set of `OBDIIISOTPBuffer`s, allocated up front so that receiving a message never allocates. */
+typedef struct OBDIIISOTPBufferPool {
+	// Private
+	OBDIIISOTPBuffer *_storage;
+	OBDIIISOTPBuffer *_free;
+} OBDIIISOTPBufferPool;
+
+/** Initialize a buffer pool.
+ *
+ * \param pool The pool to initialize
+ * \param numBuffers The number of buffers, i.e. how many segmented messages can be in flight or unconsumed at once
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIISOTPBufferPoolInit(OBDIIISOTPBufferPool *pool, int numBuffers);
+
+/** Free the memory backing a buffer pool. No buffer from the pool may be in use. */
+void OBDIIISOTPBufferPoolDestroy(OBDIIISOTPBufferPool *pool);
+
+typedef enum OBDIIISOTPSessionState {
+	OBDIIISOTPSessionIdle,
+	OBDIIISOTPSessionReceiving,
+	OBDIIISOTPSessionComplete
+} OBDIIISOTPSessionState;
+
+/** The receive state for one (transfer ID, receive ID) pair.
+ *
+ * When `state` is `OBDIIISOTPSessionComplete`, `message` points to the reassembled payload, which stays valid until
+ * `OBDIIISOTPSessionRelease` is called. Single-frame messages are stored inside the session itself, and segmented
+ * messages are reassembled directly in a buffer taken from the session's pool, so a payload is never copied after it
+ * leaves the frame it arrived in.
+ */
+typedef struct OBDIIISOTPSession {
+	canid_t tid;
+	canid_t rid;
+	OBDIIISOTPSessionState state;
+
+	unsigned char *message;
+	int messageLength;
+
+	/** Frame-level timing of the most recent message: when its first and last frames arrived */
+	struct timespec firstFrameTime;
+	struct timespec lastFrameTime;
+	/** Number of frames that made up the most recent message */
+	unsigned int numFrames;
+	/** Number of flow control frames requested while receiving the most recent message */
+	unsigned int numFlowControlFrames;
+
+	// Private
+	int _inUse;
+	unsigned char _blockSize;
+	int _blockFramesLeft;
+	unsigned char _nextSequenceNumber;
+	int _received;
+	OBDIIISOTPBuffer *_buffer;
+	OBDIIISOTPBufferPool *_pool;
+	unsigned char _singleFrame[OBDII_ISOTP_SINGLE_FRAME_MAX_PAYLOAD];
+} OBDIIISOTPSession;
+
+/** The outcome of feeding a frame to `OBDIIISOTPSessionHandleFrame` */
+typedef enum OBDIIISOTPFrameResult {
+	/** The frame is not part of a message for this session (or was malformed) and was dropped */
+	OBDIIISOTPFrameIgnored,
+	/** The frame continued a message that is still incomplete */
+	OBDIIISOTPFrameConsumed,
+	/** The frame continued an incomplete message, and the sender now waits for a flow control frame */
+	OBDIIISOTPFrameNeedsFlowControl,
+	/** The frame completed a message, which is available through `session->message` */
+	OBDIIISOTPFrameComplete,
+	/** A first frame arrived but no buffer was free; the sender should be told to abort with an overflow flow control frame */
+	OBDIIISOTPFrameOverflow
+} OBDIIISOTPFrameResult;
+
+/** Initialize a session.
+ *
+ * \param session The session to initialize
+ * \param pool The pool from which buffers for segmented messages are taken
+ * \param tx_id The ID used to address frames (including flow control frames) to the ECU
+ * \param rx_id The ID the ECU uses for its frames
+ * \param blockSize The number of consecutive frames the ECU may send before waiting for the next flow control frame (0 for no limit)
+ */
+void OBDIIISOTPSessionInit(OBDIIISOTPSession *session, OBDIIISOTPBufferPool *pool, canid_t tx_id, canid_t rx_id, unsigned char blockSize);
+
+/** Run the receive state machine of a session on a frame sent by its ECU.
+ *
+ * This function never does any I/O. The caller is responsible for sending a flow control frame when asked to, which
+ * makes it usable both by `OBDIIISOTPStack` and by passive listeners that only observe other testers' traffic.
+ *
+ * \param session The session the frame is addressed to
+ * \param frame A frame whose ID is `session->rid`
+ * \param timestamp When the frame was received
+ *
+ * \returns What the frame did to the session's state
+ */
+OBDIIISOTPFrameResult OBDIIISOTPSessionHandleFrame(OBDIIISOTPSession *session, const struct can_frame *frame, const struct timespec *timestamp);
+
+/** Discard the session's current message (complete or not), returning its buffer to the pool. */
+void OBDIIISOTPSessionRelease(OBDIIISOTPSession *session);
+
+/** Build a flow control frame.
+ *
+ * \param frame The frame to fill in
+ * \param tx_id The ID the frame will be sent with
+ * \param flowStatus One of the `OBDII_ISOTP_FLOW_STATUS_*` values
+ * \param blockSize The BS parameter
+ * \param separationTime The STmin parameter, encoded as in ISO 15765-2 (0x00-0x7F: milliseconds, 0xF1-0xF9: 100-900 microseconds)
+ * \param padding The value of unused bytes
+ */
+void OBDIIISOTPBuildFlowControlFrame(struct can_frame *frame, canid_t tx_id, unsigned char flowStatus, unsigned char blockSize, unsigned char separationTime, unsigned char padding);
+
+/** Options for an `OBDIIISOTPStack`. Zero-initialized options are valid. */
+typedef struct OBDIIISOTPOptions {
+	/** The BS parameter sent in flow control frames (0 lets the ECU send all consecutive frames without waiting) */
+	unsigned char blockSize;
+	/** The STmin parameter sent in flow control frames, encoded as in ISO 15765-2 */
+	unsigned char separationTime;
+	/** Value used to pad unused bytes of transmitted frames */
+	unsigned char padding;
+	/** Number of pooled receive buffers, shared by all sessions (0 for 4) */
+	int numBuffers;
+	/** Maximum time to wait for the next consecutive frame of a message before abandoning it, in milliseconds (0 for 1000) */
+	int consecutiveFrameTimeout;
+} OBDIIISOTPOptions;
+
+/** Default stack options: no block size limit, no separation time, 0x55 padding, and 4 buffers */
+extern const OBDIIISOTPOptions OBDIIISOTPDefaultOptions;
+
+/** A user-space ISO-TP implementation on top of a single CAN_RAW socket.
+ *
+ * One stack serves every ECU on an interface: each ECU gets its own `OBDIIISOTPSession`, and frames read from the socket
+ * are dispatched to the session matching their ID. The kernel filter of the socket is kept in sync with the set of
+ * open sessions, so unrelated traffic never wakes the process up.
+ *
+ * The stack is not thread-safe.
+ */
+typedef struct OBDIIISOTPStack {
+	int s;
+	unsigned int ifindex;
+	OBDIIISOTPOptions options;
+
+	// Private
+	OBDIIISOTPBufferPool _pool;
+	OBDIIISOTPSession _sessions[OBDII_ISOTP_MAX_SESSIONS];
+} OBDIIISOTPStack;
+
+/** Open a user-space ISO-TP stack on a CAN interface.
+ *
+ * \param stack The stack to initialize
+ * \param ifname The name of the CAN interface
+ * \param options The stack options, or NULL for `OBDIIISOTPDefaultOptions`
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIISOTPStackOpen(OBDIIISOTPStack *stack, const char *ifname, const OBDIIISOTPOptions *options);
+
+/** Close a stack opened with `OBDIIISOTPStackOpen`. All of its sessions become invalid. */
+int OBDIIISOTPStackClose(OBDIIISOTPStack *stack);
+
+/** Open a session with an ECU.
+ *
+ * \returns The new session, or NULL if the stack already has `OBDII_ISOTP_MAX_SESSIONS` sessions or one for `rx_id`
+ */
+OBDIIISOTPSession *OBDIIISOTPStackOpenSession(OBDIIISOTPStack *stack, canid_t tx_id, canid_t rx_id);
+
+/** Close a session opened with `OBDIIISOTPStackOpenSession`. */
+void OBDIIISOTPStackCloseSession(OBDIIISOTPStack *stack, OBDIIISOTPSession *session);
+
+/** Send a payload to the session's ECU.
+ *
+ * Any message still held by the session is released first, since it can only be a stale response. Only single-frame
+ * payloads (at most 7 bytes) can be sent, which covers every diagnostic request.
+ *
+ * \returns 0 on success, -1 on error (errno is set to EMSGSIZE for payloads that do not fit in a single frame)
+ */
+int OBDIIISOTPSend(OBDIIISOTPStack *stack, OBDIIISOTPSession *session, const unsigned char *payload, int len);
+
+/** Wait for a complete message on a session.
+ *
+ * Frames for other sessions that arrive in the meantime are processed as well, so their messages are ready when their
+ * owners ask for them. On success, `*payload` points into the session's buffer; call `OBDIIISOTPSessionRelease` once
+ * done with it.
+ *
+ * \param stack The stack that owns the session
+ * \param session The session to wait on
+ * \param payload Filled in with a pointer to the message
+ * \param timeoutMs Maximum time to wait, in milliseconds
+ *
+ * \returns The length of the message, 0 on timeout, or -1 on error
+ */
+int OBDIIISOTPReceive(OBDIIISOTPStack *stack, OBDIIISOTPSession *session, unsigned char **payload, int timeoutMs);
+
+/** Read and dispatch every frame that is already queued on the stack's socket, without blocking.
+ *
+ * \returns The number of frames processed, or -1 on error
+ */
+int OBDIIISOTPStackProcessPendingFrames(OBDIIISOTPStack *stack);
+
+/** Have the kernel timestamp every frame or message received on a socket (SO_TIMESTAMPNS), for `OBDIIReceiveTimestamped`.
+ *
+ * The sockets opened by this library already have this enabled.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIEnableReceiveTimestamps(int s);
+
+/** Receive from a socket like `recv`, and tell when the data arrived.
+ *
+ * The time is the one the kernel stamped the data with when it arrived, if the socket has receive timestamps enabled,
+ * and otherwise the time of the call. Either way it is given on the CLOCK_MONOTONIC clock, so it excludes the time the
+ * data spent waiting to be read, and compares with the other timestamps of the library.
+ *
+ * \param timestamp Filled in with when the data arrived, on success
+ *
+ * \returns The number of bytes received, or -1 on error
+ */
+ssize_t OBDIIReceiveTimestamped(int s, void *buffer, size_t size, int flags, struct timespec *timestamp);
+
+#endif /* OBDIIISOTP.h */
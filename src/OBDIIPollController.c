@@ -0,0 +1,274 @@
+#include "OBDIIPollController.h"
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+// The bus load is measured over windows of this many seconds
+#define LOAD_WINDOW 1.0
+
+// The bits of a data frame besides its data: start of frame, identifier, control field, CRC, acknowledgement, end of
+// frame and interframe space. Stuff bits, which depend on the contents, are not counted.
+#define STANDARD_FRAME_OVERHEAD_BITS 47
+#define EXTENDED_FRAME_OVERHEAD_BITS 67
+
+void OBDIIPollControllerOptionsInit(OBDIIPollControllerOptions *options)
+{
+	options->bitrate = 500000;
+	options->highLoad = 0.6;
+	options->lowLoad = 0.3;
+	options->maxLoadScale = 16;
+	options->holdTime = 2;
+	options->timeoutsUntilAsleep = 3;
+	options->asleepInterval = 5;
+	options->engineOffScale = 2;
+	options->chargingVoltage = 13.2;
+}
+
+// Sets the interval of every command in the schedule from its unscaled interval, the bus load and the ECU state
+static void applyIntervals(OBDIIPollController *controller)
+{
+	OBDIIPollControllerEntry *probe = NULL;
+	int i;
+
+	for (i = 0; i < controller->_numEntries; ++i) {
+		if (!probe || controller->_entries[i].interval < probe->interval) {
+			probe = &controller->_entries[i];
+		}
+	}
+
+	for (i = 0; i < controller->_numEntries; ++i) {
+		OBDIIPollControllerEntry *entry = &controller->_entries[i];
+		double interval = entry->interval * controller->loadScale;
+
+		if (controller->state == OBDIIECUStateAsleep) {
+			interval = entry == probe ? controller->options.asleepInterval : 0;
+		} else if (controller->state == OBDIIECUStateEngineOff) {
+			interval *= controller->options.engineOffScale;
+		}
+
+		OBDIIPollScheduleSetInterval(controller->schedule, entry->command, interval);
+	}
+}
+
+void OBDIIPollControllerInit(OBDIIPollController *controller, OBDIIPollSchedule *schedule, const OBDIIPollControllerOptions *options)
+{
+	int i;
+
+	memset(controller, 0, sizeof(*controller));
+
+	if (options) {
+		controller->options = *options;
+	} else {
+		OBDIIPollControllerOptionsInit(&controller->options);
+	}
+
+	controller->schedule = schedule;
+	controller->s = -1;
+	controller->state = OBDIIECUStateRunning;
+	controller->busLoad = -1;
+	controller->loadScale = 1;
+	controller->_engineRPMs = NAN;
+	controller->_voltage = NAN;
+	controller->_windowStart = -1;
+
+	for (i = 0; i < schedule->numEntries; ++i) {
+		controller->_entries[i].command = schedule->entries[i].command;
+		controller->_entries[i].interval = schedule->entries[i].interval;
+	}
+	controller->_numEntries = schedule->numEntries;
+}
+
+int OBDIIPollControllerOpenBus(OBDIIPollController *controller, const char *ifname)
+{
+	unsigned int ifindex = if_nametoindex(ifname);
+
+	if (ifindex == 0) {
+		return -1;
+	}
+
+	int s = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+	if (s < 0) {
+		return -1;
+	}
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int error = errno;
+		close(s);
+		errno = error;
+		return -1;
+	}
+
+	OBDIIPollControllerClose(controller);
+	controller->s = s;
+
+	return s;
+}
+
+int OBDIIPollControllerSetInterval(OBDIIPollController *controller, OBDIICommand *command, double interval)
+{
+	OBDIIPollControllerEntry *entry = NULL;
+	int i;
+
+	for (i = 0; i < controller->_numEntries; ++i) {
+		if (controller->_entries[i].command == command) {
+			entry = &controller->_entries[i];
+		}
+	}
+
+	if (interval <= 0) {
+		if (entry) {
+			OBDIIPollScheduleSetInterval(controller->schedule, command, 0);
+			*entry = controller->_entries[--controller->_numEntries];
+			applyIntervals(controller);
+		}
+		return 0;
+	}
+
+	if (!entry) {
+		if (controller->_numEntries == OBDII_POLL_SCHEDULE_MAX_ENTRIES) {
+			errno = ENOSPC;
+			return -1;
+		}
+
+		entry = &controller->_entries[controller->_numEntries++];
+		entry->command = command;
+	}
+
+	entry->interval = interval;
+	applyIntervals(controller);
+
+	return 0;
+}
+
+void OBDIIPollControllerCountFrame(OBDIIPollController *controller, const struct can_frame *frame)
+{
+	int overhead = (frame->can_id & CAN_EFF_FLAG) ? EXTENDED_FRAME_OVERHEAD_BITS : STANDARD_FRAME_OVERHEAD_BITS;
+
+	// Remote frames carry no data
+	controller->_bits += overhead + ((frame->can_id & CAN_RTR_FLAG) ? 0 : 8 * (frame->can_dlc & 0x0F));
+}
+
+int OBDIIPollControllerSubmit(OBDIIPollController *controller, const OBDIIResponse *response)
+{
+	OBDIIECUState state;
+
+	// Anything that arrived, even an error, means the ECU is awake, and only a request the ECU was given its full time
+	// to answer means that it may be asleep. Anything else (a refusal repeated from the socket's cache of unsupported
+	// commands, a request that couldn't be sent, or one the caller gave up on early) says nothing either way.
+	int answered = response->timestamp.tv_sec || response->timestamp.tv_nsec;
+
+	if (!answered && !response->timedOut) {
+		return 0;
+	}
+
+	if (!answered) {
+		if (++controller->_consecutiveTimeouts < controller->options.timeoutsUntilAsleep || controller->state == OBDIIECUStateAsleep) {
+			return 0;
+		}
+
+		// The engine may be in any state once the ECU wakes up
+		controller->_engineRPMs = NAN;
+		controller->_voltage = NAN;
+		state = OBDIIECUStateAsleep;
+	} else {
+		controller->_consecutiveTimeouts = 0;
+
+		if (response->success && response->command == OBDIICommands.engineRPMs) {
+			controller->_engineRPMs = response->numericValue;
+		} else if (response->success && response->command == OBDIICommands.controlModuleVoltage) {
+			controller->_voltage = response->numericValue;
+		}
+
+		// The engine speed says it best; the voltage only tells whether the alternator is charging
+		int engineOff = 0;
+		if (!isnan(controller->_engineRPMs)) {
+			engineOff = controller->_engineRPMs <= 0;
+		} else if (!isnan(controller->_voltage)) {
+			engineOff = controller->_voltage < controller->options.chargingVoltage;
+		}
+
+		state = engineOff ? OBDIIECUStateEngineOff : OBDIIECUStateRunning;
+	}
+
+	if (state == controller->state) {
+		return 0;
+	}
+
+	controller->state = state;
+	applyIntervals(controller);
+
+	return 1;
+}
+
+int OBDIIPollControllerUpdate(OBDIIPollController *controller, double now)
+{
+	const OBDIIPollControllerOptions *options = &controller->options;
+
+	if (controller->s >= 0) {
+		struct can_frame frame;
+		while (recv(controller->s, &frame, sizeof(frame), MSG_DONTWAIT) == sizeof(frame)) {
+			OBDIIPollControllerCountFrame(controller, &frame);
+		}
+	}
+
+	if (controller->_windowStart < 0) {
+		controller->_windowStart = now;
+		return 0;
+	}
+
+	double windowStart = controller->_windowStart, elapsed = now - windowStart;
+	if (elapsed < LOAD_WINDOW) {
+		return 0;
+	}
+
+	controller->busLoad = controller->_bits / (options->bitrate * elapsed);
+	controller->_bits = 0;
+	controller->_windowStart = now;
+
+	int direction = 0;
+	if (controller->busLoad > options->highLoad && controller->loadScale < options->maxLoadScale) {
+		direction = 1;
+	} else if (controller->busLoad < options->lowLoad && controller->loadScale > 1) {
+		direction = -1;
+	}
+
+	// The load was past the threshold over the whole window
+	if (direction != controller->_loadDirection) {
+		controller->_loadDirection = direction;
+		controller->_pastThresholdSince = windowStart;
+	}
+
+	if (direction == 0 || now - controller->_pastThresholdSince < options->holdTime) {
+		return 0;
+	}
+
+	controller->loadScale = direction > 0 ? controller->loadScale * 2 : controller->loadScale / 2;
+	if (controller->loadScale > options->maxLoadScale) {
+		controller->loadScale = options->maxLoadScale;
+	} else if (controller->loadScale < 1) {
+		controller->loadScale = 1;
+	}
+
+	// The next step needs the load to stay past the threshold for another hold time
+	controller->_pastThresholdSince = now;
+	applyIntervals(controller);
+
+	return 1;
+}
+
+void OBDIIPollControllerClose(OBDIIPollController *controller)
+{
+	if (controller->s >= 0) {
+		close(controller->s);
+		controller->s = -1;
+	}
+}
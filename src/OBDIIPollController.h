@@ -0,0 +1,155 @@
+#ifndef __OBDII_POLL_CONTROLLER_H
+#define __OBDII_POLL_CONTROLLER_H
+
+#include <linux/can.h>
+
+#include "OBDII.h"
+#include "OBDIIPollSchedule.h"
+
+/** What the responses of an ECU say about the vehicle */
+typedef enum OBDIIECUState {
+	/** The ECU answers, and nothing says that the engine is off */
+	OBDIIECUStateRunning,
+	/** The ECU answers, but the engine isn't turning, or the alternator isn't charging */
+	OBDIIECUStateEngineOff,
+	/** The ECU stopped answering, e.g. because the ignition is off */
+	OBDIIECUStateAsleep
+} OBDIIECUState;
+
+/** How `OBDIIPollController` scales a schedule */
+typedef struct OBDIIPollControllerOptions {
+	/** The bitrate of the bus, in bit/s */
+	unsigned int bitrate;
+	/** The intervals are stretched while the bus load stays above `highLoad`, and shrunk back while it stays below
+	 * `lowLoad`, as fractions of the bitrate */
+	double highLoad;
+	double lowLoad;
+	/** The most the intervals may be stretched because of the bus load */
+	double maxLoadScale;
+	/** How long the load must stay past a threshold before the intervals are stretched or shrunk, in seconds */
+	double holdTime;
+	/** The number of queries in a row that must time out before the ECU is considered asleep */
+	int timeoutsUntilAsleep;
+	/** While the ECU is asleep, only the command with the shortest interval is polled, at this interval, in seconds */
+	double asleepInterval;
+	/** The intervals are multiplied by this while the engine is off */
+	double engineOffScale;
+	/** Without an engine speed, the engine is considered off while `controlModuleVoltage` is below this, in volts */
+	float chargingVoltage;
+} OBDIIPollControllerOptions;
+
+typedef struct OBDIIPollControllerEntry {
+	OBDIICommand *command;
+	/** The interval set by the caller, before scaling, in seconds */
+	double interval;
+} OBDIIPollControllerEntry;
+
+/** Scales the intervals of a poll schedule to what the bus and the ECU can take.
+ *
+ * The controller estimates the load of the bus from the frames a CAN_RAW socket sees, and stretches every interval of
+ * the schedule by powers of two while the load stays above a high threshold, shrinking them back while it stays below
+ * a low one. Both thresholds must be crossed for `holdTime` before each step, so that the rates don't oscillate.
+ *
+ * It also tracks the state of the ECU from the responses: queries that time out in a row mean that the ECU is asleep,
+ * and then only the command with the shortest interval is polled, slowly, to notice when it wakes up instead of
+ * waiting out a timeout for every command. While the engine is off (`engineRPMs` is 0, or without it,
+ * `controlModuleVoltage` says the alternator isn't charging), the intervals are stretched by `engineOffScale`. Poll one
+ * of these commands, if only slowly, to detect it.
+ *
+ *     OBDIIPollController controller;
+ *     OBDIIPollControllerInit(&controller, &schedule, NULL);
+ *     int bus = OBDIIPollControllerOpenBus(&controller, "can0");
+ *
+ *     // In the polling loop
+ *     OBDIIPollControllerUpdate(&controller, now);
+ *     OBDIICommand *command = OBDIIPollScheduleNextDue(&schedule, now, &nextDue);
+ *     ...
+ *     OBDIIResponse response = OBDIIPerformQuery(&s, command);
+ *     OBDIIPollControllerSubmit(&controller, &response);
+ *
+ * The controller owns the intervals of the schedule: change them with `OBDIIPollControllerSetInterval`. Commands
+ * polled back to back (with a tiny interval) stay so whatever the load.
+ */
+typedef struct OBDIIPollController {
+	OBDIIPollControllerOptions options;
+	OBDIIPollSchedule *schedule;
+	/** The CAN_RAW socket counting frames, or -1 */
+	int s;
+	/** The state of the ECU */
+	OBDIIECUState state;
+	/** The share of the bitrate used over the last second, or -1 before it is known */
+	double busLoad;
+	/** The factor the intervals are currently stretched by because of the bus load */
+	double loadScale;
+	OBDIIPollControllerEntry _entries[OBDII_POLL_SCHEDULE_MAX_ENTRIES];
+	int _numEntries;
+	int _consecutiveTimeouts;
+	/** The latest engine speed and voltage, or NAN if unknown */
+	float _engineRPMs;
+	float _voltage;
+	/** The number of bits counted since `_windowStart` */
+	unsigned long _bits;
+	double _windowStart;
+	/** 1 if the load is past the high threshold, -1 if it is past the low one, 0 if it is between them */
+	int _loadDirection;
+	/** When the load crossed the threshold it is past, or when the intervals last changed because of it */
+	double _pastThresholdSince;
+} OBDIIPollController;
+
+/** Fill in the default options: a 500 kbit/s bus, thresholds at 60% and 30%, stretching up to 16 times after 2
+ * seconds, asleep after 3 timeouts in a row and then polling every 5 seconds, intervals doubled while the engine is
+ * off, and a charging voltage of 13.2 V. */
+void OBDIIPollControllerOptionsInit(OBDIIPollControllerOptions *options);
+
+/** Initialize a controller, taking the current intervals of a schedule as the unscaled ones.
+ *
+ * \param controller The controller
+ * \param schedule The schedule to scale, which must outlive the controller
+ * \param options The options, or NULL for the defaults
+ */
+void OBDIIPollControllerInit(OBDIIPollController *controller, OBDIIPollSchedule *schedule, const OBDIIPollControllerOptions *options);
+
+/** Open a nonblocking CAN_RAW socket to count the frames on an interface.
+ *
+ * Callers that already receive every frame (e.g. with a sniffer) can pass them to `OBDIIPollControllerCountFrame`
+ * instead.
+ *
+ * \returns The socket, to wait for alongside the others, or -1 on error
+ */
+int OBDIIPollControllerOpenBus(OBDIIPollController *controller, const char *ifname);
+
+/** Add a command, change its unscaled interval, or remove it.
+ *
+ * \returns 0 on success, or -1 with errno set to ENOSPC if the schedule is full
+ */
+int OBDIIPollControllerSetInterval(OBDIIPollController *controller, OBDIICommand *command, double interval);
+
+/** Count a frame towards the bus load. */
+void OBDIIPollControllerCountFrame(OBDIIPollController *controller, const struct can_frame *frame);
+
+/** Feed the response to a query into the controller, to track the state of the ECU.
+ *
+ * \param controller The controller
+ * \param response The response to any query. A response with a `timestamp` is an answer, even if unsuccessful; one
+ *        without is a timeout if it is `timedOut`, and is ignored otherwise: a query that couldn't be sent, that was
+ *        cancelled or hit the caller's deadline before the ECU's time was up, or a refusal the socket repeated from
+ *        memory (see `OBDIIUnsupportedCode`) says nothing about the ECU.
+ *
+ * \returns 1 if the state changed and the intervals with it, 0 otherwise
+ */
+int OBDIIPollControllerSubmit(OBDIIPollController *controller, const OBDIIResponse *response);
+
+/** Count the frames received by the socket opened by `OBDIIPollControllerOpenBus`, if any, and scale the intervals if
+ * the bus load stayed past a threshold for long enough. Call this in every iteration of the polling loop.
+ *
+ * \param controller The controller
+ * \param now The current time, in seconds, on the clock of the schedule
+ *
+ * \returns 1 if the intervals changed, 0 otherwise
+ */
+int OBDIIPollControllerUpdate(OBDIIPollController *controller, double now);
+
+/** Close the controller's socket, if any. */
+void OBDIIPollControllerClose(OBDIIPollController *controller);
+
+#endif /* OBDIIPollController.h */
@@ -0,0 +1,126 @@
+#include "OBDIIPollSchedule.h"
+#include <string.h>
+#include <errno.h>
+
+static OBDIIPollScheduleEntry *entryForCommand(const OBDIIPollSchedule *schedule, OBDIICommand *command)
+{
+	int i;
+	for (i = 0; i < schedule->numEntries; ++i) {
+		if (schedule->entries[i].command == command) {
+			return (OBDIIPollScheduleEntry *)&schedule->entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+void OBDIIPollScheduleInit(OBDIIPollSchedule *schedule)
+{
+	memset(schedule, 0, sizeof(*schedule));
+}
+
+int OBDIIPollScheduleSetInterval(OBDIIPollSchedule *schedule, OBDIICommand *command, double interval)
+{
+	OBDIIPollScheduleEntry *entry = entryForCommand(schedule, command);
+
+	if (interval <= 0) {
+		if (entry) {
+			*entry = schedule->entries[--schedule->numEntries];
+		}
+		return 0;
+	}
+
+	if (!entry) {
+		if (schedule->numEntries == OBDII_POLL_SCHEDULE_MAX_ENTRIES) {
+			errno = ENOSPC;
+			return -1;
+		}
+
+		// Never polled, so due right away
+		entry = &schedule->entries[schedule->numEntries++];
+		entry->command = command;
+		entry->interval = interval;
+		entry->nextDue = 0;
+		entry->lastPolled = -1;
+		return 0;
+	}
+
+	entry->interval = interval;
+	if (entry->lastPolled >= 0) {
+		entry->nextDue = entry->lastPolled + interval;
+	}
+
+	return 0;
+}
+
+double OBDIIPollScheduleGetInterval(const OBDIIPollSchedule *schedule, OBDIICommand *command)
+{
+	OBDIIPollScheduleEntry *entry = entryForCommand(schedule, command);
+
+	return entry ? entry->interval : 0;
+}
+
+OBDIICommand *OBDIIPollScheduleNextDue(const OBDIIPollSchedule *schedule, double now, double *nextDue)
+{
+	const OBDIIPollScheduleEntry *earliest = NULL;
+	int i;
+
+	for (i = 0; i < schedule->numEntries; ++i) {
+		if (!earliest || schedule->entries[i].nextDue < earliest->nextDue) {
+			earliest = &schedule->entries[i];
+		}
+	}
+
+	if (nextDue) {
+		*nextDue = earliest ? earliest->nextDue : -1;
+	}
+
+	return earliest && earliest->nextDue <= now ? earliest->command : NULL;
+}
+
+void OBDIIPollScheduleMarkPolled(OBDIIPollSchedule *schedule, OBDIICommand *command, double now)
+{
+	OBDIIPollScheduleEntry *entry = entryForCommand(schedule, command);
+	if (!entry) {
+		return;
+	}
+
+	entry->lastPolled = now;
+	entry->nextDue += entry->interval;
+
+	// A command that fell more than an interval behind starts over, instead of being queried back to back to catch up
+	if (entry->nextDue <= now) {
+		entry->nextDue = now + entry->interval;
+	}
+}
+
+int OBDIIPollScheduleRecommendRates(const double *ceilings, const double *maxRates, int numCommands, double headroom, double *rates)
+{
+	double capacity = 0;
+	int numMeasured = 0, i;
+
+	for (i = 0; i < numCommands; ++i) {
+		if (maxRates[i] > 0) {
+			capacity += ceilings[i];
+			numMeasured++;
+		}
+	}
+
+	if (numMeasured == 0) {
+		memset(rates, 0, numCommands * sizeof(*rates));
+		return 0;
+	}
+
+	// The mean of the back-to-back rates, shared by every command
+	capacity /= numMeasured;
+	double share = headroom * capacity / numMeasured;
+
+	for (i = 0; i < numCommands; ++i) {
+		rates[i] = maxRates[i] > 0 ? headroom * maxRates[i] : 0;
+		if (rates[i] > share) {
+			rates[i] = share;
+		}
+	}
+
+	return numMeasured;
+}
@@ -0,0 +1,101 @@
+#ifndef __OBDII_POLL_SCHEDULE_H
+#define __OBDII_POLL_SCHEDULE_H
+
+#include "OBDII.h"
+
+/** Maximum number of commands in a poll schedule */
+#define OBDII_POLL_SCHEDULE_MAX_ENTRIES 64
+
+typedef struct OBDIIPollScheduleEntry {
+	OBDIICommand *command;
+	/** The time between two queries of the command, in seconds */
+	double interval;
+	/** The time the command is next due, in seconds */
+	double nextDue;
+	/** The time the command was last queried, in seconds */
+	double lastPolled;
+} OBDIIPollScheduleEntry;
+
+/** The commands to query periodically on one ECU, each at its own interval.
+ *
+ * The schedule only keeps time; the caller sends the queries. Only one query can be outstanding on an ECU at a time, so
+ * whenever the ECU is idle, the caller asks for the most overdue command, queries it, and marks it as polled:
+ *
+ *     OBDIIPollSchedule schedule;
+ *     OBDIIPollScheduleInit(&schedule);
+ *     OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 0.1);
+ *     OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.fuelTankLevelInput, 10);
+ *
+ *     double nextDue;
+ *     OBDIICommand *command = OBDIIPollScheduleNextDue(&schedule, now, &nextDue);
+ *     if (command) {
+ *         OBDIISendRequest(&s, command);
+ *         OBDIIPollScheduleMarkPolled(&schedule, command, now);
+ *     } else {
+ *         // Sleep until nextDue
+ *     }
+ *
+ * A command that is queried on time keeps its phase, so its rate doesn't drift with the latency of each query.
+ */
+typedef struct OBDIIPollSchedule {
+	OBDIIPollScheduleEntry entries[OBDII_POLL_SCHEDULE_MAX_ENTRIES];
+	int numEntries;
+} OBDIIPollSchedule;
+
+/** Initialize an empty schedule. */
+void OBDIIPollScheduleInit(OBDIIPollSchedule *schedule);
+
+/** Add a command to a schedule, change its interval, or remove it.
+ *
+ * A new command is due right away. A command whose interval changes is next due one new interval after it was last queried.
+ *
+ * \param schedule The schedule
+ * \param command The command
+ * \param interval The time between two queries, in seconds, or 0 to remove the command
+ *
+ * \returns 0 on success, or -1 with errno set to ENOSPC if the schedule is full
+ */
+int OBDIIPollScheduleSetInterval(OBDIIPollSchedule *schedule, OBDIICommand *command, double interval);
+
+/** Get the interval of a command.
+ *
+ * \returns The interval in seconds, or 0 if the command is not in the schedule
+ */
+double OBDIIPollScheduleGetInterval(const OBDIIPollSchedule *schedule, OBDIICommand *command);
+
+/** Get the command that is most overdue.
+ *
+ * \param schedule The schedule
+ * \param now The current time, in seconds
+ * \param nextDue If not NULL, set to the earliest time any command is due, or -1 if the schedule is empty
+ *
+ * \returns The command whose due time is the furthest in the past, or NULL if no command is due yet
+ */
+OBDIICommand *OBDIIPollScheduleNextDue(const OBDIIPollSchedule *schedule, double now, double *nextDue);
+
+/** Record that a command was queried, and compute when it is next due.
+ *
+ * \param schedule The schedule
+ * \param command The command that was queried
+ * \param now The current time, in seconds
+ */
+void OBDIIPollScheduleMarkPolled(OBDIIPollSchedule *schedule, OBDIICommand *command, double now);
+
+/** Recommend a rate for each of the commands to poll on one ECU, from the rates measured for them (e.g. by
+ * `obdii-bench`).
+ *
+ * The ECU answers one query at a time, so the back-to-back rate of every command estimates the ECU's capacity, and
+ * their mean is taken as the capacity. `headroom` of the capacity is shared evenly among the commands, and no command
+ * gets more than `headroom` of the highest rate it sustained.
+ *
+ * \param ceilings The back-to-back rate of each command, in Hz
+ * \param maxRates The highest rate each command sustained, in Hz, or 0 for commands to leave out
+ * \param numCommands The number of commands
+ * \param headroom The share of the capacity and of each command's highest rate to use, e.g. 0.8
+ * \param rates Filled in with the recommended rate of each command, in Hz, or 0 for those left out
+ *
+ * \returns The number of commands with a recommended rate
+ */
+int OBDIIPollScheduleRecommendRates(const double *ceilings, const double *maxRates, int numCommands, double headroom, double *rates);
+
+#endif /* OBDIIPollSchedule.h */
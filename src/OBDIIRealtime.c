@@ -0,0 +1,100 @@
+#define _GNU_SOURCE // For pthread_setaffinity_np
+
+#include "OBDIIRealtime.h"
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define DEFAULT_STACK_SIZE (256 * 1024)
+
+void OBDIIRealtimeOptionsInit(OBDIIRealtimeOptions *options)
+{
+	options->cpu = -1;
+	options->priority = 0;
+	options->lockMemory = 1;
+	options->stackSize = DEFAULT_STACK_SIZE;
+}
+
+void OBDIIPrefault(void *buffer, size_t size)
+{
+	volatile unsigned char *bytes = buffer;
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	// Writing back what is there faults the page in as writable, without changing it
+	for (i = 0; i < size; i += pageSize) {
+		bytes[i] = bytes[i];
+	}
+
+	if (size > 0) {
+		bytes[size - 1] = bytes[size - 1];
+	}
+}
+
+// Grows the stack to its size in the loop, so that the loop doesn't fault on it
+static __attribute__((noinline)) void prefaultStack(size_t size)
+{
+	unsigned char stack[size];
+
+	memset(stack, 0, size);
+	__asm__ __volatile__("" : : "r"(stack) : "memory");
+}
+
+int OBDIIEnterRealtimeMode(const OBDIIRealtimeOptions *options)
+{
+	OBDIIRealtimeOptions defaults;
+
+	if (!options) {
+		OBDIIRealtimeOptionsInit(&defaults);
+		options = &defaults;
+	}
+
+	if (options->cpu >= CPU_SETSIZE || options->priority < 0 || options->priority > sched_get_priority_max(SCHED_FIFO)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (options->cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(options->cpu, &cpus);
+
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (error) {
+			errno = error;
+			return -1;
+		}
+	}
+
+	if (options->priority > 0) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = options->priority;
+
+		int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (error) {
+			errno = error;
+			return -1;
+		}
+	}
+
+	if (options->lockMemory) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			return -1;
+		}
+
+		// Keep freed memory around instead of unmapping it, and serve large allocations from it too
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+	}
+
+	if (options->stackSize > 0) {
+		prefaultStack(options->stackSize);
+	}
+
+	return 0;
+}
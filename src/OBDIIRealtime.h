@@ -0,0 +1,57 @@
+#ifndef __OBDII_REALTIME_H
+#define __OBDII_REALTIME_H
+
+#include <stddef.h>
+
+/** How `OBDIIEnterRealtimeMode` sets up the calling thread */
+typedef struct OBDIIRealtimeOptions {
+	/** The CPU to pin the thread to, or -1 to leave its affinity alone */
+	int cpu;
+	/** The SCHED_FIFO priority of the thread, from 1 to 99, or 0 to keep the normal scheduler */
+	int priority;
+	/** Whether to lock every current and future page of the process in memory */
+	int lockMemory;
+	/** The amount of stack to fault in up front, in bytes */
+	size_t stackSize;
+} OBDIIRealtimeOptions;
+
+/** Fill in the default options: no pinning, the normal scheduler, locked memory and 256 KiB of prefaulted stack. */
+void OBDIIRealtimeOptionsInit(OBDIIRealtimeOptions *options);
+
+/** Set up the calling thread for an acquisition loop with low jitter.
+ *
+ * Page faults and preemption by other threads are the main sources of jitter in a polling loop. With locked memory,
+ * the pages of the process stay resident, and freed heap memory is kept rather than given back to the kernel, so that
+ * later allocations don't fault either. The stack the loop will use is faulted in up front. Pinning the thread to a
+ * CPU (ideally one isolated with `isolcpus`) keeps its caches warm, and SCHED_FIFO lets it preempt every normal thread
+ * as soon as a response arrives.
+ *
+ * Call this once the buffers of the loop are allocated, e.g. after opening the sockets and initializing a cycle, and
+ * touch other large buffers with `OBDIIPrefault`. `OBDIIPerformQuery` and `OBDIICyclePerform` don't allocate for
+ * numeric and bitfield commands.
+ *
+ *     OBDIIRealtimeOptions options;
+ *     OBDIIRealtimeOptionsInit(&options);
+ *     options.cpu = 3;
+ *     options.priority = 80;
+ *     if (OBDIIEnterRealtimeMode(&options) < 0) {
+ *         perror("OBDIIEnterRealtimeMode");
+ *     }
+ *
+ * Locking memory and SCHED_FIFO need the CAP_IPC_LOCK and CAP_SYS_NICE capabilities (or matching resource limits).
+ *
+ * \param options The options, or NULL for the defaults
+ *
+ * \returns 0 on success, -1 on error. The steps are taken in the order of the fields of `OBDIIRealtimeOptions`, and
+ *          the ones before a failing step stay in effect.
+ */
+int OBDIIEnterRealtimeMode(const OBDIIRealtimeOptions *options);
+
+/** Fault in every page of a buffer, by writing to it.
+ *
+ * \param buffer The buffer; its contents are preserved
+ * \param size The size of the buffer, in bytes
+ */
+void OBDIIPrefault(void *buffer, size_t size);
+
+#endif /* OBDIIRealtime.h */
@@ -0,0 +1,443 @@
+#include "OBDIIRecorder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RECORDER_MAGIC "OBDIIREC"
+#define RECORDER_VERSION 2
+
+// The bytes of a value each slot holds, and the most slots a record can span
+#define RECORDER_SLOT_DATA_SIZE 8
+#define RECORDER_MAX_PARTS 255
+
+// Set on the records of commands that aren't built in
+#define RECORDER_FLAG_DEFINED 0x01
+
+// The first bytes of the file; the records follow
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t capacity;
+	unsigned char reserved[44];
+} RecorderHeader;
+
+// Sequence number n (counting from 1) goes in slot (n - 1) % capacity. A record takes consecutive sequence numbers,
+// one per slot, and every slot repeats the record's header, so that each is checked on its own.
+typedef struct {
+	uint64_t sequence;
+	uint64_t timestamp; // Nanoseconds
+	uint32_t rid;
+	uint16_t pid; // Or the data identifier, for mode 0x22
+	unsigned char mode;
+	unsigned char flags;
+	unsigned char part; // The index of the slot within the record
+	unsigned char numParts;
+	unsigned char length; // The number of bytes of `data` in use
+	unsigned char reserved;
+	unsigned char data[RECORDER_SLOT_DATA_SIZE]; // The next part of the value
+	uint32_t crc; // Of the preceding fields
+} RecorderSlot;
+
+// CRC-32 (IEEE 802.3), half a byte at a time so that the table stays small
+static uint32_t crc32(const unsigned char *data, size_t len)
+{
+	static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+	};
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+	}
+
+	return ~crc;
+}
+
+static double monotonicTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static inline RecorderSlot *slotForSequence(OBDIIRecorder *recorder, uint64_t sequence)
+{
+	return (RecorderSlot *)(recorder->_map + sizeof(RecorderHeader)) + (sequence - 1) % recorder->capacity;
+}
+
+// Whether a slot was written completely, as opposed to never, or torn by a crash
+static int slotIsValid(const RecorderSlot *slot)
+{
+	return slot->sequence != 0 && slot->crc == crc32((const unsigned char *)slot, offsetof(RecorderSlot, crc));
+}
+
+// Finds the slot that was written last, so that recording resumes right after it
+static void recoverRecords(OBDIIRecorder *recorder)
+{
+	uint64_t last = 0;
+	uint32_t i;
+
+	for (i = 0; i < recorder->capacity; ++i) {
+		RecorderSlot *slot = (RecorderSlot *)(recorder->_map + sizeof(RecorderHeader)) + i;
+
+		if (slotIsValid(slot) && (slot->sequence - 1) % recorder->capacity == i && slot->sequence > last) {
+			last = slot->sequence;
+		}
+	}
+
+	recorder->_nextSequence = last + 1;
+}
+
+static int initializeFile(int fd, uint32_t capacity, size_t size)
+{
+	// Allocate every block now, so that storing into the mapping can't fail for lack of space later on
+	int error = posix_fallocate(fd, 0, size);
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	RecorderHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORDER_MAGIC, sizeof(header.magic));
+	header.version = RECORDER_VERSION;
+	header.recordSize = sizeof(RecorderSlot);
+	header.capacity = capacity;
+
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		return -1;
+	}
+
+	return fsync(fd);
+}
+
+int OBDIIRecorderOpen(OBDIIRecorder *recorder, const char *path, uint32_t capacity, double syncInterval)
+{
+	memset(recorder, 0, sizeof(*recorder));
+	recorder->syncInterval = syncInterval;
+
+	if ((recorder->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(recorder->fd, &st) < 0) {
+		goto err;
+	}
+
+	if (st.st_size == 0) {
+		if (capacity == 0) {
+			errno = EINVAL;
+			goto err;
+		}
+
+		if (initializeFile(recorder->fd, capacity, sizeof(RecorderHeader) + (size_t)capacity * sizeof(RecorderSlot)) < 0) {
+			goto err;
+		}
+	} else {
+		RecorderHeader header;
+
+		if (pread(recorder->fd, &header, sizeof(header), 0) != sizeof(header)
+				|| memcmp(header.magic, RECORDER_MAGIC, sizeof(header.magic)) != 0
+				|| header.version != RECORDER_VERSION || header.recordSize != sizeof(RecorderSlot) || header.capacity == 0
+				|| (capacity != 0 && header.capacity != capacity)
+				|| (size_t)st.st_size != sizeof(RecorderHeader) + (size_t)header.capacity * sizeof(RecorderSlot)) {
+			errno = EINVAL;
+			goto err;
+		}
+
+		capacity = header.capacity;
+	}
+
+	recorder->capacity = capacity;
+	recorder->_mapSize = sizeof(RecorderHeader) + (size_t)capacity * sizeof(RecorderSlot);
+	recorder->_map = mmap(NULL, recorder->_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->fd, 0);
+	if (recorder->_map == MAP_FAILED) {
+		recorder->_map = NULL;
+		goto err;
+	}
+
+	recoverRecords(recorder);
+	recorder->_lastSync = monotonicTime();
+
+	return 0;
+
+err:
+	{
+		int error = errno;
+		close(recorder->fd);
+		recorder->fd = -1;
+		errno = error;
+	}
+	return -1;
+}
+
+// Serializes the value of a response, returning its length, or -1 if it is too long to record. Numeric and bitfield
+// values take 4 bytes, oxygen sensor values 8, strings their length and trouble codes 5 bytes each.
+static int encodeValue(const OBDIIResponse *response, unsigned char *value, int size)
+{
+	OBDIICommand *command = response->command;
+	int i, len;
+
+	switch (command->responseType) {
+		case OBDIIResponseTypeBitfield:
+			len = sizeof(response->bitfieldValue);
+			memcpy(value, &response->bitfieldValue, len);
+			return len;
+		case OBDIIResponseTypeNumeric:
+			len = sizeof(response->numericValue);
+			memcpy(value, &response->numericValue, len);
+			return len;
+		case OBDIIResponseTypeString:
+			len = response->stringValue ? strlen(response->stringValue) : 0;
+			if (len > size) {
+				return -1;
+			}
+			memcpy(value, response->stringValue, len);
+			return len;
+		default:
+			break;
+	}
+
+	if (command != OBDIICommands.DTCs) {
+		len = sizeof(response->oxygenSensorValues);
+		memcpy(value, &response->oxygenSensorValues, len);
+		return len;
+	}
+
+	if (response->DTCs.numTroubleCodes * 5 > size) {
+		return -1;
+	}
+
+	for (i = 0; i < response->DTCs.numTroubleCodes; ++i) {
+		memcpy(value + i * 5, response->DTCs.troubleCodes[i], 5);
+	}
+
+	return response->DTCs.numTroubleCodes * 5;
+}
+
+// The inverse of encodeValue, allocating strings and trouble codes like the decoders do
+static int decodeValue(OBDIIResponse *response, const unsigned char *value, int len)
+{
+	OBDIICommand *command = response->command;
+	int i;
+
+	switch (command->responseType) {
+		case OBDIIResponseTypeBitfield:
+			if (len != sizeof(response->bitfieldValue)) {
+				return -1;
+			}
+			memcpy(&response->bitfieldValue, value, len);
+			return 0;
+		case OBDIIResponseTypeNumeric:
+			if (len != sizeof(response->numericValue)) {
+				return -1;
+			}
+			memcpy(&response->numericValue, value, len);
+			return 0;
+		case OBDIIResponseTypeString:
+			if (!(response->stringValue = (char *)malloc(len + 1))) {
+				return -1;
+			}
+			memcpy(response->stringValue, value, len);
+			response->stringValue[len] = '\0';
+			return 0;
+		default:
+			break;
+	}
+
+	if (command != OBDIICommands.DTCs) {
+		if (len != sizeof(response->oxygenSensorValues)) {
+			return -1;
+		}
+		memcpy(&response->oxygenSensorValues, value, len);
+		return 0;
+	}
+
+	if (len % 5 != 0 || (len > 0 && !(response->DTCs.troubleCodes = calloc(len / 5, sizeof(*response->DTCs.troubleCodes))))) {
+		return -1;
+	}
+
+	response->DTCs.numTroubleCodes = len / 5;
+	for (i = 0; i < response->DTCs.numTroubleCodes; ++i) {
+		memcpy(response->DTCs.troubleCodes[i], value + i * 5, 5);
+	}
+
+	return 0;
+}
+
+int OBDIIRecorderAppend(OBDIIRecorder *recorder, canid_t rid, const OBDIIResponse *response, double timestamp)
+{
+	OBDIICommand *command = response ? response->command : NULL;
+
+	if (!recorder || !recorder->_map || !command || !response->success) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	unsigned char value[RECORDER_MAX_PARTS * RECORDER_SLOT_DATA_SIZE];
+	int len = encodeValue(response, value, sizeof(value));
+	int numParts = len > RECORDER_SLOT_DATA_SIZE ? (len + RECORDER_SLOT_DATA_SIZE - 1) / RECORDER_SLOT_DATA_SIZE : 1;
+
+	// A record can't overwrite its own beginning
+	if (len < 0 || (uint32_t)numParts > recorder->capacity) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	RecorderSlot slot;
+	memset(&slot, 0, sizeof(slot));
+	slot.timestamp = timestamp > 0 ? (uint64_t)(timestamp * 1e9) : 0;
+	slot.rid = rid;
+	slot.mode = OBDIICommandGetMode(command);
+	if (slot.mode == OBDII_MODE_READ_DATA_BY_IDENTIFIER) {
+		slot.pid = command->payload[1] << 8 | command->payload[2];
+	} else {
+		slot.pid = OBDIICommandGetPID(command);
+	}
+	if (slot.mode == OBDII_MODE_READ_DATA_BY_IDENTIFIER || command != OBDIICommandWithModeAndPID(slot.mode, slot.pid)) {
+		slot.flags = RECORDER_FLAG_DEFINED;
+	}
+	slot.numParts = numParts;
+
+	// A crash in the middle of the copies leaves a slot whose CRC doesn't match, which recovery and reading skip
+	int offset;
+	for (offset = 0; slot.part < numParts; ++slot.part, offset += RECORDER_SLOT_DATA_SIZE) {
+		slot.sequence = recorder->_nextSequence;
+		slot.length = len - offset < RECORDER_SLOT_DATA_SIZE ? len - offset : RECORDER_SLOT_DATA_SIZE;
+		memset(slot.data, 0, sizeof(slot.data));
+		memcpy(slot.data, value + offset, slot.length);
+		slot.crc = crc32((const unsigned char *)&slot, offsetof(RecorderSlot, crc));
+
+		memcpy(slotForSequence(recorder, recorder->_nextSequence), &slot, sizeof(slot));
+		recorder->_nextSequence++;
+	}
+	recorder->_dirty = 1;
+
+	if (monotonicTime() - recorder->_lastSync >= recorder->syncInterval) {
+		return OBDIIRecorderSync(recorder);
+	}
+
+	return 0;
+}
+
+// Gathers the value of the record that starts at `sequence`, returning its length, or -1 if the sequence number
+// doesn't start a complete record
+static int readValue(OBDIIRecorder *recorder, uint64_t sequence, RecorderSlot *first, unsigned char *value)
+{
+	RecorderSlot slot;
+	int part, len = 0;
+
+	memcpy(first, slotForSequence(recorder, sequence), sizeof(*first));
+	if (!slotIsValid(first) || first->sequence != sequence || first->part != 0 || sequence + first->numParts > recorder->_nextSequence) {
+		return -1;
+	}
+
+	for (part = 0; part < first->numParts; ++part) {
+		memcpy(&slot, slotForSequence(recorder, sequence + part), sizeof(slot));
+		if (!slotIsValid(&slot) || slot.sequence != sequence + part || slot.part != part || slot.numParts != first->numParts || slot.length > RECORDER_SLOT_DATA_SIZE) {
+			return -1;
+		}
+
+		memcpy(value + len, slot.data, slot.length);
+		len += slot.length;
+	}
+
+	return len;
+}
+
+static OBDIICommand *commandForSlot(OBDIIRecorder *recorder, const RecorderSlot *slot)
+{
+	if (slot->flags & RECORDER_FLAG_DEFINED) {
+		return recorder->definitions ? OBDIIDefinitionsCommandWithModeAndPID(recorder->definitions, slot->mode, slot->pid) : NULL;
+	}
+
+	return OBDIICommandWithModeAndPID(slot->mode, slot->pid);
+}
+
+int OBDIIRecorderRead(OBDIIRecorder *recorder, uint64_t after, OBDIIRecord *record)
+{
+	if (!recorder || !recorder->_map || !record) {
+		return 0;
+	}
+
+	uint64_t sequence = after + 1;
+	if (recorder->_nextSequence > recorder->capacity && sequence < recorder->_nextSequence - recorder->capacity) {
+		// Overwritten already
+		sequence = recorder->_nextSequence - recorder->capacity;
+	}
+
+	// Skips the slots that continue a record, and the records that are torn or whose command is unknown
+	for (; sequence < recorder->_nextSequence; ++sequence) {
+		RecorderSlot slot;
+		unsigned char value[RECORDER_MAX_PARTS * RECORDER_SLOT_DATA_SIZE];
+
+		int len = readValue(recorder, sequence, &slot, value);
+		OBDIICommand *command = len < 0 ? NULL : commandForSlot(recorder, &slot);
+		if (!command) {
+			continue;
+		}
+
+		memset(record, 0, sizeof(*record));
+		record->response.command = command;
+		if (decodeValue(&record->response, value, len) < 0) {
+			OBDIIResponseFree(&record->response);
+			continue;
+		}
+		record->response.success = 1;
+		record->rid = slot.rid;
+		record->timestamp = slot.timestamp / 1e9;
+		record->sequence = sequence;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int OBDIIRecorderSync(OBDIIRecorder *recorder)
+{
+	if (!recorder || !recorder->_map) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	recorder->_lastSync = monotonicTime();
+
+	if (!recorder->_dirty) {
+		return 0;
+	}
+
+	// Only the pages written since the last flush go to storage, however large the range
+	recorder->_dirty = 0;
+	return msync(recorder->_map, recorder->_mapSize, MS_SYNC);
+}
+
+int OBDIIRecorderClose(OBDIIRecorder *recorder)
+{
+	if (!recorder || !recorder->_map) {
+		return 0;
+	}
+
+	int retval = OBDIIRecorderSync(recorder);
+
+	munmap(recorder->_map, recorder->_mapSize);
+	recorder->_map = NULL;
+
+	if (close(recorder->fd) < 0) {
+		retval = -1;
+	}
+	recorder->fd = -1;
+
+	return retval;
+}
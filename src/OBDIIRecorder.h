@@ -0,0 +1,120 @@
+#ifndef __OBDII_RECORDER_H
+#define __OBDII_RECORDER_H
+
+#include "OBDII.h"
+#include "OBDIIDefinitions.h"
+#include <stddef.h>
+#include <linux/can.h>
+
+/** A response read back from a recorder */
+typedef struct OBDIIRecord {
+	/** The value, as if returned by `OBDIIPerformQuery`; always successful. Free it with `OBDIIResponseFree`. */
+	OBDIIResponse response;
+	/** The response ID of the ECU that answered */
+	canid_t rid;
+	/** The timestamp the response was recorded with, in seconds */
+	double timestamp;
+	/** The sequence number of the record's first slot, starting at 1 */
+	uint64_t sequence;
+} OBDIIRecord;
+
+/** A black box that keeps the most recent responses in a fixed-size file, and survives crashes and power loss.
+ *
+ * The file is a ring of fixed-size slots, mapped into memory: recording a response is a copy into the mapping, with
+ * no system call. The kernel writes dirty pages back on its own schedule; in addition, the recorder flushes them with
+ * `msync` at most once every `syncInterval` seconds while recording, which bounds both the data lost on power loss and
+ * the number of times each flash page is rewritten. Each slot carries a sequence number and a CRC, so that opening the file after a
+ * crash finds the last complete slot and ignores a torn one.
+ *
+ * A numeric, bitfield or oxygen sensor value fits in one slot. Strings and trouble codes span as many consecutive slots
+ * as they need (the VIN takes three, and each trouble code five bytes of eight per slot), and are only read back if
+ * every one of their slots is intact.
+ *
+ *     OBDIIRecorder recorder;
+ *     OBDIIRecorderOpen(&recorder, "/var/lib/obdii/blackbox", 10 * 60 * 100, 1.0);
+ *
+ *     OBDIIResponse response = OBDIIPerformQuery(&s, OBDIICommands.engineRPMs);
+ *     if (response.success) {
+ *         OBDIIRecorderAppend(&recorder, s.rid, &response, now);
+ *     }
+ *
+ * After a crash, the records are read back in order, oldest first:
+ *
+ *     OBDIIRecord record;
+ *     uint64_t sequence = 0;
+ *     while (OBDIIRecorderRead(&recorder, sequence, &record) == 1) {
+ *         sequence = record.sequence;
+ *         printf("%.3f %s\n", record.timestamp, record.response.command->name);
+ *         OBDIIResponseFree(&record.response);
+ *     }
+ *
+ * Any successful response can be recorded. Records of commands that aren't built in, e.g. those defined at runtime,
+ * are read back through `definitions`. The file is in host byte order.
+ */
+typedef struct OBDIIRecorder {
+	int fd;
+	/** The number of slots the file holds before the oldest ones are overwritten */
+	uint32_t capacity;
+	/** The time, in seconds, after which recording a response also flushes the records that precede it */
+	double syncInterval;
+	/** Where to look up the commands of records that aren't built in, by mode and PID; their records are skipped if
+	 * this is NULL (the default) or they aren't defined there */
+	const OBDIIDefinitions *definitions;
+
+	// Private
+	unsigned char *_map;
+	size_t _mapSize;
+	uint64_t _nextSequence;
+	double _lastSync;
+	int _dirty;
+} OBDIIRecorder;
+
+/** Open a recording, creating the file if needed, and recover its records.
+ *
+ * \param recorder The recorder struct that will be filled in by the call
+ * \param path The path of the file
+ * \param capacity The number of slots the file holds, or 0 to use an existing file's
+ * \param syncInterval The time, in seconds, after which recording a response also flushes the records recorded since
+ *        the last flush; 0 flushes every record. Call `OBDIIRecorderSync` when recording pauses.
+ *
+ * \returns 0 on success, -1 on error (errno is set to EINVAL if the file is not a recording, or holds a different
+ *          number of slots than `capacity`)
+ */
+int OBDIIRecorderOpen(OBDIIRecorder *recorder, const char *path, uint32_t capacity, double syncInterval);
+
+/** Record a response, overwriting the oldest record once the file is full.
+ *
+ * \param recorder The recorder
+ * \param rid The response ID of the ECU that answered
+ * \param response A successful response
+ * \param timestamp The time the response was received, in seconds on any clock: CLOCK_REALTIME is meaningful after a
+ *        reboot, and `OBDIIResponseTimestamp(response)` lines up with the other samples of the run
+ *
+ * \returns 0 on success, -1 on error (errno is set to EINVAL if the response is unsuccessful, or its value needs more
+ *          than 255 slots or the whole file)
+ */
+int OBDIIRecorderAppend(OBDIIRecorder *recorder, canid_t rid, const OBDIIResponse *response, double timestamp);
+
+/** Read the oldest record that follows a given one.
+ *
+ * \param recorder The recorder
+ * \param after The sequence number of the previous record read, or 0 to start from the oldest record
+ * \param record Filled in with the record, whose response must be freed with `OBDIIResponseFree`
+ *
+ * \returns 1 if a record was read, 0 if there are no more records
+ */
+int OBDIIRecorderRead(OBDIIRecorder *recorder, uint64_t after, OBDIIRecord *record);
+
+/** Flush the records to storage right away.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIRecorderSync(OBDIIRecorder *recorder);
+
+/** Flush the records and close the file.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIRecorderClose(OBDIIRecorder *recorder);
+
+#endif /* OBDIIRecorder.h */
@@ -0,0 +1,230 @@
+#include "OBDIISniffer.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+// Segmented responses that may be reassembled at the same time, one per responding ECU
+#define SNIFFER_NUM_BUFFERS OBDII_NUM_ECUS
+
+int OBDIISnifferInit(OBDIISniffer *sniffer, OBDIISnifferCallback callback, void *context)
+{
+	memset(sniffer, 0, sizeof(*sniffer));
+	sniffer->s = -1;
+	sniffer->callback = callback;
+	sniffer->context = context;
+
+	if (OBDIIISOTPBufferPoolInit(&sniffer->_pool, SNIFFER_NUM_BUFFERS) < 0) {
+		return -1;
+	}
+
+	int i;
+	for (i = 0; i < OBDII_NUM_ECUS; ++i) {
+		// Block size 0: the active tester is the one sending flow control
+		OBDIIISOTPSessionInit(&sniffer->_responses[i], &sniffer->_pool, OBDII_PHYSICAL_REQUEST_ID + i, OBDII_RESPONSE_ID + i, 0);
+	}
+
+	return 0;
+}
+
+int OBDIISnifferOpen(OBDIISniffer *sniffer, const char *ifname, OBDIISnifferCallback callback, void *context)
+{
+	unsigned int ifindex = if_nametoindex(ifname);
+
+	if (ifindex == 0) {
+		return -1;
+	}
+
+	if (OBDIISnifferInit(sniffer, callback, context) < 0) {
+		return -1;
+	}
+
+	if ((sniffer->s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		OBDIISnifferClose(sniffer);
+		return -1;
+	}
+
+	OBDIIEnableReceiveTimestamps(sniffer->s);
+
+	// Functional requests on 0x7DF, and physical requests and responses on 0x7E0-0x7EF
+	struct can_filter filters[2];
+	filters[0].can_id = OBDII_FUNCTIONAL_REQUEST_ID;
+	filters[0].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+	filters[1].can_id = OBDII_PHYSICAL_REQUEST_ID;
+	filters[1].can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | (CAN_SFF_MASK & ~0x0F);
+
+	if (setsockopt(sniffer->s, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters)) < 0) {
+		OBDIISnifferClose(sniffer);
+		return -1;
+	}
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifindex;
+
+	if (bind(sniffer->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		OBDIISnifferClose(sniffer);
+		return -1;
+	}
+
+	return 0;
+}
+
+int OBDIISnifferClose(OBDIISniffer *sniffer)
+{
+	if (!sniffer) {
+		return 0;
+	}
+
+	int i;
+	for (i = 0; i < OBDII_NUM_ECUS; ++i) {
+		OBDIIISOTPSessionRelease(&sniffer->_responses[i]);
+	}
+
+	OBDIIISOTPBufferPoolDestroy(&sniffer->_pool);
+
+	int retval = 0;
+	if (sniffer->s >= 0) {
+		retval = close(sniffer->s);
+		sniffer->s = -1;
+	}
+
+	return retval;
+}
+
+// Records the command requested by a tester, so that the response can be matched to it
+static void handleRequest(OBDIISniffer *sniffer, const struct can_frame *frame, const struct timespec *timestamp)
+{
+	// Requests always fit in a single frame; anything else is flow control sent by the tester
+	if (frame->can_dlc < 2 || (frame->data[0] & OBDII_ISOTP_PCI_TYPE_MASK) != OBDII_ISOTP_PCI_SINGLE_FRAME) {
+		return;
+	}
+
+	int len = frame->data[0] & 0x0F;
+	if (len == 0 || len > frame->can_dlc - 1) {
+		return;
+	}
+
+	OBDIICommand *command = OBDIICommandWithModeAndPID(frame->data[1], len >= 2 ? frame->data[2] : 0);
+
+	if (frame->can_id == OBDII_FUNCTIONAL_REQUEST_ID) {
+		sniffer->_functionalRequest.command = command;
+		sniffer->_functionalRequest.timestamp = *timestamp;
+	} else {
+		int ecu = frame->can_id - OBDII_PHYSICAL_REQUEST_ID;
+		sniffer->_physicalRequests[ecu].command = command;
+		sniffer->_physicalRequests[ecu].timestamp = *timestamp;
+	}
+}
+
+// Decodes the response reassembled by an ECU's session and hands it to the callback
+static int publishResponse(OBDIISniffer *sniffer, int ecu)
+{
+	OBDIIISOTPSession *session = &sniffer->_responses[ecu];
+	unsigned char *payload = session->message;
+	int len = session->messageLength;
+
+	OBDIISnifferSample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.timestamp = session->lastFrameTime;
+	sample.responseID = session->rid;
+
+	OBDIICommand *command = NULL;
+
+	// Prefer the request that was addressed to this ECU, then the last broadcast request
+	if (OBDIIResponseSuccessful(sniffer->_physicalRequests[ecu].command, payload, len)) {
+		command = sniffer->_physicalRequests[ecu].command;
+		sample.requestID = OBDII_PHYSICAL_REQUEST_ID + ecu;
+		sample.requestTimestamp = sniffer->_physicalRequests[ecu].timestamp;
+		sniffer->_physicalRequests[ecu].command = NULL;
+	} else if (OBDIIResponseSuccessful(sniffer->_functionalRequest.command, payload, len)) {
+		// Several ECUs may answer the same broadcast request, so it stays pending
+		command = sniffer->_functionalRequest.command;
+		sample.requestID = OBDII_FUNCTIONAL_REQUEST_ID;
+		sample.requestTimestamp = sniffer->_functionalRequest.timestamp;
+	} else if (payload[0] >= 0x40) {
+		// The request was missed (e.g. the sniffer started mid-exchange), but a positive response echoes the mode and PID
+		OBDIICommand *inferred = OBDIICommandWithModeAndPID(payload[0] - 0x40, len >= 2 ? payload[1] : 0);
+		if (OBDIIResponseSuccessful(inferred, payload, len)) {
+			command = inferred;
+		}
+	}
+
+	if (!command) {
+		OBDIIISOTPSessionRelease(session);
+		return 0;
+	}
+
+	sample.response = OBDIIDecodeResponseForCommand(command, payload, len);
+	sample.response.timestamp = sample.timestamp;
+	sample.response.requestTimestamp = sample.requestTimestamp;
+	OBDIIISOTPSessionRelease(session);
+
+	if (sniffer->callback) {
+		sniffer->callback(&sample, sniffer->context);
+	}
+
+	OBDIIResponseFree(&sample.response);
+
+	return 1;
+}
+
+int OBDIISnifferHandleFrame(OBDIISniffer *sniffer, const struct can_frame *frame, const struct timespec *timestamp)
+{
+	canid_t id = frame->can_id;
+
+	if (id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+		return 0;
+	}
+
+	if (id == OBDII_FUNCTIONAL_REQUEST_ID || (id >= OBDII_PHYSICAL_REQUEST_ID && id < OBDII_PHYSICAL_REQUEST_ID + OBDII_NUM_ECUS)) {
+		handleRequest(sniffer, frame, timestamp);
+	} else if (id >= OBDII_RESPONSE_ID && id < OBDII_RESPONSE_ID + OBDII_NUM_ECUS) {
+		int ecu = id - OBDII_RESPONSE_ID;
+
+		if (OBDIIISOTPSessionHandleFrame(&sniffer->_responses[ecu], frame, timestamp) == OBDIIISOTPFrameComplete) {
+			return publishResponse(sniffer, ecu);
+		}
+	}
+
+	return 0;
+}
+
+int OBDIISnifferProcessFrames(OBDIISniffer *sniffer, int timeoutMs)
+{
+	struct pollfd pfd;
+	pfd.fd = sniffer->s;
+	pfd.events = POLLIN;
+
+	int retval = poll(&pfd, 1, timeoutMs);
+	if (retval <= 0) {
+		return (retval < 0 && errno != EINTR) ? -1 : 0;
+	}
+
+	int numSamples = 0;
+	struct can_frame frame;
+	struct timespec timestamp;
+
+	while (1) {
+		ssize_t len = OBDIIReceiveTimestamped(sniffer->s, &frame, sizeof(frame), MSG_DONTWAIT, &timestamp);
+
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -1;
+		}
+
+		if (len != sizeof(frame)) {
+			continue;
+		}
+
+		numSamples += OBDIISnifferHandleFrame(sniffer, &frame, &timestamp);
+	}
+
+	return numSamples;
+}
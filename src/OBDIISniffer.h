@@ -0,0 +1,97 @@
+#ifndef __OBDII_SNIFFER_H
+#define __OBDII_SNIFFER_H
+
+#include "OBDII.h"
+#include "OBDIIISOTP.h"
+#include <time.h>
+#include <linux/can.h>
+
+/** A response observed on the bus, decoded for the command it answers. */
+typedef struct OBDIISnifferSample {
+	/** When the last frame of the response was received (CLOCK_MONOTONIC) */
+	struct timespec timestamp;
+	/** When the matching request was seen, or zero if the request was not seen */
+	struct timespec requestTimestamp;
+	/** The ID the request was sent to (`OBDII_FUNCTIONAL_REQUEST_ID` or a physical ID), or 0 if the request was not seen */
+	canid_t requestID;
+	/** The ID of the ECU that responded */
+	canid_t responseID;
+	/** The decoded response. Its resources are freed once the callback returns. */
+	OBDIIResponse response;
+} OBDIISnifferSample;
+
+/** Type for a function that receives each sample decoded by a sniffer */
+typedef void (*OBDIISnifferCallback)(OBDIISnifferSample *sample, void *context);
+
+/** Passively decodes OBD-II traffic generated by other testers on the bus.
+ *
+ * The sniffer never sends a frame: it follows requests sent to 0x7DF and 0x7E0-0x7E7, reassembles the responses sent on
+ * 0x7E8-0x7EF (relying on the active tester for flow control), and decodes every positive response through the
+ * predefined command tables. This yields telemetry on vehicles whose telematics unit already polls the data of interest,
+ * at no cost in bus load.
+ *
+ *     void PrintSample(OBDIISnifferSample *sample, void *context) {
+ *         if (sample->response.command == OBDIICommands.engineRPMs) {
+ *             printf("%.2f\n", sample->response.numericValue);
+ *         }
+ *     }
+ *
+ *     OBDIISniffer sniffer;
+ *     OBDIISnifferOpen(&sniffer, "can0", &PrintSample, NULL);
+ *     while (OBDIISnifferProcessFrames(&sniffer, 1000) >= 0);
+ *     OBDIISnifferClose(&sniffer);
+ */
+typedef struct OBDIISniffer {
+	int s;
+	OBDIISnifferCallback callback;
+	void *context;
+
+	// Private
+	struct {
+		OBDIICommand *command;
+		struct timespec timestamp;
+	} _physicalRequests[OBDII_NUM_ECUS], _functionalRequest;
+	OBDIIISOTPBufferPool _pool;
+	OBDIIISOTPSession _responses[OBDII_NUM_ECUS];
+} OBDIISniffer;
+
+/** Initialize a sniffer without opening a socket, so that frames obtained elsewhere can be fed to `OBDIISnifferHandleFrame`.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIISnifferInit(OBDIISniffer *sniffer, OBDIISnifferCallback callback, void *context);
+
+/** Initialize a sniffer and open a CAN_RAW socket on an interface, with kernel filters that only let OBD-II requests and responses through.
+ *
+ * \param sniffer The sniffer to initialize
+ * \param ifname The name of the CAN interface
+ * \param callback The function called for each decoded response
+ * \param context Passed through to `callback`
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIISnifferOpen(OBDIISniffer *sniffer, const char *ifname, OBDIISnifferCallback callback, void *context);
+
+/** Close a sniffer, releasing its socket (if any) and buffers. */
+int OBDIISnifferClose(OBDIISniffer *sniffer);
+
+/** Feed a single frame to the sniffer.
+ *
+ * \param sniffer The sniffer
+ * \param frame A frame observed on the bus
+ * \param timestamp When the frame was received (CLOCK_MONOTONIC)
+ *
+ * \returns 1 if the frame completed a response that was published to the callback, 0 otherwise
+ */
+int OBDIISnifferHandleFrame(OBDIISniffer *sniffer, const struct can_frame *frame, const struct timespec *timestamp);
+
+/** Wait for frames on the sniffer's socket and process every frame that arrives.
+ *
+ * \param sniffer An open sniffer
+ * \param timeoutMs Maximum time to wait for the first frame, in milliseconds
+ *
+ * \returns The number of samples published, or -1 on error
+ */
+int OBDIISnifferProcessFrames(OBDIISniffer *sniffer, int timeoutMs);
+
+#endif /* OBDIISniffer.h */
@@ -0,0 +1,252 @@
+#include "OBDIISubscription.h"
+#include "OBDIIDaemon.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+// How long to wait for the daemon to answer a request
+#define REQUEST_TIMEOUT_MS 1000
+
+static inline void pack(unsigned char **buffer, const void *data, int len) {
+	memcpy(*buffer, data, len);
+	*buffer += len;
+}
+
+static inline void unpack(const unsigned char **buffer, void *data, int len) {
+	memcpy(data, *buffer, len);
+	*buffer += len;
+}
+
+// Waits for the daemon's response code, dropping the samples that arrive in the meantime
+static int awaitResponseCode(OBDIISubscriber *subscriber, uint16_t *responseCode)
+{
+	unsigned char message[OBDII_DAEMON_RESPONSE_MAX_SIZE];
+
+	while (1) {
+		struct pollfd pfd;
+		pfd.fd = subscriber->s;
+		pfd.events = POLLIN;
+
+		int retval = poll(&pfd, 1, REQUEST_TIMEOUT_MS);
+		if (retval <= 0) {
+			if (retval == 0) {
+				errno = ETIMEDOUT;
+			}
+			return -1;
+		}
+
+		ssize_t len = recv(subscriber->s, message, sizeof(message), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		if (len == sizeof(*responseCode)) {
+			memcpy(responseCode, message, sizeof(*responseCode));
+			return 0;
+		}
+
+		if (len == OBDII_DAEMON_SAMPLE_SIZE) {
+			subscriber->_lostSamples++;
+		}
+	}
+}
+
+static int sendRequest(OBDIISubscriber *subscriber, uint16_t requestType, const unsigned char *params, int paramsLen)
+{
+	unsigned char request[OBDII_DAEMON_REQUEST_MAX_SIZE];
+	unsigned char *p = request;
+	uint16_t apiVersion = OBDII_API_VERSION;
+
+	pack(&p, &apiVersion, sizeof(apiVersion));
+	pack(&p, &requestType, sizeof(requestType));
+	pack(&p, params, paramsLen);
+
+	if (send(subscriber->s, request, p - request, 0) != p - request) {
+		return -1;
+	}
+
+	uint16_t responseCode;
+	if (awaitResponseCode(subscriber, &responseCode) < 0) {
+		return -1;
+	}
+
+	if (responseCode != OBDIIDaemonResponseCodeSuccess) {
+		errno = responseCode == OBDIIDaemonResponseCodeInvalidSubscription ? EINVAL : EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+// Packs the parameters identifying a subscription
+static int packSubscription(unsigned char **p, const char *ifname, canid_t tx_id, canid_t rx_id, OBDIICommand *command)
+{
+	unsigned int ifindex = if_nametoindex(ifname);
+
+	if (ifindex == 0) {
+		return -1;
+	}
+
+	pack(p, &ifindex, sizeof(ifindex));
+	pack(p, &tx_id, sizeof(tx_id));
+	pack(p, &rx_id, sizeof(rx_id));
+	pack(p, &command->payload[0], 1);
+	pack(p, &command->payload[1], 1);
+
+	return 0;
+}
+
+int OBDIISubscriberOpen(OBDIISubscriber *subscriber, int queueLength)
+{
+	static int numSubscribers = 0;
+
+	memset(subscriber, 0, sizeof(*subscriber));
+	subscriber->queueLength = queueLength > 0 ? queueLength : OBDII_DAEMON_DEFAULT_QUEUE_LENGTH;
+
+	if ((subscriber->s = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+		return -1;
+	}
+
+	// Samples are pushed to this address, so each subscriber needs its own
+	subscriber->_addr.sun_family = AF_UNIX;
+	snprintf(subscriber->_addr.sun_path, sizeof(subscriber->_addr.sun_path), "/tmp/obdii.%ld.%d", (long)getpid(), numSubscribers++);
+
+	struct sockaddr_un daemonAddr;
+	memset(&daemonAddr, 0, sizeof(daemonAddr));
+	daemonAddr.sun_family = AF_UNIX;
+	strncpy(daemonAddr.sun_path, OBDII_DAEMON_SOCKET_PATH, sizeof(daemonAddr.sun_path) - 1);
+
+	if ((unlink(subscriber->_addr.sun_path) < 0 && errno != ENOENT)
+			|| bind(subscriber->s, (struct sockaddr *)&subscriber->_addr, sizeof(subscriber->_addr)) < 0
+			|| connect(subscriber->s, (struct sockaddr *)&daemonAddr, sizeof(daemonAddr)) < 0) {
+		int error = errno;
+		close(subscriber->s);
+		unlink(subscriber->_addr.sun_path);
+		subscriber->s = -1;
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+int OBDIISubscribe(OBDIISubscriber *subscriber, const char *ifname, canid_t tx_id, canid_t rx_id, OBDIICommand *command, double rate, const OBDIIChangeFilterRule *rule)
+{
+	static const OBDIIChangeFilterRule everySample = { -1, 0, 0, 0xFFFFFFFF };
+
+	if (!command || !(rate > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!rule) {
+		rule = &everySample;
+	}
+
+	unsigned char params[OBDII_DAEMON_SUBSCRIBE_PARAMS_SIZE];
+	unsigned char *p = params;
+
+	uint32_t intervalMicroseconds = rate < 1e-3 ? 1000000000 : (uint32_t)(1e6 / rate);
+	uint16_t queueLength = subscriber->queueLength;
+	float absoluteDeadband = rule->absoluteDeadband;
+	float relativeDeadband = rule->relativeDeadband;
+	uint32_t maxSilenceMilliseconds = (uint32_t)(rule->maxSilence * 1000);
+
+	if (packSubscription(&p, ifname, tx_id, rx_id, command) < 0) {
+		return -1;
+	}
+
+	pack(&p, &intervalMicroseconds, sizeof(intervalMicroseconds));
+	pack(&p, &queueLength, sizeof(queueLength));
+	pack(&p, &absoluteDeadband, sizeof(absoluteDeadband));
+	pack(&p, &relativeDeadband, sizeof(relativeDeadband));
+	pack(&p, &maxSilenceMilliseconds, sizeof(maxSilenceMilliseconds));
+	pack(&p, &rule->bitfieldMask, sizeof(rule->bitfieldMask));
+
+	return sendRequest(subscriber, OBDIIDaemonRequestSubscribe, params, sizeof(params));
+}
+
+int OBDIIUnsubscribe(OBDIISubscriber *subscriber, const char *ifname, canid_t tx_id, canid_t rx_id, OBDIICommand *command)
+{
+	unsigned char params[OBDII_DAEMON_UNSUBSCRIBE_PARAMS_SIZE];
+	unsigned char *p = params;
+
+	if (!command) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (packSubscription(&p, ifname, tx_id, rx_id, command) < 0) {
+		return -1;
+	}
+
+	return sendRequest(subscriber, OBDIIDaemonRequestUnsubscribe, params, sizeof(params));
+}
+
+int OBDIIReceiveSample(OBDIISubscriber *subscriber, OBDIISample *sample)
+{
+	unsigned char message[OBDII_DAEMON_RESPONSE_MAX_SIZE];
+
+	while (1) {
+		ssize_t len = recv(subscriber->s, message, sizeof(message), 0);
+		if (len < 0) {
+			return -1;
+		}
+
+		const unsigned char *p = message;
+		uint16_t code;
+		unsigned char mode, pid;
+		uint32_t dropped, value;
+		uint64_t timestamp;
+
+		if (len != OBDII_DAEMON_SAMPLE_SIZE) {
+			continue;
+		}
+
+		unpack(&p, &code, sizeof(code));
+		unpack(&p, &mode, sizeof(mode));
+		unpack(&p, &pid, sizeof(pid));
+		unpack(&p, &sample->rid, sizeof(sample->rid));
+		unpack(&p, &dropped, sizeof(dropped));
+		unpack(&p, &timestamp, sizeof(timestamp));
+		unpack(&p, &value, sizeof(value));
+
+		OBDIICommand *command = OBDIICommandWithModeAndPID(mode, pid);
+		if (code != OBDIIDaemonResponseCodeSample || !command) {
+			continue;
+		}
+
+		memset(&sample->response, 0, sizeof(sample->response));
+		sample->response.success = 1;
+		sample->response.command = command;
+		if (command->responseType == OBDIIResponseTypeBitfield) {
+			sample->response.bitfieldValue = value;
+		} else {
+			memcpy(&sample->response.numericValue, &value, sizeof(value));
+		}
+
+		sample->timestamp = timestamp / 1e9;
+		sample->dropped = dropped + subscriber->_lostSamples;
+		subscriber->_lostSamples = 0;
+
+		return 0;
+	}
+}
+
+int OBDIISubscriberClose(OBDIISubscriber *subscriber)
+{
+	int retval = sendRequest(subscriber, OBDIIDaemonRequestUnsubscribeAll, NULL, 0);
+
+	close(subscriber->s);
+	unlink(subscriber->_addr.sun_path);
+	subscriber->s = -1;
+
+	return retval;
+}
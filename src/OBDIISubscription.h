@@ -0,0 +1,92 @@
+#ifndef __OBDII_SUBSCRIPTION_H
+#define __OBDII_SUBSCRIPTION_H
+
+#include "OBDII.h"
+#include "OBDIIChangeFilter.h"
+#include <linux/can.h>
+#include <sys/un.h>
+
+/** A connection to the daemon over which samples of subscribed commands arrive */
+typedef struct OBDIISubscriber {
+	/** The socket samples arrive on; poll it for readability to wait for samples */
+	int s;
+	/** The number of samples the daemon queues for this subscriber before dropping the oldest ones */
+	int queueLength;
+	/** Samples that arrived while waiting for the daemon to answer a request, and were lost */
+	unsigned int _lostSamples;
+	struct sockaddr_un _addr;
+} OBDIISubscriber;
+
+/** A value pushed by the daemon */
+typedef struct OBDIISample {
+	/** The value, as if returned by `OBDIIPerformQuery`; always successful */
+	OBDIIResponse response;
+	/** The response ID of the ECU that answered */
+	canid_t rid;
+	/** The time the daemon received the response, in seconds on the CLOCK_MONOTONIC clock */
+	double timestamp;
+	/** The number of samples dropped right before this one, because the subscriber didn't keep up */
+	unsigned int dropped;
+} OBDIISample;
+
+/** Open a connection to the daemon for receiving samples.
+ *
+ * Rather than each client polling shared sockets, clients subscribe to commands at the rate they need. The daemon
+ * queries each command of each ECU once, at the highest rate any subscriber asked for, and pushes the responses to
+ * every subscriber at its own rate. A subscriber that doesn't keep up loses its oldest samples first.
+ *
+ *     OBDIISubscriber subscriber;
+ *     OBDIISubscriberOpen(&subscriber, 0);
+ *     OBDIISubscribe(&subscriber, "can0", 0x7E0, 0x7E8, OBDIICommands.engineRPMs, 10, NULL);
+ *     OBDIISubscribe(&subscriber, "can0", 0x7E0, 0x7E8, OBDIICommands.fuelTankLevelInput, 0.1, NULL);
+ *
+ *     OBDIISample sample;
+ *     while (OBDIIReceiveSample(&subscriber, &sample) == 0) {
+ *         printf("%s: %.2f\n", sample.response.command->name, sample.response.numericValue);
+ *     }
+ *
+ * \param subscriber The subscriber struct that will be filled in by the call
+ * \param queueLength The number of samples the daemon queues for this subscriber, or 0 for the default
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIISubscriberOpen(OBDIISubscriber *subscriber, int queueLength);
+
+/** Subscribe to a command of an ECU, or change the rate or filter of an existing subscription.
+ *
+ * Only mode 1 and 9 commands with numeric or bitfield responses can be subscribed to.
+ *
+ * \param subscriber The subscriber
+ * \param ifname The name of the CAN interface
+ * \param tx_id The ID used to address frames to the ECU
+ * \param rx_id The ID the ECU will use for response frames
+ * \param command The command
+ * \param rate The number of samples per second to receive, e.g. 10 or 0.1
+ * \param rule If not NULL, the daemon only pushes values that change according to this rule (see `OBDIIChangeFilter`)
+ *
+ * \returns 0 on success, -1 on error (errno is set to EINVAL if the daemon rejected the subscription)
+ */
+int OBDIISubscribe(OBDIISubscriber *subscriber, const char *ifname, canid_t tx_id, canid_t rx_id, OBDIICommand *command, double rate, const OBDIIChangeFilterRule *rule);
+
+/** Cancel a subscription.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIIUnsubscribe(OBDIISubscriber *subscriber, const char *ifname, canid_t tx_id, canid_t rx_id, OBDIICommand *command);
+
+/** Wait for the next sample.
+ *
+ * \param subscriber The subscriber
+ * \param sample Filled in with the sample
+ *
+ * \returns 0 on success, -1 on error. Fails with errno set to EAGAIN if `s` was made nonblocking and no sample is queued.
+ */
+int OBDIIReceiveSample(OBDIISubscriber *subscriber, OBDIISample *sample);
+
+/** Cancel all subscriptions and close the connection to the daemon.
+ *
+ * \returns 0 on success, -1 on error
+ */
+int OBDIISubscriberClose(OBDIISubscriber *subscriber);
+
+#endif /* OBDIISubscription.h */
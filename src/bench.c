@@ -0,0 +1,569 @@
+/*
+ * Measures how fast the ECUs of a vehicle can be polled, and recommends a poll profile.
+ *
+ * For each PID of each ECU, the tool first queries back to back to find the ceiling and the base latency, then ramps
+ * the query rate up a ladder of rates, each held for a step, and checks whether the ECU keeps up: a rate is sustained
+ * if nearly every query is answered and the achieved rate stays close to the target. The latency knee is the highest
+ * sustained rate before the median latency climbs past twice its base value. It also checks whether the ECU answers
+ * mode 1 requests for several PIDs at once.
+ *
+ * The recommended profile is in the format of `cli --stream`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+
+#include "OBDII.h"
+#include "OBDIICommunication.h"
+#include "OBDIIDiscovery.h"
+#include "OBDIIPollSchedule.h"
+
+#define NO_CAN_ID 0xFFFFFFFFU
+
+#define DEFAULT_STEP_DURATION 1.0
+#define DEFAULT_MAX_RATE 1000.0
+
+// Mode 1 requests carry at most 6 PIDs
+#define MAX_PIDS_PER_REQUEST 6
+#define MULTI_PID_TIMEOUT_MS 1000
+
+// A rate is sustained if at least this share of its queries is answered, at this share of the rate or more
+#define MIN_ANSWERED_RATIO 0.99
+#define MIN_ACHIEVED_RATIO 0.95
+
+// The knee is where the median latency exceeds its base value by this factor. Steps with fewer answers than
+// MIN_LATENCY_SAMPLES are too short to tell.
+#define KNEE_LATENCY_FACTOR 2.0
+#define MIN_LATENCY_SAMPLES 10
+
+// The profile leaves this much of the ECU's capacity unused
+#define PROFILE_HEADROOM 0.8
+
+// Each rate is held for at least this many periods
+#define MIN_PERIODS_PER_STEP 5
+
+static const double RateLadder[] = { 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+#define NUM_RATES (sizeof(RateLadder) / sizeof(RateLadder[0]))
+
+typedef struct {
+	double rate; // Target rate, or 0 for back to back
+	double achievedRate;
+	unsigned long numQueries;
+	unsigned long numAnswers;
+	double medianLatency; // Seconds
+	double p99Latency;
+} StepResult;
+
+typedef struct {
+	OBDIICommand *command;
+	double ceiling; // Back to back
+	double baseLatency;
+	double maxSustainedRate;
+	double kneeRate;
+} PIDResult;
+
+static double stepDuration = DEFAULT_STEP_DURATION;
+static double maxRate = DEFAULT_MAX_RATE;
+static int verbose = 0;
+
+static const struct option longOptions[] = {
+	{ "pids", required_argument, NULL, 'p' },
+	{ "step", required_argument, NULL, 's' },
+	{ "max-rate", required_argument, NULL, 'm' },
+	{ "verbose", no_argument, NULL, 'v' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void printUsage(char *programName)
+{
+	printf("Usage: %s [-t <transfer CAN ID> -r <receive CAN ID>] [-R] [--pids <commands>] [--step <seconds>] [--max-rate <Hz>] [--verbose] <CAN interface>\n"
+	       "	-t, -r: The ECU to measure. By default, every ECU that answers on 0x7E8-0x7EF is measured.\n"
+	       "	-R: Use a raw CAN socket, which does not require the ISO-TP kernel module (the multi-PID check is skipped)\n"
+	       "	--pids <commands>: The commands to measure, separated by commas: property names of OBDIICommands (e.g. engineRPMs), or modes and PIDs in hex (e.g. 01:0c). By default, every supported mode 1 command with a numeric value.\n"
+	       "	--step <seconds>: How long each rate is held (default %.1f)\n"
+	       "	--max-rate <Hz>: The highest rate to try (default %.0f)\n"
+	       "	--verbose: Print the result of every step\n", programName, DEFAULT_STEP_DURATION, DEFAULT_MAX_RATE);
+}
+
+static double monotonicTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void sleepUntil(double time)
+{
+	struct timespec deadline;
+	deadline.tv_sec = (time_t)time;
+	deadline.tv_nsec = (long)((time - deadline.tv_sec) * 1e9);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static OBDIICommand *commandForName(const char *name)
+{
+	unsigned int mode, pid;
+	char end;
+
+	if (sscanf(name, "%x:%x%c", &mode, &pid, &end) == 2 && mode <= 0xFF && pid <= 0xFF) {
+		return OBDIICommandWithModeAndPID(mode, pid);
+	}
+
+	return OBDIICommandWithName(name);
+}
+
+// Queries a command at a rate (or back to back if the rate is 0) for one step, timing each exchange by the timestamps
+// of its request and response
+static int runStep(OBDIISocket *s, OBDIICommand *command, double rate, StepResult *result)
+{
+	double duration = stepDuration;
+	if (rate > 0 && duration < MIN_PERIODS_PER_STEP / rate) {
+		duration = MIN_PERIODS_PER_STEP / rate;
+	}
+
+	size_t maxLatencies = (rate > 0 ? rate : maxRate) * duration * 2 + 16, numLatencies = 0;
+	double *latencies = malloc(maxLatencies * sizeof(*latencies));
+
+	if (!latencies) {
+		return -1;
+	}
+
+	memset(result, 0, sizeof(*result));
+	result->rate = rate;
+
+	double start = monotonicTime(), next = start, now = start;
+
+	// Paced queries are due at the start of each period of the step
+	while (rate > 0 ? next - start < duration : now - start < duration) {
+		if (rate > 0) {
+			sleepUntil(next);
+
+			// A query that ran late delays the next ones, rather than making them burst to catch up
+			next += 1 / rate;
+			if (next < (now = monotonicTime())) {
+				next = now;
+			}
+		}
+
+		OBDIIResponse response = OBDIIPerformQuery(s, command);
+		result->numQueries++;
+
+		if (response.success) {
+			result->numAnswers++;
+			if (numLatencies < maxLatencies) {
+				latencies[numLatencies++] = OBDIIResponseTimestamp(&response) -
+					(response.requestTimestamp.tv_sec + response.requestTimestamp.tv_nsec / 1e9);
+			}
+		}
+
+		OBDIIResponseFree(&response);
+		now = monotonicTime();
+	}
+
+	result->achievedRate = result->numAnswers / (rate > 0 ? duration : now - start);
+
+	if (numLatencies > 0) {
+		qsort(latencies, numLatencies, sizeof(*latencies), &compareDoubles);
+		result->medianLatency = latencies[numLatencies / 2];
+		result->p99Latency = latencies[numLatencies * 99 / 100];
+	}
+
+	free(latencies);
+
+	if (verbose) {
+		printf("    %-6s %8.1f Hz target %8.1f Hz achieved %6lu/%-6lu answered   p50 %7.2f ms   p99 %7.2f ms\n",
+				rate > 0 ? "" : "max", rate, result->achievedRate, result->numAnswers, result->numQueries,
+				result->medianLatency * 1e3, result->p99Latency * 1e3);
+	}
+
+	return 0;
+}
+
+static int isSustained(const StepResult *step)
+{
+	return step->numQueries > 0 && step->numAnswers >= MIN_ANSWERED_RATIO * step->numQueries &&
+		step->achievedRate >= MIN_ACHIEVED_RATIO * step->rate;
+}
+
+// Whether a step answered enough queries for its latencies to mean something
+static inline int hasLatencies(const StepResult *step)
+{
+	return step->numAnswers >= MIN_LATENCY_SAMPLES;
+}
+
+static void measurePID(OBDIISocket *s, OBDIICommand *command, PIDResult *result)
+{
+	StepResult steps[NUM_RATES + 1], step;
+	int numSteps = 0, numRates = 0, i;
+
+	memset(result, 0, sizeof(*result));
+	result->command = command;
+
+	if (runStep(s, command, 0, &step) < 0 || step.numAnswers == 0) {
+		return;
+	}
+
+	result->ceiling = step.achievedRate;
+	result->baseLatency = step.medianLatency;
+
+	// The ladder, then just under the ceiling
+	double rates[NUM_RATES + 1];
+	for (i = 0; i < (int)NUM_RATES && RateLadder[i] < result->ceiling && RateLadder[i] <= maxRate; ++i) {
+		rates[numRates++] = RateLadder[i];
+	}
+	if (0.9 * result->ceiling <= maxRate && (numRates == 0 || 0.9 * result->ceiling > rates[numRates - 1])) {
+		rates[numRates++] = 0.9 * result->ceiling;
+	}
+
+	for (i = 0; i < numRates; ++i) {
+		if (runStep(s, command, rates[i], &steps[numSteps]) < 0 || !isSustained(&steps[numSteps])) {
+			break;
+		}
+
+		result->maxSustainedRate = rates[i];
+		numSteps++;
+	}
+
+	// The base latency is the lowest the ECU showed at any rate
+	for (i = 0; i < numSteps; ++i) {
+		if (hasLatencies(&steps[i]) && steps[i].medianLatency < result->baseLatency) {
+			result->baseLatency = steps[i].medianLatency;
+		}
+	}
+
+	for (i = 0; i < numSteps; ++i) {
+		if (hasLatencies(&steps[i]) && steps[i].medianLatency > KNEE_LATENCY_FACTOR * result->baseLatency) {
+			break;
+		}
+		result->kneeRate = steps[i].rate;
+	}
+}
+
+// Sends a mode 1 request for several PIDs at once, and checks that the response answers every one of them in turn
+static int queryPIDs(int s, OBDIICommand **commands, int numCommands)
+{
+	unsigned char request[1 + MAX_PIDS_PER_REQUEST], response[OBDII_ISOTP_MAX_PAYLOAD];
+	int i;
+
+	// Discard late responses to the earlier queries
+	while (recv(s, response, sizeof(response), MSG_DONTWAIT) >= 0);
+
+	request[0] = 0x01;
+	for (i = 0; i < numCommands; ++i) {
+		request[i + 1] = OBDIICommandGetPID(commands[i]);
+	}
+
+	if (write(s, request, numCommands + 1) != numCommands + 1) {
+		return 0;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, MULTI_PID_TIMEOUT_MS) <= 0) {
+		return 0;
+	}
+
+	ssize_t len = recv(s, response, sizeof(response), 0);
+	if (len < 1 || response[0] != 0x41) {
+		return 0;
+	}
+
+	// Each PID is followed by its data, the response to a single-PID request minus its mode byte
+	ssize_t position = 1;
+	for (i = 0; i < numCommands; ++i) {
+		if (position >= len || response[position] != request[i + 1]) {
+			return 0;
+		}
+		position += commands[i]->expectedResponseLength - 1;
+	}
+
+	return position == len;
+}
+
+// Finds the largest number of PIDs the ECU answers in a single request, and how many such requests it answers per second
+static int measureMultiPIDRequests(OBDIISocket *s, PIDResult *pids, int numPIDs, double *requestRate)
+{
+	OBDIICommand *commands[MAX_PIDS_PER_REQUEST];
+	int numCommands = 0, i;
+
+	*requestRate = 0;
+
+	for (i = 0; i < numPIDs && numCommands < MAX_PIDS_PER_REQUEST; ++i) {
+		if (OBDIICommandGetMode(pids[i].command) == 0x01 && pids[i].command->expectedResponseLength != VARIABLE_RESPONSE_LENGTH && pids[i].ceiling > 0) {
+			commands[numCommands++] = pids[i].command;
+		}
+	}
+
+	for (; numCommands >= 2; --numCommands) {
+		if (queryPIDs(s->s, commands, numCommands)) {
+			break;
+		}
+	}
+
+	if (numCommands < 2) {
+		return 1;
+	}
+
+	unsigned long numAnswers = 0;
+	double start = monotonicTime(), now = start;
+	while (now - start < stepDuration) {
+		numAnswers += queryPIDs(s->s, commands, numCommands);
+		now = monotonicTime();
+	}
+	*requestRate = numAnswers / (now - start);
+
+	return numCommands;
+}
+
+static void printRate(double rate)
+{
+	if (rate >= 10) {
+		printf("%.0fHz", rate);
+	} else {
+		printf("%.1fHz", rate);
+	}
+}
+
+// Splits the ECU's capacity between its PIDs, giving none more than it can sustain before its latency knee
+static void printProfile(PIDResult *pids, int numPIDs)
+{
+	double *ceilings = malloc(3 * numPIDs * sizeof(double));
+	double *kneeRates = ceilings + numPIDs, *rates = kneeRates + numPIDs;
+	int i;
+
+	if (!ceilings) {
+		return;
+	}
+
+	for (i = 0; i < numPIDs; ++i) {
+		ceilings[i] = pids[i].ceiling;
+		kneeRates[i] = pids[i].kneeRate;
+	}
+
+	if (OBDIIPollScheduleRecommendRates(ceilings, kneeRates, numPIDs, PROFILE_HEADROOM, rates) == 0) {
+		printf("  No PID sustained a rate, so there is no profile to recommend\n");
+		free(ceilings);
+		return;
+	}
+
+	const char *separator = "";
+	printf("  Recommended profile (cli --stream): ");
+	for (i = 0; i < numPIDs; ++i) {
+		if (rates[i] <= 0) {
+			continue;
+		}
+
+		printf("%s%02x:%02x@", separator, OBDIICommandGetMode(pids[i].command), OBDIICommandGetPID(pids[i].command));
+		printRate(rates[i]);
+		separator = ",";
+	}
+	printf("\n");
+
+	free(ceilings);
+}
+
+static int measureECU(OBDIISocket *s, OBDIICommand **commands, int numCommands, int checkMultiPID)
+{
+	PIDResult *pids = calloc(numCommands, sizeof(*pids));
+	int i;
+
+	if (!pids) {
+		return -1;
+	}
+
+	printf("  %-6s %10s %10s %12s %10s\n", "PID", "ceiling", "latency", "sustained", "knee");
+
+	for (i = 0; i < numCommands; ++i) {
+		measurePID(s, commands[i], &pids[i]);
+
+		printf("  %02x:%02x  ", OBDIICommandGetMode(commands[i]), OBDIICommandGetPID(commands[i]));
+		if (pids[i].ceiling == 0) {
+			printf(" not answered (%s)\n", commands[i]->name);
+			continue;
+		}
+
+		printf("%8.1f Hz %7.2f ms %9.1f Hz %7.1f Hz  %s\n", pids[i].ceiling, pids[i].baseLatency * 1e3,
+				pids[i].maxSustainedRate, pids[i].kneeRate, commands[i]->name);
+	}
+
+	if (checkMultiPID) {
+		double requestRate;
+		int numPIDsPerRequest = measureMultiPIDRequests(s, pids, numCommands, &requestRate);
+
+		if (numPIDsPerRequest >= 2) {
+			printf("  Multi-PID requests: up to %d PIDs per request, %.1f requests/s (%.1f values/s)\n", numPIDsPerRequest,
+					requestRate, requestRate * numPIDsPerRequest);
+		} else {
+			printf("  Multi-PID requests: not supported\n");
+		}
+	} else {
+		printf("  Multi-PID requests: not checked over a raw socket\n");
+	}
+
+	printProfile(pids, numCommands);
+
+	free(pids);
+
+	return 0;
+}
+
+// The commands to measure: those given on the command line, or the ECU's numeric mode 1 commands
+static int commandsToMeasure(char *names, OBDIICommandSet *supported, OBDIICommand **commands, int maxCommands)
+{
+	int numCommands = 0, i;
+
+	if (names) {
+		char *copy = strdup(names), *token, *savePtr;
+		if (!copy) {
+			return -1;
+		}
+
+		for (token = strtok_r(copy, ",", &savePtr); token != NULL && numCommands < maxCommands; token = strtok_r(NULL, ",", &savePtr)) {
+			if (!(commands[numCommands++] = commandForName(token))) {
+				fprintf(stderr, "Unknown command %s\n", token);
+				free(copy);
+				return -1;
+			}
+		}
+
+		free(copy);
+		return numCommands;
+	}
+
+	for (i = 0; i < supported->numCommands && numCommands < maxCommands; ++i) {
+		OBDIICommand *command = OBDIICommandSetCommandAtIndex(supported, i);
+		if (OBDIICommandGetMode(command) == 0x01 && command->responseType == OBDIIResponseTypeNumeric) {
+			commands[numCommands++] = command;
+		}
+	}
+
+	return numCommands;
+}
+
+static int benchECU(const char *ifname, canid_t tx_id, canid_t rx_id, int useRaw, char *names, OBDIICommandSet *supported)
+{
+	OBDIISocket s;
+	OBDIICommand *commands[256];
+	int retval;
+
+	if ((useRaw ? OBDIIOpenRawSocket(&s, ifname, tx_id, rx_id) : OBDIIOpenSocket(&s, ifname, tx_id, rx_id, 0)) < 0) {
+		fprintf(stderr, "Error connecting to ECU %x: %s\n", tx_id, strerror(errno));
+		return -1;
+	}
+
+	OBDIICommandSet ownSupported;
+	if (!supported && !names) {
+		ownSupported = OBDIIGetSupportedCommands(&s);
+		supported = &ownSupported;
+	}
+
+	printf("ECU %x/%x\n", tx_id, rx_id);
+
+	int numCommands = commandsToMeasure(names, supported, commands, sizeof(commands) / sizeof(commands[0]));
+	if (numCommands < 0) {
+		retval = -1;
+	} else if (numCommands == 0) {
+		printf("  No commands to measure\n");
+		retval = 0;
+	} else {
+		retval = measureECU(&s, commands, numCommands, !useRaw);
+	}
+
+	if (supported == &ownSupported) {
+		OBDIICommandSetFree(&ownSupported);
+	}
+
+	OBDIICloseSocket(&s);
+
+	return retval;
+}
+
+int main(int argc, char **argv)
+{
+	canid_t tx_id = NO_CAN_ID, rx_id = NO_CAN_ID;
+	char *names = NULL;
+	int opt, useRaw = 0, i;
+
+	while ((opt = getopt_long(argc, argv, "t:r:Rv", longOptions, NULL)) != -1) {
+		switch (opt) {
+			case 't':
+				tx_id = strtoul(optarg, NULL, 16);
+				if (strlen(optarg) > 7) {
+					tx_id |= CAN_EFF_FLAG;
+				}
+				break;
+			case 'r':
+				rx_id = strtoul(optarg, NULL, 16);
+				if (strlen(optarg) > 7) {
+					rx_id |= CAN_EFF_FLAG;
+				}
+				break;
+			case 'R':
+				useRaw = 1;
+				break;
+			case 'p':
+				names = optarg;
+				break;
+			case 's':
+				stepDuration = atof(optarg);
+				break;
+			case 'm':
+				maxRate = atof(optarg);
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				printUsage(basename(argv[0]));
+				return 1;
+		}
+	}
+
+	if (argc - optind != 1 || (tx_id == NO_CAN_ID) != (rx_id == NO_CAN_ID) || stepDuration <= 0 || maxRate <= 0) {
+		printUsage(basename(argv[0]));
+		return 1;
+	}
+
+	const char *ifname = argv[optind];
+
+	if (tx_id != NO_CAN_ID) {
+		return benchECU(ifname, tx_id, rx_id, useRaw, names, NULL) < 0 ? 1 : 0;
+	}
+
+	OBDIIDiscoveredECU ecus[OBDII_NUM_ECUS];
+	int numECUs = OBDIIDiscoverSupportedCommands(ifname, OBDII_DISCOVERY_DEFAULT_PROBE_TIMEOUT_MS, ecus);
+	if (numECUs < 0) {
+		fprintf(stderr, "Error discovering ECUs: %s\n", strerror(errno));
+		return 1;
+	} else if (numECUs == 0) {
+		fprintf(stderr, "No ECU answered on %s\n", ifname);
+		return 1;
+	}
+
+	int retval = 0;
+	for (i = 0; i < numECUs; ++i) {
+		if (benchECU(ifname, ecus[i].tid, ecus[i].rid, useRaw, names, &ecus[i].commands) < 0) {
+			retval = 1;
+		}
+		OBDIICommandSetFree(&ecus[i].commands);
+	}
+
+	return retval;
+}
@@ -54,6 +54,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <net/if.h>
 #include <sys/types.h>
@@ -66,14 +68,405 @@
 
 #include "OBDII.h"
 #include "OBDIICommunication.h"
+#include "OBDIIPollSchedule.h"
+#include "OBDIIDefinitions.h"
 
 #define NO_CAN_ID 0xFFFFFFFFU
 #define BUFSIZE 5000 /* size > 4095 to check socket API internal checks */
+#define STREAM_BUFFER_SIZE 65536
+
+// Polling interval of the commands of a stream that are given no rate: as fast as the ECU answers
+#define AS_FAST_AS_POSSIBLE 1e-9
 
 int interrupted = 0;
 
+typedef enum {
+	StreamFormatCSV,
+	StreamFormatJSONL,
+	StreamFormatBinary
+} StreamFormat;
+
+// A command polled in streaming mode, under the name it was given on the command line
+typedef struct {
+	const char *name;
+	OBDIICommand *command;
+	unsigned long numQueries;
+	unsigned long numAnswers;
+} StreamEntry;
+
+// Short names for the commands most often streamed; any property name of `OBDIICommands` works too
+static const struct {
+	const char *alias;
+	const char *name;
+} commandAliases[] = {
+	{ "rpm", "engineRPMs" },
+	{ "speed", "vehicleSpeed" },
+	{ "maf", "mafAirFlowRate" },
+	{ "load", "calculatedEngineLoad" },
+	{ "coolant", "engineCoolantTemperature" },
+	{ "iat", "intakeAirTemperature" },
+	{ "map", "intakeManifoldAbsolutePressure" },
+	{ "throttle", "throttlePosition" },
+	{ "timing", "timingAdvance" },
+	{ "fuel", "fuelTankLevelInput" },
+	{ "voltage", "controlModuleVoltage" },
+	{ "dtcs", "DTCs" },
+	{ "vin", "VIN" }
+};
+
+static const struct option longOptions[] = {
+	{ "stream", required_argument, NULL, 's' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "duration", required_argument, NULL, 'D' },
+	{ "definitions", required_argument, NULL, 'p' },
+	{ NULL, 0, NULL, 0 }
+};
+
 void print_usage(char *program_name) {
-	printf("Usage: %s -t <transfer CAN ID> -r <receive CAN ID> [-d] <CAN interface>\n	<transfer CAN ID>: The CAN ID that will be used for sending the diagnostic requests. For 11-bit identifiers, this can be either the broadcast ID, 0x7DF, or an ID in the range 0x7E0 to 0x7E7, indicating a particular ECU.\n	<receive CAN ID>: The CAN ID that the ECU will be using to respond to the diagnostic requests that are sent. For 11-bit identifiers, this is an ID in the range 0x7E8 to 0x7EF (i.e. <transfer CAN ID> + 8)\n	-d: Use a shared socket to allow other programs to access the ECU (the obdiid daemon must be running for this to work)\n", program_name);
+	printf("Usage: %s -t <transfer CAN ID> -r <receive CAN ID> [-d | -R] [--definitions <file>] [--stream <commands> [--format csv|jsonl|binary] [--duration <seconds>]] <CAN interface>\n	<transfer CAN ID>: The CAN ID that will be used for sending the diagnostic requests. For 11-bit identifiers, this can be either the broadcast ID, 0x7DF, or an ID in the range 0x7E0 to 0x7E7, indicating a particular ECU.\n	<receive CAN ID>: The CAN ID that the ECU will be using to respond to the diagnostic requests that are sent. For 11-bit identifiers, this is an ID in the range 0x7E8 to 0x7EF (i.e. <transfer CAN ID> + 8)\n	-d: Use a shared socket to allow other programs to access the ECU (the obdiid daemon must be running for this to work)\n	-R: Use a raw CAN socket for single-frame queries, which does not require the ISO-TP kernel module\n	--definitions <file>: Load manufacturer-specific commands (e.g. mode 22 data identifiers) from a definition file, and offer them along with the supported commands. Lines are of the form <name> <mode> <PID> <data length> <formula>, e.g. hybridBatteryCharge 22 5b3d 1 A * 100 / 255\n	--stream <commands>: Poll the commands on a schedule and write every response to stdout, instead of prompting. Commands are separated by commas, and a rate in Hz applies to the commands before it, back to the previous rate, e.g. rpm,speed@20Hz,coolant@1Hz. Commands without a rate are polled as fast as the ECU answers. A command is a short name (rpm, speed, maf, load, coolant, iat, map, throttle, timing, fuel, voltage, dtcs, vin), a property name of OBDIICommands (e.g. engineRPMs), a mode and PID in hex (e.g. 01:0c or 22:5b3d), or the name of a loaded definition\n	--format: csv (the default), jsonl, or binary\n	--duration <seconds>: Stop streaming after this long, and report the rate achieved by each command on stderr (so does Ctrl-C)\n", program_name);
+}
+
+// Commands loaded with --definitions
+static OBDIIDefinitions definitions;
+
+// The PID of a command, or the 16-bit data identifier of a mode 0x22 command
+static unsigned int commandPID(OBDIICommand *command)
+{
+	if (OBDIICommandGetRequestLength(command) == 3) {
+		return OBDIICommandGetPID(command) << 8 | command->payload[2];
+	}
+
+	return OBDIICommandGetPID(command);
+}
+
+static OBDIICommand *commandForName(const char *name)
+{
+	OBDIICommand *command;
+	size_t i;
+	for (i = 0; i < sizeof(commandAliases) / sizeof(commandAliases[0]); ++i) {
+		if (strcmp(commandAliases[i].alias, name) == 0) {
+			return OBDIICommandWithName(commandAliases[i].name);
+		}
+	}
+
+	unsigned int mode, pid;
+	char end;
+	if (sscanf(name, "%x:%x%c", &mode, &pid, &end) == 2 && mode <= 0xFF) {
+		if ((command = OBDIIDefinitionsCommandWithModeAndPID(&definitions, mode, pid))) {
+			return command;
+		}
+
+		return pid <= 0xFF ? OBDIICommandWithModeAndPID(mode, pid) : NULL;
+	}
+
+	if ((command = OBDIIDefinitionsCommandWithName(&definitions, name))) {
+		return command;
+	}
+
+	return OBDIICommandWithName(name);
+}
+
+// Parses a stream specification such as "rpm,speed@20Hz,coolant@1Hz" into the entries and the schedule, modifying `spec`
+static int parseStreamSpec(char *spec, StreamEntry *entries, int maxEntries, OBDIIPollSchedule *schedule)
+{
+	int numEntries = 0, firstWithoutRate = 0, i;
+	char *token, *savePtr;
+
+	OBDIIPollScheduleInit(schedule);
+
+	for (token = strtok_r(spec, ",", &savePtr); token != NULL; token = strtok_r(NULL, ",", &savePtr)) {
+		char *rate = strchr(token, '@');
+		if (rate) {
+			*rate++ = '\0';
+		}
+
+		if (numEntries == maxEntries) {
+			fprintf(stderr, "Too many commands to stream (at most %d)\n", maxEntries);
+			return -1;
+		}
+
+		StreamEntry *entry = &entries[numEntries++];
+		memset(entry, 0, sizeof(*entry));
+		entry->name = token;
+
+		if (!(entry->command = commandForName(token))) {
+			fprintf(stderr, "Unknown command %s\n", token);
+			return -1;
+		}
+
+		if (!rate) {
+			continue;
+		}
+
+		char *unit;
+		double hz = strtod(rate, &unit);
+		if (hz <= 0 || (*unit != '\0' && strcasecmp(unit, "Hz") != 0)) {
+			fprintf(stderr, "Invalid rate %s\n", rate);
+			return -1;
+		}
+
+		for (i = firstWithoutRate; i < numEntries; ++i) {
+			OBDIIPollScheduleSetInterval(schedule, entries[i].command, 1 / hz);
+		}
+		firstWithoutRate = numEntries;
+	}
+
+	for (i = firstWithoutRate; i < numEntries; ++i) {
+		OBDIIPollScheduleSetInterval(schedule, entries[i].command, AS_FAST_AS_POSSIBLE);
+	}
+
+	if (numEntries == 0) {
+		fprintf(stderr, "No commands to stream\n");
+		return -1;
+	}
+
+	return numEntries;
+}
+
+// Oxygen sensor responses hold two values, whose meaning depends on the PID
+static int oxygenSensorValueNames(OBDIICommand *command, const char **first, const char **second)
+{
+	unsigned char pid = OBDIICommandGetPID(command);
+
+	if (OBDIICommandGetMode(command) != 0x01) {
+		return 0;
+	}
+
+	if (pid >= 0x14 && pid <= 0x1B) {
+		*first = "voltage";
+		*second = "shortTermFuelTrim";
+	} else if (pid >= 0x24 && pid <= 0x2B) {
+		*first = "voltage";
+		*second = "fuelAirEquivalenceRatio";
+	} else if (pid >= 0x34 && pid <= 0x3B) {
+		*first = "current";
+		*second = "fuelAirEquivalenceRatio";
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+// Writes a string as a JSON string, or as a CSV field if `json` is 0
+static void writeQuotedString(FILE *out, const char *string, int json)
+{
+	fputc('"', out);
+	for (; *string; ++string) {
+		if (*string == '"') {
+			fputs(json ? "\\\"" : "\"\"", out);
+		} else if (json && *string == '\\') {
+			fputs("\\\\", out);
+		} else if (json && (unsigned char)*string < 0x20) {
+			fprintf(out, "\\u%04x", *string);
+		} else {
+			fputc(*string, out);
+		}
+	}
+	fputc('"', out);
+}
+
+// Writes the value of a successful response, as JSON or as a CSV field
+static void writeValue(FILE *out, OBDIIResponse *response, int json)
+{
+	OBDIICommand *command = response->command;
+	const char *first, *second;
+	int i;
+
+	switch (command->responseType) {
+		case OBDIIResponseTypeNumeric:
+			fprintf(out, "%g", response->numericValue);
+			break;
+		case OBDIIResponseTypeBitfield:
+			fprintf(out, json ? "%u" : "%08x", response->bitfieldValue);
+			break;
+		case OBDIIResponseTypeString:
+			writeQuotedString(out, response->stringValue ? response->stringValue : "", json);
+			break;
+		case OBDIIResponseTypeOther:
+			if (command == OBDIICommands.DTCs) {
+				fputs(json ? "[" : "", out);
+				for (i = 0; i < response->DTCs.numTroubleCodes; ++i) {
+					if (json) {
+						fprintf(out, "%s\"%s\"", i > 0 ? "," : "", response->DTCs.troubleCodes[i]);
+					} else {
+						fprintf(out, "%s%s", i > 0 ? " " : "", response->DTCs.troubleCodes[i]);
+					}
+				}
+				fputs(json ? "]" : "", out);
+			} else if (oxygenSensorValueNames(command, &first, &second)) {
+				float firstValue = response->oxygenSensorValues.voltage;
+				float secondValue = response->oxygenSensorValues.shortTermFuelTrim;
+				if (json) {
+					fprintf(out, "{\"%s\":%g,\"%s\":%g}", first, firstValue, second, secondValue);
+				} else {
+					fprintf(out, "%g %g", firstValue, secondValue);
+				}
+			} else if (json) {
+				fputs("null", out);
+			}
+			break;
+	}
+}
+
+static void writeUInt(FILE *out, uint64_t value, int size)
+{
+	fwrite(&value, size, 1, out);
+}
+
+// Writes a response as a binary record: a 17-byte header (the time in nanoseconds as a uint64_t, the mode, the PID or
+// mode 0x22 data identifier as a uint16_t, 1 if the response is successful, the NRC, and the length of the value as a
+// uint32_t), then the value. Numeric values
+// are floats, bitfields uint32_t, strings and trouble codes their characters (5 per code), and oxygen sensor values
+// two floats. Integers and floats are in host byte order.
+static void writeBinaryRecord(FILE *out, OBDIIResponse *response, double time)
+{
+	OBDIICommand *command = response->command;
+	unsigned char value[OBDII_ISOTP_MAX_PAYLOAD * 2];
+	uint32_t length = 0;
+	const char *first, *second;
+	int i;
+
+	if (response->success) {
+		switch (command->responseType) {
+			case OBDIIResponseTypeNumeric:
+			case OBDIIResponseTypeBitfield:
+				length = sizeof(response->bitfieldValue);
+				memcpy(value, &response->bitfieldValue, length);
+				break;
+			case OBDIIResponseTypeString:
+				if (response->stringValue) {
+					length = strlen(response->stringValue);
+					memcpy(value, response->stringValue, length);
+				}
+				break;
+			case OBDIIResponseTypeOther:
+				if (command == OBDIICommands.DTCs) {
+					for (i = 0; i < response->DTCs.numTroubleCodes && length + 5 <= sizeof(value); ++i, length += 5) {
+						memcpy(&value[length], response->DTCs.troubleCodes[i], 5);
+					}
+				} else if (oxygenSensorValueNames(command, &first, &second)) {
+					length = sizeof(response->oxygenSensorValues);
+					memcpy(value, &response->oxygenSensorValues, length);
+				}
+				break;
+		}
+	}
+
+	writeUInt(out, time > 0 ? (uint64_t)(time * 1e9) : 0, 8);
+	writeUInt(out, OBDIICommandGetMode(command), 1);
+	writeUInt(out, commandPID(command), 2);
+	writeUInt(out, response->success != 0, 1);
+	writeUInt(out, response->negativeResponseCode, 1);
+	writeUInt(out, length, 4);
+	fwrite(value, 1, length, out);
+}
+
+static void writeSample(FILE *out, StreamFormat format, StreamEntry *entry, OBDIIResponse *response, double time)
+{
+	switch (format) {
+		case StreamFormatCSV:
+			fprintf(out, "%.6f,", time);
+			writeQuotedString(out, entry->name, 0);
+			fputc(',', out);
+			if (response->success) {
+				writeValue(out, response, 0);
+			}
+			fputc(',', out);
+			if (response->negativeResponseCode) {
+				fprintf(out, "%u", response->negativeResponseCode);
+			}
+			fputc('\n', out);
+			break;
+		case StreamFormatJSONL:
+			fprintf(out, "{\"time\":%.6f,\"command\":", time);
+			writeQuotedString(out, entry->name, 1);
+			fputs(",\"value\":", out);
+			if (response->success) {
+				writeValue(out, response, 1);
+			} else {
+				fputs("null", out);
+			}
+			if (response->negativeResponseCode) {
+				fprintf(out, ",\"nrc\":%u", response->negativeResponseCode);
+			}
+			fputs("}\n", out);
+			break;
+		case StreamFormatBinary:
+			writeBinaryRecord(out, response, time);
+			break;
+	}
+}
+
+static double monotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Polls the entries on their schedule until interrupted or out of time, writing every response to stdout
+static void runStream(OBDIISocket *s, StreamEntry *entries, int numEntries, OBDIIPollSchedule *schedule, StreamFormat format, double duration)
+{
+	static char buffer[STREAM_BUFFER_SIZE];
+	int i;
+
+	// Samples go out in large writes, and whenever the loop is about to sleep
+	setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+
+	if (format == StreamFormatCSV) {
+		printf("time,command,value,nrc\n");
+	}
+
+	double start = monotonicTime(), now = start;
+
+	while (!interrupted && (duration <= 0 || now - start < duration)) {
+		double nextDue;
+		OBDIICommand *command = OBDIIPollScheduleNextDue(schedule, now, &nextDue);
+
+		if (!command) {
+			fflush(stdout);
+
+			double wait = nextDue - now;
+			if (duration > 0 && start + duration - now < wait) {
+				wait = start + duration - now;
+			}
+
+			struct timespec delay;
+			delay.tv_sec = (time_t)wait;
+			delay.tv_nsec = (long)((wait - delay.tv_sec) * 1e9);
+			nanosleep(&delay, NULL);
+
+			now = monotonicTime();
+			continue;
+		}
+
+		OBDIIPollScheduleMarkPolled(schedule, command, now);
+		OBDIIResponse response = OBDIIPerformQuery(s, command);
+		now = monotonicTime();
+
+		// Time the sample by when the response arrived, or when the query gave up if it didn't
+		double time = response.success ? OBDIIResponseTimestamp(&response) - start : now - start;
+
+		for (i = 0; i < numEntries; ++i) {
+			if (entries[i].command == command) {
+				entries[i].numQueries++;
+				entries[i].numAnswers += response.success != 0;
+				writeSample(stdout, format, &entries[i], &response, time);
+			}
+		}
+
+		OBDIIResponseFree(&response);
+	}
+
+	fflush(stdout);
+
+	double elapsed = now - start;
+	fprintf(stderr, "%-24s %10s %10s %10s\n", "command", "queries", "answers", "rate (Hz)");
+	for (i = 0; i < numEntries; ++i) {
+		fprintf(stderr, "%-24s %10lu %10lu %10.2f\n", entries[i].name, entries[i].numQueries, entries[i].numAnswers,
+				elapsed > 0 ? entries[i].numAnswers / elapsed : 0);
+	}
 }
 
 void handleInterrupted(int signum)
@@ -84,11 +477,17 @@ void handleInterrupted(int signum)
 int main(int argc, char **argv)
 {
     OBDIISocket s;
-    int opt, i, use_daemon = 0;
+    int opt, i, use_daemon = 0, use_raw = 0;
     extern int optind, opterr, optopt;
     canid_t tx_id = NO_CAN_ID, rx_id = NO_CAN_ID;
+    char *stream_spec = NULL;
+    StreamFormat stream_format = StreamFormatCSV;
+    double stream_duration = 0;
+    int line;
+
+    OBDIIDefinitionsInit(&definitions);
 
-    while ((opt = getopt(argc, argv, "r:t:d")) != -1) {
+    while ((opt = getopt_long(argc, argv, "r:t:dR", longOptions, NULL)) != -1) {
 	    switch (opt) {
 	    case 't':
 		    tx_id = strtoul(optarg, (char **)NULL, 16);
@@ -106,9 +505,44 @@ int main(int argc, char **argv)
 	   case 'd':
 		    use_daemon = 1;
 		    break;
+	   case 'R':
+		    use_raw = 1;
+		    break;
+	   case 's':
+		    stream_spec = optarg;
+		    break;
+	   case 'f':
+		    if (strcmp(optarg, "csv") == 0) {
+			    stream_format = StreamFormatCSV;
+		    } else if (strcmp(optarg, "jsonl") == 0) {
+			    stream_format = StreamFormatJSONL;
+		    } else if (strcmp(optarg, "binary") == 0) {
+			    stream_format = StreamFormatBinary;
+		    } else {
+			    fprintf(stderr, "Unknown format %s\n", optarg);
+			    exit(1);
+		    }
+		    break;
+	   case 'D':
+		    stream_duration = atof(optarg);
+		    break;
+	   case 'p':
+		    if (OBDIIDefinitionsLoad(&definitions, optarg, &line) < 0) {
+			    if (line == 0) {
+				    fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+			    } else if (errno == ENOENT) {
+				    fprintf(stderr, "%s:%d: The formula refers to a byte past the data length\n", optarg, line);
+			    } else if (errno == EEXIST) {
+				    fprintf(stderr, "%s:%d: A command with this name is already defined\n", optarg, line);
+			    } else {
+				    fprintf(stderr, "%s:%d: Invalid definition (%s)\n", optarg, line, strerror(errno));
+			    }
+			    exit(1);
+		    }
+		    break;
 
 	    default:
-		    fprintf(stderr, "Unknown option %c\n", opt);
+		    fprintf(stderr, "Unknown option %s\n", argv[optind - 1]);
 		    print_usage(basename(argv[0]));
 		    exit(1);
 		    break;
@@ -117,7 +551,8 @@ int main(int argc, char **argv)
 
     if ((argc - optind != 1) ||
 	(tx_id == NO_CAN_ID) ||
-	(rx_id == NO_CAN_ID)) {
+	(rx_id == NO_CAN_ID) ||
+	(use_daemon && use_raw)) {
 	    print_usage(basename(argv[0]));
 	    exit(1);
     }
@@ -130,20 +565,49 @@ int main(int argc, char **argv)
 
     sigaction(SIGINT, &interruptSignalAction, NULL);
 
-    if ((OBDIIOpenSocket(&s, argv[optind], tx_id, rx_id, use_daemon)) < 0) {
-	printf("Error connecting to vehicle: %s\n", strerror(errno));
+    int openResult;
+    if (use_raw) {
+	    openResult = OBDIIOpenRawSocket(&s, argv[optind], tx_id, rx_id);
+    } else {
+	    openResult = OBDIIOpenSocket(&s, argv[optind], tx_id, rx_id, use_daemon);
+    }
+
+    if (openResult < 0) {
+	fprintf(stderr, "Error connecting to vehicle: %s\n", strerror(errno));
     	exit(EXIT_FAILURE);
     }
+
+    if (stream_spec) {
+	StreamEntry entries[OBDII_POLL_SCHEDULE_MAX_ENTRIES];
+	OBDIIPollSchedule schedule;
+
+	int numEntries = parseStreamSpec(stream_spec, entries, OBDII_POLL_SCHEDULE_MAX_ENTRIES, &schedule);
+	if (numEntries < 0) {
+		OBDIICloseSocket(&s);
+		exit(1);
+	}
+
+	runStream(&s, entries, numEntries, &schedule, stream_format, stream_duration);
+	OBDIICloseSocket(&s);
+
+	return 0;
+    }
     
     printf("Supported commands:\n");
 
 	OBDIICommandSet supportedCommands = OBDIIGetSupportedCommands(&s);
 
 	for (i = 0; i < supportedCommands.numCommands; ++i) {
-		OBDIICommand *command = supportedCommands.commands[i];
+		OBDIICommand *command = OBDIICommandSetCommandAtIndex(&supportedCommands, i);
 		printf("%i: mode %02x, PID %02x: %s\n", i, OBDIICommandGetMode(command), OBDIICommandGetPID(command), command->name);
 	}
 
+	// Loaded definitions follow the supported commands
+	for (i = 0; i < definitions.numDefinitions; ++i) {
+		OBDIICommand *command = &definitions.definitions[i].command;
+		printf("%i: mode %02x, PID %02x: %s\n", supportedCommands.numCommands + i, OBDIICommandGetMode(command), commandPID(command), command->name);
+	}
+
     while (1) {
 	// Print prompt
 	printf("> "); 
@@ -163,10 +627,11 @@ int main(int argc, char **argv)
 		int repeatQuery = numScanned == 2 && strcmp(option, "-p") == 0;
 		int repeatInterval = (repeatQuery && numScanned == 3) ? atoi(optionArg) : 1000; // milliseconds
 
-		if (selection >= 0 && selection < supportedCommands.numCommands) {
-			OBDIICommand *command = supportedCommands.commands[selection];
+		if (selection >= 0 && selection < supportedCommands.numCommands + definitions.numDefinitions) {
+			OBDIICommand *command = selection < supportedCommands.numCommands ? OBDIICommandSetCommandAtIndex(&supportedCommands, selection)
+					: &definitions.definitions[selection - supportedCommands.numCommands].command;
 
-			printf("Querying mode %02x PID %02x...\n", OBDIICommandGetMode(command), OBDIICommandGetPID(command));
+			printf("Querying mode %02x PID %02x...\n", OBDIICommandGetMode(command), commandPID(command));
 
 			do {
 				OBDIIResponse response = OBDIIPerformQuery(&s, command);
@@ -181,7 +646,7 @@ int main(int argc, char **argv)
 					} else if (command->responseType == OBDIIResponseTypeString) {
 						printf("%s", response.stringValue);
 					} else if (command->responseType == OBDIIResponseTypeOther) {
-						printf("Unimplemented!");
+						writeValue(stdout, &response, 0);
 					}
 
 					printf("\n");
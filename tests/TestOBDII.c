@@ -111,3 +111,80 @@ TEST(OBDII, mode9SupportedPIDs)
 {
 	TestBitfield(OBDIICommands.mode9SupportedPIDs);
 }
+
+TEST(OBDII, CommandWithModeAndPID)
+{
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, OBDIICommandWithModeAndPID(0x01, 0x0C));
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.DTCs, OBDIICommandWithModeAndPID(0x03, 0x00));
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.VIN, OBDIICommandWithModeAndPID(0x09, 0x02));
+	TEST_ASSERT_NULL(OBDIICommandWithModeAndPID(0x01, 0xFF));
+	TEST_ASSERT_NULL(OBDIICommandWithModeAndPID(0x05, 0x00));
+}
+
+TEST(OBDII, CommandSetMembership)
+{
+	OBDIICommandSet commands = { 0 };
+
+	OBDIICommandSetAddCommand(&commands, OBDIICommands.engineRPMs);
+	OBDIICommandSetAddCommand(&commands, OBDIICommands.timeSinceTroubleCodesCleared);
+	OBDIICommandSetAddCommand(&commands, OBDIICommands.VIN);
+	OBDIICommandSetAddCommand(&commands, OBDIICommands.engineRPMs);
+
+	TEST_ASSERT_EQUAL(3, commands.numCommands);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.engineRPMs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.VIN));
+	TEST_ASSERT_FALSE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_FALSE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.DTCs));
+
+	OBDIICommandSetRemoveCommand(&commands, OBDIICommands.engineRPMs);
+	TEST_ASSERT_EQUAL(2, commands.numCommands);
+	TEST_ASSERT_FALSE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.engineRPMs));
+}
+
+TEST(OBDII, CommandSetIteration)
+{
+	OBDIICommandSet commands = { 0 };
+	OBDIICommand *expected[] = { OBDIICommands.mode1SupportedPIDs_1_to_20, OBDIICommands.engineRPMs, OBDIICommands.catalystTemperatureBank2Sensor2, OBDIICommands.timeSinceTroubleCodesCleared, OBDIICommands.DTCs, OBDIICommands.VIN };
+	int i;
+
+	for (i = sizeof(expected) / sizeof(expected[0]) - 1; i >= 0; --i) {
+		OBDIICommandSetAddCommand(&commands, expected[i]);
+	}
+
+	// PIDs without a predefined command are recorded, but not iterated over
+	commands._mode1SupportedPIDs.words[0xA6 / 64] |= 1ULL << (0xA6 % 64);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsPID(&commands, 0x01, 0xA6));
+
+	OBDIICommand *command = NULL;
+	for (i = 0; (command = OBDIICommandSetNextCommand(&commands, command)); ++i) {
+		TEST_ASSERT_EQUAL_PTR(expected[i], command);
+		TEST_ASSERT_EQUAL_PTR(expected[i], OBDIICommandSetCommandAtIndex(&commands, i));
+	}
+
+	TEST_ASSERT_EQUAL(6, i);
+	TEST_ASSERT_EQUAL(6, commands.numCommands);
+	TEST_ASSERT_NULL(OBDIICommandSetCommandAtIndex(&commands, 6));
+}
+
+TEST(OBDII, CommandSetAlgebra)
+{
+	OBDIICommandSet a = { 0 }, b = { 0 }, result;
+
+	OBDIICommandSetAddCommand(&a, OBDIICommands.engineRPMs);
+	OBDIICommandSetAddCommand(&a, OBDIICommands.vehicleSpeed);
+	OBDIICommandSetAddCommand(&a, OBDIICommands.DTCs);
+	OBDIICommandSetAddCommand(&b, OBDIICommands.vehicleSpeed);
+	OBDIICommandSetAddCommand(&b, OBDIICommands.VIN);
+
+	OBDIICommandSetUnion(&result, &a, &b);
+	TEST_ASSERT_EQUAL(4, result.numCommands);
+
+	OBDIICommandSetIntersection(&result, &a, &b);
+	TEST_ASSERT_EQUAL(1, result.numCommands);
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.vehicleSpeed, OBDIICommandSetNextCommand(&result, NULL));
+
+	OBDIICommandSetDifference(&a, &a, &b);
+	TEST_ASSERT_EQUAL(2, a.numCommands);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&a, OBDIICommands.engineRPMs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&a, OBDIICommands.DTCs));
+}
@@ -0,0 +1,126 @@
+#include "OBDIIArrow.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+static OBDIIArrowBuilder builder;
+static struct ArrowArrayStream stream;
+
+TEST_GROUP(OBDIIArrow);
+
+TEST_SETUP(OBDIIArrow)
+{
+	memset(&stream, 0, sizeof(stream));
+}
+
+TEST_TEAR_DOWN(OBDIIArrow)
+{
+	if (stream.release) {
+		stream.release(&stream);
+	}
+	OBDIIArrowBuilderFree(&builder);
+}
+
+TEST(OBDIIArrow, Numeric)
+{
+	struct ArrowSchema schema;
+	struct ArrowArray batch;
+	OBDIIResponse response = { 0 };
+	response.command = OBDIICommands.engineRPMs;
+
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderInit(&builder, OBDIICommands.engineRPMs, 2));
+
+	// Monotonic timestamps come out as wall-clock time
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	TEST_ASSERT_TRUE(llabs(builder.wallClockOffset / 1000000000LL - (time(NULL) - now.tv_sec)) <= 1);
+
+	response.success = 1;
+	response.numericValue = 1000;
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderAppend(&builder, &response, 1.5));
+	response.success = 0;
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderAppend(&builder, &response, 2.5));
+	response.success = 1;
+	response.numericValue = 3000;
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderAppend(&builder, &response, 3.5));
+
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderExportStream(&builder, &stream));
+
+	TEST_ASSERT_EQUAL(0, stream.get_schema(&stream, &schema));
+	TEST_ASSERT_EQUAL_STRING("+s", schema.format);
+	TEST_ASSERT_EQUAL(2, schema.n_children);
+	TEST_ASSERT_EQUAL_STRING("tsn:UTC", schema.children[0]->format);
+	TEST_ASSERT_EQUAL_STRING("timestamp", schema.children[0]->name);
+	TEST_ASSERT_EQUAL_STRING("f", schema.children[1]->format);
+	TEST_ASSERT_EQUAL_STRING(OBDIICommands.engineRPMs->name, schema.children[1]->name);
+	TEST_ASSERT_EQUAL(ARROW_FLAG_NULLABLE, schema.children[1]->flags);
+	schema.release(&schema);
+	TEST_ASSERT_NULL(schema.release);
+
+	// The first batch is full, with a null
+	TEST_ASSERT_EQUAL(0, stream.get_next(&stream, &batch));
+	TEST_ASSERT_EQUAL(2, batch.length);
+	TEST_ASSERT_EQUAL(2, batch.n_children);
+
+	const int64_t *timestamps = batch.children[0]->buffers[1];
+	TEST_ASSERT_TRUE(timestamps[0] == 1500000000LL + builder.wallClockOffset && timestamps[1] == 2500000000LL + builder.wallClockOffset);
+
+	struct ArrowArray *values = batch.children[1];
+	TEST_ASSERT_EQUAL(1, values->null_count);
+	TEST_ASSERT_EQUAL_HEX8(0x01, ((const uint8_t *)values->buffers[0])[0]);
+	TEST_ASSERT_EQUAL_FLOAT(1000, ((const float *)values->buffers[1])[0]);
+	batch.release(&batch);
+
+	// The rest, without nulls
+	TEST_ASSERT_EQUAL(0, stream.get_next(&stream, &batch));
+	TEST_ASSERT_EQUAL(1, batch.length);
+	TEST_ASSERT_EQUAL(0, batch.children[1]->null_count);
+	TEST_ASSERT_NULL(batch.children[1]->buffers[0]);
+	TEST_ASSERT_EQUAL_FLOAT(3000, ((const float *)batch.children[1]->buffers[1])[0]);
+	batch.release(&batch);
+
+	TEST_ASSERT_EQUAL(0, stream.get_next(&stream, &batch));
+	TEST_ASSERT_NULL(batch.release);
+}
+
+TEST(OBDIIArrow, TroubleCodes)
+{
+	struct ArrowArray batch;
+	char troubleCodes[2][6] = { "P0301", "U0100" };
+	OBDIIResponse response = { 0 };
+	response.success = 1;
+	response.command = OBDIICommands.DTCs;
+	response.DTCs.troubleCodes = troubleCodes;
+	response.DTCs.numTroubleCodes = 2;
+
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderInit(&builder, OBDIICommands.DTCs, 16));
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderAppend(&builder, &response, 1));
+	response.DTCs.numTroubleCodes = 0;
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderAppend(&builder, &response, 2));
+
+	TEST_ASSERT_EQUAL(0, OBDIIArrowBuilderExportStream(&builder, &stream));
+	TEST_ASSERT_EQUAL(0, stream.get_next(&stream, &batch));
+	TEST_ASSERT_EQUAL(2, batch.length);
+
+	// A list of strings per row
+	struct ArrowArray *lists = batch.children[1];
+	const int32_t *listOffsets = lists->buffers[1];
+	TEST_ASSERT_TRUE(listOffsets[0] == 0 && listOffsets[1] == 2 && listOffsets[2] == 2);
+
+	struct ArrowArray *items = lists->children[0];
+	const int32_t *stringOffsets = items->buffers[1];
+	TEST_ASSERT_EQUAL(2, items->length);
+	TEST_ASSERT_TRUE(stringOffsets[0] == 0 && stringOffsets[1] == 5 && stringOffsets[2] == 10);
+	TEST_ASSERT_EQUAL(0, memcmp("P0301U0100", items->buffers[2], 10));
+
+	batch.release(&batch);
+}
+
+TEST(OBDIIArrow, Unsupported)
+{
+	TEST_ASSERT_EQUAL(-1, OBDIIArrowBuilderInit(&builder, OBDIICommands.oxygenSensor1_fuelTrim, 16));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+}
@@ -0,0 +1,124 @@
+#include "OBDIIBatch.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// An odd number of payloads, so that every kernel leaves a tail for the scalar loop
+#define NUM_PAYLOADS 37
+
+static unsigned char *payloads;
+static float values[NUM_PAYLOADS], secondaryValues[NUM_PAYLOADS];
+static unsigned char valid[NUM_PAYLOADS];
+
+// Fills `count` payloads of `stride` bytes with valid responses to the command, using varied data bytes
+static void FillPayloads(OBDIICommand *command, int stride, int count)
+{
+	int i, j;
+	for (i = 0; i < count; ++i) {
+		unsigned char *payload = payloads + i * stride;
+		payload[0] = OBDIICommandGetMode(command) + 0x40;
+		payload[1] = OBDIICommandGetPID(command);
+		for (j = 2; j < stride; ++j) {
+			payload[j] = (unsigned char)(i * 71 + j * 29 + (i == count - 1 ? 0xFF : 0));
+		}
+	}
+}
+
+static void AssertMatchesDecoder(OBDIICommand *command, int stride, int count)
+{
+	int i;
+	for (i = 0; i < count; ++i) {
+		OBDIIResponse response = OBDIIDecodeResponseForCommand(command, payloads + i * stride, command->expectedResponseLength);
+		TEST_ASSERT_TRUE(response.success);
+		TEST_ASSERT_EQUAL(1, valid[i]);
+
+		if (command->responseType == OBDIIResponseTypeNumeric) {
+			TEST_ASSERT_FLOAT_WITHIN(1e-4 + 1e-5 * fabs(response.numericValue), response.numericValue, values[i]);
+		} else {
+			TEST_ASSERT_FLOAT_WITHIN(1e-4 + 1e-5 * fabs(response.oxygenSensorValues.voltage), response.oxygenSensorValues.voltage, values[i]);
+			TEST_ASSERT_FLOAT_WITHIN(1e-4 + 1e-5 * fabs(response.oxygenSensorValues.shortTermFuelTrim), response.oxygenSensorValues.shortTermFuelTrim, secondaryValues[i]);
+		}
+	}
+}
+
+TEST_GROUP(OBDIIBatch);
+
+TEST_SETUP(OBDIIBatch)
+{
+	payloads = malloc(NUM_PAYLOADS * 8);
+	memset(values, 0, sizeof(values));
+	memset(secondaryValues, 0, sizeof(secondaryValues));
+	memset(valid, 0, sizeof(valid));
+}
+
+TEST_TEAR_DOWN(OBDIIBatch)
+{
+	free(payloads);
+}
+
+TEST(OBDIIBatch, MatchesDecoders)
+{
+	int pid, numSupported = 0;
+	for (pid = 0; pid <= 0x4E; ++pid) {
+		OBDIICommand *command = OBDIICommandWithModeAndPID(0x01, pid);
+		if (!OBDIIBatchSupportsCommand(command)) {
+			continue;
+		}
+
+		numSupported++;
+
+		// Payloads packed back to back, so that the vectorized loads can't run past the end of the buffer unnoticed
+		int stride = command->expectedResponseLength;
+		free(payloads);
+		payloads = malloc(NUM_PAYLOADS * stride);
+		FillPayloads(command, stride, NUM_PAYLOADS);
+
+		TEST_ASSERT_EQUAL(NUM_PAYLOADS, OBDIIDecodeBatch(command, payloads, stride, NUM_PAYLOADS, values, secondaryValues, valid));
+		AssertMatchesDecoder(command, stride, NUM_PAYLOADS);
+
+		memset(valid, 0, sizeof(valid));
+		TEST_ASSERT_EQUAL(NUM_PAYLOADS, OBDIIDecodeBatchScalar(command, payloads, stride, NUM_PAYLOADS, values, secondaryValues, valid));
+		AssertMatchesDecoder(command, stride, NUM_PAYLOADS);
+	}
+
+	// Every numeric and oxygen sensor command in the table
+	TEST_ASSERT_EQUAL(67, numSupported);
+}
+
+TEST(OBDIIBatch, InvalidPayloads)
+{
+	OBDIICommand *command = OBDIICommands.engineRPMs;
+	FillPayloads(command, 8, NUM_PAYLOADS);
+
+	payloads[3 * 8] = 0x7F; // Negative response
+	payloads[20 * 8 + 1] = 0x0D; // Response to another PID
+	payloads[36 * 8] = 0x00;
+
+	TEST_ASSERT_EQUAL(NUM_PAYLOADS - 3, OBDIIDecodeBatch(command, payloads, 8, NUM_PAYLOADS, values, NULL, valid));
+
+	int i;
+	for (i = 0; i < NUM_PAYLOADS; ++i) {
+		if (i == 3 || i == 20 || i == 36) {
+			TEST_ASSERT_EQUAL(0, valid[i]);
+			TEST_ASSERT_TRUE(isnan(values[i]));
+		} else {
+			TEST_ASSERT_EQUAL(1, valid[i]);
+			TEST_ASSERT_EQUAL_FLOAT((payloads[i * 8 + 2] << 8 | payloads[i * 8 + 3]) / 4.0, values[i]);
+		}
+	}
+}
+
+TEST(OBDIIBatch, UnsupportedCommands)
+{
+	TEST_ASSERT_FALSE(OBDIIBatchSupportsCommand(OBDIICommands.mode1SupportedPIDs_1_to_20));
+	TEST_ASSERT_FALSE(OBDIIBatchSupportsCommand(OBDIICommands.fuelSystemStatus));
+	TEST_ASSERT_FALSE(OBDIIBatchSupportsCommand(OBDIICommands.DTCs));
+	TEST_ASSERT_FALSE(OBDIIBatchSupportsCommand(OBDIICommands.VIN));
+
+	TEST_ASSERT_EQUAL(-1, OBDIIDecodeBatch(OBDIICommands.VIN, payloads, 8, NUM_PAYLOADS, values, NULL, NULL));
+
+	// Stride shorter than a response
+	TEST_ASSERT_EQUAL(-1, OBDIIDecodeBatch(OBDIICommands.engineRPMs, payloads, 3, NUM_PAYLOADS, values, NULL, NULL));
+}
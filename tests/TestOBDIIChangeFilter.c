@@ -0,0 +1,142 @@
+#include "OBDIIChangeFilter.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+static OBDIIChangeFilter filter;
+
+static int Submit(OBDIICommand *command, float value, double timestamp)
+{
+	OBDIIResponse response;
+	memset(&response, 0, sizeof(response));
+	response.success = 1;
+	response.command = command;
+
+	if (command->responseType == OBDIIResponseTypeBitfield) {
+		response.bitfieldValue = (uint32_t)value;
+	} else {
+		response.numericValue = value;
+	}
+
+	return OBDIIChangeFilterSubmit(&filter, &response, timestamp);
+}
+
+static int IsReadable(int fd)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	return poll(&pfd, 1, 0) == 1;
+}
+
+TEST_GROUP(OBDIIChangeFilter);
+
+TEST_SETUP(OBDIIChangeFilter)
+{
+	OBDIIChangeFilterInit(&filter, NULL);
+}
+
+TEST_TEAR_DOWN(OBDIIChangeFilter)
+{
+	OBDIIChangeFilterFree(&filter);
+}
+
+TEST(OBDIIChangeFilter, DefaultRule)
+{
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineCoolantTemperature, 80, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineCoolantTemperature, 80, 1));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineCoolantTemperature, 81, 2));
+
+	TEST_ASSERT_EQUAL(3, filter.numSubmitted);
+	TEST_ASSERT_EQUAL(2, filter.numPublished);
+}
+
+TEST(OBDIIChangeFilter, Deadbands)
+{
+	OBDIIChangeFilterRule absolute = { 2, 0, 0, 0 };
+	OBDIIChangeFilterRule relative = { 0, 0.1, 0, 0 };
+	OBDIIChangeFilterSetRule(&filter, OBDIICommands.engineCoolantTemperature, &absolute);
+	OBDIIChangeFilterSetRule(&filter, OBDIICommands.engineRPMs, &relative);
+
+	// Compared with the last published value, so that slow drifts are published eventually
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineCoolantTemperature, 80, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineCoolantTemperature, 81, 1));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineCoolantTemperature, 82, 2));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineCoolantTemperature, 83, 3));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineCoolantTemperature, 81, 4));
+
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineRPMs, 1000, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 1090, 1));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineRPMs, 1110, 2));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 1010, 3));
+}
+
+TEST(OBDIIChangeFilter, MaxSilence)
+{
+	OBDIIChangeFilterRule rule = { 5, 0, 10, 0 };
+	OBDIIChangeFilterSetRule(&filter, OBDIICommands.fuelTankLevelInput, &rule);
+
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.fuelTankLevelInput, 50, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.fuelTankLevelInput, 50, 9.9));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.fuelTankLevelInput, 50, 10));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.fuelTankLevelInput, 51, 15));
+}
+
+TEST(OBDIIChangeFilter, Bitfields)
+{
+	// Only the MIL bit of the monitor status
+	OBDIIChangeFilterRule rule = { 0, 0, 0, 0x80000000 };
+	OBDIIChangeFilterSetRule(&filter, OBDIICommands.monitorStatus, &rule);
+
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.monitorStatus, 0x00070000, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.monitorStatus, 0x00070100, 1));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.monitorStatus, 0x80070100, 2));
+}
+
+TEST(OBDIIChangeFilter, EventFD)
+{
+	int efd = OBDIIChangeFilterOpenEventFD(&filter);
+	TEST_ASSERT_TRUE(efd >= 0);
+	TEST_ASSERT_EQUAL(efd, OBDIIChangeFilterOpenEventFD(&filter));
+	TEST_ASSERT_FALSE(IsReadable(efd));
+
+	Submit(OBDIICommands.engineRPMs, 800, 0);
+	Submit(OBDIICommands.engineRPMs, 900, 1);
+	Submit(OBDIICommands.vehicleSpeed, 30, 1);
+	TEST_ASSERT_TRUE(IsReadable(efd));
+
+	// The latest value of each command, one at a time
+	OBDIIChangeFilterSample samples[2];
+	TEST_ASSERT_EQUAL(1, OBDIIChangeFilterTakeChanges(&filter, samples, 1));
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, samples[0].command);
+	TEST_ASSERT_EQUAL_FLOAT(900, samples[0].numericValue);
+	TEST_ASSERT_EQUAL_FLOAT(1, samples[0].timestamp);
+	TEST_ASSERT_TRUE(IsReadable(efd));
+
+	TEST_ASSERT_EQUAL(1, OBDIIChangeFilterTakeChanges(&filter, samples, 2));
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.vehicleSpeed, samples[0].command);
+	TEST_ASSERT_FALSE(IsReadable(efd));
+
+	// Dropped values don't wake the consumer
+	Submit(OBDIICommands.vehicleSpeed, 30, 2);
+	TEST_ASSERT_FALSE(IsReadable(efd));
+	TEST_ASSERT_EQUAL(0, OBDIIChangeFilterTakeChanges(&filter, samples, 2));
+}
+
+TEST(OBDIIChangeFilter, UnfilterableResponses)
+{
+	OBDIIResponse response;
+	memset(&response, 0, sizeof(response));
+	response.command = OBDIICommands.engineRPMs;
+	TEST_ASSERT_EQUAL(-1, OBDIIChangeFilterSubmit(&filter, &response, 0));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	response.success = 1;
+	response.command = OBDIICommands.VIN;
+	TEST_ASSERT_EQUAL(-1, OBDIIChangeFilterSubmit(&filter, &response, 0));
+	TEST_ASSERT_EQUAL(0, filter.numSubmitted);
+}
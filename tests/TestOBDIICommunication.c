@@ -0,0 +1,561 @@
+#include "OBDIICommunication.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+// The library's end of a socket pair stands in for a CAN socket; the test plays the ECU on the other end
+static OBDIISocket s;
+static int ecu;
+
+static void OpenSocketPair(OBDIITransport transport)
+{
+	int fds[2];
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+
+	TEST_ASSERT_EQUAL(0, OBDIIOpenSocketOnDescriptor(&s, fds[0], transport, 0x7E0, 0x7E8));
+	ecu = fds[1];
+}
+
+static void RespondWithFrame(const unsigned char *data)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = 0x7E8;
+	frame.can_dlc = 8;
+	memcpy(frame.data, data, 8);
+
+	TEST_ASSERT_EQUAL(sizeof(frame), write(ecu, &frame, sizeof(frame)));
+}
+
+TEST_GROUP(OBDIICommunication);
+
+TEST_SETUP(OBDIICommunication)
+{
+	ecu = -1;
+}
+
+TEST_TEAR_DOWN(OBDIICommunication)
+{
+	// Unless the test closed it already. The socket pair isn't the daemon's, even if a test shared it.
+	if (s.queue) {
+		s.shared = 0;
+		OBDIICloseSocket(&s);
+	}
+	close(ecu);
+}
+
+TEST(OBDIICommunication, RawRequestAndResponse)
+{
+	OpenSocketPair(OBDIITransportRaw);
+	OBDIIResponse response;
+
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+
+	struct can_frame request;
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX32(0x7E0, request.can_id);
+	TEST_ASSERT_EQUAL_HEX8(0x02, request.data[0]);
+	TEST_ASSERT_EQUAL_HEX8(0x01, request.data[1]);
+	TEST_ASSERT_EQUAL_HEX8(0x0C, request.data[2]);
+
+	TEST_ASSERT_EQUAL(0, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+
+	// A late response to another query, then the response
+	RespondWithFrame((unsigned char []){ 0x03, 0x41, 0x0D, 0x32, 0x55, 0x55, 0x55, 0x55 });
+	TEST_ASSERT_EQUAL(0, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+
+	RespondWithFrame((unsigned char []){ 0x04, 0x41, 0x0C, 0x1A, 0xF8, 0x55, 0x55, 0x55 });
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(1726.0, response.numericValue);
+}
+
+TEST(OBDIICommunication, RawSegmentedResponse)
+{
+	OpenSocketPair(OBDIITransportRaw);
+	OBDIIResponse response;
+
+	TEST_ASSERT_EQUAL(-1, OBDIISendRequest(&s, OBDIICommands.VIN));
+	TEST_ASSERT_EQUAL(EMSGSIZE, errno);
+
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.mode1SupportedPIDs_1_to_20));
+
+	// An ECU may still split a response that would fit in a single frame
+	RespondWithFrame((unsigned char []){ 0x10, 0x08, 0x41, 0x00, 0xBE, 0x1F, 0xA8, 0x13 });
+	TEST_ASSERT_EQUAL(-1, OBDIITryReceiveResponse(&s, OBDIICommands.mode1SupportedPIDs_1_to_20, &response));
+	TEST_ASSERT_EQUAL(EMSGSIZE, errno);
+}
+
+TEST(OBDIICommunication, ISOTPRequestAndResponse)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+	OBDIIResponse response;
+	unsigned char request[8];
+
+	// Responses left over from earlier queries are discarded when sending
+	TEST_ASSERT_EQUAL(3, write(ecu, (unsigned char []){ 0x41, 0x0D, 0x32 }, 3));
+
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(2, read(ecu, request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x0D, request[1]);
+
+	TEST_ASSERT_EQUAL(0, OBDIITryReceiveResponse(&s, OBDIICommands.vehicleSpeed, &response));
+
+	TEST_ASSERT_EQUAL(3, write(ecu, (unsigned char []){ 0x41, 0x0D, 0x58 }, 3));
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.vehicleSpeed, &response));
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(88.0, response.numericValue);
+
+	// A truncated response answers the request, but unsuccessfully
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(2, write(ecu, (unsigned char []){ 0x41, 0x0C }, 2));
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+	TEST_ASSERT_FALSE(response.success);
+}
+
+TEST(OBDIICommunication, NegativeResponse)
+{
+	OpenSocketPair(OBDIITransportRaw);
+	OBDIIResponse response;
+	struct can_frame request;
+
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.fuelPressure));
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+
+	// "Response pending" isn't the answer yet
+	RespondWithFrame((unsigned char []){ 0x03, 0x7F, 0x01, 0x78, 0x55, 0x55, 0x55, 0x55 });
+	TEST_ASSERT_EQUAL(0, OBDIITryReceiveResponse(&s, OBDIICommands.fuelPressure, &response));
+
+	RespondWithFrame((unsigned char []){ 0x03, 0x7F, 0x01, 0x31, 0x55, 0x55, 0x55, 0x55 });
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.fuelPressure, &response));
+	TEST_ASSERT_FALSE(response.success);
+	TEST_ASSERT_EQUAL_HEX8(OBDII_NRC_REQUEST_OUT_OF_RANGE, response.negativeResponseCode);
+	TEST_ASSERT_EQUAL_HEX8(OBDII_NRC_REQUEST_OUT_OF_RANGE, OBDIIUnsupportedCode(&s, OBDIICommands.fuelPressure));
+
+	// The command isn't sent to the ECU again
+	response = OBDIIPerformQuery(&s, OBDIICommands.fuelPressure);
+	TEST_ASSERT_FALSE(response.success);
+	TEST_ASSERT_EQUAL_HEX8(OBDII_NRC_REQUEST_OUT_OF_RANGE, response.negativeResponseCode);
+	TEST_ASSERT_TRUE(OBDIIResponseTimestamp(&response) > 0);
+	TEST_ASSERT_EQUAL(-1, recv(ecu, &request, sizeof(request), MSG_DONTWAIT));
+
+	// Later queries get the code the ECU refused the command with
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+	RespondWithFrame((unsigned char []){ 0x03, 0x7F, 0x01, 0x12, 0x55, 0x55, 0x55, 0x55 });
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.vehicleSpeed, &response));
+	response = OBDIIPerformQuery(&s, OBDIICommands.vehicleSpeed);
+	TEST_ASSERT_EQUAL_HEX8(OBDII_NRC_SUBFUNCTION_NOT_SUPPORTED, response.negativeResponseCode);
+	TEST_ASSERT_EQUAL(-1, recv(ecu, &request, sizeof(request), MSG_DONTWAIT));
+
+	// Refusals for other reasons aren't remembered
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+	RespondWithFrame((unsigned char []){ 0x03, 0x7F, 0x01, 0x22, 0x55, 0x55, 0x55, 0x55 });
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+	TEST_ASSERT_EQUAL_HEX8(OBDII_NRC_CONDITIONS_NOT_CORRECT, response.negativeResponseCode);
+	TEST_ASSERT_EQUAL_HEX8(0, OBDIIUnsupportedCode(&s, OBDIICommands.engineRPMs));
+
+	// Forgotten refusals are asked again
+	OBDIIForgetUnsupported(&s, OBDIICommands.vehicleSpeed);
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+	TEST_ASSERT_EQUAL(0, OBDIICancelRequest(&s));
+}
+
+TEST(OBDIICommunication, ResponsePending)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+
+	// The ECU asks for more time, then answers after the usual one second timeout
+	pid_t pid = fork();
+	TEST_ASSERT_TRUE(pid >= 0);
+	if (pid == 0) {
+		unsigned char request[8];
+		if (read(ecu, request, sizeof(request)) == 2) {
+			write(ecu, (unsigned char []){ 0x7F, 0x01, 0x78 }, 3);
+			usleep(1200000);
+			write(ecu, (unsigned char []){ 0x41, 0x0C, 0x1A, 0xF8 }, 4);
+		}
+		_exit(0);
+	}
+
+	OBDIIResponse response = OBDIIPerformQuery(&s, OBDIICommands.engineRPMs);
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL(0, response.negativeResponseCode);
+	TEST_ASSERT_EQUAL_FLOAT(1726.0, response.numericValue);
+
+	waitpid(pid, NULL, 0);
+}
+
+static double Seconds(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+TEST(OBDIICommunication, Timestamps)
+{
+	OpenSocketPair(OBDIITransportRaw);
+	OBDIIResponse response;
+	struct can_frame request;
+	struct timespec now;
+
+	// The response is stamped as it arrives, not when it is read
+	TEST_ASSERT_EQUAL(0, OBDIIEnableReceiveTimestamps(s.s));
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+	RespondWithFrame((unsigned char []){ 0x04, 0x41, 0x0C, 0x1A, 0xF8, 0x55, 0x55, 0x55 });
+	usleep(50000);
+
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	TEST_ASSERT_TRUE(Seconds(&response.requestTimestamp) > 0);
+	TEST_ASSERT_TRUE(Seconds(&response.requestTimestamp) <= OBDIIResponseTimestamp(&response));
+	TEST_ASSERT_TRUE(Seconds(&now) - OBDIIResponseTimestamp(&response) >= 0.04);
+	TEST_ASSERT_TRUE(Seconds(&now) - OBDIIResponseTimestamp(&response) < 1);
+
+	// Without kernel timestamps, it is stamped when read
+	OBDIICloseSocket(&s);
+	close(ecu);
+	OpenSocketPair(OBDIITransportRaw);
+
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(sizeof(request), read(ecu, &request, sizeof(request)));
+	RespondWithFrame((unsigned char []){ 0x04, 0x41, 0x0C, 0x1A, 0xF8, 0x55, 0x55, 0x55 });
+	usleep(50000);
+
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	TEST_ASSERT_TRUE(Seconds(&now) - OBDIIResponseTimestamp(&response) < 0.04);
+	TEST_ASSERT_TRUE(Seconds(&now) - Seconds(&response.requestTimestamp) >= 0.05);
+
+	// Responses the ECU wasn't asked for have no timestamps
+	OBDIIResponse decoded = OBDIIDecodeResponseForCommand(OBDIICommands.engineRPMs, (unsigned char []){ 0x41, 0x0C, 0x1A, 0xF8 }, 4);
+	TEST_ASSERT_EQUAL_FLOAT(0, OBDIIResponseTimestamp(&decoded));
+}
+
+TEST(OBDIICommunication, SupportedCommandsUpToFF)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+
+	// Queued in the order the ranges are queried; each range flags the next one with its last bit
+	unsigned char responses[][6] = {
+		{ 0x41, 0x00, 0x00, 0x18, 0x00, 0x01 }, // 0x0C, 0x0D, 0x20
+		{ 0x41, 0x20, 0x00, 0x00, 0x00, 0x01 }, // 0x40
+		{ 0x41, 0x40, 0x00, 0x00, 0x00, 0x03 }, // 0x5F, 0x60
+		{ 0x41, 0x60, 0x00, 0x00, 0x00, 0x01 }, // 0x80
+		{ 0x41, 0x80, 0x00, 0x00, 0x00, 0x01 }, // 0xA0
+		{ 0x41, 0xA0, 0x00, 0x00, 0x00, 0x01 }, // 0xC0
+		{ 0x41, 0xC0, 0x00, 0x00, 0x00, 0x01 }, // 0xE0
+		{ 0x41, 0xE0, 0x00, 0x00, 0x00, 0x02 }, // 0xFF
+		{ 0x49, 0x00, 0x40, 0x00, 0x00, 0x00 } // VIN
+	};
+
+	int i;
+	for (i = 0; i < sizeof(responses) / sizeof(responses[0]); ++i) {
+		TEST_ASSERT_EQUAL(6, write(ecu, responses[i], 6));
+	}
+
+	OBDIICommandSet commands = OBDIIGetSupportedCommands(&s);
+
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.engineRPMs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.mode1SupportedPIDs_41_to_60));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.DTCs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.VIN));
+	TEST_ASSERT_FALSE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.vinMessageCount));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsPID(&commands, 0x01, 0x5F));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsPID(&commands, 0x01, 0xE0));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsPID(&commands, 0x01, 0xFF));
+
+	// 0x00, 0x0C, 0x0D, 0x20, 0x40, DTCs, mode 9 0x00 and VIN
+	TEST_ASSERT_EQUAL(8, commands.numCommands);
+}
+
+TEST(OBDIICommunication, Cycle)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+
+	// A second ECU, which never answers
+	int fds[2];
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+	OBDIISocket other;
+	TEST_ASSERT_EQUAL(0, OBDIIOpenSocketOnDescriptor(&other, fds[0], OBDIITransportISOTP, 0x7E1, 0x7E9));
+
+	OBDIICycle cycle;
+	OBDIICycleInit(&cycle);
+	TEST_ASSERT_EQUAL(0, OBDIICycleAdd(&cycle, &s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(1, OBDIICycleAdd(&cycle, &other, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(2, OBDIICycleAdd(&cycle, &s, OBDIICommands.vehicleSpeed));
+
+	// A late response to an earlier query is skipped, and the queries on the same socket are answered in order
+	TEST_ASSERT_EQUAL(3, write(ecu, (unsigned char []){ 0x41, 0x0D, 0x32 }, 3));
+	TEST_ASSERT_EQUAL(4, write(ecu, (unsigned char []){ 0x41, 0x0C, 0x1A, 0xF8 }, 4));
+	TEST_ASSERT_EQUAL(3, write(ecu, (unsigned char []){ 0x41, 0x0D, 0x58 }, 3));
+
+	TEST_ASSERT_EQUAL(2, OBDIICyclePerform(&cycle, 50));
+	TEST_ASSERT_TRUE(cycle.responses[0].success);
+	TEST_ASSERT_EQUAL_FLOAT(1726.0, cycle.responses[0].numericValue);
+	TEST_ASSERT_FALSE(cycle.responses[1].success);
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, cycle.responses[1].command);
+	TEST_ASSERT_TRUE(cycle.responses[2].success);
+	TEST_ASSERT_EQUAL_FLOAT(88.0, cycle.responses[2].numericValue);
+
+	// The second query on the socket was only sent once the first was answered
+	unsigned char request[8];
+	TEST_ASSERT_EQUAL(2, read(ecu, request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x0C, request[1]);
+	TEST_ASSERT_EQUAL(2, read(ecu, request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x0D, request[1]);
+	TEST_ASSERT_EQUAL(2, read(fds[1], request, sizeof(request)));
+
+	OBDIICycleFree(&cycle);
+	OBDIICloseSocket(&other);
+	close(fds[1]);
+}
+
+TEST(OBDIICommunication, CycleFull)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+
+	OBDIICycle cycle;
+	OBDIICycleInit(&cycle);
+
+	int i;
+	for (i = 0; i < OBDII_CYCLE_MAX_QUERIES; ++i) {
+		TEST_ASSERT_EQUAL(i, OBDIICycleAdd(&cycle, &s, OBDIICommands.engineRPMs));
+	}
+
+	errno = 0;
+	TEST_ASSERT_EQUAL(-1, OBDIICycleAdd(&cycle, &s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(ENOSPC, errno);
+}
+
+static struct timespec DeadlineAfter(long ms)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	deadline.tv_sec += ms / 1000;
+	deadline.tv_nsec += (ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	return deadline;
+}
+
+TEST(OBDIICommunication, DeadlineAnswered)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+	OBDIIResponse response;
+
+	// The ECU answers from another process, once the request is sent
+	pid_t pid = fork();
+	TEST_ASSERT_TRUE(pid >= 0);
+	if (pid == 0) {
+		unsigned char request[8];
+		if (read(ecu, request, sizeof(request)) == 2) {
+			write(ecu, (unsigned char []){ 0x41, 0x0C, 0x1A, 0xF8 }, 4);
+		}
+		_exit(0);
+	}
+
+	struct timespec deadline = DeadlineAfter(1000);
+	TEST_ASSERT_EQUAL(OBDIIQueryStatusAnswered, OBDIIPerformQueryWithDeadline(&s, OBDIICommands.engineRPMs, &deadline, -1, &response));
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(1726.0, response.numericValue);
+
+	waitpid(pid, NULL, 0);
+}
+
+TEST(OBDIICommunication, DeadlineTimedOut)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+	OBDIIResponse response;
+
+	struct timespec deadline = DeadlineAfter(20);
+	TEST_ASSERT_EQUAL(OBDIIQueryStatusTimedOut, OBDIIPerformQueryWithDeadline(&s, OBDIICommands.engineRPMs, &deadline, -1, &response));
+	TEST_ASSERT_FALSE(response.success);
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, response.command);
+
+	// Nothing arrived, so the response is stamped with when the request went out
+	TEST_ASSERT_TRUE(OBDIIResponseTimestamp(&response) > 0);
+	TEST_ASSERT_TRUE(OBDIIResponseTimestamp(&response) == Seconds(&response.requestTimestamp));
+
+	// The caller gave up long before the ECU's time was up, so this doesn't say that the ECU stopped answering
+	TEST_ASSERT_FALSE(response.timedOut);
+
+	// A deadline shared with an earlier query may already have passed
+	TEST_ASSERT_EQUAL(OBDIIQueryStatusTimedOut, OBDIIPerformQueryWithDeadline(&s, OBDIICommands.vehicleSpeed, &deadline, -1, &response));
+}
+
+TEST(OBDIICommunication, DeadlineCancelled)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+	OBDIIResponse response;
+
+	int cancelFD = eventfd(0, EFD_NONBLOCK);
+	TEST_ASSERT_TRUE(cancelFD >= 0);
+	TEST_ASSERT_EQUAL(0, eventfd_write(cancelFD, 1));
+
+	struct timespec start = DeadlineAfter(0);
+	struct timespec deadline = DeadlineAfter(5000);
+	TEST_ASSERT_EQUAL(OBDIIQueryStatusCancelled, OBDIIPerformQueryWithDeadline(&s, OBDIICommands.engineRPMs, &deadline, cancelFD, &response));
+	TEST_ASSERT_FALSE(response.success);
+	TEST_ASSERT_FALSE(response.timedOut);
+
+	// Well before the deadline
+	struct timespec end = DeadlineAfter(0);
+	TEST_ASSERT_TRUE(end.tv_sec - start.tv_sec < 1);
+
+	close(cancelFD);
+}
+
+TEST(OBDIICommunication, SharedSocketLockedByAnotherProcess)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+	s.shared = 1;
+
+	int locked[2], release[2];
+	TEST_ASSERT_EQUAL(0, pipe(locked));
+	TEST_ASSERT_EQUAL(0, pipe(release));
+
+	// Another client holds the lock on the same open file description, as passed on by the daemon
+	pid_t pid = fork();
+	TEST_ASSERT_TRUE(pid >= 0);
+	if (pid == 0) {
+		struct flock lock;
+		char c = 0;
+		memset(&lock, 0, sizeof(lock));
+		lock.l_type = F_WRLCK;
+		lock.l_whence = SEEK_SET;
+		fcntl(s.s, F_SETLKW, &lock);
+		write(locked[1], &c, 1);
+		read(release[0], &c, 1);
+		_exit(0);
+	}
+
+	char c = 0;
+	TEST_ASSERT_EQUAL(1, read(locked[0], &c, 1));
+	TEST_ASSERT_EQUAL(-1, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(EWOULDBLOCK, errno);
+
+	// The lock goes away with the other client
+	TEST_ASSERT_EQUAL(1, write(release[1], &c, 1));
+	waitpid(pid, NULL, 0);
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(0, OBDIICancelRequest(&s));
+
+	close(locked[0]);
+	close(locked[1]);
+	close(release[0]);
+	close(release[1]);
+}
+
+#define QUERIES_PER_THREAD 50
+
+TEST(OBDIICommunication, RequestWhileSocketBusy)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.engineRPMs));
+
+	// Nothing else goes out on the socket while the response is outstanding
+	TEST_ASSERT_EQUAL(-1, OBDIISendRequest(&s, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(EWOULDBLOCK, errno);
+
+	struct timespec deadline = DeadlineAfter(20);
+	OBDIIResponse response;
+	TEST_ASSERT_EQUAL(OBDIIQueryStatusTimedOut, OBDIIPerformQueryWithDeadline(&s, OBDIICommands.vehicleSpeed, &deadline, -1, &response));
+
+	OBDIICycle cycle;
+	OBDIICycleInit(&cycle);
+	OBDIICycleAdd(&cycle, &s, OBDIICommands.vehicleSpeed);
+	TEST_ASSERT_EQUAL(0, OBDIICyclePerform(&cycle, 20));
+	OBDIICycleFree(&cycle);
+
+	// Only the first request reached the ECU
+	unsigned char request[8];
+	TEST_ASSERT_EQUAL(2, read(ecu, request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x0C, request[1]);
+	TEST_ASSERT_EQUAL(-1, recv(ecu, request, sizeof(request), MSG_DONTWAIT));
+
+	// Receiving the response hands the socket back
+	TEST_ASSERT_EQUAL(4, write(ecu, (unsigned char []){ 0x41, 0x0C, 0x1A, 0xF8 }, 4));
+	TEST_ASSERT_EQUAL(1, OBDIITryReceiveResponse(&s, OBDIICommands.engineRPMs, &response));
+	TEST_ASSERT_EQUAL(0, OBDIISendRequest(&s, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(0, OBDIICancelRequest(&s));
+
+	TEST_ASSERT_EQUAL(0, OBDIICloseSocket(&s));
+}
+
+static float ExpectedValue(OBDIICommand *command)
+{
+	return command == OBDIICommands.engineRPMs ? 1726.0 : command == OBDIICommands.vehicleSpeed ? 88.0 : 83.0;
+}
+
+static void *QueryRepeatedly(void *arg)
+{
+	OBDIICommand *command = (OBDIICommand *)arg;
+	long numCorrect = 0;
+	int i;
+
+	for (i = 0; i < QUERIES_PER_THREAD; ++i) {
+		OBDIIResponse response = OBDIIPerformQuery(&s, command);
+		numCorrect += response.success && response.command == command && response.numericValue == ExpectedValue(command);
+	}
+
+	return (void *)numCorrect;
+}
+
+TEST(OBDIICommunication, ThreadsShareSocket)
+{
+	OpenSocketPair(OBDIITransportISOTP);
+
+	// The ECU answers every request from another process, until the socket is closed
+	pid_t pid = fork();
+	TEST_ASSERT_TRUE(pid >= 0);
+	if (pid == 0) {
+		unsigned char request[8];
+		close(s.s);
+		while (read(ecu, request, sizeof(request)) == 2) {
+			if (request[1] == 0x0C) {
+				write(ecu, (unsigned char []){ 0x41, 0x0C, 0x1A, 0xF8 }, 4);
+			} else if (request[1] == 0x0D) {
+				write(ecu, (unsigned char []){ 0x41, 0x0D, 0x58 }, 3);
+			} else {
+				write(ecu, (unsigned char []){ 0x41, 0x05, 0x7B }, 3);
+			}
+		}
+		_exit(0);
+	}
+
+	OBDIICommand *commands[] = { OBDIICommands.engineRPMs, OBDIICommands.vehicleSpeed, OBDIICommands.engineCoolantTemperature, OBDIICommands.engineRPMs };
+	pthread_t threads[4];
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		TEST_ASSERT_EQUAL(0, pthread_create(&threads[i], NULL, QueryRepeatedly, commands[i]));
+	}
+
+	// Every response went back to the thread that asked for it
+	for (i = 0; i < 4; ++i) {
+		void *numCorrect;
+		pthread_join(threads[i], &numCorrect);
+		TEST_ASSERT_EQUAL(QUERIES_PER_THREAD, (long)numCorrect);
+	}
+
+	// The ECU process exits once the socket is closed
+	TEST_ASSERT_EQUAL(0, OBDIICloseSocket(&s));
+	TEST_ASSERT_NULL(s.queue);
+	waitpid(pid, NULL, 0);
+}
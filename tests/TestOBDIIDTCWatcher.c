@@ -0,0 +1,177 @@
+#include "OBDIIDTCWatcher.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static OBDIIDTCWatcher watcher;
+
+static int SubmitStatus(int milOn, int numConfirmed, double timestamp)
+{
+	OBDIIResponse response;
+	memset(&response, 0, sizeof(response));
+	response.success = 1;
+	response.command = OBDIICommands.monitorStatus;
+	response.bitfieldValue = (milOn ? 0x80000000U : 0) | (numConfirmed << 24) | 0x076500;
+	response.timestamp.tv_sec = (time_t)timestamp;
+
+	return OBDIIDTCWatcherSubmitStatus(&watcher, &response);
+}
+
+static int SubmitDTCs(char (*codes)[6], int numCodes, double timestamp)
+{
+	OBDIIResponse response;
+	memset(&response, 0, sizeof(response));
+	response.success = 1;
+	response.command = OBDIICommands.DTCs;
+	response.DTCs.troubleCodes = codes;
+	response.DTCs.numTroubleCodes = numCodes;
+	response.timestamp.tv_sec = (time_t)timestamp;
+
+	return OBDIIDTCWatcherSubmitDTCs(&watcher, &response);
+}
+
+TEST_GROUP(OBDIIDTCWatcher);
+
+TEST_SETUP(OBDIIDTCWatcher)
+{
+	OBDIIDTCWatcherInit(&watcher);
+}
+
+TEST_TEAR_DOWN(OBDIIDTCWatcher)
+{
+}
+
+TEST(OBDIIDTCWatcher, FetchesOnlyWhenStatusChanges)
+{
+	char first[][6] = { "P0301", "P0420" };
+	char second[][6] = { "P0420", "P0171", "P0301" };
+	char third[][6] = { "P0171" };
+
+	// The first status always leads to a fetch, whose codes are all new
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 2, 0));
+	TEST_ASSERT_EQUAL(1, SubmitDTCs(first, 2, 0));
+	TEST_ASSERT_EQUAL(2, watcher.numAdded);
+	TEST_ASSERT_EQUAL_STRING("P0301", watcher.added[0]);
+	TEST_ASSERT_EQUAL_STRING("P0420", watcher.added[1]);
+	TEST_ASSERT_EQUAL(0, watcher.numCleared);
+
+	TEST_ASSERT_EQUAL(0, SubmitStatus(1, 2, 1));
+	TEST_ASSERT_EQUAL(0, SubmitStatus(1, 2, 2));
+
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 3, 3));
+	TEST_ASSERT_EQUAL(1, SubmitDTCs(second, 3, 3));
+	TEST_ASSERT_EQUAL(1, watcher.numAdded);
+	TEST_ASSERT_EQUAL_STRING("P0171", watcher.added[0]);
+	TEST_ASSERT_EQUAL(0, watcher.numCleared);
+
+	// The MIL turning off is a change even if the count stays the same
+	TEST_ASSERT_EQUAL(1, SubmitStatus(0, 3, 4));
+	TEST_ASSERT_EQUAL(0, SubmitDTCs(second, 3, 4));
+
+	TEST_ASSERT_EQUAL(1, SubmitStatus(0, 1, 5));
+	TEST_ASSERT_EQUAL(1, SubmitDTCs(third, 1, 5));
+	TEST_ASSERT_EQUAL(0, watcher.numAdded);
+	TEST_ASSERT_EQUAL(2, watcher.numCleared);
+	TEST_ASSERT_EQUAL_STRING("P0420", watcher.cleared[0]);
+	TEST_ASSERT_EQUAL_STRING("P0301", watcher.cleared[1]);
+	TEST_ASSERT_EQUAL(1, watcher.numTroubleCodes);
+
+	TEST_ASSERT_EQUAL(0, watcher.milOn);
+	TEST_ASSERT_EQUAL(1, watcher.numConfirmed);
+	TEST_ASSERT_EQUAL(6, watcher.numStatusQueries);
+	TEST_ASSERT_EQUAL(4, watcher.numDTCQueries);
+}
+
+TEST(OBDIIDTCWatcher, MaxAge)
+{
+	char codes[][6] = { "P0301" };
+	char swapped[][6] = { "P0302" };
+
+	watcher.maxAge = 10;
+
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 1, 100));
+	TEST_ASSERT_EQUAL(1, SubmitDTCs(codes, 1, 100));
+	TEST_ASSERT_EQUAL(0, SubmitStatus(1, 1, 105));
+
+	// A code replaced by another one only shows once the codes are too old
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 1, 110));
+	TEST_ASSERT_EQUAL(1, SubmitDTCs(swapped, 1, 110));
+	TEST_ASSERT_EQUAL_STRING("P0302", watcher.added[0]);
+	TEST_ASSERT_EQUAL_STRING("P0301", watcher.cleared[0]);
+	TEST_ASSERT_EQUAL(0, SubmitStatus(1, 1, 111));
+}
+
+TEST(OBDIIDTCWatcher, PaddingAndDuplicates)
+{
+	char codes[][6] = { "P0301", "P0000", "P0301", "C0035" };
+
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 2, 0));
+	TEST_ASSERT_EQUAL(1, SubmitDTCs(codes, 4, 0));
+	TEST_ASSERT_EQUAL(2, watcher.numTroubleCodes);
+	TEST_ASSERT_EQUAL_STRING("P0301", watcher.troubleCodes[0]);
+	TEST_ASSERT_EQUAL_STRING("C0035", watcher.troubleCodes[1]);
+}
+
+TEST(OBDIIDTCWatcher, FailedFetchIsRetried)
+{
+	OBDIIResponse failed;
+	memset(&failed, 0, sizeof(failed));
+	failed.command = OBDIICommands.DTCs;
+
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 1, 0));
+	TEST_ASSERT_EQUAL(-1, OBDIIDTCWatcherSubmitDTCs(&watcher, &failed));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+	TEST_ASSERT_EQUAL(1, SubmitStatus(1, 1, 1));
+
+	// Responses to other commands are rejected
+	failed.success = 1;
+	failed.command = OBDIICommands.engineRPMs;
+	TEST_ASSERT_EQUAL(-1, OBDIIDTCWatcherSubmitStatus(&watcher, &failed));
+	TEST_ASSERT_EQUAL(-1, OBDIIDTCWatcherSubmitDTCs(&watcher, &failed));
+	TEST_ASSERT_EQUAL(2, watcher.numStatusQueries);
+}
+
+TEST(OBDIIDTCWatcher, Poll)
+{
+	// The library's end of a socket pair stands in for an ISO-TP socket, and the responses are queued ahead
+	static const unsigned char status[] = { 0x41, 0x01, 0x81, 0x07, 0x65, 0x00 };
+	static const unsigned char codes[] = { 0x43, 0x01, 0x03, 0x01 };
+	unsigned char request[8];
+	int fds[2];
+	OBDIISocket s;
+
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+	memset(&s, 0, sizeof(s));
+	s.s = fds[0];
+	s.tid = 0x7E0;
+	s.rid = 0x7E8;
+	s.transport = OBDIITransportISOTP;
+	s.isotp = -1;
+
+	TEST_ASSERT_EQUAL(sizeof(status), write(fds[1], status, sizeof(status)));
+	TEST_ASSERT_EQUAL(sizeof(codes), write(fds[1], codes, sizeof(codes)));
+	TEST_ASSERT_EQUAL(sizeof(status), write(fds[1], status, sizeof(status)));
+
+	TEST_ASSERT_EQUAL(1, OBDIIDTCWatcherPoll(&watcher, &s));
+	TEST_ASSERT_EQUAL(1, watcher.milOn);
+	TEST_ASSERT_EQUAL(1, watcher.numAdded);
+	TEST_ASSERT_EQUAL_STRING("P0301", watcher.added[0]);
+
+	// The same status again doesn't fetch the codes
+	TEST_ASSERT_EQUAL(0, OBDIIDTCWatcherPoll(&watcher, &s));
+	TEST_ASSERT_EQUAL(2, watcher.numStatusQueries);
+	TEST_ASSERT_EQUAL(1, watcher.numDTCQueries);
+
+	TEST_ASSERT_EQUAL(2, read(fds[1], request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x01, request[1]);
+	TEST_ASSERT_EQUAL(2, read(fds[1], request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x03, request[0]);
+	TEST_ASSERT_EQUAL(2, read(fds[1], request, sizeof(request)));
+	TEST_ASSERT_EQUAL(-1, recv(fds[1], request, sizeof(request), MSG_DONTWAIT));
+
+	close(fds[0]);
+	close(fds[1]);
+}
@@ -0,0 +1,160 @@
+#include "OBDIIDefinitions.h"
+#include "OBDIICommunication.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static OBDIIDefinitions definitions;
+
+static OBDIIResponse Decode(OBDIICommand *command, const unsigned char *payload, int len)
+{
+	unsigned char copy[16];
+	memcpy(copy, payload, len);
+
+	return OBDIIDecodeResponseForCommand(command, copy, len);
+}
+
+TEST_GROUP(OBDIIDefinitions);
+
+TEST_SETUP(OBDIIDefinitions)
+{
+	OBDIIDefinitionsInit(&definitions);
+}
+
+TEST_TEAR_DOWN(OBDIIDefinitions)
+{
+}
+
+TEST(OBDIIDefinitions, Decode)
+{
+	OBDIICommand *temperature = OBDIIDefinitionsAdd(&definitions, "transmissionTemperature", 0x22, 0x1E1C, 2, "(A * 256 + B) / 16 - 40");
+	OBDIICommand *angle = OBDIIDefinitionsAdd(&definitions, "steeringAngle", 0x22, 0x3201, 2, "(((A << 8 | B) ^ 0x8000) - 0x8000) / 10");
+	OBDIICommand *brake = OBDIIDefinitionsAdd(&definitions, "brakeSwitch", 0x21, 0x0A, 1, "(A >> 3) & 1");
+
+	TEST_ASSERT_NOT_NULL(temperature);
+	TEST_ASSERT_NOT_NULL(angle);
+	TEST_ASSERT_NOT_NULL(brake);
+	TEST_ASSERT_EQUAL(3, OBDIICommandGetRequestLength(temperature));
+	TEST_ASSERT_EQUAL(2, OBDIICommandGetRequestLength(brake));
+	TEST_ASSERT_EQUAL(5, temperature->expectedResponseLength);
+	TEST_ASSERT_EQUAL_STRING("transmissionTemperature", temperature->name);
+
+	OBDIIResponse response = Decode(temperature, (unsigned char []){ 0x62, 0x1E, 0x1C, 0x05, 0x00 }, 5);
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(40, response.numericValue);
+
+	response = Decode(angle, (unsigned char []){ 0x62, 0x32, 0x01, 0xFF, 0x9C }, 5);
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(-10, response.numericValue);
+
+	response = Decode(brake, (unsigned char []){ 0x61, 0x0A, 0x08 }, 3);
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(1, response.numericValue);
+
+	// Responses to another data identifier, or of the wrong length, are unsuccessful
+	TEST_ASSERT_FALSE(Decode(temperature, (unsigned char []){ 0x62, 0x32, 0x01, 0x05, 0x00 }, 5).success);
+	TEST_ASSERT_FALSE(Decode(temperature, (unsigned char []){ 0x62, 0x1E, 0x1C, 0x05 }, 4).success);
+
+	response = Decode(temperature, (unsigned char []){ 0x7F, 0x22, 0x31 }, 3);
+	TEST_ASSERT_FALSE(response.success);
+	TEST_ASSERT_EQUAL_HEX8(OBDII_NRC_REQUEST_OUT_OF_RANGE, response.negativeResponseCode);
+}
+
+TEST(OBDIIDefinitions, Lookup)
+{
+	OBDIICommand *charge = OBDIIDefinitionsAdd(&definitions, "hybridBatteryCharge", 0x22, 0x5B3D, 1, "A * 100 / 255");
+	OBDIICommand *oil = OBDIIDefinitionsAdd(&definitions, "oilTemperature", 0x21, 0x01, 3, "C - 40");
+
+	TEST_ASSERT_EQUAL_PTR(charge, OBDIIDefinitionsCommandWithName(&definitions, "hybridBatteryCharge"));
+	TEST_ASSERT_EQUAL_PTR(oil, OBDIIDefinitionsCommandWithModeAndPID(&definitions, 0x21, 0x01));
+	TEST_ASSERT_EQUAL_PTR(charge, OBDIIDefinitionsCommandWithModeAndPID(&definitions, 0x22, 0x5B3D));
+	TEST_ASSERT_NULL(OBDIIDefinitionsCommandWithModeAndPID(&definitions, 0x22, 0x5B3E));
+	TEST_ASSERT_NULL(OBDIIDefinitionsCommandWithName(&definitions, "engineRPMs"));
+}
+
+TEST(OBDIIDefinitions, InvalidDefinitions)
+{
+	TEST_ASSERT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x22, 0x1234, 1, "B"));
+	TEST_ASSERT_EQUAL(ENOENT, errno);
+	TEST_ASSERT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x22, 0x1234, 1, "A +"));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+	TEST_ASSERT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x21, 0x100, 1, "A"));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+	TEST_ASSERT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x62, 0x01, 1, "A"));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+	TEST_ASSERT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x22, 0x1234, OBDII_DEFINITIONS_MAX_DATA_BYTES + 1, "A"));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	TEST_ASSERT_NOT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x22, 0x1234, 1, "A"));
+	TEST_ASSERT_NULL(OBDIIDefinitionsAdd(&definitions, "a", 0x22, 0x1235, 1, "A"));
+	TEST_ASSERT_EQUAL(EEXIST, errno);
+	TEST_ASSERT_EQUAL(1, definitions.numDefinitions);
+}
+
+TEST(OBDIIDefinitions, Load)
+{
+	char path[] = "/tmp/obdii-definitions-XXXXXX";
+	int fd = mkstemp(path), line;
+	TEST_ASSERT_TRUE(fd >= 0);
+
+	FILE *file = fdopen(fd, "w");
+	fputs("# name mode PID length formula\n"
+	      "hybridBatteryCharge 22 5b3d 1 A * 100 / 255\n"
+	      "\n"
+	      "transmissionTemperature\t22 1E1C 2   (A * 256 + B) / 16 - 40\r\n"
+	      "broken 22 zz 1 A\n", file);
+	fclose(file);
+
+	TEST_ASSERT_EQUAL(-1, OBDIIDefinitionsLoad(&definitions, path, &line));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+	TEST_ASSERT_EQUAL(5, line);
+	TEST_ASSERT_EQUAL(2, definitions.numDefinitions);
+
+	OBDIICommand *temperature = OBDIIDefinitionsCommandWithName(&definitions, "transmissionTemperature");
+	TEST_ASSERT_NOT_NULL(temperature);
+	TEST_ASSERT_EQUAL_FLOAT(40, Decode(temperature, (unsigned char []){ 0x62, 0x1E, 0x1C, 0x05, 0x00 }, 5).numericValue);
+
+	unlink(path);
+
+	TEST_ASSERT_EQUAL(-1, OBDIIDefinitionsLoad(&definitions, path, &line));
+	TEST_ASSERT_EQUAL(ENOENT, errno);
+	TEST_ASSERT_EQUAL(0, line);
+}
+
+TEST(OBDIIDefinitions, Query)
+{
+	// The library's end of a socket pair stands in for an ISO-TP socket, and the responses are queued ahead
+	OBDIICommand *charge = OBDIIDefinitionsAdd(&definitions, "hybridBatteryCharge", 0x22, 0x5B3D, 1, "A * 100 / 255");
+	unsigned char request[8];
+	int fds[2];
+	OBDIISocket s;
+
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+	memset(&s, 0, sizeof(s));
+	s.s = fds[0];
+	s.tid = 0x7E0;
+	s.rid = 0x7E8;
+	s.transport = OBDIITransportISOTP;
+	s.isotp = -1;
+
+	// A late response to another data identifier is skipped
+	TEST_ASSERT_EQUAL(4, write(fds[1], (unsigned char []){ 0x62, 0x1E, 0x1C, 0x05 }, 4));
+	TEST_ASSERT_EQUAL(4, write(fds[1], (unsigned char []){ 0x62, 0x5B, 0x3D, 0xFF }, 4));
+
+	OBDIIResponse response = OBDIIPerformQuery(&s, charge);
+	TEST_ASSERT_TRUE(response.success);
+	TEST_ASSERT_EQUAL_FLOAT(100, response.numericValue);
+
+	TEST_ASSERT_EQUAL(3, read(fds[1], request, sizeof(request)));
+	TEST_ASSERT_EQUAL_HEX8(0x22, request[0]);
+	TEST_ASSERT_EQUAL_HEX8(0x5B, request[1]);
+	TEST_ASSERT_EQUAL_HEX8(0x3D, request[2]);
+
+	close(fds[0]);
+	close(fds[1]);
+}
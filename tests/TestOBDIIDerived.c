@@ -0,0 +1,126 @@
+#include "OBDIIDerived.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <errno.h>
+
+static OBDIIDerivedEngine engine;
+
+static int Feed(OBDIICommand *command, float value, double timestamp)
+{
+	OBDIIResponse response;
+	memset(&response, 0, sizeof(response));
+	response.success = 1;
+	response.command = command;
+
+	if (command->responseType == OBDIIResponseTypeBitfield) {
+		response.bitfieldValue = (uint32_t)value;
+	} else {
+		response.numericValue = value;
+	}
+
+	return OBDIIDerivedUpdate(&engine, &response, timestamp);
+}
+
+TEST_GROUP(OBDIIDerived);
+
+TEST_SETUP(OBDIIDerived)
+{
+	OBDIIDerivedEngineInit(&engine, 0);
+}
+
+TEST_TEAR_DOWN(OBDIIDerived)
+{
+}
+
+TEST(OBDIIDerived, SharedInputs)
+{
+	int fuelRate = OBDIIDerivedAddChannel(&engine, "fuelRate", OBDII_DERIVED_FUEL_RATE);
+	int economy = OBDIIDerivedAddChannel(&engine, "economy", OBDII_DERIVED_FUEL_ECONOMY);
+	TEST_ASSERT_EQUAL(0, fuelRate);
+	TEST_ASSERT_EQUAL(1, economy);
+
+	// The air flow is queried once for both channels
+	OBDIICommandSet commands = OBDIIDerivedGetCommands(&engine);
+	TEST_ASSERT_EQUAL(2, commands.numCommands);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.mafAirFlowRate));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&commands, OBDIICommands.vehicleSpeed));
+
+	TEST_ASSERT_EQUAL(1, Feed(OBDIICommands.mafAirFlowRate, 20.0f, 1.0));
+	TEST_ASSERT_TRUE(engine.channels[fuelRate].valid);
+	TEST_ASSERT_FALSE(engine.channels[economy].valid);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4, 20.0 * 3600 / (14.7 * 737), engine.channels[fuelRate].value);
+
+	TEST_ASSERT_EQUAL(1, Feed(OBDIICommands.vehicleSpeed, 90.0f, 1.1));
+	TEST_ASSERT_TRUE(engine.channels[economy].valid);
+	TEST_ASSERT_FLOAT_WITHIN(1e-4, 90.0 / (20.0 * 3600 / (14.7 * 737)), engine.channels[economy].value);
+	TEST_ASSERT_EQUAL_FLOAT(1.1, engine.channels[economy].timestamp);
+
+	// A response to the shared input updates both channels
+	TEST_ASSERT_EQUAL(2, Feed(OBDIICommands.mafAirFlowRate, 10.0f, 1.2));
+	TEST_ASSERT_EQUAL_FLOAT(1.2, engine.channels[fuelRate].timestamp);
+	TEST_ASSERT_EQUAL_FLOAT(1.2, engine.channels[economy].timestamp);
+
+	// Responses to other commands, and failed responses, change nothing
+	TEST_ASSERT_EQUAL(0, Feed(OBDIICommands.engineRPMs, 800.0f, 1.3));
+
+	OBDIIResponse failed;
+	memset(&failed, 0, sizeof(failed));
+	failed.command = OBDIICommands.vehicleSpeed;
+	TEST_ASSERT_EQUAL(0, OBDIIDerivedUpdate(&engine, &failed, 1.4));
+	TEST_ASSERT_EQUAL_FLOAT(1.2, engine.channels[economy].timestamp);
+}
+
+TEST(OBDIIDerived, MaxSkew)
+{
+	engine.maxSkew = 0.5;
+	int channel = OBDIIDerivedAddChannel(&engine, "sum", "vehicleSpeed + engineRPMs");
+
+	Feed(OBDIICommands.vehicleSpeed, 50.0f, 1.0);
+	TEST_ASSERT_EQUAL(1, Feed(OBDIICommands.engineRPMs, 1000.0f, 1.4));
+	TEST_ASSERT_EQUAL_FLOAT(1050, engine.channels[channel].value);
+
+	// The speed is now too old to be combined with the RPMs
+	TEST_ASSERT_EQUAL(0, Feed(OBDIICommands.engineRPMs, 2000.0f, 1.6));
+	TEST_ASSERT_FALSE(engine.channels[channel].valid);
+
+	TEST_ASSERT_EQUAL(1, Feed(OBDIICommands.vehicleSpeed, 60.0f, 1.7));
+	TEST_ASSERT_EQUAL_FLOAT(2060, engine.channels[channel].value);
+}
+
+TEST(OBDIIDerived, ConstantsAndBitfields)
+{
+	TEST_ASSERT_EQUAL(0, OBDIIDerivedSetConstant(&engine, "peakTorque", 200));
+	int power = OBDIIDerivedAddChannel(&engine, "power", OBDII_DERIVED_ENGINE_POWER);
+	int milOn = OBDIIDerivedAddChannel(&engine, "milOn", "monitorStatus >> 31 & 1");
+
+	Feed(OBDIICommands.engineRPMs, 3000.0f, 1.0);
+	TEST_ASSERT_EQUAL(1, Feed(OBDIICommands.calculatedEngineLoad, 50.0f, 1.0));
+	TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.5 * 200 * 3000 * 2 * 3.14159265 / 60000, engine.channels[power].value);
+
+	TEST_ASSERT_EQUAL(0, OBDIIDerivedSetConstant(&engine, "peakTorque", 100));
+	TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.5 * 100 * 3000 * 2 * 3.14159265 / 60000, engine.channels[power].value);
+
+	TEST_ASSERT_EQUAL(1, Feed(OBDIICommands.monitorStatus, 0x80070000u, 1.0));
+	TEST_ASSERT_EQUAL_FLOAT(1, engine.channels[milOn].value);
+}
+
+TEST(OBDIIDerived, Errors)
+{
+	TEST_ASSERT_EQUAL(-1, OBDIIDerivedAddChannel(&engine, "a", "vehicleSpeed +"));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	TEST_ASSERT_EQUAL(-1, OBDIIDerivedAddChannel(&engine, "b", "vehicleSpeed * peakTorque"));
+	TEST_ASSERT_EQUAL(ENOENT, errno);
+
+	// Not a numeric or bitfield command
+	TEST_ASSERT_EQUAL(-1, OBDIIDerivedAddChannel(&engine, "c", "VIN"));
+	TEST_ASSERT_EQUAL(ENOENT, errno);
+
+	TEST_ASSERT_EQUAL(-1, OBDIIDerivedAddChannel(&engine, "a name that is much too long to fit", "1"));
+	TEST_ASSERT_EQUAL(ENAMETOOLONG, errno);
+
+	// Failed channels leave no inputs behind
+	TEST_ASSERT_EQUAL(0, engine.numChannels);
+	TEST_ASSERT_EQUAL(0, engine.numInputs);
+}
@@ -0,0 +1,124 @@
+#include "OBDIIDiscovery.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define PROBE_TIMEOUT_MS 20
+
+// The library's end of a socket pair stands in for a CAN_RAW socket; the test plays every ECU on the other end
+static int s, ecus;
+static OBDIIDiscoveredECU discovered[OBDII_NUM_ECUS];
+
+// Queues a response, which the library reads in order; responses must therefore follow each ECU's chain of probes
+static void RespondWithFrame(canid_t id, const unsigned char *data)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = id;
+	frame.can_dlc = 8;
+	memcpy(frame.data, data, 8);
+
+	TEST_ASSERT_EQUAL(sizeof(frame), write(ecus, &frame, sizeof(frame)));
+}
+
+static void AssertRequest(canid_t id, unsigned char mode, unsigned char pid)
+{
+	struct can_frame request;
+	TEST_ASSERT_EQUAL(sizeof(request), recv(ecus, &request, sizeof(request), MSG_DONTWAIT));
+	TEST_ASSERT_EQUAL_HEX32(id, request.can_id);
+	TEST_ASSERT_EQUAL(8, request.can_dlc);
+	TEST_ASSERT_EQUAL_HEX32(0x02, request.data[0]);
+	TEST_ASSERT_EQUAL_HEX32(mode, request.data[1]);
+	TEST_ASSERT_EQUAL_HEX32(pid, request.data[2]);
+}
+
+static void AssertNoMoreRequests(void)
+{
+	struct can_frame request;
+	TEST_ASSERT_EQUAL(-1, recv(ecus, &request, sizeof(request), MSG_DONTWAIT));
+}
+
+TEST_GROUP(OBDIIDiscovery);
+
+TEST_SETUP(OBDIIDiscovery)
+{
+	int fds[2];
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+	s = fds[0];
+	ecus = fds[1];
+	memset(discovered, 0, sizeof(discovered));
+}
+
+TEST_TEAR_DOWN(OBDIIDiscovery)
+{
+	close(s);
+	close(ecus);
+}
+
+TEST(OBDIIDiscovery, ParallelChains)
+{
+	const unsigned char engineSupportedPIDs1[] = { 0x06, 0x41, 0x00, 0xBE, 0x1F, 0xA8, 0x13, 0x55 };
+	const unsigned char transmissionSupportedPIDs1[] = { 0x06, 0x41, 0x00, 0x80, 0x00, 0x00, 0x00, 0x55 };
+	const unsigned char engineSupportedPIDs21[] = { 0x06, 0x41, 0x20, 0x80, 0x00, 0x00, 0x00, 0x55 };
+	const unsigned char transmissionMode9SupportedPIDs[] = { 0x06, 0x49, 0x00, 0x40, 0x00, 0x00, 0x00, 0x55 };
+	const unsigned char engineMode9NotSupported[] = { 0x03, 0x7F, 0x09, 0x12, 0x55, 0x55, 0x55, 0x55 };
+
+	RespondWithFrame(0x7E8, engineSupportedPIDs1);
+	RespondWithFrame(0x7E9, transmissionSupportedPIDs1);
+	RespondWithFrame(0x7E8, engineSupportedPIDs21);
+	RespondWithFrame(0x7E9, transmissionMode9SupportedPIDs);
+	RespondWithFrame(0x7E8, engineMode9NotSupported);
+
+	// Not a response to any probe of an ECU that never answered the broadcast
+	RespondWithFrame(0x7EB, engineSupportedPIDs21);
+
+	TEST_ASSERT_EQUAL(2, OBDIIDiscoverSupportedCommandsOnSocket(s, PROBE_TIMEOUT_MS, discovered));
+
+	AssertRequest(0x7DF, 0x01, 0x00);
+	AssertRequest(0x7E0, 0x01, 0x20);
+	AssertRequest(0x7E1, 0x09, 0x00);
+	AssertRequest(0x7E0, 0x09, 0x00);
+	AssertNoMoreRequests();
+
+	TEST_ASSERT_EQUAL_HEX32(0x7E0, discovered[0].tid);
+	TEST_ASSERT_EQUAL_HEX32(0x7E8, discovered[0].rid);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[0].commands, OBDIICommands.engineRPMs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsPID(&discovered[0].commands, 0x01, 0x21));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[0].commands, OBDIICommands.DTCs));
+	TEST_ASSERT_FALSE(OBDIICommandSetContainsCommand(&discovered[0].commands, OBDIICommands.VIN));
+
+	TEST_ASSERT_EQUAL_HEX32(0x7E1, discovered[1].tid);
+	TEST_ASSERT_EQUAL_HEX32(0x7E9, discovered[1].rid);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[1].commands, OBDIICommands.monitorStatus));
+	TEST_ASSERT_FALSE(OBDIICommandSetContainsCommand(&discovered[1].commands, OBDIICommands.engineRPMs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[1].commands, OBDIICommands.VIN));
+}
+
+TEST(OBDIIDiscovery, UnansweredProbes)
+{
+	const unsigned char supportedPIDs1[] = { 0x06, 0x41, 0x00, 0x00, 0x18, 0x00, 0x01, 0x55 };
+	RespondWithFrame(0x7EA, supportedPIDs1);
+
+	// Each probe of the chain times out in turn
+	TEST_ASSERT_EQUAL(1, OBDIIDiscoverSupportedCommandsOnSocket(s, PROBE_TIMEOUT_MS, discovered));
+
+	AssertRequest(0x7DF, 0x01, 0x00);
+	AssertRequest(0x7E2, 0x01, 0x20);
+	AssertRequest(0x7E2, 0x09, 0x00);
+	AssertNoMoreRequests();
+
+	TEST_ASSERT_EQUAL_HEX32(0x7E2, discovered[0].tid);
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[0].commands, OBDIICommands.engineRPMs));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[0].commands, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_TRUE(OBDIICommandSetContainsCommand(&discovered[0].commands, OBDIICommands.mode9SupportedPIDs));
+}
+
+TEST(OBDIIDiscovery, NoECUs)
+{
+	TEST_ASSERT_EQUAL(0, OBDIIDiscoverSupportedCommandsOnSocket(s, PROBE_TIMEOUT_MS, discovered));
+
+	AssertRequest(0x7DF, 0x01, 0x00);
+	AssertNoMoreRequests();
+}
@@ -0,0 +1,114 @@
+#include "OBDIIExpression.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+static OBDIIExpression expression;
+static double variables[OBDII_EXPRESSION_MAX_VARIABLES];
+
+// Variables named x, y and z are indices 0, 1 and 2
+static int resolveXYZ(const char *name, int length, void *context)
+{
+	(void)context;
+	return length == 1 && name[0] >= 'x' && name[0] <= 'z' ? name[0] - 'x' : -1;
+}
+
+static double Evaluate(const char *source)
+{
+	TEST_ASSERT_EQUAL(0, OBDIIExpressionCompile(&expression, source, &resolveXYZ, NULL, NULL));
+	return OBDIIExpressionEvaluate(&expression, variables);
+}
+
+static void AssertCompileError(const char *source, int error, int position)
+{
+	int errorPosition = -1;
+	TEST_ASSERT_EQUAL(-1, OBDIIExpressionCompile(&expression, source, &resolveXYZ, NULL, &errorPosition));
+	TEST_ASSERT_EQUAL(error, errno);
+	TEST_ASSERT_EQUAL(position, errorPosition);
+}
+
+TEST_GROUP(OBDIIExpression);
+
+TEST_SETUP(OBDIIExpression)
+{
+	memset(variables, 0, sizeof(variables));
+}
+
+TEST_TEAR_DOWN(OBDIIExpression)
+{
+}
+
+TEST(OBDIIExpression, Arithmetic)
+{
+	TEST_ASSERT_EQUAL_FLOAT(7, Evaluate("1 + 2 * 3"));
+	TEST_ASSERT_EQUAL_FLOAT(9, Evaluate("(1 + 2) * 3"));
+	TEST_ASSERT_EQUAL_FLOAT(2, Evaluate("10 - 4 - 4"));
+	TEST_ASSERT_EQUAL_FLOAT(1.5, Evaluate("12 / 4 / 2"));
+	TEST_ASSERT_EQUAL_FLOAT(1, Evaluate("10 % 3"));
+	TEST_ASSERT_EQUAL_FLOAT(-5, Evaluate("-(2 + 3)"));
+	TEST_ASSERT_EQUAL_FLOAT(2.5e3, Evaluate("+2.5e3"));
+	TEST_ASSERT_TRUE(isinf(Evaluate("1 / 0")));
+}
+
+TEST(OBDIIExpression, Bitwise)
+{
+	TEST_ASSERT_EQUAL_FLOAT(0x0F, Evaluate("0x1F & 0xF0 >> 4"));
+	TEST_ASSERT_EQUAL_FLOAT(0x1A2B, Evaluate("0x1A << 8 | 0x2B"));
+	TEST_ASSERT_EQUAL_FLOAT(6, Evaluate("5 ^ 3"));
+	TEST_ASSERT_EQUAL_FLOAT(-1, Evaluate("~0"));
+	TEST_ASSERT_EQUAL_FLOAT(3, Evaluate("1 + 2 & 7"));
+	TEST_ASSERT_TRUE(isnan(Evaluate("1 << 64")));
+}
+
+TEST(OBDIIExpression, Functions)
+{
+	TEST_ASSERT_EQUAL_FLOAT(2, Evaluate("min(2, 3)"));
+	TEST_ASSERT_EQUAL_FLOAT(3, Evaluate("max(2, min(3, 4))"));
+	TEST_ASSERT_EQUAL_FLOAT(4, Evaluate("abs(-4)"));
+}
+
+TEST(OBDIIExpression, Variables)
+{
+	variables[0] = 10;
+	variables[1] = 4;
+	variables[2] = 0x35;
+
+	TEST_ASSERT_EQUAL_FLOAT(2.5, Evaluate("x / y"));
+	TEST_ASSERT_EQUAL_HEX32(0x3, expression.variables);
+
+	TEST_ASSERT_EQUAL_FLOAT(5, Evaluate("(z & 0x0F) * max(x, y) / 10"));
+	TEST_ASSERT_EQUAL_HEX32(0x7, expression.variables);
+}
+
+TEST(OBDIIExpression, ConstantFolding)
+{
+	variables[0] = 1;
+
+	// Folded to a single constant
+	TEST_ASSERT_EQUAL_FLOAT(14.7 * 737, Evaluate("14.7 * 737"));
+	TEST_ASSERT_EQUAL(1, expression._length);
+
+	// Variable, folded constant, division
+	TEST_ASSERT_EQUAL_FLOAT(1 / (14.7 * 737), Evaluate("x / (14.7 * 737)"));
+	TEST_ASSERT_EQUAL(3, expression._length);
+}
+
+TEST(OBDIIExpression, Errors)
+{
+	AssertCompileError("", EINVAL, 0);
+	AssertCompileError("1 +", EINVAL, 3);
+	AssertCompileError("(1 + 2", EINVAL, 6);
+	AssertCompileError("1 2", EINVAL, 2);
+	AssertCompileError("x < y", EINVAL, 2);
+	AssertCompileError("x + w", ENOENT, 4);
+	AssertCompileError("sqrt(x)", ENOENT, 0);
+	AssertCompileError("min(x)", EINVAL, 5);
+
+	// Deeper than the evaluation stack
+	AssertCompileError("1+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+(x+1))))))))))))))))", EINVAL, 48);
+
+	// A failed compilation evaluates to NAN
+	TEST_ASSERT_TRUE(isnan(OBDIIExpressionEvaluate(&expression, variables)));
+}
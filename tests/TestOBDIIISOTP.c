@@ -0,0 +1,149 @@
+#include "OBDIIISOTP.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+
+static OBDIIISOTPBufferPool pool;
+static OBDIIISOTPSession session;
+static struct timespec timestamp;
+
+static struct can_frame Frame(unsigned char dlc, const unsigned char *data)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = 0x7E8;
+	frame.can_dlc = dlc;
+	memcpy(frame.data, data, dlc);
+
+	return frame;
+}
+
+// Feeds a 20 byte message (bytes 0x00 to 0x13) to the session, returning the result for each frame
+static void SendSegmentedMessage(OBDIIISOTPSession *s, OBDIIISOTPFrameResult results[3])
+{
+	unsigned char first[] = { 0x10, 20, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05 };
+	unsigned char second[] = { 0x21, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C };
+	unsigned char third[] = { 0x22, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13 };
+
+	struct can_frame frame = Frame(8, first);
+	results[0] = OBDIIISOTPSessionHandleFrame(s, &frame, &timestamp);
+	frame = Frame(8, second);
+	results[1] = OBDIIISOTPSessionHandleFrame(s, &frame, &timestamp);
+	frame = Frame(8, third);
+	results[2] = OBDIIISOTPSessionHandleFrame(s, &frame, &timestamp);
+}
+
+TEST_GROUP(OBDIIISOTP);
+
+TEST_SETUP(OBDIIISOTP)
+{
+	OBDIIISOTPBufferPoolInit(&pool, 1);
+	OBDIIISOTPSessionInit(&session, &pool, 0x7E0, 0x7E8, 0);
+	timestamp.tv_sec = 1;
+	timestamp.tv_nsec = 0;
+}
+
+TEST_TEAR_DOWN(OBDIIISOTP)
+{
+	OBDIIISOTPSessionRelease(&session);
+	OBDIIISOTPBufferPoolDestroy(&pool);
+}
+
+TEST(OBDIIISOTP, SingleFrame)
+{
+	unsigned char data[] = { 0x04, 0x41, 0x0C, 0x1A, 0xF8, 0x55, 0x55, 0x55 };
+	struct can_frame frame = Frame(8, data);
+
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameComplete, OBDIIISOTPSessionHandleFrame(&session, &frame, &timestamp));
+	TEST_ASSERT_EQUAL(OBDIIISOTPSessionComplete, session.state);
+	TEST_ASSERT_EQUAL(4, session.messageLength);
+	TEST_ASSERT_EQUAL_MEMORY(&data[1], session.message, 4);
+	TEST_ASSERT_EQUAL(1, session.numFrames);
+}
+
+TEST(OBDIIISOTP, SingleFrameLongerThanFrame)
+{
+	unsigned char data[] = { 0x05, 0x41, 0x0C, 0x1A };
+	struct can_frame frame = Frame(4, data);
+
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameIgnored, OBDIIISOTPSessionHandleFrame(&session, &frame, &timestamp));
+	TEST_ASSERT_EQUAL(OBDIIISOTPSessionIdle, session.state);
+}
+
+TEST(OBDIIISOTP, SegmentedMessage)
+{
+	OBDIIISOTPFrameResult results[3];
+	SendSegmentedMessage(&session, results);
+
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameNeedsFlowControl, results[0]);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameConsumed, results[1]);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameComplete, results[2]);
+	TEST_ASSERT_EQUAL(20, session.messageLength);
+	TEST_ASSERT_EQUAL(3, session.numFrames);
+
+	int i;
+	for (i = 0; i < 20; ++i) {
+		TEST_ASSERT_EQUAL_HEX8(i, session.message[i]);
+	}
+}
+
+TEST(OBDIIISOTP, BlockSizeRequestsFlowControl)
+{
+	OBDIIISOTPSessionInit(&session, &pool, 0x7E0, 0x7E8, 1);
+
+	OBDIIISOTPFrameResult results[3];
+	SendSegmentedMessage(&session, results);
+
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameNeedsFlowControl, results[0]);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameNeedsFlowControl, results[1]);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameComplete, results[2]);
+	TEST_ASSERT_EQUAL(2, session.numFlowControlFrames);
+}
+
+TEST(OBDIIISOTP, WrongSequenceNumberAbandonsMessage)
+{
+	unsigned char first[] = { 0x10, 20, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05 };
+	unsigned char skipped[] = { 0x22, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13 };
+
+	struct can_frame frame = Frame(8, first);
+	OBDIIISOTPSessionHandleFrame(&session, &frame, &timestamp);
+	frame = Frame(8, skipped);
+
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameIgnored, OBDIIISOTPSessionHandleFrame(&session, &frame, &timestamp));
+	TEST_ASSERT_EQUAL(OBDIIISOTPSessionIdle, session.state);
+
+	// The buffer went back to the pool, so another message can be received
+	OBDIIISOTPFrameResult results[3];
+	SendSegmentedMessage(&session, results);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameComplete, results[2]);
+}
+
+TEST(OBDIIISOTP, PoolExhaustionOverflows)
+{
+	OBDIIISOTPSession other;
+	OBDIIISOTPSessionInit(&other, &pool, 0x7E1, 0x7E9, 0);
+
+	OBDIIISOTPFrameResult results[3];
+	SendSegmentedMessage(&session, results);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameComplete, results[2]);
+
+	// The only buffer still holds the first session's unconsumed message
+	unsigned char first[] = { 0x10, 20, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05 };
+	struct can_frame frame = Frame(8, first);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameOverflow, OBDIIISOTPSessionHandleFrame(&other, &frame, &timestamp));
+
+	OBDIIISOTPSessionRelease(&session);
+	TEST_ASSERT_EQUAL(OBDIIISOTPFrameNeedsFlowControl, OBDIIISOTPSessionHandleFrame(&other, &frame, &timestamp));
+	OBDIIISOTPSessionRelease(&other);
+}
+
+TEST(OBDIIISOTP, FlowControlFrame)
+{
+	struct can_frame frame;
+	OBDIIISOTPBuildFlowControlFrame(&frame, 0x7E0, OBDII_ISOTP_FLOW_STATUS_CONTINUE, 8, 0x0A, OBDII_ISOTP_DEFAULT_PADDING);
+
+	unsigned char expected[] = { 0x30, 0x08, 0x0A, 0x55, 0x55, 0x55, 0x55, 0x55 };
+	TEST_ASSERT_EQUAL_HEX32(0x7E0, frame.can_id);
+	TEST_ASSERT_EQUAL(8, frame.can_dlc);
+	TEST_ASSERT_EQUAL_MEMORY(expected, frame.data, 8);
+}
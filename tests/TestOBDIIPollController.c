@@ -0,0 +1,186 @@
+#include "OBDIIPollController.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static OBDIIPollSchedule schedule;
+static OBDIIPollController controller;
+
+static int Submit(OBDIICommand *command, int answered, float value)
+{
+	OBDIIResponse response;
+	memset(&response, 0, sizeof(response));
+	response.command = command;
+	response.success = answered;
+	response.numericValue = value;
+	if (answered) {
+		clock_gettime(CLOCK_MONOTONIC, &response.timestamp);
+	} else {
+		response.timedOut = 1;
+	}
+
+	return OBDIIPollControllerSubmit(&controller, &response);
+}
+
+// Sends `numFrames` frames of 8 bytes (111 bits each) to the controller's socket
+static void SendFrames(int bus, int numFrames)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = 0x123;
+	frame.can_dlc = 8;
+
+	while (numFrames-- > 0) {
+		TEST_ASSERT_EQUAL(sizeof(frame), write(bus, &frame, sizeof(frame)));
+	}
+}
+
+TEST_GROUP(OBDIIPollController);
+
+TEST_SETUP(OBDIIPollController)
+{
+	OBDIIPollScheduleInit(&schedule);
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 0.1);
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.vehicleSpeed, 0.2);
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineCoolantTemperature, 10);
+	OBDIIPollControllerInit(&controller, &schedule, NULL);
+}
+
+TEST_TEAR_DOWN(OBDIIPollController)
+{
+	OBDIIPollControllerClose(&controller);
+}
+
+TEST(OBDIIPollController, Asleep)
+{
+	TEST_ASSERT_EQUAL(OBDIIECUStateRunning, controller.state);
+
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 0, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.vehicleSpeed, 0, 0));
+
+	// A query the caller gave up on before the ECU's time was up isn't a timeout
+	OBDIIResponse aborted;
+	memset(&aborted, 0, sizeof(aborted));
+	aborted.command = OBDIICommands.engineCoolantTemperature;
+	clock_gettime(CLOCK_MONOTONIC, &aborted.requestTimestamp);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerSubmit(&controller, &aborted));
+	TEST_ASSERT_EQUAL(OBDIIECUStateRunning, controller.state);
+
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineCoolantTemperature, 0, 0));
+	TEST_ASSERT_EQUAL(OBDIIECUStateAsleep, controller.state);
+
+	// Only the most frequent command is left, polled slowly
+	TEST_ASSERT_EQUAL(1, schedule.numEntries);
+	TEST_ASSERT_EQUAL_FLOAT(5, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 0, 0));
+
+	// An answer wakes every command up
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineRPMs, 1, 750));
+	TEST_ASSERT_EQUAL(OBDIIECUStateRunning, controller.state);
+	TEST_ASSERT_EQUAL(3, schedule.numEntries);
+	TEST_ASSERT_EQUAL_FLOAT(0.1, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL_FLOAT(10, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineCoolantTemperature));
+}
+
+TEST(OBDIIPollController, EngineOff)
+{
+	// A negative response is an answer, not a timeout
+	OBDIIResponse refused;
+	memset(&refused, 0, sizeof(refused));
+	refused.command = OBDIICommands.vehicleSpeed;
+	refused.negativeResponseCode = OBDII_NRC_CONDITIONS_NOT_CORRECT;
+	clock_gettime(CLOCK_MONOTONIC, &refused.timestamp);
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 0, 0));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 0, 0));
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerSubmit(&controller, &refused));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 0, 0));
+	TEST_ASSERT_EQUAL(OBDIIECUStateRunning, controller.state);
+
+	// A refusal repeated from the cache of unsupported commands never reached the bus, so the ECU may still be asleep
+	memset(&refused.timestamp, 0, sizeof(refused.timestamp));
+	refused.negativeResponseCode = OBDII_NRC_REQUEST_OUT_OF_RANGE;
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerSubmit(&controller, &refused));
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.engineRPMs, 0, 0));
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerSubmit(&controller, &refused));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineRPMs, 0, 0));
+	TEST_ASSERT_EQUAL(OBDIIECUStateAsleep, controller.state);
+
+	// Without an engine speed, the voltage tells whether the alternator is charging
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.controlModuleVoltage, 1, 12.4));
+	TEST_ASSERT_EQUAL(OBDIIECUStateEngineOff, controller.state);
+	TEST_ASSERT_EQUAL_FLOAT(0.4, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.controlModuleVoltage, 1, 14.1));
+	TEST_ASSERT_EQUAL(OBDIIECUStateRunning, controller.state);
+
+	// The engine speed overrides it
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineRPMs, 1, 0));
+	TEST_ASSERT_EQUAL(OBDIIECUStateEngineOff, controller.state);
+	TEST_ASSERT_EQUAL(0, Submit(OBDIICommands.controlModuleVoltage, 1, 14.1));
+	TEST_ASSERT_EQUAL(1, Submit(OBDIICommands.engineRPMs, 1, 820));
+	TEST_ASSERT_EQUAL_FLOAT(0.2, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.vehicleSpeed));
+}
+
+TEST(OBDIIPollController, BusLoad)
+{
+	// The library's end of a socket pair stands in for the CAN_RAW socket; at 10 kbit/s, 60 frames per second are 67% of
+	// the bus, and 20 are 22%
+	OBDIIPollControllerOptions options;
+	OBDIIPollControllerOptionsInit(&options);
+	options.bitrate = 10000;
+	OBDIIPollControllerInit(&controller, &schedule, &options);
+
+	int fds[2];
+	TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds));
+	controller.s = fds[0];
+
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 100));
+	TEST_ASSERT_EQUAL_FLOAT(-1, controller.busLoad);
+
+	SendFrames(fds[1], 60);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 101));
+	TEST_ASSERT_FLOAT_WITHIN(0.001, 0.666, controller.busLoad);
+
+	// The load must stay high for the hold time
+	SendFrames(fds[1], 60);
+	TEST_ASSERT_EQUAL(1, OBDIIPollControllerUpdate(&controller, 102));
+	TEST_ASSERT_EQUAL_FLOAT(2, controller.loadScale);
+	TEST_ASSERT_EQUAL_FLOAT(0.2, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineRPMs));
+
+	// Between the thresholds, nothing changes
+	SendFrames(fds[1], 40);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 103));
+	SendFrames(fds[1], 40);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 104));
+	SendFrames(fds[1], 40);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 105));
+	TEST_ASSERT_EQUAL_FLOAT(2, controller.loadScale);
+
+	SendFrames(fds[1], 20);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 106));
+	SendFrames(fds[1], 20);
+	TEST_ASSERT_EQUAL(1, OBDIIPollControllerUpdate(&controller, 107));
+	TEST_ASSERT_EQUAL_FLOAT(1, controller.loadScale);
+	TEST_ASSERT_EQUAL_FLOAT(0.1, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineRPMs));
+
+	// Windows shorter than a second are left to accumulate
+	SendFrames(fds[1], 60);
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerUpdate(&controller, 107.5));
+	TEST_ASSERT_FLOAT_WITHIN(0.001, 0.222, controller.busLoad);
+
+	close(fds[1]);
+}
+
+TEST(OBDIIPollController, SetInterval)
+{
+	Submit(OBDIICommands.engineRPMs, 1, 0);
+
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerSetInterval(&controller, OBDIICommands.fuelTankLevelInput, 30));
+	TEST_ASSERT_EQUAL_FLOAT(60, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.fuelTankLevelInput));
+
+	TEST_ASSERT_EQUAL(0, OBDIIPollControllerSetInterval(&controller, OBDIICommands.vehicleSpeed, 0));
+	TEST_ASSERT_EQUAL_FLOAT(0, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.vehicleSpeed));
+	TEST_ASSERT_EQUAL(3, schedule.numEntries);
+}
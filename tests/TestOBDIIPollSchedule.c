@@ -0,0 +1,120 @@
+#include "OBDIIPollSchedule.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <errno.h>
+
+static OBDIIPollSchedule schedule;
+
+TEST_GROUP(OBDIIPollSchedule);
+
+TEST_SETUP(OBDIIPollSchedule)
+{
+	OBDIIPollScheduleInit(&schedule);
+}
+
+TEST_TEAR_DOWN(OBDIIPollSchedule)
+{
+}
+
+TEST(OBDIIPollSchedule, Empty)
+{
+	double nextDue;
+
+	TEST_ASSERT_NULL(OBDIIPollScheduleNextDue(&schedule, 10, &nextDue));
+	TEST_ASSERT_EQUAL_FLOAT(-1, nextDue);
+}
+
+TEST(OBDIIPollSchedule, Rates)
+{
+	double nextDue;
+
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 0.1);
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.fuelTankLevelInput, 10);
+
+	// Both are due right away, and are polled one after the other
+	OBDIICommand *first = OBDIIPollScheduleNextDue(&schedule, 100, NULL);
+	TEST_ASSERT_NOT_NULL(first);
+	OBDIIPollScheduleMarkPolled(&schedule, first, 100);
+
+	OBDIICommand *second = OBDIIPollScheduleNextDue(&schedule, 100, NULL);
+	TEST_ASSERT_NOT_NULL(second);
+	TEST_ASSERT_TRUE(first != second);
+	OBDIIPollScheduleMarkPolled(&schedule, second, 100);
+
+	TEST_ASSERT_NULL(OBDIIPollScheduleNextDue(&schedule, 100.05, &nextDue));
+	TEST_ASSERT_EQUAL_FLOAT(100.1, nextDue);
+
+	int rpms = 0, fuel = 0, i;
+	for (i = 1; i <= 200; ++i) {
+		double now = 100 + i / 10.0;
+		OBDIICommand *command;
+		while ((command = OBDIIPollScheduleNextDue(&schedule, now + 1e-6, NULL))) {
+			if (command == OBDIICommands.engineRPMs) {
+				rpms++;
+			} else {
+				fuel++;
+			}
+			OBDIIPollScheduleMarkPolled(&schedule, command, now);
+		}
+	}
+
+	TEST_ASSERT_TRUE(rpms >= 198 && rpms <= 200);
+	TEST_ASSERT_EQUAL(2, fuel);
+}
+
+TEST(OBDIIPollSchedule, ChangeInterval)
+{
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 1);
+	OBDIIPollScheduleMarkPolled(&schedule, OBDIICommands.engineRPMs, 10);
+
+	// A faster rate takes effect from the last poll, not from the next one that was planned
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 0.1);
+	TEST_ASSERT_EQUAL_FLOAT(0.1, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineRPMs));
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, OBDIIPollScheduleNextDue(&schedule, 10.1, NULL));
+
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 0);
+	TEST_ASSERT_EQUAL(0, schedule.numEntries);
+	TEST_ASSERT_EQUAL_FLOAT(0, OBDIIPollScheduleGetInterval(&schedule, OBDIICommands.engineRPMs));
+}
+
+TEST(OBDIIPollSchedule, FallingBehind)
+{
+	OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.engineRPMs, 1);
+	OBDIIPollScheduleMarkPolled(&schedule, OBDIICommands.engineRPMs, 0);
+
+	// Polled late: the schedule starts over instead of catching up with back to back queries
+	OBDIIPollScheduleMarkPolled(&schedule, OBDIICommands.engineRPMs, 5.5);
+	TEST_ASSERT_EQUAL_PTR(NULL, OBDIIPollScheduleNextDue(&schedule, 6, NULL));
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, OBDIIPollScheduleNextDue(&schedule, 6.5, NULL));
+}
+
+TEST(OBDIIPollSchedule, Full)
+{
+	int i;
+	for (i = 0; i < OBDII_POLL_SCHEDULE_MAX_ENTRIES; ++i) {
+		TEST_ASSERT_EQUAL(0, OBDIIPollScheduleSetInterval(&schedule, OBDIICommandWithModeAndPID(1, i + 1), 1));
+	}
+
+	errno = 0;
+	TEST_ASSERT_EQUAL(-1, OBDIIPollScheduleSetInterval(&schedule, OBDIICommands.vinMessageCount, 1));
+	TEST_ASSERT_EQUAL(ENOSPC, errno);
+}
+
+TEST(OBDIIPollSchedule, RecommendRates)
+{
+	double ceilings[] = { 100, 110, 90, 95 };
+	double maxRates[] = { 50, 10, 80, 0 };
+	double rates[4];
+
+	// The capacity is the mean back-to-back rate of the measured commands, 100 Hz, and 80 Hz of it is shared by three
+	TEST_ASSERT_EQUAL(3, OBDIIPollScheduleRecommendRates(ceilings, maxRates, 4, 0.8, rates));
+	TEST_ASSERT_EQUAL_FLOAT(80.0 / 3, rates[0]);
+	TEST_ASSERT_EQUAL_FLOAT(8, rates[1]);
+	TEST_ASSERT_EQUAL_FLOAT(80.0 / 3, rates[2]);
+	TEST_ASSERT_EQUAL_FLOAT(0, rates[3]);
+
+	// Nothing to recommend if no command sustained a rate
+	maxRates[0] = maxRates[1] = maxRates[2] = 0;
+	TEST_ASSERT_EQUAL(0, OBDIIPollScheduleRecommendRates(ceilings, maxRates, 4, 0.8, rates));
+	TEST_ASSERT_EQUAL_FLOAT(0, rates[0]);
+}
@@ -0,0 +1,200 @@
+#include "OBDIIRecorder.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static OBDIIRecorder recorder;
+static char path[32];
+
+static void Record(float rpms, double timestamp)
+{
+	OBDIIResponse response = { 0 };
+	response.success = 1;
+	response.command = OBDIICommands.engineRPMs;
+	response.numericValue = rpms;
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderAppend(&recorder, 0x7E8, &response, timestamp));
+}
+
+TEST_GROUP(OBDIIRecorder);
+
+TEST_SETUP(OBDIIRecorder)
+{
+	strcpy(path, "/tmp/obdii-recorder.XXXXXX");
+	close(mkstemp(path));
+}
+
+TEST_TEAR_DOWN(OBDIIRecorder)
+{
+	OBDIIRecorderClose(&recorder);
+	unlink(path);
+}
+
+TEST(OBDIIRecorder, Ring)
+{
+	OBDIIRecord record;
+	int i;
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderOpen(&recorder, path, 4, 1.0));
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderRead(&recorder, 0, &record));
+
+	for (i = 1; i <= 6; ++i) {
+		Record(1000 * i, 100 + i);
+	}
+
+	// The two oldest records were overwritten
+	uint64_t sequence = 0;
+	for (i = 3; i <= 6; ++i) {
+		TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, sequence, &record));
+		sequence = record.sequence;
+
+		TEST_ASSERT_EQUAL(i, sequence);
+		TEST_ASSERT_TRUE(record.response.success);
+		TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, record.response.command);
+		TEST_ASSERT_EQUAL_FLOAT(1000 * i, record.response.numericValue);
+		TEST_ASSERT_EQUAL_HEX32(0x7E8, record.rid);
+		TEST_ASSERT_EQUAL_FLOAT(100 + i, record.timestamp);
+	}
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderRead(&recorder, sequence, &record));
+}
+
+TEST(OBDIIRecorder, RecoverAfterTornRecord)
+{
+	OBDIIRecord record;
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderOpen(&recorder, path, 8, 0));
+	Record(1000, 1);
+	Record(2000, 2);
+	Record(3000, 3);
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderClose(&recorder));
+
+	// Power fails while the third record is being written: its value made it to storage, but not its CRC
+	int fd = open(path, O_RDWR);
+	TEST_ASSERT_TRUE(fd >= 0);
+	TEST_ASSERT_EQUAL(1, pwrite(fd, "\xFF", 1, 64 + 2 * 40 + 28));
+	close(fd);
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderOpen(&recorder, path, 0, 0));
+	TEST_ASSERT_EQUAL(8, recorder.capacity);
+
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 0, &record));
+	TEST_ASSERT_EQUAL(1, record.sequence);
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 1, &record));
+	TEST_ASSERT_EQUAL(2, record.sequence);
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderRead(&recorder, 2, &record));
+
+	// Recording resumes right after the last complete record
+	Record(4000, 4);
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 2, &record));
+	TEST_ASSERT_EQUAL(3, record.sequence);
+	TEST_ASSERT_EQUAL_FLOAT(4000, record.response.numericValue);
+}
+
+TEST(OBDIIRecorder, VariableLengthValues)
+{
+	static OBDIIDefinitions definitions;
+	char troubleCodes[3][6] = { "P0301", "P0420", "U0100" };
+	OBDIIResponse response = { 0 };
+	OBDIIRecord record;
+
+	OBDIIDefinitionsInit(&definitions);
+	OBDIICommand *charge = OBDIIDefinitionsAdd(&definitions, "hybridBatteryCharge", 0x22, 0x5B3D, 1, "A * 100 / 255");
+	TEST_ASSERT_NOT_NULL(charge);
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderOpen(&recorder, path, 16, 1.0));
+	response.success = 1;
+
+	response.command = OBDIICommands.VIN;
+	response.stringValue = "1G1JC5444R7252367";
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderAppend(&recorder, 0x7E8, &response, 1));
+
+	response.command = OBDIICommands.DTCs;
+	response.DTCs.troubleCodes = troubleCodes;
+	response.DTCs.numTroubleCodes = 3;
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderAppend(&recorder, 0x7E8, &response, 2));
+
+	memset(&response, 0, sizeof(response));
+	response.success = 1;
+	response.command = OBDIICommands.oxygenSensor1_fuelTrim;
+	response.oxygenSensorValues.voltage = 0.45;
+	response.oxygenSensorValues.shortTermFuelTrim = -2.5;
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderAppend(&recorder, 0x7E8, &response, 3));
+
+	response.command = charge;
+	response.numericValue = 61;
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderAppend(&recorder, 0x7E9, &response, 4));
+
+	// The VIN spans three slots and the trouble codes two
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 0, &record));
+	TEST_ASSERT_EQUAL(1, record.sequence);
+	TEST_ASSERT_EQUAL_STRING("1G1JC5444R7252367", record.response.stringValue);
+	OBDIIResponseFree(&record.response);
+
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 1, &record));
+	TEST_ASSERT_EQUAL(4, record.sequence);
+	TEST_ASSERT_EQUAL(3, record.response.DTCs.numTroubleCodes);
+	TEST_ASSERT_EQUAL_STRING("P0420", record.response.DTCs.troubleCodes[1]);
+	TEST_ASSERT_EQUAL_STRING("U0100", record.response.DTCs.troubleCodes[2]);
+	OBDIIResponseFree(&record.response);
+
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 4, &record));
+	TEST_ASSERT_EQUAL(6, record.sequence);
+	TEST_ASSERT_EQUAL_FLOAT(0.45, record.response.oxygenSensorValues.voltage);
+	TEST_ASSERT_EQUAL_FLOAT(-2.5, record.response.oxygenSensorValues.shortTermFuelTrim);
+
+	// Defined commands are skipped unless their definitions are given
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderRead(&recorder, 6, &record));
+	recorder.definitions = &definitions;
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 6, &record));
+	TEST_ASSERT_EQUAL_PTR(charge, record.response.command);
+	TEST_ASSERT_EQUAL_FLOAT(61, record.response.numericValue);
+	TEST_ASSERT_EQUAL_HEX32(0x7E9, record.rid);
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderClose(&recorder));
+
+	// A record missing a slot is skipped
+	int fd = open(path, O_RDWR);
+	TEST_ASSERT_TRUE(fd >= 0);
+	TEST_ASSERT_EQUAL(1, pwrite(fd, "\xFF", 1, 64 + 1 * 40 + 28));
+	close(fd);
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderOpen(&recorder, path, 0, 1.0));
+	TEST_ASSERT_EQUAL(1, OBDIIRecorderRead(&recorder, 0, &record));
+	TEST_ASSERT_EQUAL(4, record.sequence);
+	OBDIIResponseFree(&record.response);
+}
+
+TEST(OBDIIRecorder, Invalid)
+{
+	OBDIIResponse response = { 0 };
+	response.command = OBDIICommands.engineRPMs;
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderOpen(&recorder, path, 2, 1.0));
+
+	// Unsuccessful responses, and values longer than the file, can't be recorded
+	TEST_ASSERT_EQUAL(-1, OBDIIRecorderAppend(&recorder, 0x7E8, &response, 0));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	response.success = 1;
+	response.command = OBDIICommands.VIN;
+	response.stringValue = "1G1JC5444R7252367";
+	TEST_ASSERT_EQUAL(-1, OBDIIRecorderAppend(&recorder, 0x7E8, &response, 0));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	TEST_ASSERT_EQUAL(0, OBDIIRecorderClose(&recorder));
+
+	// A recording of a different size
+	TEST_ASSERT_EQUAL(-1, OBDIIRecorderOpen(&recorder, path, 8, 1.0));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+
+	// Not a recording
+	int fd = open(path, O_WRONLY | O_TRUNC);
+	TEST_ASSERT_EQUAL(5, write(fd, "hello", 5));
+	close(fd);
+	TEST_ASSERT_EQUAL(-1, OBDIIRecorderOpen(&recorder, path, 0, 1.0));
+	TEST_ASSERT_EQUAL(EINVAL, errno);
+}
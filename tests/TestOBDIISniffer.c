@@ -0,0 +1,108 @@
+#include "OBDIISniffer.h"
+#include "unity.h"
+#include "unity_fixture.h"
+#include <string.h>
+
+static OBDIISniffer sniffer;
+static struct timespec timestamp;
+
+static int numSamples;
+static OBDIISnifferSample lastSample;
+static char lastString[32];
+
+static void RecordSample(OBDIISnifferSample *sample, void *context)
+{
+	numSamples++;
+	lastSample = *sample;
+
+	// The response is freed once the callback returns
+	if (sample->response.command->responseType == OBDIIResponseTypeString) {
+		strncpy(lastString, sample->response.stringValue, sizeof(lastString) - 1);
+	}
+}
+
+static int Feed(canid_t id, const unsigned char *data)
+{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id = id;
+	frame.can_dlc = 8;
+	memcpy(frame.data, data, 8);
+
+	timestamp.tv_nsec += 1000;
+
+	return OBDIISnifferHandleFrame(&sniffer, &frame, &timestamp);
+}
+
+TEST_GROUP(OBDIISniffer);
+
+TEST_SETUP(OBDIISniffer)
+{
+	numSamples = 0;
+	memset(&lastSample, 0, sizeof(lastSample));
+	memset(lastString, 0, sizeof(lastString));
+	timestamp.tv_sec = 1;
+	timestamp.tv_nsec = 0;
+	OBDIISnifferInit(&sniffer, &RecordSample, NULL);
+}
+
+TEST_TEAR_DOWN(OBDIISniffer)
+{
+	OBDIISnifferClose(&sniffer);
+}
+
+TEST(OBDIISniffer, FunctionalRequest)
+{
+	unsigned char request[] = { 0x02, 0x01, 0x0C, 0x55, 0x55, 0x55, 0x55, 0x55 };
+	unsigned char response[] = { 0x04, 0x41, 0x0C, 0x1A, 0xF8, 0x55, 0x55, 0x55 };
+
+	TEST_ASSERT_EQUAL(0, Feed(0x7DF, request));
+	TEST_ASSERT_EQUAL(1, Feed(0x7E8, response));
+
+	TEST_ASSERT_EQUAL(1, numSamples);
+	TEST_ASSERT(lastSample.response.success);
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.engineRPMs, lastSample.response.command);
+	TEST_ASSERT_EQUAL_FLOAT(1726.0, lastSample.response.numericValue);
+	TEST_ASSERT_EQUAL_HEX32(0x7DF, lastSample.requestID);
+	TEST_ASSERT_EQUAL_HEX32(0x7E8, lastSample.responseID);
+	TEST_ASSERT_EQUAL(1000, lastSample.requestTimestamp.tv_nsec);
+	TEST_ASSERT_EQUAL(2000, lastSample.timestamp.tv_nsec);
+}
+
+TEST(OBDIISniffer, ResponseWithoutRequest)
+{
+	unsigned char response[] = { 0x03, 0x41, 0x0D, 0x32, 0x55, 0x55, 0x55, 0x55 };
+
+	TEST_ASSERT_EQUAL(1, Feed(0x7E9, response));
+
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.vehicleSpeed, lastSample.response.command);
+	TEST_ASSERT_EQUAL_FLOAT(50.0, lastSample.response.numericValue);
+	TEST_ASSERT_EQUAL(0, lastSample.requestID);
+}
+
+TEST(OBDIISniffer, SegmentedResponse)
+{
+	unsigned char request[] = { 0x02, 0x09, 0x02, 0x55, 0x55, 0x55, 0x55, 0x55 };
+	unsigned char first[] = { 0x10, 0x0B, 0x49, 0x02, '1', 'G', '1', 'J' };
+	unsigned char flowControl[] = { 0x30, 0x00, 0x00, 0x55, 0x55, 0x55, 0x55, 0x55 };
+	unsigned char second[] = { 0x21, 'C', '5', '4', '4', '4', 0x55, 0x55 };
+
+	Feed(0x7E0, request);
+	TEST_ASSERT_EQUAL(0, Feed(0x7E8, first));
+	TEST_ASSERT_EQUAL(0, Feed(0x7E0, flowControl));
+	TEST_ASSERT_EQUAL(1, Feed(0x7E8, second));
+
+	TEST_ASSERT_EQUAL_PTR(OBDIICommands.VIN, lastSample.response.command);
+	TEST_ASSERT_EQUAL_STRING("1G1JC5444", lastString);
+	TEST_ASSERT_EQUAL_HEX32(0x7E0, lastSample.requestID);
+}
+
+TEST(OBDIISniffer, IgnoresNegativeResponse)
+{
+	unsigned char request[] = { 0x02, 0x01, 0x0C, 0x55, 0x55, 0x55, 0x55, 0x55 };
+	unsigned char response[] = { 0x03, 0x7F, 0x01, 0x12, 0x55, 0x55, 0x55, 0x55 };
+
+	Feed(0x7E0, request);
+	TEST_ASSERT_EQUAL(0, Feed(0x7E8, response));
+	TEST_ASSERT_EQUAL(0, numSamples);
+}
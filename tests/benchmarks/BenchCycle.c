@@ -0,0 +1,184 @@
+#include "OBDIICommunication.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Compares querying several ECUs one after the other with a single cycle. Socket pairs stand in for the CAN sockets,
+// with each response queued before the query, so only the library's own work is measured.
+#define NUM_ECUS 8
+#define NUM_ROUNDS 20000
+
+static const unsigned char Response[] = { 0x41, 0x0C, 0x1A, 0xF8 };
+
+static OBDIISocket sockets[NUM_ECUS];
+static int ecus[NUM_ECUS];
+
+static double CPUTime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Counts the system calls the process enters with the raw_syscalls:sys_enter tracepoint, the same way for both
+// approaches. This needs tracefs and a perf_event_paranoid of 1 or less (or CAP_PERFMON); otherwise no counts are
+// reported.
+static int syscallCounter = -1;
+static long long countingOverhead;
+
+static int OpenSyscallCounter(void)
+{
+	const char *paths[] = { "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id", "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" };
+	unsigned long long id;
+	int i, found = 0;
+
+	for (i = 0; i < 2 && !found; ++i) {
+		FILE *file = fopen(paths[i], "r");
+		if (file) {
+			found = fscanf(file, "%llu", &id) == 1;
+			fclose(file);
+		}
+	}
+
+	if (!found) {
+		return -1;
+	}
+
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = id;
+	attr.disabled = 1;
+
+	syscallCounter = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+	return syscallCounter;
+}
+
+static void StartCounting(void)
+{
+	if (syscallCounter >= 0) {
+		ioctl(syscallCounter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(syscallCounter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+// Returns the number of system calls since StartCounting, not counting those of the counter itself
+static long long StopCounting(void)
+{
+	long long count = 0;
+
+	if (syscallCounter >= 0) {
+		ioctl(syscallCounter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(syscallCounter, &count, sizeof(count)) != sizeof(count)) {
+			count = 0;
+		}
+	}
+
+	return count - countingOverhead;
+}
+
+static void QueueResponses(void)
+{
+	int i;
+	for (i = 0; i < NUM_ECUS; ++i) {
+		if (write(ecus[i], Response, sizeof(Response)) != sizeof(Response)) {
+			perror("write");
+		}
+	}
+}
+
+static void DiscardRequests(void)
+{
+	unsigned char request[8];
+	int i;
+	for (i = 0; i < NUM_ECUS; ++i) {
+		while (recv(ecus[i], request, sizeof(request), MSG_DONTWAIT) > 0);
+	}
+}
+
+static void Report(const char *name, double elapsed, long long numSyscalls)
+{
+	printf("%-24s %8.2f us/cycle", name, elapsed * 1e6 / NUM_ROUNDS);
+	if (syscallCounter >= 0) {
+		printf(" %6.1f syscalls/cycle", (double)numSyscalls / NUM_ROUNDS);
+	}
+	printf("\n");
+}
+
+int main(void)
+{
+	int i, round;
+
+	for (i = 0; i < NUM_ECUS; ++i) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+			perror("socketpair");
+			return 1;
+		}
+
+		memset(&sockets[i], 0, sizeof(sockets[i]));
+		sockets[i].s = fds[0];
+		sockets[i].transport = OBDIITransportISOTP;
+		sockets[i].isotp = -1;
+		ecus[i] = fds[1];
+	}
+
+	printf("%d ECUs\n", NUM_ECUS);
+
+	if (OpenSyscallCounter() < 0) {
+		perror("Can't count system calls with perf_event_open");
+	} else {
+		StartCounting();
+		countingOverhead = StopCounting();
+	}
+
+	double elapsed = 0;
+	long long numSyscalls = 0;
+	for (round = 0; round < NUM_ROUNDS; ++round) {
+		QueueResponses();
+
+		double start = CPUTime();
+		StartCounting();
+		for (i = 0; i < NUM_ECUS; ++i) {
+			OBDIIResponse response = OBDIIPerformQuery(&sockets[i], OBDIICommands.engineRPMs);
+			OBDIIResponseFree(&response);
+		}
+		numSyscalls += StopCounting();
+		elapsed += CPUTime() - start;
+
+		DiscardRequests();
+	}
+	Report("  OBDIIPerformQuery", elapsed, numSyscalls);
+
+	OBDIICycle cycle;
+	OBDIICycleInit(&cycle);
+	for (i = 0; i < NUM_ECUS; ++i) {
+		OBDIICycleAdd(&cycle, &sockets[i], OBDIICommands.engineRPMs);
+	}
+
+	elapsed = 0;
+	numSyscalls = 0;
+	for (round = 0; round < NUM_ROUNDS; ++round) {
+		QueueResponses();
+
+		double start = CPUTime();
+		StartCounting();
+		OBDIICyclePerform(&cycle, 1000);
+		numSyscalls += StopCounting();
+		elapsed += CPUTime() - start;
+
+		DiscardRequests();
+	}
+	Report("  OBDIICyclePerform", elapsed, numSyscalls);
+
+	OBDIICycleFree(&cycle);
+
+	return 0;
+}
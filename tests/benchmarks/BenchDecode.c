@@ -0,0 +1,79 @@
+#include "OBDII.h"
+#include "OBDIIBatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Compares per-response decoding with the batch decoder on recorded-style data
+#define NUM_PAYLOADS (1 << 20)
+#define NUM_ROUNDS 10
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Report(const char *name, double elapsed)
+{
+	printf("%-28s %8.2f ns/response\n", name, elapsed * 1e9 / ((double)NUM_PAYLOADS * NUM_ROUNDS));
+}
+
+static void Bench(OBDIICommand *command)
+{
+	int stride = command->expectedResponseLength;
+	unsigned char *payloads = malloc((size_t)NUM_PAYLOADS * stride);
+	float *values = malloc(NUM_PAYLOADS * sizeof(float));
+	float *secondaryValues = malloc(NUM_PAYLOADS * sizeof(float));
+	volatile float sink = 0;
+	int i, j, round;
+
+	for (i = 0; i < NUM_PAYLOADS; ++i) {
+		unsigned char *payload = payloads + (size_t)i * stride;
+		payload[0] = OBDIICommandGetMode(command) + 0x40;
+		payload[1] = OBDIICommandGetPID(command);
+		for (j = 2; j < stride; ++j) {
+			payload[j] = rand();
+		}
+	}
+
+	printf("%s\n", command->name);
+
+	double start = Now();
+	for (round = 0; round < NUM_ROUNDS; ++round) {
+		for (i = 0; i < NUM_PAYLOADS; ++i) {
+			OBDIIResponse response = OBDIIDecodeResponseForCommand(command, payloads + (size_t)i * stride, stride);
+			values[i] = response.numericValue;
+		}
+		sink += values[round];
+	}
+	Report("  OBDIIDecodeResponse", Now() - start);
+
+	start = Now();
+	for (round = 0; round < NUM_ROUNDS; ++round) {
+		OBDIIDecodeBatchScalar(command, payloads, stride, NUM_PAYLOADS, values, secondaryValues, NULL);
+		sink += values[round];
+	}
+	Report("  OBDIIDecodeBatchScalar", Now() - start);
+
+	start = Now();
+	for (round = 0; round < NUM_ROUNDS; ++round) {
+		OBDIIDecodeBatch(command, payloads, stride, NUM_PAYLOADS, values, secondaryValues, NULL);
+		sink += values[round];
+	}
+	Report("  OBDIIDecodeBatch", Now() - start);
+
+	free(payloads);
+	free(values);
+	free(secondaryValues);
+}
+
+int main(int argc, char *argv[])
+{
+	Bench(OBDIICommands.engineRPMs);
+	Bench(OBDIICommands.vehicleSpeed);
+	Bench(OBDIICommands.oxygenSensor1_fuelAirRatioVoltage);
+
+	return 0;
+}
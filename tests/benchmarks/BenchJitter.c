@@ -0,0 +1,211 @@
+#define _GNU_SOURCE // For sched_getcpu
+
+#include "OBDIICommunication.h"
+#include "OBDIIRealtime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/can/raw.h>
+
+// Runs a 100 Hz acquisition loop, first as is and then in real-time mode, and reports how far the intervals between
+// samples stray from the period. An ECU thread answers the queries, over the given CAN interface (e.g. vcan0) if any,
+// or over a socket pair otherwise. Load the system (e.g. with stress-ng) to see the difference.
+//
+//     bench_jitter [interface [samples]]
+#define PERIOD_NS 10000000L
+#define DEFAULT_NUM_SAMPLES 3000
+
+static const long BucketLimitsUs[] = { 20, 50, 100, 200, 500, 1000, 2000, 5000 };
+#define NUM_BUCKETS (sizeof(BucketLimitsUs) / sizeof(BucketLimitsUs[0]) + 1)
+
+static OBDIISocket s;
+static int ecu;
+static int numSamples = DEFAULT_NUM_SAMPLES;
+static long *deviations;
+
+static long long Nanoseconds(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+// Answers every request with the same engine speed
+static void *RunECU(void *arg)
+{
+	struct can_frame frame;
+
+	while (read(ecu, &frame, sizeof(frame)) == sizeof(frame)) {
+		static const unsigned char response[8] = { 0x04, 0x41, 0x0C, 0x1A, 0xF8, 0x55, 0x55, 0x55 };
+		frame.can_id = 0x7E8;
+		frame.can_dlc = 8;
+		memcpy(frame.data, response, sizeof(response));
+
+		if (write(ecu, &frame, sizeof(frame)) != sizeof(frame)) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int OpenECU(const char *ifname)
+{
+	if (!ifname) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+			return -1;
+		}
+
+		memset(&s, 0, sizeof(s));
+		s.s = fds[0];
+		s.tid = 0x7E0;
+		s.rid = 0x7E8;
+		s.transport = OBDIITransportRaw;
+		s.isotp = -1;
+		ecu = fds[1];
+		return 0;
+	}
+
+	if (OBDIIOpenRawSocket(&s, ifname, 0x7E0, 0x7E8) < 0 || (ecu = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		return -1;
+	}
+
+	struct can_filter filter;
+	filter.can_id = 0x7E0;
+	filter.can_mask = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_SFF_MASK;
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = if_nametoindex(ifname);
+
+	if (setsockopt(ecu, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) < 0 || bind(ecu, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int CompareLongs(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+static void RunLoop(const char *name)
+{
+	struct timespec next, now, previous = { 0, 0 };
+	int i, numFailures = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	for (i = -1; i < numSamples; ++i) {
+		next.tv_nsec += PERIOD_NS;
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+
+		OBDIIResponse response = OBDIIPerformQuery(&s, OBDIICommands.engineRPMs);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		numFailures += !response.success;
+		OBDIIResponseFree(&response);
+
+		// The first sample only starts the clock
+		if (i >= 0) {
+			deviations[i] = labs((long)(Nanoseconds(&now) - Nanoseconds(&previous) - PERIOD_NS)) / 1000;
+		}
+		previous = now;
+	}
+
+	unsigned int buckets[NUM_BUCKETS] = { 0 };
+	for (i = 0; i < numSamples; ++i) {
+		unsigned int bucket = 0;
+		while (bucket < NUM_BUCKETS - 1 && deviations[i] >= BucketLimitsUs[bucket]) {
+			bucket++;
+		}
+		buckets[bucket]++;
+	}
+
+	qsort(deviations, numSamples, sizeof(*deviations), &CompareLongs);
+
+	printf("%s: %d samples, %d failed queries\n", name, numSamples, numFailures);
+	for (i = 0; i < (int)NUM_BUCKETS; ++i) {
+		if (i < (int)NUM_BUCKETS - 1) {
+			printf("  < %5ld us %8u\n", BucketLimitsUs[i], buckets[i]);
+		} else {
+			printf("  >= %4ld us %8u\n", BucketLimitsUs[i - 1], buckets[i]);
+		}
+	}
+	printf("  p50 %ld us, p99 %ld us, p99.9 %ld us, max %ld us\n", deviations[numSamples / 2], deviations[numSamples * 99 / 100],
+			deviations[numSamples * 999 / 1000], deviations[numSamples - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *ifname = argc > 1 ? argv[1] : NULL;
+	pthread_t thread;
+
+	if (argc > 2) {
+		numSamples = atoi(argv[2]);
+	}
+
+	if (numSamples <= 0 || !(deviations = malloc(numSamples * sizeof(*deviations)))) {
+		fprintf(stderr, "Invalid number of samples\n");
+		return 1;
+	}
+
+	if (OpenECU(ifname) < 0) {
+		perror(ifname ? ifname : "socketpair");
+		return 1;
+	}
+
+	if ((errno = pthread_create(&thread, NULL, &RunECU, NULL))) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	printf("Deviation of the sample interval from %ld ms, over %s\n", PERIOD_NS / 1000000, ifname ? ifname : "a socket pair");
+
+	RunLoop("Normal");
+
+	// Pin to the CPU we're on, and take the steps one by one so that a missing capability only disables its own step
+	OBDIIRealtimeOptions options;
+	OBDIIRealtimeOptionsInit(&options);
+	options.cpu = sched_getcpu();
+	options.priority = 80;
+
+	OBDIIRealtimeOptions step = options;
+	step.priority = 0;
+	step.lockMemory = 0;
+	if (OBDIIEnterRealtimeMode(&step) < 0) {
+		perror("Pinning");
+	}
+
+	step = options;
+	step.cpu = -1;
+	step.lockMemory = 0;
+	if (OBDIIEnterRealtimeMode(&step) < 0) {
+		perror("SCHED_FIFO");
+	}
+
+	step = options;
+	step.cpu = -1;
+	step.priority = 0;
+	if (OBDIIEnterRealtimeMode(&step) < 0) {
+		perror("mlockall");
+	}
+
+	OBDIIPrefault(deviations, numSamples * sizeof(*deviations));
+
+	RunLoop("Real-time");
+
+	return 0;
+}
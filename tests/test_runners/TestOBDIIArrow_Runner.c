@@ -0,0 +1,9 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIArrow)
+{
+	RUN_TEST_CASE(OBDIIArrow, Numeric);
+	RUN_TEST_CASE(OBDIIArrow, TroubleCodes);
+	RUN_TEST_CASE(OBDIIArrow, Unsupported);
+}
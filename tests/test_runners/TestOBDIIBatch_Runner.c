@@ -0,0 +1,9 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIBatch)
+{
+	RUN_TEST_CASE(OBDIIBatch, MatchesDecoders);
+	RUN_TEST_CASE(OBDIIBatch, InvalidPayloads);
+	RUN_TEST_CASE(OBDIIBatch, UnsupportedCommands);
+}
@@ -0,0 +1,12 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIChangeFilter)
+{
+	RUN_TEST_CASE(OBDIIChangeFilter, DefaultRule);
+	RUN_TEST_CASE(OBDIIChangeFilter, Deadbands);
+	RUN_TEST_CASE(OBDIIChangeFilter, MaxSilence);
+	RUN_TEST_CASE(OBDIIChangeFilter, Bitfields);
+	RUN_TEST_CASE(OBDIIChangeFilter, EventFD);
+	RUN_TEST_CASE(OBDIIChangeFilter, UnfilterableResponses);
+}
@@ -0,0 +1,21 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIICommunication)
+{
+	RUN_TEST_CASE(OBDIICommunication, RawRequestAndResponse);
+	RUN_TEST_CASE(OBDIICommunication, RawSegmentedResponse);
+	RUN_TEST_CASE(OBDIICommunication, ISOTPRequestAndResponse);
+	RUN_TEST_CASE(OBDIICommunication, NegativeResponse);
+	RUN_TEST_CASE(OBDIICommunication, ResponsePending);
+	RUN_TEST_CASE(OBDIICommunication, Timestamps);
+	RUN_TEST_CASE(OBDIICommunication, SupportedCommandsUpToFF);
+	RUN_TEST_CASE(OBDIICommunication, Cycle);
+	RUN_TEST_CASE(OBDIICommunication, CycleFull);
+	RUN_TEST_CASE(OBDIICommunication, DeadlineAnswered);
+	RUN_TEST_CASE(OBDIICommunication, DeadlineTimedOut);
+	RUN_TEST_CASE(OBDIICommunication, DeadlineCancelled);
+	RUN_TEST_CASE(OBDIICommunication, SharedSocketLockedByAnotherProcess);
+	RUN_TEST_CASE(OBDIICommunication, RequestWhileSocketBusy);
+	RUN_TEST_CASE(OBDIICommunication, ThreadsShareSocket);
+}
@@ -0,0 +1,11 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIDTCWatcher)
+{
+	RUN_TEST_CASE(OBDIIDTCWatcher, FetchesOnlyWhenStatusChanges);
+	RUN_TEST_CASE(OBDIIDTCWatcher, MaxAge);
+	RUN_TEST_CASE(OBDIIDTCWatcher, PaddingAndDuplicates);
+	RUN_TEST_CASE(OBDIIDTCWatcher, FailedFetchIsRetried);
+	RUN_TEST_CASE(OBDIIDTCWatcher, Poll);
+}
@@ -0,0 +1,11 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIDefinitions)
+{
+	RUN_TEST_CASE(OBDIIDefinitions, Decode);
+	RUN_TEST_CASE(OBDIIDefinitions, Lookup);
+	RUN_TEST_CASE(OBDIIDefinitions, InvalidDefinitions);
+	RUN_TEST_CASE(OBDIIDefinitions, Load);
+	RUN_TEST_CASE(OBDIIDefinitions, Query);
+}
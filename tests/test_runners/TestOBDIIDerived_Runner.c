@@ -0,0 +1,10 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIDerived)
+{
+	RUN_TEST_CASE(OBDIIDerived, SharedInputs);
+	RUN_TEST_CASE(OBDIIDerived, MaxSkew);
+	RUN_TEST_CASE(OBDIIDerived, ConstantsAndBitfields);
+	RUN_TEST_CASE(OBDIIDerived, Errors);
+}
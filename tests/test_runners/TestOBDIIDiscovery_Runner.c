@@ -0,0 +1,9 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIDiscovery)
+{
+	RUN_TEST_CASE(OBDIIDiscovery, ParallelChains);
+	RUN_TEST_CASE(OBDIIDiscovery, UnansweredProbes);
+	RUN_TEST_CASE(OBDIIDiscovery, NoECUs);
+}
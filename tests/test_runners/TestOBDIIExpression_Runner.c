@@ -0,0 +1,12 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIExpression)
+{
+	RUN_TEST_CASE(OBDIIExpression, Arithmetic);
+	RUN_TEST_CASE(OBDIIExpression, Bitwise);
+	RUN_TEST_CASE(OBDIIExpression, Functions);
+	RUN_TEST_CASE(OBDIIExpression, Variables);
+	RUN_TEST_CASE(OBDIIExpression, ConstantFolding);
+	RUN_TEST_CASE(OBDIIExpression, Errors);
+}
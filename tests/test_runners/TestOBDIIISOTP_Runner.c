@@ -0,0 +1,13 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIISOTP)
+{
+	RUN_TEST_CASE(OBDIIISOTP, SingleFrame);
+	RUN_TEST_CASE(OBDIIISOTP, SingleFrameLongerThanFrame);
+	RUN_TEST_CASE(OBDIIISOTP, SegmentedMessage);
+	RUN_TEST_CASE(OBDIIISOTP, BlockSizeRequestsFlowControl);
+	RUN_TEST_CASE(OBDIIISOTP, WrongSequenceNumberAbandonsMessage);
+	RUN_TEST_CASE(OBDIIISOTP, PoolExhaustionOverflows);
+	RUN_TEST_CASE(OBDIIISOTP, FlowControlFrame);
+}
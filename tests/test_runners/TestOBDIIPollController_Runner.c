@@ -0,0 +1,10 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIPollController)
+{
+	RUN_TEST_CASE(OBDIIPollController, Asleep);
+	RUN_TEST_CASE(OBDIIPollController, EngineOff);
+	RUN_TEST_CASE(OBDIIPollController, BusLoad);
+	RUN_TEST_CASE(OBDIIPollController, SetInterval);
+}
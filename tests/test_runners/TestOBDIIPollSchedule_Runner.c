@@ -0,0 +1,12 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIPollSchedule)
+{
+	RUN_TEST_CASE(OBDIIPollSchedule, Empty);
+	RUN_TEST_CASE(OBDIIPollSchedule, Rates);
+	RUN_TEST_CASE(OBDIIPollSchedule, ChangeInterval);
+	RUN_TEST_CASE(OBDIIPollSchedule, FallingBehind);
+	RUN_TEST_CASE(OBDIIPollSchedule, Full);
+	RUN_TEST_CASE(OBDIIPollSchedule, RecommendRates);
+}
@@ -0,0 +1,10 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIIRecorder)
+{
+	RUN_TEST_CASE(OBDIIRecorder, Ring);
+	RUN_TEST_CASE(OBDIIRecorder, RecoverAfterTornRecord);
+	RUN_TEST_CASE(OBDIIRecorder, VariableLengthValues);
+	RUN_TEST_CASE(OBDIIRecorder, Invalid);
+}
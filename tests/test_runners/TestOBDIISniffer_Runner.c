@@ -0,0 +1,10 @@
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP_RUNNER(OBDIISniffer)
+{
+	RUN_TEST_CASE(OBDIISniffer, FunctionalRequest);
+	RUN_TEST_CASE(OBDIISniffer, ResponseWithoutRequest);
+	RUN_TEST_CASE(OBDIISniffer, SegmentedResponse);
+	RUN_TEST_CASE(OBDIISniffer, IgnoresNegativeResponse);
+}
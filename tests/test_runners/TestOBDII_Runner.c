@@ -16,4 +16,8 @@ TEST_GROUP_RUNNER(OBDII)
 	RUN_TEST_CASE(OBDII, mode1SupportedPIDs_41_to_60);
 	RUN_TEST_CASE(OBDII, currentDriveCycleMonitorStatus);
 	RUN_TEST_CASE(OBDII, mode9SupportedPIDs);
+	RUN_TEST_CASE(OBDII, CommandWithModeAndPID);
+	RUN_TEST_CASE(OBDII, CommandSetMembership);
+	RUN_TEST_CASE(OBDII, CommandSetIteration);
+	RUN_TEST_CASE(OBDII, CommandSetAlgebra);
 }
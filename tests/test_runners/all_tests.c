@@ -3,6 +3,20 @@
 static void RunAllTests(void)
 {
   RUN_TEST_GROUP(OBDII);
+  RUN_TEST_GROUP(OBDIIISOTP);
+  RUN_TEST_GROUP(OBDIISniffer);
+  RUN_TEST_GROUP(OBDIIBatch);
+  RUN_TEST_GROUP(OBDIICommunication);
+  RUN_TEST_GROUP(OBDIIDiscovery);
+  RUN_TEST_GROUP(OBDIIExpression);
+  RUN_TEST_GROUP(OBDIIDerived);
+  RUN_TEST_GROUP(OBDIIDefinitions);
+  RUN_TEST_GROUP(OBDIIChangeFilter);
+  RUN_TEST_GROUP(OBDIIDTCWatcher);
+  RUN_TEST_GROUP(OBDIIPollSchedule);
+  RUN_TEST_GROUP(OBDIIPollController);
+  RUN_TEST_GROUP(OBDIIRecorder);
+  RUN_TEST_GROUP(OBDIIArrow);
 }
 
 int main(int argc, const char * argv[])